@@ -0,0 +1,94 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef PMEMKV_BENCHMARKS_HISTOGRAM_HPP
+#define PMEMKV_BENCHMARKS_HISTOGRAM_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Log-linear latency histogram (in ns) with 128 sub-buckets per power of 2,
+ * i.e. with relative error below 1%.
+ */
+class histogram {
+public:
+	static constexpr unsigned SUB_BITS = 7;
+	static constexpr uint64_t SUB = 1ULL << SUB_BITS;
+	static constexpr size_t BUCKETS = (64 - SUB_BITS + 1) * SUB;
+
+	histogram() : buckets(BUCKETS, 0)
+	{
+	}
+
+	void add(uint64_t ns)
+	{
+		buckets[bucket(ns)]++;
+		count++;
+		sum += ns;
+		max = (std::max)(max, ns);
+	}
+
+	void merge(const histogram &other)
+	{
+		for (size_t i = 0; i < BUCKETS; i++)
+			buckets[i] += other.buckets[i];
+		count += other.count;
+		sum += other.sum;
+		max = (std::max)(max, other.max);
+	}
+
+	/* Returns upper bound of the bucket holding the q-th quantile. */
+	uint64_t percentile(double q) const
+	{
+		if (count == 0)
+			return 0;
+
+		auto rank = static_cast<uint64_t>(
+			std::ceil(q * static_cast<double>(count)));
+		uint64_t seen = 0;
+		for (size_t i = 0; i < BUCKETS; i++) {
+			seen += buckets[i];
+			if (seen >= rank)
+				return (std::min)(upper_bound(i), max);
+		}
+
+		return max;
+	}
+
+	double mean() const
+	{
+		return count ? static_cast<double>(sum) / static_cast<double>(count) : 0;
+	}
+
+	uint64_t count = 0;
+	uint64_t sum = 0;
+	uint64_t max = 0;
+
+private:
+	static size_t bucket(uint64_t ns)
+	{
+		if (ns < SUB)
+			return static_cast<size_t>(ns);
+
+		auto msb = 63 - static_cast<unsigned>(__builtin_clzll(ns));
+		auto shift = msb - SUB_BITS;
+		return (shift + 1) * SUB + static_cast<size_t>((ns >> shift) - SUB);
+	}
+
+	static uint64_t upper_bound(size_t i)
+	{
+		if (i < SUB)
+			return i;
+
+		auto shift = i / SUB - 1;
+		return ((i % SUB + SUB + 1) << shift) - 1;
+	}
+
+	std::vector<uint64_t> buckets;
+};
+
+#endif /* PMEMKV_BENCHMARKS_HISTOGRAM_HPP */
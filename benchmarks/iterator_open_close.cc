@@ -0,0 +1,98 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+/*
+ * iterator_open_close.cc -- measures latency of the short-lived iterator
+ *		pattern: pmemkv_iterator_new(), one seek, pmemkv_iterator_delete().
+ *
+ * Usage: iterator_open_close engine path [n_keys] [n_iterations]
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <libpmemkv.h>
+
+static const uint64_t SIZE = 1024UL * 1024UL * 1024UL;
+
+static void fail(const char *what)
+{
+	std::cerr << what << " failed: " << pmemkv_errormsg() << std::endl;
+	exit(1);
+}
+
+template <typename Function>
+static double measure_ns(size_t n, Function &&f)
+{
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < n; i++)
+		f(i);
+	auto end = std::chrono::steady_clock::now();
+
+	return static_cast<double>(
+		       std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+			       .count()) /
+		static_cast<double>(n);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 3) {
+		std::cerr << "Usage: " << argv[0]
+			  << " engine path [n_keys] [n_iterations]" << std::endl;
+		return 1;
+	}
+
+	const char *engine = argv[1];
+	size_t n_keys = argc > 3 ? std::stoull(argv[3]) : 1000;
+	size_t n_iterations = argc > 4 ? std::stoull(argv[4]) : 1000000;
+
+	pmemkv_config *cfg = pmemkv_config_new();
+	if (!cfg)
+		fail("pmemkv_config_new");
+	if (pmemkv_config_put_path(cfg, argv[2]) != PMEMKV_STATUS_OK ||
+	    pmemkv_config_put_size(cfg, SIZE) != PMEMKV_STATUS_OK ||
+	    pmemkv_config_put_force_create(cfg, true) != PMEMKV_STATUS_OK)
+		fail("pmemkv_config_put");
+
+	pmemkv_db *db = nullptr;
+	if (pmemkv_open(engine, cfg, &db) != PMEMKV_STATUS_OK)
+		fail("pmemkv_open");
+
+	std::vector<std::string> keys;
+	for (size_t i = 0; i < n_keys; i++) {
+		keys.emplace_back(std::to_string(i));
+		if (pmemkv_put(db, keys.back().data(), keys.back().size(), "value",
+			       5) != PMEMKV_STATUS_OK)
+			fail("pmemkv_put");
+	}
+
+	double read_ns = measure_ns(n_iterations, [&](size_t i) {
+		pmemkv_iterator *it;
+		if (pmemkv_iterator_new(db, &it) != PMEMKV_STATUS_OK)
+			fail("pmemkv_iterator_new");
+		auto &key = keys[i % n_keys];
+		pmemkv_iterator_seek(it, key.data(), key.size());
+		pmemkv_iterator_delete(it);
+	});
+
+	double write_ns = measure_ns(n_iterations, [&](size_t i) {
+		pmemkv_write_iterator *it;
+		if (pmemkv_write_iterator_new(db, &it) != PMEMKV_STATUS_OK)
+			fail("pmemkv_write_iterator_new");
+		auto &key = keys[i % n_keys];
+		pmemkv_iterator_seek(it->iter, key.data(), key.size());
+		pmemkv_write_iterator_delete(it);
+	});
+
+	std::cout << "engine,iterator,iterations,avg_ns" << std::endl;
+	std::cout << engine << ",read," << n_iterations << "," << read_ns << std::endl;
+	std::cout << engine << ",write," << n_iterations << "," << write_ns << std::endl;
+
+	pmemkv_close(db);
+
+	return 0;
+}
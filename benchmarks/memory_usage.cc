@@ -0,0 +1,114 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+/*
+ * memory_usage.cc -- reports DRAM and PMem bytes per entry (see
+ *		pmemkv_memory_usage_get) for a range of key and value sizes.
+ *		For every combination a new pool is created at 'path' (an
+ *		existing file is removed) and filled with n_keys entries.
+ *
+ * Usage: memory_usage engine path [n_keys] [pool_size_mb]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+
+#include <libpmemkv.h>
+
+static const size_t KEY_SIZES[] = {8, 16, 64, 256};
+static const size_t VALUE_SIZES[] = {8, 64, 256, 1024, 4096};
+
+static void fail(const char *what)
+{
+	std::cerr << what << " failed: " << pmemkv_errormsg() << std::endl;
+	exit(1);
+}
+
+/* Returns key of exactly 'size' bytes: 'n' padded with zeros. */
+static std::string make_key(size_t n, size_t size)
+{
+	auto number = std::to_string(n);
+	if (number.size() >= size)
+		return number.substr(number.size() - size);
+
+	return std::string(size - number.size(), '0') + number;
+}
+
+static void run(const char *engine, const char *path, size_t n_keys, uint64_t pool_size,
+		size_t key_size, size_t value_size)
+{
+	unlink(path);
+
+	pmemkv_config *cfg = pmemkv_config_new();
+	if (!cfg)
+		fail("pmemkv_config_new");
+	if (pmemkv_config_put_path(cfg, path) != PMEMKV_STATUS_OK ||
+	    pmemkv_config_put_size(cfg, pool_size) != PMEMKV_STATUS_OK ||
+	    pmemkv_config_put_force_create(cfg, true) != PMEMKV_STATUS_OK ||
+	    /* needed for pmem_fragmented_bytes */
+	    pmemkv_config_put_uint64(cfg, "heap_stats", 1) != PMEMKV_STATUS_OK)
+		fail("pmemkv_config_put");
+
+	pmemkv_db *db = nullptr;
+	if (pmemkv_open(engine, cfg, &db) != PMEMKV_STATUS_OK)
+		fail("pmemkv_open");
+
+	std::string value(value_size, 'x');
+	for (size_t i = 0; i < n_keys; i++) {
+		auto key = make_key(i, key_size);
+		if (pmemkv_put(db, key.data(), key.size(), value.data(), value.size()) !=
+		    PMEMKV_STATUS_OK)
+			fail("pmemkv_put");
+	}
+
+	/* short keys may repeat, count what is really stored */
+	size_t count;
+	if (pmemkv_count_all(db, &count) != PMEMKV_STATUS_OK)
+		fail("pmemkv_count_all");
+
+	pmemkv_memory_usage usage;
+	if (pmemkv_memory_usage_get(db, &usage) != PMEMKV_STATUS_OK)
+		fail("pmemkv_memory_usage_get");
+
+	auto per_entry = [&](uint64_t bytes) {
+		return count ? static_cast<double>(bytes) / static_cast<double>(count)
+			     : 0;
+	};
+
+	std::cout << engine << "," << key_size << "," << value_size << "," << count
+		  << "," << per_entry(usage.dram_bytes) << ","
+		  << per_entry(usage.pmem_data_bytes) << ","
+		  << per_entry(usage.pmem_metadata_bytes) << ","
+		  << per_entry(usage.pmem_data_bytes + usage.pmem_metadata_bytes) << ","
+		  << usage.pmem_free_bytes << "," << usage.pmem_fragmented_bytes
+		  << std::endl;
+
+	pmemkv_close(db);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 3) {
+		std::cerr << "Usage: " << argv[0]
+			  << " engine path [n_keys] [pool_size_mb]" << std::endl;
+		return 1;
+	}
+
+	const char *engine = argv[1];
+	const char *path = argv[2];
+	size_t n_keys = argc > 3 ? std::stoull(argv[3]) : 100000;
+	uint64_t pool_size = (argc > 4 ? std::stoull(argv[4]) : 4096) * 1024 * 1024;
+
+	std::cout << "engine,key_size,value_size,entries,dram_per_entry,"
+		  << "pmem_data_per_entry,pmem_metadata_per_entry,pmem_total_per_entry,"
+		  << "pmem_free_bytes,pmem_fragmented_bytes" << std::endl;
+
+	for (auto key_size : KEY_SIZES)
+		for (auto value_size : VALUE_SIZES)
+			run(engine, path, n_keys, pool_size, key_size, value_size);
+
+	return 0;
+}
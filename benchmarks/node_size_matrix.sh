@@ -0,0 +1,83 @@
+#!/usr/bin/env bash
+# SPDX-License-Identifier: BSD-3-Clause
+# Copyright 2021, Intel Corporation
+
+#
+# node_size_matrix.sh -- runs pmemkv_bench on every node size of the sorted
+#	persistent engines and prints a single CSV with the results
+#
+# Usage: node_size_matrix.sh <pool path> [pool size]
+#
+# stree is run with each supported degree, in both modes (hybrid=0 and 1), and
+# tree3 with each pair of supported leaf and inner node sizes (its node_size
+# column is "<leaf keys>/<inner keys>"; inner nodes of tree3 are always in DRAM).
+#
+# Variables (and their defaults):
+#	PMEMKV_BENCH	pmemkv_bench binary (directory of this script)
+#	BENCHMARKS	fillrandom,readrandom,overwrite,deleterandom,ycsba,ycsbc
+#	NUM		number of keys (1000000)
+#	THREADS		number of threads (1)
+#	KEY_SIZES	key sizes to test ("16 64")
+#	VALUE_SIZES	value sizes to test ("8 100 1024")
+#	STREE_DEGREES	stree degrees to test ("16 32 64")
+#	TREE3_LEAF_KEYS	tree3 leaf node sizes to test ("16 48 64")
+#	TREE3_INNER_KEYS	tree3 inner node sizes to test ("4 16")
+#
+
+set -e
+
+if [ $# -lt 1 ]; then
+	echo "Usage: $0 <pool path> [pool size]" >&2
+	exit 2
+fi
+
+POOL=$1
+SIZE=${2:-4294967296}
+
+PMEMKV_BENCH=${PMEMKV_BENCH:-$(dirname $0)/pmemkv_bench}
+BENCHMARKS=${BENCHMARKS:-fillrandom,readrandom,overwrite,deleterandom,ycsba,ycsbc}
+NUM=${NUM:-1000000}
+THREADS=${THREADS:-1}
+KEY_SIZES=${KEY_SIZES:-"16 64"}
+VALUE_SIZES=${VALUE_SIZES:-"8 100 1024"}
+STREE_DEGREES=${STREE_DEGREES:-"16 32 64"}
+TREE3_LEAF_KEYS=${TREE3_LEAF_KEYS:-"16 48 64"}
+TREE3_INNER_KEYS=${TREE3_INNER_KEYS:-"4 16"}
+
+HEADER_PRINTED=0
+
+# run <engine> <node size> <hybrid> <extra config>
+function run() {
+	local engine=$1 node_size=$2 hybrid=$3 extra=$4 out
+
+	for key_size in $KEY_SIZES; do
+		for value_size in $VALUE_SIZES; do
+			rm -f $POOL
+			out=$($PMEMKV_BENCH --engine=$engine --benchmarks=$BENCHMARKS \
+				--num=$NUM --threads=$THREADS --key_size=$key_size \
+				--value_size=$value_size \
+				--config="{\"path\":\"$POOL\",\"size\":$SIZE,\"force_create\":1$extra}")
+
+			# every run prints its own header, only the first one is kept
+			if [ $HEADER_PRINTED -eq 0 ]; then
+				echo "node_size,hybrid,$(echo "$out" | head -n 1)"
+				HEADER_PRINTED=1
+			fi
+			echo "$out" | tail -n +2 | sed "s/^/$node_size,$hybrid,/"
+		done
+	done
+	rm -f $POOL
+}
+
+for degree in $STREE_DEGREES; do
+	for hybrid in 0 1; do
+		run stree $degree $hybrid ",\"degree\":$degree,\"hybrid\":$hybrid"
+	done
+done
+
+for leaf_keys in $TREE3_LEAF_KEYS; do
+	for inner_keys in $TREE3_INNER_KEYS; do
+		run tree3 $leaf_keys/$inner_keys 1 \
+			",\"leaf_keys\":$leaf_keys,\"inner_keys\":$inner_keys"
+	done
+done
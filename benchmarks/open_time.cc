@@ -0,0 +1,198 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+/*
+ * open_time.cc -- measures how long pmemkv_open() takes on a pool with n_keys
+ *		keys, broken down into phases reported by the engine (opening the
+ *		pool, rebuilding volatile state, ...) as "open.*" statistics.
+ *
+ *		The pool is populated first (unless n_keys is 0, then an existing
+ *		pool is opened). If 'crash' is 1, it's populated by a child process
+ *		which exits without closing the database, so that the first open
+ *		measures recovery after a crash. The database is then opened
+ *		n_opens times.
+ *
+ *		Engine's config items (of uint64 type) used on open can be passed as
+ *		a comma-separated list, e.g. "recovery_threads=8".
+ *
+ *		'threads' is a comma-separated list of values of "recovery_threads"
+ *		(e.g. "1,2,4,8,16"); the database is opened n_opens times with each
+ *		of them, to compare tree3's recovery with a different number of
+ *		threads. Each line of the output has the value in the
+ *		recovery_threads column (empty if the engine's default is used).
+ *
+ * Usage: open_time engine path [n_keys] [value_size] [n_opens] [crash] [items]
+ *	  [threads]
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include <libpmemkv.h>
+
+static const uint64_t MIN_SIZE = 1024UL * 1024UL * 1024UL;
+
+static void fail(const char *what)
+{
+	std::cerr << what << " failed: " << pmemkv_errormsg() << std::endl;
+	exit(1);
+}
+
+static pmemkv_config *make_config(const char *path, uint64_t size,
+				  const std::string &items = "")
+{
+	pmemkv_config *cfg = pmemkv_config_new();
+	if (!cfg)
+		fail("pmemkv_config_new");
+
+	/* items: "name=value[,name=value...]" */
+	for (size_t pos = 0; pos < items.size();) {
+		auto end = items.find(',', pos);
+		if (end == std::string::npos)
+			end = items.size();
+		auto item = items.substr(pos, end - pos);
+		auto eq = item.find('=');
+		if (eq == std::string::npos) {
+			std::cerr << "invalid config item: " << item << std::endl;
+			exit(1);
+		}
+		if (pmemkv_config_put_uint64(cfg, item.substr(0, eq).c_str(),
+					     std::stoull(item.substr(eq + 1))) !=
+		    PMEMKV_STATUS_OK)
+			fail("pmemkv_config_put_uint64");
+		pos = end + 1;
+	}
+
+	if (pmemkv_config_put_path(cfg, path) != PMEMKV_STATUS_OK ||
+	    pmemkv_config_put_uint64(cfg, "stats", 1) != PMEMKV_STATUS_OK)
+		fail("pmemkv_config_put");
+
+	if (size && (pmemkv_config_put_size(cfg, size) != PMEMKV_STATUS_OK ||
+		     pmemkv_config_put_force_create(cfg, true) != PMEMKV_STATUS_OK))
+		fail("pmemkv_config_put");
+
+	return cfg;
+}
+
+static void populate(const char *engine, const char *path, size_t n_keys,
+		     size_t value_size, bool crash)
+{
+	/* rough upper bound of space taken by keys, values and engine's metadata */
+	uint64_t size = (std::max)(MIN_SIZE, n_keys * (value_size + 128) * 2);
+
+	pmemkv_db *db = nullptr;
+	if (pmemkv_open(engine, make_config(path, size), &db) != PMEMKV_STATUS_OK)
+		fail("pmemkv_open");
+
+	std::string value(value_size, 'x');
+	for (size_t i = 0; i < n_keys; i++) {
+		auto key = std::to_string(i);
+		if (pmemkv_put(db, key.data(), key.size(), value.data(), value.size()) !=
+		    PMEMKV_STATUS_OK)
+			fail("pmemkv_put");
+	}
+
+	if (crash)
+		_exit(0);
+
+	pmemkv_close(db);
+}
+
+static int print_phase(const char *name, size_t namebytes, uint64_t value, void *arg)
+{
+	std::string metric(name, namebytes);
+	if (metric.compare(0, 5, "open.") == 0)
+		std::cout << *static_cast<std::string *>(arg) << "," << metric.substr(5)
+			  << "," << value << std::endl;
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 3) {
+		std::cerr << "Usage: " << argv[0]
+			  << " engine path [n_keys] [value_size] [n_opens] [crash]"
+			  << " [items] [threads]" << std::endl;
+		return 1;
+	}
+
+	const char *engine = argv[1];
+	const char *path = argv[2];
+	size_t n_keys = argc > 3 ? std::stoull(argv[3]) : 1000000;
+	size_t value_size = argc > 4 ? std::stoull(argv[4]) : 64;
+	size_t n_opens = argc > 5 ? std::stoull(argv[5]) : 3;
+	bool crash = argc > 6 && std::stoull(argv[6]) != 0;
+	std::string items = argc > 7 ? argv[7] : "";
+	std::string threads = argc > 8 ? argv[8] : "";
+
+	/* empty string stands for the default number of recovery threads */
+	std::vector<std::string> thread_counts;
+	for (size_t pos = 0; pos <= threads.size();) {
+		auto end = threads.find(',', pos);
+		if (end == std::string::npos)
+			end = threads.size();
+		thread_counts.push_back(threads.substr(pos, end - pos));
+		pos = end + 1;
+	}
+
+	if (n_keys > 0) {
+		if (crash) {
+			pid_t pid = fork();
+			if (pid < 0)
+				fail("fork");
+			if (pid == 0)
+				populate(engine, path, n_keys, value_size, true);
+
+			int wstatus;
+			if (waitpid(pid, &wstatus, 0) < 0 || !WIFEXITED(wstatus) ||
+			    WEXITSTATUS(wstatus) != 0)
+				fail("populating the pool");
+		} else {
+			populate(engine, path, n_keys, value_size, false);
+		}
+	}
+
+	std::cout << "engine,n_keys,recovery_threads,run,phase,ns" << std::endl;
+
+	for (auto &n_threads : thread_counts) {
+		auto open_items = items;
+		if (!n_threads.empty()) {
+			if (!open_items.empty())
+				open_items += ",";
+			open_items += "recovery_threads=" + n_threads;
+		}
+
+		for (size_t run = 0; run < n_opens; run++) {
+			pmemkv_db *db = nullptr;
+
+			auto start = std::chrono::steady_clock::now();
+			if (pmemkv_open(engine, make_config(path, 0, open_items), &db) !=
+			    PMEMKV_STATUS_OK)
+				fail("pmemkv_open");
+			auto end = std::chrono::steady_clock::now();
+
+			auto prefix = std::string(engine) + "," + std::to_string(n_keys) +
+				"," + n_threads + "," + std::to_string(run);
+			std::cout << prefix << ",wall,"
+				  << std::chrono::duration_cast<std::chrono::nanoseconds>(
+					     end - start)
+					     .count()
+				  << std::endl;
+
+			if (pmemkv_stats_get(db, print_phase, &prefix) !=
+			    PMEMKV_STATUS_OK)
+				fail("pmemkv_stats_get");
+
+			pmemkv_close(db);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,124 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+/*
+ * persist_cost.cc -- reports persistence cost (flushed cache lines, fences,
+ *		bytes snapshotted in transactions) of put, overwrite and remove,
+ *		per operation. Requires pmemkv built with PERSIST_STATS=ON.
+ *
+ * Usage: persist_cost engine path [n_keys] [value_size]
+ */
+
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <string>
+
+#include <libpmemkv.h>
+
+static const uint64_t SIZE = 1024UL * 1024UL * 1024UL;
+
+static const char *METRICS[] = {"flushes", "flushed_lines", "flushed_bytes",
+				"fences", "tx_ranges", "tx_bytes"};
+
+static void fail(const char *what)
+{
+	std::cerr << what << " failed: " << pmemkv_errormsg() << std::endl;
+	exit(1);
+}
+
+static int collect(const char *name, size_t namebytes, uint64_t value, void *arg)
+{
+	auto stats = static_cast<std::map<std::string, uint64_t> *>(arg);
+	(*stats)[std::string(name, namebytes)] = value;
+
+	return 0;
+}
+
+/* Prints persist.* metrics of operation 'op', divided by the number of calls. */
+static void report(pmemkv_db *db, const char *engine, const char *phase,
+		   const std::string &op)
+{
+	std::map<std::string, uint64_t> stats;
+	if (pmemkv_stats_get(db, collect, &stats) != PMEMKV_STATUS_OK)
+		fail("pmemkv_stats_get");
+
+	if (stats.find(op + ".persist.flushes") == stats.end()) {
+		std::cerr << "no persistence statistics, is pmemkv built with "
+			  << "PERSIST_STATS=ON?" << std::endl;
+		exit(1);
+	}
+
+	double count = static_cast<double>(stats[op + ".count"]);
+
+	std::cout << engine << "," << phase << "," << stats[op + ".count"];
+	for (auto metric : METRICS)
+		std::cout << ","
+			  << static_cast<double>(stats[op + ".persist." + metric]) /
+				count;
+	std::cout << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 3) {
+		std::cerr << "Usage: " << argv[0] << " engine path [n_keys] [value_size]"
+			  << std::endl;
+		return 1;
+	}
+
+	const char *engine = argv[1];
+	size_t n_keys = argc > 3 ? std::stoull(argv[3]) : 100000;
+	size_t value_size = argc > 4 ? std::stoull(argv[4]) : 64;
+
+	pmemkv_config *cfg = pmemkv_config_new();
+	if (!cfg)
+		fail("pmemkv_config_new");
+	if (pmemkv_config_put_path(cfg, argv[2]) != PMEMKV_STATUS_OK ||
+	    pmemkv_config_put_size(cfg, SIZE) != PMEMKV_STATUS_OK ||
+	    pmemkv_config_put_force_create(cfg, true) != PMEMKV_STATUS_OK ||
+	    pmemkv_config_put_uint64(cfg, "stats", 1) != PMEMKV_STATUS_OK)
+		fail("pmemkv_config_put");
+
+	pmemkv_db *db = nullptr;
+	if (pmemkv_open(engine, cfg, &db) != PMEMKV_STATUS_OK)
+		fail("pmemkv_open");
+
+	std::string value(value_size, 'x');
+
+	std::cout << "engine,operation,count";
+	for (auto metric : METRICS)
+		std::cout << "," << metric << "_per_op";
+	std::cout << std::endl;
+
+	/* the first pass inserts new keys, the second one overwrites them */
+	const char *phases[] = {"insert", "overwrite"};
+	for (auto phase : phases) {
+		if (pmemkv_stats_reset(db) != PMEMKV_STATUS_OK)
+			fail("pmemkv_stats_reset");
+
+		for (size_t i = 0; i < n_keys; i++) {
+			auto key = std::to_string(i);
+			if (pmemkv_put(db, key.data(), key.size(), value.data(),
+				       value.size()) != PMEMKV_STATUS_OK)
+				fail("pmemkv_put");
+		}
+
+		report(db, engine, phase, "put");
+	}
+
+	if (pmemkv_stats_reset(db) != PMEMKV_STATUS_OK)
+		fail("pmemkv_stats_reset");
+
+	for (size_t i = 0; i < n_keys; i++) {
+		auto key = std::to_string(i);
+		if (pmemkv_remove(db, key.data(), key.size()) != PMEMKV_STATUS_OK)
+			fail("pmemkv_remove");
+	}
+
+	report(db, engine, "remove", "remove");
+
+	pmemkv_close(db);
+
+	return 0;
+}
@@ -0,0 +1,694 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+/*
+ * pmemkv_bench.cc -- db_bench/YCSB-style benchmark of any pmemkv engine.
+ *
+ * Usage: pmemkv_bench --engine=<name> --config=<json> [options]
+ *
+ * Options:
+ *	--benchmarks=<list>	comma-separated benchmarks, run in the given order
+ *				on the same database (default: fillrandom,readrandom)
+ *	--num=<n>		number of keys loaded by fill benchmarks and
+ *				range of keys used by others (default: 100000)
+ *	--ops=<n>		number of operations of other benchmarks, split
+ *				between threads (default: --num)
+ *	--threads=<n>		number of threads (default: 1)
+ *	--thread_sweep=<n>	run every benchmark with 1, 2, 4, ... and <n>
+ *				threads instead of --threads, to find where
+ *				scaling flattens
+ *	--per_thread=<0|1>	also print a line per thread (default: 0)
+ *	--key_size=<n>		key size in bytes (default: 16)
+ *	--value_size=<n>	value size in bytes (default: 100)
+ *	--distribution=<d>	uniform, zipfian or latest (default: uniform for
+ *				db_bench benchmarks, latest for ycsbd, zipfian
+ *				for other YCSB workloads)
+ *	--zipf_theta=<f>	skew of zipfian and latest distributions
+ *				(default: 0.99)
+ *	--scan_length=<n>	number of records read by a ycsbe scan (default: 100)
+ *	--seed=<n>		random seed (default: 1)
+ *	--format=<f>		csv or json (default: csv)
+ *
+ * Benchmarks:
+ *	fillseq, fillrandom	put --num keys in sequential / random order
+ *	overwrite		put --ops random existing keys
+ *	readrandom		get --ops random keys
+ *	readseq			read whole database with get_all(), in each thread
+ *	deleterandom		remove --ops random keys
+ *	ycsba ... ycsbf		YCSB core workloads A-F: 50/50 read/update,
+ *				95/5 read/update, read only, 95/5 read latest/insert,
+ *				95/5 scan/insert, 50/50 read/read-modify-write
+ *
+ * For every benchmark (and thread count) a line with throughput and latency
+ * percentiles is printed to stdout (as CSV, with a header, or as a JSON object
+ * per line). If the database is opened with runtime statistics enabled
+ * ("stats" config item), the lines also contain how many times and for how long
+ * threads waited for engine's locks, as reported by the engine's gauges named
+ * "*waits" and "*wait_ns" (e.g. csmap's global lock).
+ *
+ * Example:
+ *	pmemkv_bench --engine=cmap --threads=4 --benchmarks=fillseq,ycsba \
+ *		--config='{"path":"/mnt/pmem/pool","size":4294967296,"force_create":1}'
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <libpmemkv.hpp>
+#include <libpmemkv_json_config.h>
+
+#include "histogram.hpp"
+
+using namespace pmem::kv;
+
+struct options {
+	std::string engine;
+	std::string config;
+	std::string benchmarks = "fillrandom,readrandom";
+	size_t num = 100000;
+	size_t ops = 0;
+	size_t threads = 1;
+	size_t thread_sweep = 0;
+	bool per_thread = false;
+	size_t key_size = 16;
+	size_t value_size = 100;
+	std::string distribution;
+	double zipf_theta = 0.99;
+	size_t scan_length = 100;
+	uint64_t seed = 1;
+	std::string format = "csv";
+};
+
+static void usage(const char *name)
+{
+	std::cerr << "Usage: " << name << " --engine=<name> --config=<json> [options]"
+		  << std::endl
+		  << "See the top of benchmarks/pmemkv_bench.cc for all options."
+		  << std::endl;
+	exit(1);
+}
+
+static options parse_options(int argc, char *argv[])
+{
+	std::map<std::string, std::string> args;
+	for (int i = 1; i < argc; i++) {
+		std::string arg(argv[i]);
+		auto eq = arg.find('=');
+		if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos)
+			usage(argv[0]);
+		args[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+	}
+
+	options opts;
+	try {
+		for (auto &a : args) {
+			auto &v = a.second;
+			if (a.first == "engine")
+				opts.engine = v;
+			else if (a.first == "config")
+				opts.config = v;
+			else if (a.first == "benchmarks")
+				opts.benchmarks = v;
+			else if (a.first == "num")
+				opts.num = std::stoull(v);
+			else if (a.first == "ops")
+				opts.ops = std::stoull(v);
+			else if (a.first == "threads")
+				opts.threads = std::stoull(v);
+			else if (a.first == "thread_sweep")
+				opts.thread_sweep = std::stoull(v);
+			else if (a.first == "per_thread")
+				opts.per_thread = std::stoull(v) != 0;
+			else if (a.first == "key_size")
+				opts.key_size = std::stoull(v);
+			else if (a.first == "value_size")
+				opts.value_size = std::stoull(v);
+			else if (a.first == "distribution")
+				opts.distribution = v;
+			else if (a.first == "zipf_theta")
+				opts.zipf_theta = std::stod(v);
+			else if (a.first == "scan_length")
+				opts.scan_length = std::stoull(v);
+			else if (a.first == "seed")
+				opts.seed = std::stoull(v);
+			else if (a.first == "format")
+				opts.format = v;
+			else
+				usage(argv[0]);
+		}
+	} catch (std::logic_error &) {
+		usage(argv[0]);
+	}
+
+	if (opts.engine.empty() || opts.config.empty() || opts.num == 0 ||
+	    opts.threads == 0 || opts.key_size == 0 ||
+	    (opts.format != "csv" && opts.format != "json"))
+		usage(argv[0]);
+	if (opts.ops == 0)
+		opts.ops = opts.num;
+
+	return opts;
+}
+
+/*
+ * Zipfian distribution over [0, n), as in YCSB's ZipfianGenerator (after
+ * Gray et al., "Quickly Generating Billion-Record Synthetic Databases").
+ * Item 0 is the most popular one.
+ */
+class zipfian_generator {
+public:
+	zipfian_generator(uint64_t n, double theta) : n(n), theta(theta)
+	{
+		double zeta2 = zeta(2);
+		zetan = zeta(n);
+		alpha = 1.0 / (1.0 - theta);
+		eta = (1 - std::pow(2.0 / static_cast<double>(n), 1 - theta)) /
+			(1 - zeta2 / zetan);
+	}
+
+	template <typename Rng>
+	uint64_t next(Rng &rng) const
+	{
+		double u = std::uniform_real_distribution<double>(0, 1)(rng);
+		double uz = u * zetan;
+		if (uz < 1.0)
+			return 0;
+		if (uz < 1.0 + std::pow(0.5, theta))
+			return 1;
+
+		auto item = static_cast<uint64_t>(static_cast<double>(n) *
+						  std::pow(eta * u - eta + 1, alpha));
+		return (std::min)(item, n - 1);
+	}
+
+private:
+	double zeta(uint64_t count) const
+	{
+		double sum = 0;
+		for (uint64_t i = 1; i <= count; i++)
+			sum += 1 / std::pow(static_cast<double>(i), theta);
+
+		return sum;
+	}
+
+	uint64_t n;
+	double theta;
+	double zetan, alpha, eta;
+};
+
+static uint64_t fnv1a(uint64_t v)
+{
+	uint64_t h = 14695981039346656037ULL;
+	for (int i = 0; i < 8; i++) {
+		h ^= (v >> (i * 8)) & 0xff;
+		h *= 1099511628211ULL;
+	}
+
+	return h;
+}
+
+enum class distribution { uniform, zipfian, latest };
+
+using rng_type = std::mt19937_64;
+
+struct benchmark_result {
+	histogram latency;
+	uint64_t bytes = 0;
+	uint64_t errors = 0;
+	bool not_supported = false;
+};
+
+class benchmark_runner {
+public:
+	benchmark_runner(const options &opts, db &kv)
+	    : opts(opts),
+	      kv(kv),
+	      zipf(opts.num, opts.zipf_theta),
+	      inserted(opts.num),
+	      values(opts.value_size * 2 + 1, 'v')
+	{
+		rng_type rng(opts.seed);
+		for (auto &c : values)
+			c = static_cast<char>('a' + rng() % 26);
+	}
+
+	/* Runs benchmark 'name' and prints its results, returns false if unknown. */
+	bool run(const std::string &name)
+	{
+		std::function<void(size_t, rng_type &, benchmark_result &)> worker;
+		size_t ops = opts.ops;
+		distribution dist = distribution::uniform;
+		bool ycsb = name.compare(0, 4, "ycsb") == 0 && name.size() == 5;
+		if (ycsb)
+			dist = name == "ycsbd" ? distribution::latest
+						: distribution::zipfian;
+		if (opts.distribution == "uniform")
+			dist = distribution::uniform;
+		else if (opts.distribution == "zipfian")
+			dist = distribution::zipfian;
+		else if (opts.distribution == "latest")
+			dist = distribution::latest;
+
+		auto next_key = [this, dist](rng_type &rng) {
+			return this->next_key(dist, rng);
+		};
+
+		if (name == "fillseq") {
+			ops = opts.num;
+			worker = [&](size_t t, rng_type &rng, benchmark_result &r) {
+				size_t begin = opts.num * t / threads;
+				size_t end = opts.num * (t + 1) / threads;
+				for (size_t i = begin; i < end; i++)
+					put(i, rng, r);
+			};
+		} else if (name == "fillrandom" || name == "overwrite") {
+			if (name == "fillrandom")
+				ops = opts.num;
+			worker = [&, ops](size_t t, rng_type &rng,
+					  benchmark_result &r) {
+				for (size_t i = 0; i < share(ops, t); i++)
+					put(next_key(rng), rng, r);
+			};
+		} else if (name == "readrandom" || name == "ycsbc") {
+			worker = [&](size_t t, rng_type &rng, benchmark_result &r) {
+				for (size_t i = 0; i < share(ops, t); i++)
+					get(next_key(rng), r);
+			};
+		} else if (name == "readseq") {
+			ops = 0;
+			worker = [&](size_t, rng_type &, benchmark_result &r) {
+				read_all(r);
+			};
+		} else if (name == "deleterandom") {
+			worker = [&](size_t t, rng_type &rng, benchmark_result &r) {
+				for (size_t i = 0; i < share(ops, t); i++)
+					remove(next_key(rng), r);
+			};
+		} else if (name == "ycsba" || name == "ycsbb" || name == "ycsbf") {
+			unsigned writes = name == "ycsbb" ? 5 : 50;
+			bool rmw = name == "ycsbf";
+			worker = [&, writes, rmw](size_t t, rng_type &rng,
+						  benchmark_result &r) {
+				for (size_t i = 0; i < share(ops, t); i++) {
+					auto key = next_key(rng);
+					if (rng() % 100 >= writes)
+						get(key, r);
+					else if (rmw)
+						read_modify_write(key, rng, r);
+					else
+						put(key, rng, r);
+				}
+			};
+		} else if (name == "ycsbd" || name == "ycsbe") {
+			bool scans = name == "ycsbe";
+			worker = [&, scans](size_t t, rng_type &rng,
+					    benchmark_result &r) {
+				for (size_t i = 0; i < share(ops, t); i++) {
+					if (rng() % 100 < 5)
+						put(inserted.fetch_add(1), rng, r);
+					else if (scans)
+						scan(next_key(rng), r);
+					else
+						get(next_key(rng), r);
+				}
+			};
+		} else {
+			return false;
+		}
+
+		for (auto n : thread_counts()) {
+			threads = n;
+			run_threads(name, worker);
+		}
+
+		return true;
+	}
+
+private:
+	size_t share(size_t ops, size_t t) const
+	{
+		return ops * (t + 1) / threads - ops * t / threads;
+	}
+
+	std::vector<size_t> thread_counts() const
+	{
+		if (opts.thread_sweep == 0)
+			return {opts.threads};
+
+		std::vector<size_t> counts;
+		for (size_t n = 1; n < opts.thread_sweep; n *= 2)
+			counts.push_back(n);
+		counts.push_back(opts.thread_sweep);
+
+		return counts;
+	}
+
+	/*
+	 * Sums engine's lock wait gauges, returns false if runtime statistics
+	 * are not enabled.
+	 */
+	bool lock_waits(uint64_t &waits, uint64_t &wait_ns)
+	{
+		waits = wait_ns = 0;
+		auto s = kv.stats([&](string_view name, uint64_t value) {
+			if (ends_with(name, "waits"))
+				waits += value;
+			else if (ends_with(name, "wait_ns"))
+				wait_ns += value;
+			return 0;
+		});
+
+		return s == status::OK;
+	}
+
+	static bool ends_with(string_view s, const std::string &suffix)
+	{
+		return s.size() >= suffix.size() &&
+			std::string(s.data() + s.size() - suffix.size(), suffix.size()) ==
+			suffix;
+	}
+
+	uint64_t next_key(distribution dist, rng_type &rng) const
+	{
+		switch (dist) {
+			case distribution::zipfian:
+				/* scrambled, so that popular keys are spread */
+				return fnv1a(zipf.next(rng)) % opts.num;
+			case distribution::latest: {
+				auto last = inserted.load(std::memory_order_relaxed);
+				auto back = zipf.next(rng);
+				return back < last ? last - 1 - back : 0;
+			}
+			default:
+				return rng() % opts.num;
+		}
+	}
+
+	std::string key(uint64_t n) const
+	{
+		std::string k(opts.key_size, '0');
+		for (size_t i = opts.key_size; i > 0 && n; i--, n /= 10)
+			k[i - 1] = static_cast<char>('0' + n % 10);
+
+		return k;
+	}
+
+	string_view value(rng_type &rng) const
+	{
+		return string_view(values.data() + rng() % (opts.value_size + 1),
+				   opts.value_size);
+	}
+
+	template <typename Function>
+	void measure(benchmark_result &r, Function &&f)
+	{
+		auto start = std::chrono::steady_clock::now();
+		auto s = f();
+		auto end = std::chrono::steady_clock::now();
+
+		r.latency.add(static_cast<uint64_t>(
+			std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+				.count()));
+		if (s == status::NOT_SUPPORTED)
+			r.not_supported = true;
+		else if (s != status::OK && s != status::NOT_FOUND &&
+			 s != status::STOPPED_BY_CB)
+			r.errors++;
+	}
+
+	void put(uint64_t n, rng_type &rng, benchmark_result &r)
+	{
+		auto k = key(n);
+		auto v = value(rng);
+		measure(r, [&] { return kv.put(k, v); });
+		r.bytes += k.size() + v.size();
+	}
+
+	void get(uint64_t n, benchmark_result &r)
+	{
+		auto k = key(n);
+		size_t read = 0;
+		measure(r, [&] {
+			return kv.get(k, [&](string_view v) { read = v.size(); });
+		});
+		r.bytes += k.size() + read;
+	}
+
+	void remove(uint64_t n, benchmark_result &r)
+	{
+		auto k = key(n);
+		measure(r, [&] { return kv.remove(k); });
+		r.bytes += k.size();
+	}
+
+	void read_modify_write(uint64_t n, rng_type &rng, benchmark_result &r)
+	{
+		auto k = key(n);
+		std::string v;
+		measure(r, [&] {
+			auto s = kv.get(k, &v);
+			if (s != status::OK && s != status::NOT_FOUND)
+				return s;
+			v.assign(value(rng).data(), opts.value_size);
+			return kv.put(k, v);
+		});
+		r.bytes += k.size() + v.size() * 2;
+	}
+
+	void scan(uint64_t n, benchmark_result &r)
+	{
+		auto k = key(n);
+		size_t left = opts.scan_length;
+		measure(r, [&] {
+			return kv.get_above(k, [&](string_view key, string_view value) {
+				r.bytes += key.size() + value.size();
+				return --left == 0 ? 1 : 0;
+			});
+		});
+	}
+
+	/* Latency of every entry is the time since the previous callback. */
+	void read_all(benchmark_result &r)
+	{
+		auto last = std::chrono::steady_clock::now();
+		auto s = kv.get_all([&](string_view key, string_view value) {
+			auto now = std::chrono::steady_clock::now();
+			r.latency.add(static_cast<uint64_t>(
+				std::chrono::duration_cast<std::chrono::nanoseconds>(now -
+										     last)
+					.count()));
+			r.bytes += key.size() + value.size();
+			last = now;
+			return 0;
+		});
+		if (s == status::NOT_SUPPORTED)
+			r.not_supported = true;
+		else if (s != status::OK)
+			r.errors++;
+	}
+
+	void run_threads(
+		const std::string &name,
+		const std::function<void(size_t, rng_type &, benchmark_result &)>
+			&worker)
+	{
+		std::vector<benchmark_result> results(threads);
+		std::vector<std::chrono::steady_clock::time_point> ends(threads);
+		std::atomic<size_t> ready(0);
+		std::atomic<bool> go(false);
+
+		std::vector<std::thread> workers;
+		for (size_t t = 0; t < threads; t++) {
+			workers.emplace_back([&, t] {
+				rng_type rng(opts.seed * 1000003 + t);
+				ready++;
+				while (!go.load(std::memory_order_acquire))
+					std::this_thread::yield();
+
+				worker(t, rng, results[t]);
+				ends[t] = std::chrono::steady_clock::now();
+			});
+		}
+
+		uint64_t waits_before, wait_ns_before;
+		bool have_waits = lock_waits(waits_before, wait_ns_before);
+
+		while (ready.load() != threads)
+			std::this_thread::yield();
+		auto start = std::chrono::steady_clock::now();
+		go.store(true, std::memory_order_release);
+
+		for (auto &w : workers)
+			w.join();
+
+		benchmark_result total;
+		for (auto &r : results) {
+			total.latency.merge(r.latency);
+			total.bytes += r.bytes;
+			total.errors += r.errors;
+			total.not_supported |= r.not_supported;
+		}
+
+		if (total.not_supported) {
+			std::cerr << name << ": not supported by engine " << opts.engine
+				  << std::endl;
+			return;
+		}
+
+		std::string waits, wait_ns;
+		uint64_t waits_after, wait_ns_after;
+		if (have_waits && lock_waits(waits_after, wait_ns_after)) {
+			waits = std::to_string(waits_after - waits_before);
+			wait_ns = std::to_string(wait_ns_after - wait_ns_before);
+		}
+
+		auto end = *std::max_element(ends.begin(), ends.end());
+		report(name, "all", total, seconds(start, end), waits, wait_ns);
+
+		if (!opts.per_thread)
+			return;
+		for (size_t t = 0; t < threads; t++) {
+			auto id = std::to_string(t);
+			report(name, id, results[t], seconds(start, ends[t]), "", "");
+		}
+	}
+
+	static double seconds(std::chrono::steady_clock::time_point start,
+			      std::chrono::steady_clock::time_point end)
+	{
+		return std::chrono::duration<double>(end - start).count();
+	}
+
+	struct field {
+		const char *name;
+		std::string value;
+		bool text;
+	};
+
+	/* Prints results of all threads ('thread' is "all") or of a single one. */
+	void report(const std::string &name, const std::string &thread,
+		    const benchmark_result &r, double seconds, const std::string &waits,
+		    const std::string &wait_ns)
+	{
+		auto &l = r.latency;
+		double ops_per_sec =
+			seconds > 0 ? static_cast<double>(l.count) / seconds : 0;
+		double mb_per_sec = seconds > 0
+			? static_cast<double>(r.bytes) / (1024 * 1024) / seconds
+			: 0;
+
+		std::vector<field> fields = {
+			{"benchmark", name, true},
+			{"engine", opts.engine, true},
+			{"threads", std::to_string(threads), false},
+			{"thread", thread, true},
+			{"key_size", std::to_string(opts.key_size), false},
+			{"value_size", std::to_string(opts.value_size), false},
+			{"ops", std::to_string(l.count), false},
+			{"errors", std::to_string(r.errors), false},
+			{"seconds", format(seconds, 6), false},
+			{"ops_per_sec", format(ops_per_sec), false},
+			{"mb_per_sec", format(mb_per_sec), false},
+			{"lat_avg_ns", format(l.mean()), false},
+			{"lat_p50_ns", std::to_string(l.percentile(0.5)), false},
+			{"lat_p99_ns", std::to_string(l.percentile(0.99)), false},
+			{"lat_p999_ns", std::to_string(l.percentile(0.999)), false},
+			{"lat_max_ns", std::to_string(l.max), false},
+			{"lock_waits", waits, false},
+			{"lock_wait_ns", wait_ns, false},
+		};
+
+		if (opts.format == "json") {
+			std::cout << "{";
+			for (size_t i = 0; i < fields.size(); i++) {
+				auto &f = fields[i];
+				std::cout << (i ? ", " : "") << "\"" << f.name << "\": ";
+				if (f.text)
+					std::cout << "\"" << f.value << "\"";
+				else
+					std::cout << (f.value.empty() ? "null" : f.value);
+			}
+			std::cout << "}" << std::endl;
+			return;
+		}
+
+		if (!header_printed) {
+			for (size_t i = 0; i < fields.size(); i++)
+				std::cout << (i ? "," : "") << fields[i].name;
+			std::cout << std::endl;
+			header_printed = true;
+		}
+		for (size_t i = 0; i < fields.size(); i++)
+			std::cout << (i ? "," : "") << fields[i].value;
+		std::cout << std::endl;
+	}
+
+	static std::string format(double v, int precision = 3)
+	{
+		char buf[64];
+		snprintf(buf, sizeof(buf), "%.*f", precision, v);
+
+		return buf;
+	}
+
+	const options &opts;
+	db &kv;
+	zipfian_generator zipf;
+	std::atomic<uint64_t> inserted;
+	std::string values;
+	size_t threads = 0;
+	bool header_printed = false;
+};
+
+int main(int argc, char *argv[])
+{
+	auto opts = parse_options(argc, argv);
+
+	pmemkv_config *c = pmemkv_config_new();
+	if (!c) {
+		std::cerr << "pmemkv_config_new failed: " << pmemkv_errormsg()
+			  << std::endl;
+		return 1;
+	}
+	if (pmemkv_config_from_json(c, opts.config.c_str()) != PMEMKV_STATUS_OK) {
+		std::cerr << "invalid config: " << pmemkv_config_from_json_errormsg()
+			  << std::endl;
+		pmemkv_config_delete(c);
+		return 1;
+	}
+
+	db kv;
+	auto s = kv.open(opts.engine, config(c));
+	if (s != status::OK) {
+		std::cerr << "cannot open " << opts.engine << ": " << kv.errormsg()
+			  << std::endl;
+		return 1;
+	}
+
+	benchmark_runner runner(opts, kv);
+
+	std::stringstream names(opts.benchmarks);
+	std::string name;
+	while (std::getline(names, name, ',')) {
+		if (!runner.run(name)) {
+			std::cerr << "unknown benchmark: " << name << std::endl;
+			return 1;
+		}
+	}
+
+	kv.close();
+
+	return 0;
+}
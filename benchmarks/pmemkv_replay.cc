@@ -0,0 +1,572 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+/*
+ * pmemkv_replay.cc -- replays a workload captured with the "capture_path"
+ *		config item (see libpmemkv(7)) against any engine and reports
+ *		latency of every type of operation.
+ *
+ * Usage: pmemkv_replay --engine=<name> --config=<json> --capture=<file> [options]
+ *
+ * Options:
+ *	--timing=<t>		original (keep inter-arrival times of the capture)
+ *				or fast (as fast as possible) (default: fast)
+ *	--speedup=<f>		with original timing, divide inter-arrival times
+ *				by <f> (default: 1)
+ *	--threads=<n>		number of replaying threads, captured threads are
+ *				assigned to them round-robin (default: number of
+ *				threads in the capture)
+ *	--prefill=<0|1>		before replaying, put keys which were found by
+ *				the captured workload before it wrote them
+ *				(default: 1)
+ *	--value_size=<n>	size of prefilled values, if not known from the
+ *				capture (default: 100)
+ *	--format=<f>		csv or json (default: csv)
+ *
+ * Keys are generated from captured hashes - the same hash and size always give
+ * the same key. Values are filled with 'x'. Operations of a captured thread
+ * are replayed in their order, by a single thread. Puts and removes done in
+ * transactions are captured as puts and removes (followed by a tx_commit
+ * record), so they are replayed as separate operations (commits are skipped)
+ * and their latency is the one of buffering in the transaction, range
+ * queries as get_all() or get_equal_above() the captured key, stopped after
+ * as many bytes as were read in the capture. Defragmentation and bulk loads
+ * (whose input is not captured) are skipped.
+ *
+ * For every type of operation (and for all of them) a line is printed with
+ * throughput, latency percentiles of the replay and of the capture and with
+ * the number of mismatches, i.e. of operations with a different result
+ * (e.g. not found) than in the capture.
+ */
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include <libpmemkv.hpp>
+#include <libpmemkv_json_config.h>
+
+#include "histogram.hpp"
+
+using namespace pmem::kv;
+
+/* keep in sync with src/trace.h */
+struct capture_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+	uint64_t records;
+};
+
+struct capture_record {
+	uint64_t timestamp_ns;
+	uint64_t duration_ns;
+	uint64_t key_hash;
+	uint32_t key_size;
+	uint32_t value_size;
+	uint32_t thread;
+	uint8_t op;
+	int8_t status;
+	uint16_t reserved;
+};
+
+/* order of internal::api_op in src/stats.h */
+enum class op_type : uint8_t {
+	get,
+	put,
+	remove,
+	exists,
+	count,
+	iterate,
+	tx_commit,
+	defrag,
+	bulk_load,
+};
+
+static const char *OP_NAMES[] = {"get",	   "put",    "remove",
+				 "exists",	   "count",  "iterate",
+				 "tx_commit", "defrag", "bulk_load"};
+static constexpr size_t OPS = sizeof(OP_NAMES) / sizeof(OP_NAMES[0]);
+
+struct options {
+	std::string engine;
+	std::string config;
+	std::string capture;
+	bool original_timing = false;
+	double speedup = 1;
+	size_t threads = 0;
+	bool prefill = true;
+	size_t value_size = 100;
+	std::string format = "csv";
+};
+
+static void usage(const char *name)
+{
+	std::cerr << "Usage: " << name
+		  << " --engine=<name> --config=<json> --capture=<file> [options]"
+		  << std::endl
+		  << "See the top of benchmarks/pmemkv_replay.cc for all options."
+		  << std::endl;
+	exit(1);
+}
+
+static options parse_options(int argc, char *argv[])
+{
+	std::map<std::string, std::string> args;
+	for (int i = 1; i < argc; i++) {
+		std::string arg(argv[i]);
+		auto eq = arg.find('=');
+		if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos)
+			usage(argv[0]);
+		args[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+	}
+
+	options opts;
+	try {
+		for (auto &a : args) {
+			auto &v = a.second;
+			if (a.first == "engine")
+				opts.engine = v;
+			else if (a.first == "config")
+				opts.config = v;
+			else if (a.first == "capture")
+				opts.capture = v;
+			else if (a.first == "timing" && (v == "original" || v == "fast"))
+				opts.original_timing = v == "original";
+			else if (a.first == "speedup")
+				opts.speedup = std::stod(v);
+			else if (a.first == "threads")
+				opts.threads = std::stoull(v);
+			else if (a.first == "prefill")
+				opts.prefill = std::stoull(v) != 0;
+			else if (a.first == "value_size")
+				opts.value_size = std::stoull(v);
+			else if (a.first == "format")
+				opts.format = v;
+			else
+				usage(argv[0]);
+		}
+	} catch (std::logic_error &) {
+		usage(argv[0]);
+	}
+
+	if (opts.engine.empty() || opts.config.empty() || opts.capture.empty() ||
+	    opts.speedup <= 0 || (opts.format != "csv" && opts.format != "json"))
+		usage(argv[0]);
+
+	return opts;
+}
+
+/*
+ * Reads all records of a capture. Captures of processes which did not close
+ * the database have no record count in the header, then the file size is used.
+ */
+static std::vector<capture_record> read_capture(const std::string &path)
+{
+	std::ifstream in(path, std::ios::binary | std::ios::ate);
+	if (!in)
+		throw std::runtime_error("cannot open " + path);
+
+	auto file_size = static_cast<uint64_t>(in.tellg());
+	in.seekg(0);
+
+	capture_header header;
+	in.read(reinterpret_cast<char *>(&header), sizeof(header));
+	if (!in || memcmp(header.magic, "PMKVTRC", 8) != 0)
+		throw std::runtime_error(path + " is not a pmemkv capture");
+	if (header.version != 1 || header.record_size != sizeof(capture_record))
+		throw std::runtime_error(path + ": unsupported version " +
+					 std::to_string(header.version));
+
+	auto available = (file_size - sizeof(header)) / sizeof(capture_record);
+	auto n = header.records ? (std::min)(header.records, available) : available;
+
+	std::vector<capture_record> records(n);
+	in.read(reinterpret_cast<char *>(records.data()),
+		static_cast<std::streamsize>(n * sizeof(capture_record)));
+	if (!in)
+		throw std::runtime_error("cannot read " + path);
+
+	return records;
+}
+
+static uint64_t splitmix64(uint64_t x)
+{
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+/* Returns printable key of 'size' bytes, derived from 'hash'. */
+static std::string make_key(uint64_t hash, uint32_t size)
+{
+	static const char chars[] =
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+	std::string key(size, '\0');
+	uint64_t bits = 0;
+	for (uint32_t i = 0; i < size; i++) {
+		/* 10 characters per 64 random bits */
+		if (i % 10 == 0)
+			bits = splitmix64(hash + i);
+		key[i] = chars[bits & 63];
+		bits >>= 6;
+	}
+
+	return key;
+}
+
+/* Statuses which are not errors, STOPPED_BY_CB is reported as OK. */
+static int normalize(int s)
+{
+	return s == static_cast<int>(status::STOPPED_BY_CB) ? static_cast<int>(status::OK)
+							     : s;
+}
+
+static bool is_error(int s)
+{
+	return s != static_cast<int>(status::OK) &&
+		s != static_cast<int>(status::NOT_FOUND);
+}
+
+struct op_result {
+	histogram latency;
+	histogram captured;
+	uint64_t errors = 0;
+	uint64_t mismatches = 0;
+
+	void merge(const op_result &other)
+	{
+		latency.merge(other.latency);
+		captured.merge(other.captured);
+		errors += other.errors;
+		mismatches += other.mismatches;
+	}
+};
+
+using results = std::array<op_result, OPS>;
+
+/* Stops a range query after 'limit' bytes (but not before the first element). */
+struct scan_context {
+	uint64_t limit;
+	uint64_t bytes;
+};
+
+static int scan_cb(const char *, size_t kb, const char *, size_t vb, void *arg)
+{
+	auto ctx = static_cast<scan_context *>(arg);
+	ctx->bytes += kb + vb;
+
+	return ctx->bytes >= ctx->limit ? 1 : 0;
+}
+
+static void get_cb(const char *, size_t, void *)
+{
+}
+
+static bool by_timestamp(const capture_record &a, const capture_record &b)
+{
+	return a.timestamp_ns < b.timestamp_ns;
+}
+
+class replayer {
+public:
+	replayer(const options &opts, db &kv, std::vector<capture_record> records)
+	    : opts(opts), kv(kv), records(std::move(records))
+	{
+		uint32_t max_thread = 0;
+		uint32_t max_value = static_cast<uint32_t>(opts.value_size);
+		for (auto &r : this->records) {
+			max_thread = (std::max)(max_thread, r.thread);
+			max_value = (std::max)(max_value, r.value_size);
+		}
+		values.assign(max_value, 'x');
+
+		threads = opts.threads ? opts.threads : max_thread + 1;
+		per_thread.resize(threads);
+		for (auto &r : this->records)
+			per_thread[r.thread % threads].push_back(r);
+
+		/* records of a captured thread were stored in order of calls */
+		for (auto &t : per_thread)
+			std::stable_sort(t.begin(), t.end(), by_timestamp);
+
+		first_timestamp = UINT64_MAX;
+		for (auto &r : this->records)
+			first_timestamp = (std::min)(first_timestamp, r.timestamp_ns);
+	}
+
+	/* Puts keys which the capture found before writing them. */
+	void prefill()
+	{
+		auto sorted = records;
+		std::stable_sort(sorted.begin(), sorted.end(), by_timestamp);
+
+		std::unordered_set<std::string> seen;
+		for (auto &r : sorted) {
+			auto op = static_cast<op_type>(r.op);
+			if (r.key_size == 0 ||
+			    (op != op_type::put && op != op_type::get &&
+			     op != op_type::exists && op != op_type::remove))
+				continue;
+
+			auto key = make_key(r.key_hash, r.key_size);
+			if (!seen.insert(key).second)
+				continue;
+
+			auto found = r.status == static_cast<int>(status::OK);
+			if (op == op_type::put || !found)
+				continue;
+
+			auto size = op == op_type::get ? r.value_size : opts.value_size;
+			auto s = kv.put(key, string_view(values.data(), size));
+			if (s != status::OK)
+				throw std::runtime_error("prefill failed: " +
+							 kv.errormsg());
+		}
+	}
+
+	void run()
+	{
+		std::vector<results> thread_results(threads);
+		std::vector<std::thread> workers;
+		std::atomic<bool> go(false);
+
+		for (size_t t = 0; t < threads; t++)
+			workers.emplace_back([&, t] {
+				while (!go.load(std::memory_order_acquire))
+					std::this_thread::yield();
+				replay(per_thread[t], thread_results[t]);
+			});
+
+		start = std::chrono::steady_clock::now();
+		go.store(true, std::memory_order_release);
+		for (auto &w : workers)
+			w.join();
+		auto seconds = std::chrono::duration<double>(
+				       std::chrono::steady_clock::now() - start)
+				       .count();
+
+		results total;
+		op_result all;
+		for (auto &tr : thread_results)
+			for (size_t op = 0; op < OPS; op++)
+				total[op].merge(tr[op]);
+
+		for (size_t op = 0; op < OPS; op++) {
+			if (total[op].latency.count == 0)
+				continue;
+			report(OP_NAMES[op], total[op], seconds);
+			all.merge(total[op]);
+		}
+		report("all", all, seconds);
+	}
+
+private:
+	void replay(const std::vector<capture_record> &recs, results &res)
+	{
+		for (auto &r : recs) {
+			if (r.op >= OPS)
+				continue;
+
+			if (opts.original_timing) {
+				auto offset = static_cast<double>(r.timestamp_ns -
+								  first_timestamp) /
+					opts.speedup;
+				std::this_thread::sleep_until(
+					start + std::chrono::nanoseconds(
+							static_cast<int64_t>(offset)));
+			}
+
+			auto key = make_key(r.key_hash, r.key_size);
+
+			auto begin = std::chrono::steady_clock::now();
+			int s;
+			if (!execute(r, key, s))
+				continue;
+			auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+					  std::chrono::steady_clock::now() - begin)
+					  .count();
+
+			auto &o = res[r.op];
+			o.latency.add(static_cast<uint64_t>(ns));
+			o.captured.add(r.duration_ns);
+			if (is_error(normalize(s)))
+				o.errors++;
+			if (normalize(s) != normalize(r.status))
+				o.mismatches++;
+		}
+	}
+
+	/* Executes operation of record 'r', returns false if it's skipped. */
+	bool execute(const capture_record &r, const std::string &key, int &s)
+	{
+		status ret;
+		switch (static_cast<op_type>(r.op)) {
+			case op_type::get:
+				ret = kv.get(key, &get_cb, nullptr);
+				break;
+			case op_type::put:
+				ret = kv.put(key,
+					     string_view(values.data(), r.value_size));
+				break;
+			case op_type::remove:
+				ret = kv.remove(key);
+				break;
+			case op_type::exists:
+				ret = kv.exists(key);
+				break;
+			case op_type::count: {
+				size_t cnt;
+				ret = kv.count_all(cnt);
+				break;
+			}
+			case op_type::iterate: {
+				scan_context ctx = {r.value_size, 0};
+				ret = r.key_size ? kv.get_equal_above(key, &scan_cb, &ctx)
+						 : kv.get_all(&scan_cb, &ctx);
+				break;
+			}
+			default:
+				return false;
+		}
+
+		s = static_cast<int>(ret);
+		return true;
+	}
+
+	struct field {
+		const char *name;
+		std::string value;
+		bool text;
+	};
+
+	void report(const std::string &name, const op_result &r, double seconds)
+	{
+		auto &l = r.latency;
+		double ops_per_sec =
+			seconds > 0 ? static_cast<double>(l.count) / seconds : 0;
+
+		std::vector<field> fields = {
+			{"op", name, true},
+			{"engine", opts.engine, true},
+			{"threads", std::to_string(threads), false},
+			{"ops", std::to_string(l.count), false},
+			{"errors", std::to_string(r.errors), false},
+			{"mismatches", std::to_string(r.mismatches), false},
+			{"seconds", format(seconds, 6), false},
+			{"ops_per_sec", format(ops_per_sec), false},
+			{"lat_avg_ns", format(l.mean()), false},
+			{"lat_p50_ns", std::to_string(l.percentile(0.5)), false},
+			{"lat_p99_ns", std::to_string(l.percentile(0.99)), false},
+			{"lat_p999_ns", std::to_string(l.percentile(0.999)), false},
+			{"lat_max_ns", std::to_string(l.max), false},
+			{"captured_p50_ns", std::to_string(r.captured.percentile(0.5)),
+			 false},
+			{"captured_p99_ns", std::to_string(r.captured.percentile(0.99)),
+			 false},
+		};
+
+		if (opts.format == "json") {
+			std::cout << "{";
+			for (size_t i = 0; i < fields.size(); i++) {
+				auto &f = fields[i];
+				std::cout << (i ? ", " : "") << "\"" << f.name << "\": ";
+				if (f.text)
+					std::cout << "\"" << f.value << "\"";
+				else
+					std::cout << f.value;
+			}
+			std::cout << "}" << std::endl;
+			return;
+		}
+
+		if (!header_printed) {
+			for (size_t i = 0; i < fields.size(); i++)
+				std::cout << (i ? "," : "") << fields[i].name;
+			std::cout << std::endl;
+			header_printed = true;
+		}
+		for (size_t i = 0; i < fields.size(); i++)
+			std::cout << (i ? "," : "") << fields[i].value;
+		std::cout << std::endl;
+	}
+
+	static std::string format(double v, int precision = 3)
+	{
+		char buf[64];
+		snprintf(buf, sizeof(buf), "%.*f", precision, v);
+
+		return buf;
+	}
+
+	const options &opts;
+	db &kv;
+	std::vector<capture_record> records;
+	std::vector<std::vector<capture_record>> per_thread;
+	std::string values;
+	size_t threads = 0;
+	uint64_t first_timestamp = 0;
+	std::chrono::steady_clock::time_point start;
+	bool header_printed = false;
+};
+
+int main(int argc, char *argv[])
+{
+	auto opts = parse_options(argc, argv);
+
+	std::vector<capture_record> records;
+	try {
+		records = read_capture(opts.capture);
+	} catch (std::exception &e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	pmemkv_config *c = pmemkv_config_new();
+	if (!c) {
+		std::cerr << "pmemkv_config_new failed: " << pmemkv_errormsg()
+			  << std::endl;
+		return 1;
+	}
+	if (pmemkv_config_from_json(c, opts.config.c_str()) != PMEMKV_STATUS_OK) {
+		std::cerr << "invalid config: " << pmemkv_config_from_json_errormsg()
+			  << std::endl;
+		pmemkv_config_delete(c);
+		return 1;
+	}
+
+	db kv;
+	auto s = kv.open(opts.engine, config(c));
+	if (s != status::OK) {
+		std::cerr << "cannot open " << opts.engine << ": " << kv.errormsg()
+			  << std::endl;
+		return 1;
+	}
+
+	try {
+		replayer r(opts, kv, std::move(records));
+		if (opts.prefill)
+			r.prefill();
+		r.run();
+	} catch (std::exception &e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	kv.close();
+
+	return 0;
+}
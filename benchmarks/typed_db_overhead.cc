@@ -0,0 +1,103 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+/*
+ * typed_db_overhead.cc -- measures the cost of the API itself: put, get and
+ *		exists on the blackhole engine (which does nothing), called
+ *		through pmem::kv::db (the C API) and through typed_db<blackhole>
+ *		(direct calls). Requires pmemkv built with BUILD_STATIC=ON.
+ *
+ *		Prints CSV: api,operation,ns_per_op.
+ *
+ * Usage: typed_db_overhead [n_ops]
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "engines/blackhole.h"
+#include "typed_db.h"
+
+using namespace pmem::kv;
+
+static const size_t KEY_SIZE = 16;
+static const size_t VALUE_SIZE = 64;
+
+static size_t n_ops = 10000000;
+
+static void fail(const char *what, status s)
+{
+	std::cerr << what << " failed with status " << static_cast<int>(s) << std::endl;
+	exit(1);
+}
+
+/* Runs op for every key, prints time per call. */
+template <typename Op>
+static void measure(const char *api, const char *op_name, Op &&op)
+{
+	const std::string key(KEY_SIZE, 'k');
+
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < n_ops; i++)
+		op(key);
+	auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - start);
+
+	std::cout << api << "," << op_name << ","
+		  << static_cast<double>(ns.count()) / static_cast<double>(n_ops)
+		  << std::endl;
+}
+
+static void bench_db()
+{
+	db kv;
+	auto s = kv.open("blackhole", config());
+	if (s != status::OK)
+		fail("db::open", s);
+
+	const std::string value(VALUE_SIZE, 'v');
+	size_t bytes = 0;
+
+	measure("db", "put", [&](const std::string &k) { kv.put(k, value); });
+	measure("db", "get", [&](const std::string &k) {
+		kv.get(k, [&](string_view v) { bytes += v.size(); });
+	});
+	measure("db", "exists", [&](const std::string &k) { kv.exists(k); });
+
+	kv.close();
+}
+
+static void bench_typed_db()
+{
+	typed_db<blackhole> kv;
+	auto s = kv.open(config());
+	if (s != status::OK)
+		fail("typed_db::open", s);
+
+	const std::string value(VALUE_SIZE, 'v');
+	size_t bytes = 0;
+
+	measure("typed_db", "put", [&](const std::string &k) { kv.put(k, value); });
+	measure("typed_db", "get", [&](const std::string &k) {
+		kv.get(k, [&](string_view v) { bytes += v.size(); });
+	});
+	measure("typed_db", "exists", [&](const std::string &k) { kv.exists(k); });
+
+	kv.close();
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc > 1)
+		n_ops = std::strtoull(argv[1], nullptr, 10);
+
+	std::cout << "api,operation,ns_per_op" << std::endl;
+
+	bench_db();
+	bench_typed_db();
+
+	return 0;
+}
@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2020, Intel Corporation */
+/* Copyright 2020-2021, Intel Corporation */
 
 #ifndef LIBPMEMKV_COMPARATOR_H
 #define LIBPMEMKV_COMPARATOR_H
@@ -54,6 +54,15 @@ static inline const comparator &binary_comparator()
 	return cmp;
 }
 
+/*
+ * Checks by name, so that it does not matter in which translation unit
+ * the comparator was created.
+ */
+static inline bool is_binary_comparator(const comparator *cmp)
+{
+	return cmp->name() == binary_comparator().name();
+}
+
 template <typename T,
 	  typename Enable = typename std::enable_if<std::is_same<
 		  const char *, decltype(std::declval<T>().c_str())>::value>::type>
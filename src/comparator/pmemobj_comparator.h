@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2020, Intel Corporation */
+/* Copyright 2020-2021, Intel Corporation */
 
 #ifndef LIBPMEMKV_PMEMOBJ_COMPARATOR_H
 #define LIBPMEMKV_PMEMOBJ_COMPARATOR_H
@@ -11,6 +11,9 @@
 
 #include <libpmemobj++/container/string.hpp>
 
+#include <cstdint>
+#include <cstring>
+
 namespace pmem
 {
 namespace kv
@@ -72,6 +75,49 @@ private:
 
 static_assert(sizeof(pmemobj_compare) == 40, "wrong pmemobj_compare size");
 
+/*
+ * Used instead of pmemobj_compare when the binary comparator is configured -
+ * keys are compared inline, without the call through comparator::compare.
+ * The layout (and initialization) is the same, so a pool can be opened with
+ * either of them.
+ */
+class binary_pmemobj_compare : public pmemobj_compare {
+public:
+	template <typename T, typename U>
+	bool operator()(const T &lhs, const U &rhs) const
+	{
+		return make_string_view(lhs).compare(make_string_view(rhs)) < 0;
+	}
+
+	/*
+	 * 1-byte hash of a key, used by stree's leaves to skip comparisons with
+	 * keys which cannot be equal.
+	 */
+	template <typename T>
+	static uint8_t fingerprint(const T &key)
+	{
+		auto k = make_string_view(key);
+		const uint64_t mul = 0x9e3779b97f4a7c15ULL;
+
+		uint64_t h = k.size();
+		size_t i = 0;
+		for (; i + sizeof(uint64_t) <= k.size(); i += sizeof(uint64_t)) {
+			uint64_t w;
+			memcpy(&w, k.data() + i, sizeof(w));
+			h = (h ^ w) * mul;
+		}
+		for (; i < k.size(); i++)
+			h = (h ^ static_cast<unsigned char>(k.data()[i])) * mul;
+
+		h = (h ^ (h >> 29)) * mul;
+
+		return static_cast<uint8_t>(h >> 56);
+	}
+};
+
+static_assert(sizeof(binary_pmemobj_compare) == sizeof(pmemobj_compare),
+	      "wrong binary_pmemobj_compare size");
+
 } /* namespace internal */
 } /* namespace kv */
 } /* namespace pmem */
@@ -0,0 +1,74 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "defrag_scheduler.h"
+#include "out.h"
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+defrag_scheduler::defrag_scheduler(step_function step,
+				   fragmentation_function fragmentation,
+				   std::chrono::milliseconds interval,
+				   double step_percent, bool on_idle,
+				   double fragmentation_percent)
+    : step(std::move(step)),
+      fragmentation(std::move(fragmentation)),
+      interval(interval),
+      step_percent(step_percent),
+      on_idle(on_idle),
+      fragmentation_percent(fragmentation_percent)
+{
+	thread = std::thread(&defrag_scheduler::run, this);
+}
+
+defrag_scheduler::~defrag_scheduler()
+{
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		stopped = true;
+	}
+	cv.notify_one();
+
+	thread.join();
+}
+
+void defrag_scheduler::run()
+{
+	/* set when an idle pass reached the end, reset by any activity */
+	bool idle_pass_done = false;
+
+	std::unique_lock<std::mutex> lock(mtx);
+	while (!cv.wait_for(lock, interval, [&] { return stopped; })) {
+		lock.unlock();
+
+		bool idle = !active.exchange(false, std::memory_order_relaxed);
+		if (!idle)
+			idle_pass_done = false;
+
+		bool fragmented = fragmentation_percent > 0 &&
+			fragmentation() >= fragmentation_percent;
+
+		if ((on_idle && idle && !idle_pass_done) || fragmented) {
+			bool finished = false;
+			auto s = step(step_percent, finished);
+			if (s != status::OK)
+				ERR() << "background defrag failed with status " << s;
+			else
+				n_steps.fetch_add(1, std::memory_order_relaxed);
+
+			if (finished && idle)
+				idle_pass_done = true;
+		}
+
+		lock.lock();
+	}
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
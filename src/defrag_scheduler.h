@@ -0,0 +1,92 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_DEFRAG_SCHEDULER_H
+#define LIBPMEMKV_DEFRAG_SCHEDULER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "libpmemkv.hpp"
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/*
+ * Runs defrag in a background thread, in small steps. Every 'interval' it checks
+ * whether the engine was idle since the previous check (no notify_activity() call)
+ * or fragmentation of the pool reached 'fragmentation_percent', and if so, it
+ * defragments the next 'step_percent' percent of elements. Steps continue where
+ * the previous one ended and wrap around at the end of the database. A pass over
+ * the whole database triggered by idleness is not repeated until the engine is
+ * used again. At most one step is done per interval, which bounds the time the
+ * engine is blocked by defrag.
+ *
+ * The step function must be safe to call concurrently with all other engine
+ * operations.
+ */
+class defrag_scheduler {
+public:
+	/*
+	 * Defragments the given percent of elements following the ones defragmented
+	 * by the previous call, sets 'finished' if it reached the end.
+	 */
+	using step_function = std::function<status(double, bool &)>;
+	/* returns fragmentation of the pool, in percent */
+	using fragmentation_function = std::function<double()>;
+
+	defrag_scheduler(step_function step, fragmentation_function fragmentation,
+			 std::chrono::milliseconds interval, double step_percent,
+			 bool on_idle, double fragmentation_percent);
+	~defrag_scheduler();
+
+	defrag_scheduler(const defrag_scheduler &) = delete;
+	defrag_scheduler &operator=(const defrag_scheduler &) = delete;
+
+	/* Marks the engine as busy, cheap enough to be called by every operation. */
+	void notify_activity() noexcept
+	{
+		if (!active.load(std::memory_order_relaxed))
+			active.store(true, std::memory_order_relaxed);
+	}
+
+	/* number of steps done so far */
+	std::uint64_t steps() const noexcept
+	{
+		return n_steps.load(std::memory_order_relaxed);
+	}
+
+private:
+	void run();
+
+	step_function step;
+	fragmentation_function fragmentation;
+	std::chrono::milliseconds interval;
+	double step_percent;
+	bool on_idle;
+	/* 0 disables the trigger */
+	double fragmentation_percent;
+
+	std::atomic<bool> active{false};
+	std::atomic<std::uint64_t> n_steps{0};
+
+	std::mutex mtx;
+	std::condition_variable cv;
+	bool stopped = false;
+	std::thread thread;
+};
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_DEFRAG_SCHEDULER_H */
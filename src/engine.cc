@@ -47,11 +47,15 @@ namespace kv
 {
 
 engine_base::engine_base()
+    : iterators(std::make_shared<internal::iterator_cache>()),
+      const_iterators(std::make_shared<internal::iterator_cache>())
 {
 }
 
 engine_base::~engine_base()
 {
+	/* no-op if the database was closed with pmemkv_close */
+	drain_iterators();
 }
 
 static constexpr const char *available_engines = "blackhole"
@@ -84,6 +88,73 @@ static constexpr const char *available_engines = "blackhole"
 #endif
 	;
 
+#if defined(ENGINE_CSMAP) || defined(ENGINE_STREE)
+/*
+ * Creates a sorted engine with comparisons inlined if the binary (default)
+ * comparator is configured, so that only user's comparators are called
+ * through a function pointer.
+ */
+template <template <typename> class Engine, typename... Args>
+static std::unique_ptr<engine_base>
+create_sorted_engine(std::unique_ptr<internal::config> cfg, Args &&... args)
+{
+	if (internal::is_binary_comparator(internal::extract_comparator(*cfg)))
+		return std::unique_ptr<engine_base>(
+			new Engine<internal::binary_pmemobj_compare>(
+				std::move(cfg), std::forward<Args>(args)...));
+
+	return std::unique_ptr<engine_base>(new Engine<internal::pmemobj_compare>(
+		std::move(cfg), std::forward<Args>(args)...));
+}
+#endif
+
+#ifdef ENGINE_STREE
+/* Creates stree instantiated for the degree of the tree in the pool. */
+template <bool Hybrid>
+static std::unique_ptr<engine_base> create_stree(std::unique_ptr<internal::config> cfg)
+{
+	internal::pmemobj_pool pool;
+	switch (internal::stree::pool_degree(*cfg, Hybrid, pool)) {
+		case 16:
+			return create_sorted_engine<
+				stree_variant<Hybrid, 16>::template type>(
+				std::move(cfg), std::move(pool));
+		case 64:
+			return create_sorted_engine<
+				stree_variant<Hybrid, 64>::template type>(
+				std::move(cfg), std::move(pool));
+		default:
+			return create_sorted_engine<
+				stree_variant<Hybrid, 32>::template type>(
+				std::move(cfg), std::move(pool));
+	}
+}
+#endif
+
+#ifdef ENGINE_TREE3
+/* Creates tree3 instantiated for the node sizes of the tree in the pool. */
+template <std::size_t InnerKeys>
+static std::unique_ptr<engine_base> create_tree3(std::unique_ptr<internal::config> cfg,
+						 std::size_t leaf_keys,
+						 internal::pmemobj_pool pool)
+{
+	switch (leaf_keys) {
+		case 16:
+			return std::unique_ptr<engine_base>(
+				new basic_tree3<16, InnerKeys>(std::move(cfg),
+							       std::move(pool)));
+		case 64:
+			return std::unique_ptr<engine_base>(
+				new basic_tree3<64, InnerKeys>(std::move(cfg),
+							       std::move(pool)));
+		default:
+			return std::unique_ptr<engine_base>(
+				new basic_tree3<48, InnerKeys>(std::move(cfg),
+							       std::move(pool)));
+	}
+}
+#endif
+
 /* throws internal error (status) if config is null */
 void engine_base::check_config_null(const std::string &engine_name,
 				    std::unique_ptr<internal::config> &cfg)
@@ -112,7 +183,7 @@ engine_base::create_engine(const std::string &engine,
 #ifdef ENGINE_CSMAP
 	if (engine == "csmap") {
 		engine_base::check_config_null(engine, cfg);
-		return std::unique_ptr<engine_base>(new pmem::kv::csmap(std::move(cfg)));
+		return create_sorted_engine<pmem::kv::csmap>(std::move(cfg));
 	}
 #endif
 
@@ -140,14 +211,26 @@ engine_base::create_engine(const std::string &engine,
 #ifdef ENGINE_TREE3
 	if (engine == "tree3") {
 		engine_base::check_config_null(engine, cfg);
-		return std::unique_ptr<engine_base>(new pmem::kv::tree3(std::move(cfg)));
+
+		internal::pmemobj_pool pool;
+		auto sizes = internal::tree3::pool_node_sizes(*cfg, pool);
+		if (sizes.second == 16)
+			return create_tree3<16>(std::move(cfg), sizes.first,
+						std::move(pool));
+
+		return create_tree3<4>(std::move(cfg), sizes.first, std::move(pool));
 	}
 #endif
 
 #ifdef ENGINE_STREE
 	if (engine == "stree") {
 		engine_base::check_config_null(engine, cfg);
-		return std::unique_ptr<engine_base>(new pmem::kv::stree(std::move(cfg)));
+
+		uint64_t hybrid;
+		if (cfg->get_uint64("hybrid", &hybrid) && hybrid != 0)
+			return create_stree<true>(std::move(cfg));
+
+		return create_stree<false>(std::move(cfg));
 	}
 #endif
 
@@ -241,6 +324,11 @@ status engine_base::defrag(double start_percent, double amount_percent)
 	return status::NOT_SUPPORTED;
 }
 
+status engine_base::bulk_load(bulk_load_callback *callback, void *arg)
+{
+	return status::NOT_SUPPORTED;
+}
+
 internal::transaction *engine_base::begin_tx()
 {
 	throw internal::not_supported("Transactions are not supported in this engine");
@@ -256,5 +344,81 @@ engine_base::iterator *engine_base::new_const_iterator()
 	throw internal::not_supported("Iterators are not supported in this engine");
 }
 
+/*
+ * Returns a write iterator, reusing one released earlier (see
+ * pmemkv_write_iterator_delete) if possible. Iterators obtained this way
+ * are handed back to the engine on delete instead of being destroyed.
+ */
+engine_base::iterator *engine_base::acquire_iterator()
+{
+	auto it = iterators->acquire();
+	if (!it) {
+		it = new_iterator();
+		it->owner = iterators;
+	}
+
+	return it;
+}
+
+/*
+ * Returns a read iterator, reusing one released earlier (see
+ * pmemkv_iterator_delete) if possible.
+ */
+engine_base::iterator *engine_base::acquire_const_iterator()
+{
+	auto it = const_iterators->acquire();
+	if (!it) {
+		it = new_const_iterator();
+		it->owner = const_iterators;
+	}
+
+	return it;
+}
+
+void engine_base::drain_iterators()
+{
+	iterators->drain();
+	const_iterators->drain();
+}
+
+void engine_base::get_gauges(internal::stats::metrics_type &gauges)
+{
+}
+
+status engine_base::memory_usage(pmemkv_memory_usage &usage)
+{
+	return status::NOT_SUPPORTED;
+}
+
+/*
+ * Records duration of a phase of opening the database, reported along with the
+ * runtime statistics as "open.<phase>_ns". Phases are recorded only while the
+ * database is being opened, so no synchronization is needed.
+ */
+void engine_base::add_open_phase(const std::string &phase, std::uint64_t ns)
+{
+	open_times.emplace_back(phase, ns);
+}
+
+/*
+ * Starts collecting runtime statistics (see pmemkv_stats_get). It's called
+ * once, right after the engine is created, so no operation is in flight.
+ */
+void engine_base::enable_stats()
+{
+	if (!statistics)
+		statistics.reset(new internal::stats());
+}
+
+/*
+ * Starts tracing API calls into per-thread rings (see pmemkv_trace_dump)
+ * and/or a capture file. Like enable_stats(), called right after open.
+ */
+void engine_base::enable_trace(const internal::trace_options &options)
+{
+	if (!tracing)
+		tracing.reset(new internal::trace(options));
+}
+
 } // namespace kv
 } // namespace pmem
@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2019-2020, Intel Corporation */
+/* Copyright 2019-2021, Intel Corporation */
 
 #ifndef LIBPMEMKV_ENGINE_H
 #define LIBPMEMKV_ENGINE_H
@@ -11,6 +11,8 @@
 #include "config.h"
 #include "iterator.h"
 #include "libpmemkv.hpp"
+#include "stats.h"
+#include "trace.h"
 #include "transaction.h"
 
 namespace pmem
@@ -55,15 +57,64 @@ public:
 	virtual status put(string_view key, string_view value) = 0;
 	virtual status remove(string_view key) = 0;
 	virtual status defrag(double start_percent, double amount_percent);
+	virtual status bulk_load(bulk_load_callback *callback, void *arg);
+
+	virtual status memory_usage(pmemkv_memory_usage &usage);
 
 	virtual internal::transaction *begin_tx();
 
 	virtual iterator *new_iterator();
 	virtual iterator *new_const_iterator();
 
+	iterator *acquire_iterator();
+	iterator *acquire_const_iterator();
+
+	/*
+	 * Destroys iterators parked for reuse. Called when the database is closed,
+	 * before the derived engine releases its state.
+	 */
+	void drain_iterators();
+
+	/* Engine specific gauges, reported along with the runtime statistics. */
+	virtual void get_gauges(internal::stats::metrics_type &gauges);
+
+	void enable_stats();
+	void enable_trace(const internal::trace_options &options);
+
+	/* Returns nullptr if runtime statistics are disabled. */
+	internal::stats *stats() noexcept
+	{
+		return statistics.get();
+	}
+
+	/* Returns nullptr if trace is disabled. */
+	internal::trace *tracer() noexcept
+	{
+		return tracing.get();
+	}
+
+	/*
+	 * Durations (in ns) of phases of opening the database, like opening the
+	 * pool or rebuilding engine's volatile state, in order of recording.
+	 */
+	const internal::stats::metrics_type &open_phases() const noexcept
+	{
+		return open_times;
+	}
+
+	void add_open_phase(const std::string &phase, std::uint64_t ns);
+
 private:
 	static void check_config_null(const std::string &engine_name,
 				      std::unique_ptr<internal::config> &cfg);
+
+	std::shared_ptr<internal::iterator_cache> iterators;
+	std::shared_ptr<internal::iterator_cache> const_iterators;
+
+	std::unique_ptr<internal::stats> statistics;
+	std::unique_ptr<internal::trace> tracing;
+
+	internal::stats::metrics_type open_times;
 };
 
 } /* namespace kv */
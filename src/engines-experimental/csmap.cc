@@ -1,32 +1,42 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2020, Intel Corporation */
+/* Copyright 2020-2021, Intel Corporation */
 
 #include "csmap.h"
 #include "../out.h"
 
+#include <chrono>
+#include <cmath>
+
 namespace pmem
 {
 namespace kv
 {
 
-csmap::csmap(std::unique_ptr<internal::config> cfg)
-    : pmemobj_engine_base(cfg, "pmemkv_csmap"), config(std::move(cfg))
+template <typename Compare>
+csmap<Compare>::csmap(std::unique_ptr<internal::config> cfg)
+    : pmemobj_engine_base<pmem_type>(cfg, "pmemkv_csmap"), config(std::move(cfg))
 {
+	internal::stopwatch recover_time;
 	Recover();
+	this->add_open_phase("recover", recover_time.lap());
+	start_defrag_scheduler();
 	LOG("Started ok");
 }
 
-csmap::~csmap()
+template <typename Compare>
+csmap<Compare>::~csmap()
 {
 	LOG("Stopped ok");
 }
 
-std::string csmap::name()
+template <typename Compare>
+std::string csmap<Compare>::name()
 {
 	return "csmap";
 }
 
-status csmap::count_all(std::size_t &cnt)
+template <typename Compare>
+status csmap<Compare>::count_all(std::size_t &cnt)
 {
 	LOG("count_all");
 	check_outside_tx();
@@ -44,12 +54,13 @@ static std::size_t size(It first, It last)
 	return static_cast<std::size_t>(dist);
 }
 
-status csmap::count_above(string_view key, std::size_t &cnt)
+template <typename Compare>
+status csmap<Compare>::count_above(string_view key, std::size_t &cnt)
 {
 	LOG("count_above for key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
 
-	shared_global_lock_type lock(mtx);
+	auto lock = lock_shared();
 
 	auto first = container->upper_bound(key);
 	auto last = container->end();
@@ -59,12 +70,13 @@ status csmap::count_above(string_view key, std::size_t &cnt)
 	return status::OK;
 }
 
-status csmap::count_equal_above(string_view key, std::size_t &cnt)
+template <typename Compare>
+status csmap<Compare>::count_equal_above(string_view key, std::size_t &cnt)
 {
 	LOG("count_equal_above for key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
 
-	shared_global_lock_type lock(mtx);
+	auto lock = lock_shared();
 
 	auto first = container->lower_bound(key);
 	auto last = container->end();
@@ -74,12 +86,13 @@ status csmap::count_equal_above(string_view key, std::size_t &cnt)
 	return status::OK;
 }
 
-status csmap::count_equal_below(string_view key, std::size_t &cnt)
+template <typename Compare>
+status csmap<Compare>::count_equal_below(string_view key, std::size_t &cnt)
 {
 	LOG("count_equal_below for key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
 
-	shared_global_lock_type lock(mtx);
+	auto lock = lock_shared();
 
 	auto first = container->begin();
 	auto last = container->upper_bound(key);
@@ -89,12 +102,13 @@ status csmap::count_equal_below(string_view key, std::size_t &cnt)
 	return status::OK;
 }
 
-status csmap::count_below(string_view key, std::size_t &cnt)
+template <typename Compare>
+status csmap<Compare>::count_below(string_view key, std::size_t &cnt)
 {
 	LOG("count_below for key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
 
-	shared_global_lock_type lock(mtx);
+	auto lock = lock_shared();
 
 	auto first = container->begin();
 	auto last = container->lower_bound(key);
@@ -104,13 +118,15 @@ status csmap::count_below(string_view key, std::size_t &cnt)
 	return status::OK;
 }
 
-status csmap::count_between(string_view key1, string_view key2, std::size_t &cnt)
+template <typename Compare>
+status csmap<Compare>::count_between(string_view key1, string_view key2,
+				      std::size_t &cnt)
 {
 	LOG("count_between for key1=" << key1.data() << ", key2=" << key2.data());
 	check_outside_tx();
 
 	if (container->key_comp()(key1, key2)) {
-		shared_global_lock_type lock(mtx);
+		auto lock = lock_shared();
 
 		auto first = container->upper_bound(key1);
 		auto last = container->lower_bound(key2);
@@ -123,9 +139,10 @@ status csmap::count_between(string_view key1, string_view key2, std::size_t &cnt
 	return status::OK;
 }
 
-status csmap::iterate(typename container_type::iterator first,
-		      typename container_type::iterator last, get_kv_callback *callback,
-		      void *arg)
+template <typename Compare>
+status csmap<Compare>::iterate(typename container_type::iterator first,
+				typename container_type::iterator last,
+				get_kv_callback *callback, void *arg)
 {
 	for (auto it = first; it != last; ++it) {
 		shared_node_lock_type lock(it->second.mtx);
@@ -140,12 +157,13 @@ status csmap::iterate(typename container_type::iterator first,
 	return status::OK;
 }
 
-status csmap::get_all(get_kv_callback *callback, void *arg)
+template <typename Compare>
+status csmap<Compare>::get_all(get_kv_callback *callback, void *arg)
 {
 	LOG("get_all");
 	check_outside_tx();
 
-	shared_global_lock_type lock(mtx);
+	auto lock = lock_shared();
 
 	auto first = container->begin();
 	auto last = container->end();
@@ -153,12 +171,13 @@ status csmap::get_all(get_kv_callback *callback, void *arg)
 	return iterate(first, last, callback, arg);
 }
 
-status csmap::get_above(string_view key, get_kv_callback *callback, void *arg)
+template <typename Compare>
+status csmap<Compare>::get_above(string_view key, get_kv_callback *callback, void *arg)
 {
 	LOG("get_above for key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
 
-	shared_global_lock_type lock(mtx);
+	auto lock = lock_shared();
 
 	auto first = container->upper_bound(key);
 	auto last = container->end();
@@ -166,12 +185,14 @@ status csmap::get_above(string_view key, get_kv_callback *callback, void *arg)
 	return iterate(first, last, callback, arg);
 }
 
-status csmap::get_equal_above(string_view key, get_kv_callback *callback, void *arg)
+template <typename Compare>
+status csmap<Compare>::get_equal_above(string_view key, get_kv_callback *callback,
+					void *arg)
 {
 	LOG("get_equal_above for key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
 
-	shared_global_lock_type lock(mtx);
+	auto lock = lock_shared();
 
 	auto first = container->lower_bound(key);
 	auto last = container->end();
@@ -179,12 +200,14 @@ status csmap::get_equal_above(string_view key, get_kv_callback *callback, void *
 	return iterate(first, last, callback, arg);
 }
 
-status csmap::get_equal_below(string_view key, get_kv_callback *callback, void *arg)
+template <typename Compare>
+status csmap<Compare>::get_equal_below(string_view key, get_kv_callback *callback,
+					void *arg)
 {
 	LOG("get_equal_below for key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
 
-	shared_global_lock_type lock(mtx);
+	auto lock = lock_shared();
 
 	auto first = container->begin();
 	auto last = container->upper_bound(key);
@@ -192,12 +215,13 @@ status csmap::get_equal_below(string_view key, get_kv_callback *callback, void *
 	return iterate(first, last, callback, arg);
 }
 
-status csmap::get_below(string_view key, get_kv_callback *callback, void *arg)
+template <typename Compare>
+status csmap<Compare>::get_below(string_view key, get_kv_callback *callback, void *arg)
 {
 	LOG("get_below for key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
 
-	shared_global_lock_type lock(mtx);
+	auto lock = lock_shared();
 
 	auto first = container->begin();
 	auto last = container->lower_bound(key);
@@ -205,14 +229,15 @@ status csmap::get_below(string_view key, get_kv_callback *callback, void *arg)
 	return iterate(first, last, callback, arg);
 }
 
-status csmap::get_between(string_view key1, string_view key2, get_kv_callback *callback,
-			  void *arg)
+template <typename Compare>
+status csmap<Compare>::get_between(string_view key1, string_view key2,
+				    get_kv_callback *callback, void *arg)
 {
 	LOG("get_between for key1=" << key1.data() << ", key2=" << key2.data());
 	check_outside_tx();
 
 	if (container->key_comp()(key1, key2)) {
-		shared_global_lock_type lock(mtx);
+		auto lock = lock_shared();
 
 		auto first = container->upper_bound(key1);
 		auto last = container->lower_bound(key2);
@@ -222,21 +247,23 @@ status csmap::get_between(string_view key1, string_view key2, get_kv_callback *c
 	return status::OK;
 }
 
-status csmap::exists(string_view key)
+template <typename Compare>
+status csmap<Compare>::exists(string_view key)
 {
 	LOG("exists for key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
 
-	shared_global_lock_type lock(mtx);
+	auto lock = lock_shared();
 	return container->contains(key) ? status::OK : status::NOT_FOUND;
 }
 
-status csmap::get(string_view key, get_v_callback *callback, void *arg)
+template <typename Compare>
+status csmap<Compare>::get(string_view key, get_v_callback *callback, void *arg)
 {
 	LOG("get key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
 
-	shared_global_lock_type lock(mtx);
+	auto lock = lock_shared();
 	auto it = container->find(key);
 	if (it != container->end()) {
 		shared_node_lock_type lock(it->second.mtx);
@@ -248,20 +275,21 @@ status csmap::get(string_view key, get_v_callback *callback, void *arg)
 	return status::NOT_FOUND;
 }
 
-status csmap::put(string_view key, string_view value)
+template <typename Compare>
+status csmap<Compare>::put(string_view key, string_view value)
 {
 	LOG("put key=" << std::string(key.data(), key.size())
 		       << ", value.size=" << std::to_string(value.size()));
 	check_outside_tx();
 
-	shared_global_lock_type lock(mtx);
+	auto lock = lock_shared();
 
 	auto result = container->try_emplace(key, value);
 
 	if (result.second == false) {
 		auto &it = result.first;
 		unique_node_lock_type lock(it->second.mtx);
-		pmem::obj::transaction::run(pmpool, [&] {
+		pmem::obj::transaction::run(this->pmpool, [&] {
 			it->second.val.assign(value.data(), value.size());
 		});
 	}
@@ -269,32 +297,214 @@ status csmap::put(string_view key, string_view value)
 	return status::OK;
 }
 
-status csmap::remove(string_view key)
+template <typename Compare>
+status csmap<Compare>::remove(string_view key)
 {
 	LOG("remove key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
-	unique_global_lock_type lock(mtx);
+	auto lock = lock_unique();
 	return container->unsafe_erase(key) > 0 ? status::OK : status::NOT_FOUND;
 }
 
-void csmap::Recover()
+template <typename Compare>
+status csmap<Compare>::defrag(double start_percent, double amount_percent)
+{
+	LOG("defrag: start_percent = " << start_percent
+				       << " amount_percent = " << amount_percent);
+	check_outside_tx();
+
+	try {
+		/* defrag relocates objects, no other thread may access them */
+		auto lock = lock_unique();
+
+		auto range = this->defrag_range(container->size(), start_percent,
+						amount_percent);
+
+		pmem::obj::defrag my_defrag(this->pmpool);
+
+		auto it = container->begin();
+		std::advance(it, range.first);
+		for (auto i = range.first; i < range.second; ++i, ++it) {
+			/* only the string's buffer is relocated, the key object
+			 * itself stays in place, so the map's ordering is intact */
+			my_defrag.add(const_cast<internal::csmap::key_type &>(it->first));
+			my_defrag.add(it->second.val);
+		}
+
+		my_defrag.run();
+	} catch (std::range_error &e) {
+		out_err_stream("defrag") << e.what();
+		return status::INVALID_ARGUMENT;
+	} catch (pmem::defrag_error &e) {
+		out_err_stream("defrag") << e.what();
+		return status::DEFRAG_ERROR;
+	}
+
+	return status::OK;
+}
+
+template <typename Compare>
+void csmap<Compare>::get_gauges(internal::stats::metrics_type &gauges)
+{
+	gauges.emplace_back("size", container->size());
+	gauges.emplace_back("global_lock.shared_waits", shared_waits.load());
+	gauges.emplace_back("global_lock.shared_wait_ns", shared_wait_ns.load());
+	gauges.emplace_back("global_lock.exclusive_waits", exclusive_waits.load());
+	gauges.emplace_back("global_lock.exclusive_wait_ns", exclusive_wait_ns.load());
+	if (scheduler)
+		gauges.emplace_back("defrag.steps", scheduler->steps());
+}
+
+/*
+ * Takes 'lock', if it is not immediately available, counts the time spent
+ * waiting for it in 'waits' and 'wait_ns'.
+ */
+template <typename Lock>
+static void lock_measured(Lock &lock, std::atomic<std::uint64_t> &waits,
+			  std::atomic<std::uint64_t> &wait_ns)
+{
+	if (lock.try_lock())
+		return;
+
+	auto start = std::chrono::steady_clock::now();
+	lock.lock();
+	auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - start);
+
+	waits.fetch_add(1, std::memory_order_relaxed);
+	wait_ns.fetch_add(static_cast<std::uint64_t>(ns.count()),
+			  std::memory_order_relaxed);
+}
+
+template <typename Compare>
+typename csmap<Compare>::shared_global_lock_type csmap<Compare>::lock_shared()
+{
+	if (scheduler)
+		scheduler->notify_activity();
+
+	shared_global_lock_type lock(mtx, std::defer_lock);
+	lock_measured(lock, shared_waits, shared_wait_ns);
+
+	return lock;
+}
+
+template <typename Compare>
+typename csmap<Compare>::unique_global_lock_type csmap<Compare>::lock_unique()
+{
+	if (scheduler)
+		scheduler->notify_activity();
+
+	unique_global_lock_type lock(mtx, std::defer_lock);
+	lock_measured(lock, exclusive_waits, exclusive_wait_ns);
+
+	return lock;
+}
+
+/*
+ * Defragments the next 'amount_percent' percent of elements, starting after the
+ * one defragmented last by the previous step (used by the background scheduler).
+ * The position is kept as a key, so a step finds it in O(log n) instead of
+ * walking from the beginning, and it stays valid when that element is removed.
+ */
+template <typename Compare>
+status csmap<Compare>::defrag_step(double amount_percent, bool &finished)
+{
+	try {
+		/* not lock_unique(), defrag is not an activity of the user */
+		unique_global_lock_type lock(mtx);
+
+		auto n = static_cast<std::size_t>(std::ceil(
+			static_cast<double>(container->size()) * amount_percent / 100));
+
+		auto it = has_defrag_cursor
+			? container->upper_bound(string_view(defrag_cursor))
+			: container->begin();
+
+		pmem::obj::defrag my_defrag(this->pmpool);
+		for (std::size_t i = 0; i < n && it != container->end(); ++i, ++it) {
+			my_defrag.add(const_cast<internal::csmap::key_type &>(it->first));
+			my_defrag.add(it->second.val);
+			defrag_cursor.assign(it->first.c_str(), it->first.size());
+			has_defrag_cursor = true;
+		}
+
+		finished = it == container->end();
+		if (finished)
+			has_defrag_cursor = false;
+
+		my_defrag.run();
+	} catch (pmem::defrag_error &e) {
+		out_err_stream("defrag") << e.what();
+		return status::DEFRAG_ERROR;
+	}
+
+	return status::OK;
+}
+
+/*
+ * Starts background defragmentation if "defrag_interval_ms" is set in the
+ * config. Steps are done when the engine is idle ("defrag_on_idle", default 1)
+ * or fragmentation of the pool reaches "defrag_fragmentation_percent" (default
+ * 0 - disabled); "defrag_step_percent" (default 10) limits the work per step.
+ */
+template <typename Compare>
+void csmap<Compare>::start_defrag_scheduler()
 {
-	if (!OID_IS_NULL(*root_oid)) {
-		auto pmem_ptr = static_cast<internal::csmap::pmem_type *>(
-			pmemobj_direct(*root_oid));
+	uint64_t interval_ms;
+	if (!config->get_uint64("defrag_interval_ms", &interval_ms) || interval_ms == 0)
+		return;
+
+	uint64_t step_percent;
+	if (!config->get_uint64("defrag_step_percent", &step_percent))
+		step_percent = 10;
+
+	if (step_percent == 0 || step_percent > 100)
+		throw internal::invalid_argument(
+			"Config item \"defrag_step_percent\" must be in range [1, 100]");
+
+	uint64_t on_idle;
+	if (!config->get_uint64("defrag_on_idle", &on_idle))
+		on_idle = 1;
+
+	uint64_t fragmentation_percent;
+	if (!config->get_uint64("defrag_fragmentation_percent", &fragmentation_percent))
+		fragmentation_percent = 0;
+
+	if (fragmentation_percent > 100)
+		throw internal::invalid_argument(
+			"Config item \"defrag_fragmentation_percent\" must be in "
+			"range [0, 100]");
+
+	if (fragmentation_percent > 0)
+		this->enable_heap_stats();
+
+	scheduler = std::unique_ptr<internal::defrag_scheduler>(
+		new internal::defrag_scheduler(
+			[this](double amount, bool &finished) {
+				return defrag_step(amount, finished);
+			},
+			[this] { return this->fragmentation_percent(); },
+			std::chrono::milliseconds(interval_ms),
+			static_cast<double>(step_percent), on_idle != 0,
+			static_cast<double>(fragmentation_percent)));
+}
+
+template <typename Compare>
+void csmap<Compare>::Recover()
+{
+	if (!OID_IS_NULL(*this->root_oid)) {
+		auto pmem_ptr = static_cast<pmem_type *>(pmemobj_direct(*this->root_oid));
 
 		container = &pmem_ptr->map;
 		container->runtime_initialize();
 		container->key_comp().runtime_initialize(
 			internal::extract_comparator(*config));
 	} else {
-		pmem::obj::transaction::run(pmpool, [&] {
-			pmem::obj::transaction::snapshot(root_oid);
-			*root_oid =
-				pmem::obj::make_persistent<internal::csmap::pmem_type>()
-					.raw();
-			auto pmem_ptr = static_cast<internal::csmap::pmem_type *>(
-				pmemobj_direct(*root_oid));
+		pmem::obj::transaction::run(this->pmpool, [&] {
+			pmem::obj::transaction::snapshot(this->root_oid);
+			*this->root_oid = pmem::obj::make_persistent<pmem_type>().raw();
+			auto pmem_ptr =
+				static_cast<pmem_type *>(pmemobj_direct(*this->root_oid));
 			container = &pmem_ptr->map;
 			container->runtime_initialize();
 			container->key_comp().initialize(
@@ -303,27 +513,34 @@ void csmap::Recover()
 	}
 }
 
-internal::iterator_base *csmap::new_iterator()
+template <typename Compare>
+internal::iterator_base *csmap<Compare>::new_iterator()
 {
-	return new csmap_iterator<false>{container, mtx};
+	return new csmap_iterator<Compare, false>{container, mtx};
 }
 
-internal::iterator_base *csmap::new_const_iterator()
+template <typename Compare>
+internal::iterator_base *csmap<Compare>::new_const_iterator()
 {
-	return new csmap_iterator<true>{container, mtx};
+	return new csmap_iterator<Compare, true>{container, mtx};
 }
 
-csmap::csmap_iterator<true>::csmap_iterator(container_type *c, global_mutex_type &mtx)
+template <typename Compare>
+csmap_iterator<Compare, true>::csmap_iterator(container_type *c,
+					      internal::csmap::global_mutex_type &mtx)
     : container(c), lock(mtx), pop(pmem::obj::pool_by_vptr(c))
 {
 }
 
-csmap::csmap_iterator<false>::csmap_iterator(container_type *c, global_mutex_type &mtx)
-    : csmap::csmap_iterator<true>(c, mtx)
+template <typename Compare>
+csmap_iterator<Compare, false>::csmap_iterator(container_type *c,
+					       internal::csmap::global_mutex_type &mtx)
+    : csmap_iterator<Compare, true>(c, mtx)
 {
 }
 
-status csmap::csmap_iterator<true>::seek(string_view key)
+template <typename Compare>
+status csmap_iterator<Compare, true>::seek(string_view key)
 {
 	init_seek();
 
@@ -332,12 +549,13 @@ status csmap::csmap_iterator<true>::seek(string_view key)
 		return status::NOT_FOUND;
 	}
 
-	node_lock = csmap::unique_node_lock_type(it_->second.mtx);
+	node_lock = internal::csmap::unique_node_lock_type(it_->second.mtx);
 
 	return status::OK;
 }
 
-status csmap::csmap_iterator<true>::seek_lower(string_view key)
+template <typename Compare>
+status csmap_iterator<Compare, true>::seek_lower(string_view key)
 {
 	init_seek();
 
@@ -345,12 +563,13 @@ status csmap::csmap_iterator<true>::seek_lower(string_view key)
 	if (it_ == container->end())
 		return status::NOT_FOUND;
 
-	node_lock = csmap::unique_node_lock_type(it_->second.mtx);
+	node_lock = internal::csmap::unique_node_lock_type(it_->second.mtx);
 
 	return status::OK;
 }
 
-status csmap::csmap_iterator<true>::seek_lower_eq(string_view key)
+template <typename Compare>
+status csmap_iterator<Compare, true>::seek_lower_eq(string_view key)
 {
 	init_seek();
 
@@ -358,12 +577,13 @@ status csmap::csmap_iterator<true>::seek_lower_eq(string_view key)
 	if (it_ == container->end())
 		return status::NOT_FOUND;
 
-	node_lock = csmap::unique_node_lock_type(it_->second.mtx);
+	node_lock = internal::csmap::unique_node_lock_type(it_->second.mtx);
 
 	return status::OK;
 }
 
-status csmap::csmap_iterator<true>::seek_higher(string_view key)
+template <typename Compare>
+status csmap_iterator<Compare, true>::seek_higher(string_view key)
 {
 	init_seek();
 
@@ -371,12 +591,13 @@ status csmap::csmap_iterator<true>::seek_higher(string_view key)
 	if (it_ == container->end())
 		return status::NOT_FOUND;
 
-	node_lock = csmap::unique_node_lock_type(it_->second.mtx);
+	node_lock = internal::csmap::unique_node_lock_type(it_->second.mtx);
 
 	return status::OK;
 }
 
-status csmap::csmap_iterator<true>::seek_higher_eq(string_view key)
+template <typename Compare>
+status csmap_iterator<Compare, true>::seek_higher_eq(string_view key)
 {
 	init_seek();
 
@@ -384,12 +605,13 @@ status csmap::csmap_iterator<true>::seek_higher_eq(string_view key)
 	if (it_ == container->end())
 		return status::NOT_FOUND;
 
-	node_lock = csmap::unique_node_lock_type(it_->second.mtx);
+	node_lock = internal::csmap::unique_node_lock_type(it_->second.mtx);
 
 	return status::OK;
 }
 
-status csmap::csmap_iterator<true>::seek_to_first()
+template <typename Compare>
+status csmap_iterator<Compare, true>::seek_to_first()
 {
 	init_seek();
 
@@ -398,12 +620,13 @@ status csmap::csmap_iterator<true>::seek_to_first()
 
 	it_ = container->begin();
 
-	node_lock = csmap::unique_node_lock_type(it_->second.mtx);
+	node_lock = internal::csmap::unique_node_lock_type(it_->second.mtx);
 
 	return status::OK;
 }
 
-status csmap::csmap_iterator<true>::is_next()
+template <typename Compare>
+status csmap_iterator<Compare, true>::is_next()
 {
 	auto tmp = it_;
 	if (tmp == container->end() || ++tmp == container->end())
@@ -412,27 +635,30 @@ status csmap::csmap_iterator<true>::is_next()
 	return status::OK;
 }
 
-status csmap::csmap_iterator<true>::next()
+template <typename Compare>
+status csmap_iterator<Compare, true>::next()
 {
 	init_seek();
 
 	if (it_ == container->end() || ++it_ == container->end())
 		return status::NOT_FOUND;
 
-	node_lock = csmap::unique_node_lock_type(it_->second.mtx);
+	node_lock = internal::csmap::unique_node_lock_type(it_->second.mtx);
 
 	return status::OK;
 }
 
-result<string_view> csmap::csmap_iterator<true>::key()
+template <typename Compare>
+result<string_view> csmap_iterator<Compare, true>::key()
 {
 	assert(it_ != container->end());
 
 	return {it_->first.cdata()};
 }
 
-result<pmem::obj::slice<const char *>> csmap::csmap_iterator<true>::read_range(size_t pos,
-									       size_t n)
+template <typename Compare>
+result<pmem::obj::slice<const char *>>
+csmap_iterator<Compare, true>::read_range(size_t pos, size_t n)
 {
 	assert(it_ != container->end());
 
@@ -442,25 +668,28 @@ result<pmem::obj::slice<const char *>> csmap::csmap_iterator<true>::read_range(s
 	return {it_->second.val.crange(pos, n)};
 }
 
-result<pmem::obj::slice<char *>> csmap::csmap_iterator<false>::write_range(size_t pos,
-									   size_t n)
+template <typename Compare>
+result<pmem::obj::slice<char *>>
+csmap_iterator<Compare, false>::write_range(size_t pos, size_t n)
 {
-	assert(it_ != container->end());
+	auto &it = this->it_;
+	assert(it != this->container->end());
 
-	if (pos + n > it_->second.val.size() || pos + n < pos)
-		n = it_->second.val.size() - pos;
+	if (pos + n > it->second.val.size() || pos + n < pos)
+		n = it->second.val.size() - pos;
 
-	log.push_back({{it_->second.val.cdata() + pos, n}, pos});
+	log.push_back({{it->second.val.cdata() + pos, n}, pos});
 	auto &val = log.back().first;
 
 	return {{&val[0], &val[n]}};
 }
 
-status csmap::csmap_iterator<false>::commit()
+template <typename Compare>
+status csmap_iterator<Compare, false>::commit()
 {
-	pmem::obj::transaction::run(pop, [&] {
+	pmem::obj::transaction::run(this->pop, [&] {
 		for (auto &p : log) {
-			auto dest = it_->second.val.range(p.second, p.first.size());
+			auto dest = this->it_->second.val.range(p.second, p.first.size());
 			std::copy(p.first.begin(), p.first.end(), dest.begin());
 		}
 	});
@@ -469,23 +698,45 @@ status csmap::csmap_iterator<false>::commit()
 	return status::OK;
 }
 
-void csmap::csmap_iterator<false>::abort()
+template <typename Compare>
+void csmap_iterator<Compare, false>::abort()
 {
 	log.clear();
 }
 
-void csmap::csmap_iterator<true>::init_seek()
+template <typename Compare>
+void csmap_iterator<Compare, true>::release()
+{
+	init_seek();
+
+	/* do not block remove() while the iterator is parked */
+	it_ = container->end();
+	lock.unlock();
+}
+
+template <typename Compare>
+void csmap_iterator<Compare, true>::reacquire()
+{
+	lock.lock();
+}
+
+template <typename Compare>
+void csmap_iterator<Compare, true>::init_seek()
 {
 	if (it_ != container->end())
 		node_lock.unlock();
 }
 
-void csmap::csmap_iterator<false>::init_seek()
+template <typename Compare>
+void csmap_iterator<Compare, false>::init_seek()
 {
-	csmap::csmap_iterator<true>::init_seek();
+	csmap_iterator<Compare, true>::init_seek();
 
 	log.clear();
 }
 
+template class csmap<internal::pmemobj_compare>;
+template class csmap<internal::binary_pmemobj_compare>;
+
 } // namespace kv
 } // namespace pmem
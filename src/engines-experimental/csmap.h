@@ -1,16 +1,19 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2020, Intel Corporation */
+/* Copyright 2020-2021, Intel Corporation */
 
 #pragma once
 
 #include "../comparator/pmemobj_comparator.h"
+#include "../defrag_scheduler.h"
 #include "../pmemobj_engine.h"
 
 #include <libpmemobj++/container/string.hpp>
+#include <libpmemobj++/defrag.hpp>
 #include <libpmemobj++/experimental/concurrent_map.hpp>
 #include <libpmemobj++/persistent_ptr.hpp>
 #include <libpmemobj++/shared_mutex.hpp>
 
+#include <atomic>
 #include <mutex>
 #include <shared_mutex>
 
@@ -52,28 +55,47 @@ struct mapped_type {
 
 static_assert(sizeof(mapped_type) == 96, "");
 
-using map_type = pmem::obj::experimental::concurrent_map<key_type, mapped_type,
-							 internal::pmemobj_compare>;
+template <typename Compare>
+using map_type = pmem::obj::experimental::concurrent_map<key_type, mapped_type, Compare>;
 
+template <typename Compare>
 struct pmem_type {
 	pmem_type() : map()
 	{
 		std::memset(reserved, 0, sizeof(reserved));
 	}
 
-	map_type map;
+	map_type<Compare> map;
 	uint64_t reserved[8];
 };
 
-static_assert(sizeof(pmem_type) == sizeof(map_type) + 64, "");
+static_assert(sizeof(pmem_type<pmemobj_compare>) ==
+		      sizeof(map_type<pmemobj_compare>) + 64,
+	      "");
+static_assert(sizeof(pmem_type<binary_pmemobj_compare>) ==
+		      sizeof(pmem_type<pmemobj_compare>),
+	      "");
+
+using node_mutex_type = pmem::obj::shared_mutex;
+using global_mutex_type = std::shared_timed_mutex;
+using shared_global_lock_type = std::shared_lock<global_mutex_type>;
+using unique_global_lock_type = std::unique_lock<global_mutex_type>;
+using shared_node_lock_type = std::shared_lock<node_mutex_type>;
+using unique_node_lock_type = std::unique_lock<node_mutex_type>;
 
 } /* namespace csmap */
 } /* namespace internal */
 
-class csmap : public pmemobj_engine_base<internal::csmap::pmem_type> {
-	template <bool IsConst>
-	class csmap_iterator;
+template <typename Compare, bool IsConst>
+class csmap_iterator;
 
+/**
+ * Compare is internal::binary_pmemobj_compare if the default (binary) comparator
+ * is used - comparisons are then inlined into the map - and
+ * internal::pmemobj_compare, which calls the configured comparator, otherwise.
+ */
+template <typename Compare>
+class csmap : public pmemobj_engine_base<internal::csmap::pmem_type<Compare>> {
 public:
 	csmap(std::unique_ptr<internal::config> cfg);
 	~csmap();
@@ -108,38 +130,68 @@ public:
 
 	status remove(string_view key) final;
 
+	status defrag(double start_percent, double amount_percent) final;
+
+	void get_gauges(internal::stats::metrics_type &gauges) final;
+
 	internal::iterator_base *new_iterator() final;
 	internal::iterator_base *new_const_iterator() final;
 
 private:
-	using node_mutex_type = pmem::obj::shared_mutex;
-	using global_mutex_type = std::shared_timed_mutex;
-	using shared_global_lock_type = std::shared_lock<global_mutex_type>;
-	using unique_global_lock_type = std::unique_lock<global_mutex_type>;
-	using shared_node_lock_type = std::shared_lock<node_mutex_type>;
-	using unique_node_lock_type = std::unique_lock<node_mutex_type>;
-	using container_type = internal::csmap::map_type;
+	using global_mutex_type = internal::csmap::global_mutex_type;
+	using shared_global_lock_type = internal::csmap::shared_global_lock_type;
+	using unique_global_lock_type = internal::csmap::unique_global_lock_type;
+	using shared_node_lock_type = internal::csmap::shared_node_lock_type;
+	using unique_node_lock_type = internal::csmap::unique_node_lock_type;
+	using container_type = internal::csmap::map_type<Compare>;
+	using pmem_type = internal::csmap::pmem_type<Compare>;
 
 	void Recover();
+	void start_defrag_scheduler();
+	status defrag_step(double amount_percent, bool &finished);
 	status iterate(typename container_type::iterator first,
 		       typename container_type::iterator last, get_kv_callback *callback,
 		       void *arg);
 
+	shared_global_lock_type lock_shared();
+	unique_global_lock_type lock_unique();
+
 	/*
 	 * We take read lock for thread-safe methods (like get/insert/get_all) to
 	 * synchronize with unsafe_erase() which is not thread-safe.
 	 */
 	global_mutex_type mtx;
+
+	/*
+	 * How many times and for how long (in ns) threads had to wait for 'mtx',
+	 * reported as gauges, to spot contention on the global lock.
+	 */
+	std::atomic<std::uint64_t> shared_waits{0};
+	std::atomic<std::uint64_t> shared_wait_ns{0};
+	std::atomic<std::uint64_t> exclusive_waits{0};
+	std::atomic<std::uint64_t> exclusive_wait_ns{0};
+
 	container_type *container;
 	std::unique_ptr<internal::config> config;
+
+	/*
+	 * Key of the last element defragmented by the scheduler, the next step
+	 * starts after it (or from the beginning, if there is no cursor).
+	 */
+	std::string defrag_cursor;
+	bool has_defrag_cursor = false;
+
+	/* must be destroyed (stopped) before everything it uses */
+	std::unique_ptr<internal::defrag_scheduler> scheduler;
 };
 
-template <>
-class csmap::csmap_iterator<true> : virtual public internal::iterator_base {
-	using container_type = csmap::container_type;
+template <typename Compare>
+class csmap_iterator<Compare, true> : virtual public internal::iterator_base {
+	using container_type = internal::csmap::map_type<Compare>;
 
 public:
-	csmap_iterator(container_type *container, global_mutex_type &mtx);
+	csmap_iterator(container_type *container,
+		       internal::csmap::global_mutex_type &mtx);
 
 	status seek(string_view key) final;
 	status seek_lower(string_view key) final;
@@ -156,22 +208,26 @@ public:
 
 	result<pmem::obj::slice<const char *>> read_range(size_t pos, size_t n) final;
 
+	void release() final;
+	void reacquire() final;
+
 protected:
 	container_type *container;
-	container_type::iterator it_;
-	csmap::shared_global_lock_type lock;
-	csmap::unique_node_lock_type node_lock;
+	typename container_type::iterator it_;
+	internal::csmap::shared_global_lock_type lock;
+	internal::csmap::unique_node_lock_type node_lock;
 	pmem::obj::pool_base pop;
 
 	void init_seek();
 };
 
-template <>
-class csmap::csmap_iterator<false> : public csmap::csmap_iterator<true> {
-	using container_type = csmap::container_type;
+template <typename Compare>
+class csmap_iterator<Compare, false> : public csmap_iterator<Compare, true> {
+	using container_type = internal::csmap::map_type<Compare>;
 
 public:
-	csmap_iterator(container_type *container, global_mutex_type &mtx);
+	csmap_iterator(container_type *container,
+		       internal::csmap::global_mutex_type &mtx);
 
 	result<pmem::obj::slice<char *>> write_range(size_t pos, size_t n) final;
 
@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2020, Intel Corporation */
+/* Copyright 2020-2021, Intel Corporation */
 
 #include "radix.h"
 #include "../out.h"
@@ -59,7 +59,9 @@ void transaction::abort()
 radix::radix(std::unique_ptr<internal::config> cfg)
     : pmemobj_engine_base(cfg, "pmemkv_radix"), config(std::move(cfg))
 {
+	internal::stopwatch recover_time;
 	Recover();
+	add_open_phase("recover", recover_time.lap());
 	LOG("Started ok");
 }
 
@@ -303,6 +305,115 @@ status radix::remove(string_view key)
 	return status::OK;
 }
 
+/* number of leaves reallocated in a single transaction by defrag */
+static const std::size_t DEFRAG_BATCH = 1024;
+
+status radix::defrag(double start_percent, double amount_percent)
+{
+	LOG("defrag: start_percent = " << start_percent
+				       << " amount_percent = " << amount_percent);
+	check_outside_tx();
+
+	try {
+		auto range = defrag_range(container->size(), start_percent,
+					  amount_percent);
+
+		auto it = container->begin();
+		std::advance(it, range.first);
+		auto i = range.first;
+		while (i < range.second) {
+			/*
+			 * radix_tree does not expose its node pointers to
+			 * pmem::obj::defrag, so leaves are reallocated instead:
+			 * a new one is placed in the best fitting free block,
+			 * which gets previously freed holes filled first.
+			 */
+			pmem::obj::transaction::run(pmpool, [&] {
+				for (std::size_t n = 0;
+				     n < DEFRAG_BATCH && i < range.second; ++n, ++i) {
+					auto k = string_view(it->key());
+					auto v = string_view(it->value());
+					std::string key(k.data(), k.size());
+					std::string value(v.data(), v.size());
+
+					it = container->erase(it);
+					container->try_emplace(key, value);
+				}
+			});
+		}
+	} catch (std::range_error &e) {
+		out_err_stream("defrag") << e.what();
+		return status::INVALID_ARGUMENT;
+	}
+
+	return status::OK;
+}
+
+/* number of pairs inserted in a single transaction by bulk_load */
+static const std::size_t BULK_LOAD_BATCH = 1024;
+
+/*
+ * radix_tree does not expose its nodes, so the tree cannot be built bottom-up like
+ * stree. Pairs are inserted in batches instead, each one in a single transaction,
+ * which saves the transaction overhead of separate puts.
+ */
+status radix::bulk_load(bulk_load_callback *callback, void *arg)
+{
+	LOG("bulk_load");
+	check_outside_tx();
+
+	if (container->size() != 0) {
+		out_err_stream("bulk_load") << "database is not empty";
+		return status::INVALID_ARGUMENT;
+	}
+
+	auto s = status::OK;
+	bool more = true;
+	std::string last_key;
+	try {
+		while (more && s == status::OK) {
+			pmem::obj::transaction::run(pmpool, [&] {
+				for (std::size_t i = 0; i < BULK_LOAD_BATCH; ++i) {
+					const char *k, *v;
+					std::size_t kb, vb;
+					int ret = callback(&k, &kb, &v, &vb, arg);
+					if (ret != 0) {
+						more = false;
+						if (ret < 0)
+							s = status::STOPPED_BY_CB;
+						return;
+					}
+
+					auto key = string_view(k, kb);
+					if (container->size() > 0 &&
+					    key.compare(last_key) <= 0) {
+						out_err_stream("bulk_load")
+							<< "keys are not sorted";
+						s = status::INVALID_ARGUMENT;
+						return;
+					}
+
+					container->try_emplace(key, string_view(v, vb));
+					last_key.assign(k, kb);
+				}
+			});
+		}
+	} catch (...) {
+		container->erase(container->begin(), container->end());
+		throw;
+	}
+
+	if (s != status::OK)
+		container->erase(container->begin(), container->end());
+
+	return s;
+}
+
+void radix::get_gauges(internal::stats::metrics_type &gauges)
+{
+	gauges.emplace_back("size", container->size());
+}
+
 internal::transaction *radix::begin_tx()
 {
 	return new internal::radix::transaction(pmpool, container);
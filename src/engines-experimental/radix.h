@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2020, Intel Corporation */
+/* Copyright 2020-2021, Intel Corporation */
 
 #pragma once
 
@@ -108,6 +108,11 @@ public:
 
 	status remove(string_view key) final;
 
+	status defrag(double start_percent, double amount_percent) final;
+	status bulk_load(bulk_load_callback *callback, void *arg) final;
+
+	void get_gauges(internal::stats::metrics_type &gauges) final;
+
 	internal::transaction *begin_tx() final;
 
 	internal::iterator_base *new_iterator() final;
@@ -514,7 +514,9 @@ size_t robinhood::shard_hash(uint64_t key)
 robinhood::robinhood(std::unique_ptr<internal::config> cfg)
     : pmemobj_engine_base(cfg, "pmemkv_robinhood")
 {
+	internal::stopwatch recover_time;
 	Recover();
+	add_open_phase("recover", recover_time.lap());
 
 	LOG("Started ok");
 }
@@ -647,6 +649,11 @@ status robinhood::remove(string_view key)
 	return status::OK;
 }
 
+std::uint64_t robinhood::dram_usage()
+{
+	return mtxs.capacity() * sizeof(mutex_type);
+}
+
 void robinhood::Recover()
 {
 	auto sn = std::getenv("PMEMKV_ROBINHOOD_SHARDS_NUMBER");
@@ -132,6 +132,8 @@ private:
 
 	size_t shard_hash(uint64_t key);
 
+	std::uint64_t dram_usage() final;
+
 	TOID(struct internal::robinhood::hashmap_rp) * container;
 
 	std::vector<mutex_type> mtxs;
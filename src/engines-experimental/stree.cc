@@ -1,11 +1,15 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2017-2020, Intel Corporation */
+/* Copyright 2017-2021, Intel Corporation */
 
+#include <algorithm>
 #include <iostream>
+#include <iterator>
+#include <thread>
 #include <unistd.h>
 
 #include <libpmemobj++/make_persistent_atomic.hpp>
 #include <libpmemobj++/transaction.hpp>
+#include <libpmemobj/pool_base.h>
 
 #include "../out.h"
 #include "stree.h"
@@ -19,24 +23,87 @@ namespace pmem
 namespace kv
 {
 
-stree::stree(std::unique_ptr<internal::config> cfg)
-    : pmemobj_engine_base(cfg, "pmemkv_stree"), config(std::move(cfg))
+/*
+ * Leaves with fingerprints cannot be read by older versions (and the other way
+ * round), so the layout of non-hybrid pools was bumped along with them; pools
+ * of the former layout fail to open instead of being misread.
+ */
+static const char *layout(bool hybrid)
 {
-	Recover();
+	return hybrid ? "pmemkv_stree_hybrid" : "pmemkv_stree_v2";
+}
+
+/* Inner nodes of the hybrid tree are volatile, they are built from leaves on open. */
+template <typename Compare, std::size_t Degree>
+static void open_index(internal::stree::hybrid_btree_type<Compare, Degree> *tree,
+		       std::size_t n_threads)
+{
+	tree->open(n_threads);
+}
+
+template <typename Compare, std::size_t Degree>
+static void open_index(internal::stree::btree_type<Compare, Degree> *, std::size_t)
+{
+}
+
+template <typename Compare, std::size_t Degree>
+static void close_index(internal::stree::hybrid_btree_type<Compare, Degree> *tree)
+{
+	tree->close();
+}
+
+template <typename Compare, std::size_t Degree>
+static void close_index(internal::stree::btree_type<Compare, Degree> *)
+{
+}
+
+template <typename Compare, std::size_t Degree>
+static void
+enable_prefix_compression(internal::stree::hybrid_btree_type<Compare, Degree> *tree)
+{
+	tree->enable_prefix_compression();
+}
+
+/* inner nodes of the persistent tree point to keys in leaves, see Recover */
+template <typename Compare, std::size_t Degree>
+static void enable_prefix_compression(internal::stree::btree_type<Compare, Degree> *)
+{
+	assert(false);
+}
+
+template <typename Compare, bool Hybrid, std::size_t Degree>
+basic_stree<Compare, Hybrid, Degree>::basic_stree(std::unique_ptr<internal::config> cfg,
+						 internal::pmemobj_pool pool)
+    : pmemobj_engine_base<internal::stree::root_type>(cfg, layout(Hybrid),
+						      std::move(pool)),
+      config(std::move(cfg))
+{
+	uint64_t n_threads;
+	if (!config->get_uint64("recovery_threads", &n_threads))
+		n_threads = std::thread::hardware_concurrency();
+	recovery_threads = std::max<std::size_t>(1, n_threads);
+
+	internal::stopwatch recover_time;
+	Recover(recovery_threads);
+	this->add_open_phase("recover", recover_time.lap());
 	LOG("Started ok");
 }
 
-stree::~stree()
+template <typename Compare, bool Hybrid, std::size_t Degree>
+basic_stree<Compare, Hybrid, Degree>::~basic_stree()
 {
+	close_index(my_btree);
 	LOG("Stopped ok");
 }
 
-std::string stree::name()
+template <typename Compare, bool Hybrid, std::size_t Degree>
+std::string basic_stree<Compare, Hybrid, Degree>::name()
 {
 	return "stree";
 }
 
-status stree::count_all(std::size_t &cnt)
+template <typename Compare, bool Hybrid, std::size_t Degree>
+status basic_stree<Compare, Hybrid, Degree>::count_all(std::size_t &cnt)
 {
 	LOG("count_all");
 	check_outside_tx();
@@ -56,7 +123,9 @@ static std::size_t size(It first, It last)
 }
 
 /* above key, key exclusive */
-status stree::count_above(string_view key, std::size_t &cnt)
+template <typename Compare, bool Hybrid, std::size_t Degree>
+status basic_stree<Compare, Hybrid, Degree>::count_above(string_view key,
+							 std::size_t &cnt)
 {
 	LOG("count_above key>=" << std::string(key.data(), key.size()));
 	check_outside_tx();
@@ -70,7 +139,9 @@ status stree::count_above(string_view key, std::size_t &cnt)
 }
 
 /* above or equal to key, key inclusive */
-status stree::count_equal_above(string_view key, std::size_t &cnt)
+template <typename Compare, bool Hybrid, std::size_t Degree>
+status basic_stree<Compare, Hybrid, Degree>::count_equal_above(string_view key,
+							       std::size_t &cnt)
 {
 	LOG("count_equal_above key>=" << std::string(key.data(), key.size()));
 	check_outside_tx();
@@ -84,7 +155,9 @@ status stree::count_equal_above(string_view key, std::size_t &cnt)
 }
 
 /* below key, key exclusive */
-status stree::count_below(string_view key, std::size_t &cnt)
+template <typename Compare, bool Hybrid, std::size_t Degree>
+status basic_stree<Compare, Hybrid, Degree>::count_below(string_view key,
+							 std::size_t &cnt)
 {
 	LOG("count_below key<" << std::string(key.data(), key.size()));
 	check_outside_tx();
@@ -98,7 +171,9 @@ status stree::count_below(string_view key, std::size_t &cnt)
 }
 
 /* below or equal to key, key inclusive */
-status stree::count_equal_below(string_view key, std::size_t &cnt)
+template <typename Compare, bool Hybrid, std::size_t Degree>
+status basic_stree<Compare, Hybrid, Degree>::count_equal_below(string_view key,
+							       std::size_t &cnt)
 {
 	LOG("count_equal_below key>=" << std::string(key.data(), key.size()));
 	check_outside_tx();
@@ -111,7 +186,10 @@ status stree::count_equal_below(string_view key, std::size_t &cnt)
 	return status::OK;
 }
 
-status stree::count_between(string_view key1, string_view key2, std::size_t &cnt)
+template <typename Compare, bool Hybrid, std::size_t Degree>
+status basic_stree<Compare, Hybrid, Degree>::count_between(string_view key1,
+							   string_view key2,
+							   std::size_t &cnt)
 {
 	LOG("count_between key range=[" << std::string(key1.data(), key1.size()) << ","
 					<< std::string(key2.data(), key2.size()) << ")");
@@ -129,12 +207,16 @@ status stree::count_between(string_view key1, string_view key2, std::size_t &cnt
 	return status::OK;
 }
 
-status stree::iterate(container_iterator first, container_iterator last,
-		      get_kv_callback *callback, void *arg)
+template <typename Compare, bool Hybrid, std::size_t Degree>
+status basic_stree<Compare, Hybrid, Degree>::iterate(container_iterator first,
+						     container_iterator last,
+						     get_kv_callback *callback, void *arg)
 {
+	std::string buffer;
 	for (auto it = first; it != last; ++it) {
-		auto ret = callback(it->first.c_str(), it->first.size(),
-				    it->second.c_str(), it->second.size(), arg);
+		auto key = it.key(buffer);
+		auto ret = callback(key.data(), key.size(), it->second.c_str(),
+				    it->second.size(), arg);
 
 		if (ret != 0)
 			return status::STOPPED_BY_CB;
@@ -143,7 +225,8 @@ status stree::iterate(container_iterator first, container_iterator last,
 	return status::OK;
 }
 
-status stree::get_all(get_kv_callback *callback, void *arg)
+template <typename Compare, bool Hybrid, std::size_t Degree>
+status basic_stree<Compare, Hybrid, Degree>::get_all(get_kv_callback *callback, void *arg)
 {
 	LOG("get_all");
 	check_outside_tx();
@@ -155,7 +238,10 @@ status stree::get_all(get_kv_callback *callback, void *arg)
 }
 
 /* (key, end), above key */
-status stree::get_above(string_view key, get_kv_callback *callback, void *arg)
+template <typename Compare, bool Hybrid, std::size_t Degree>
+status basic_stree<Compare, Hybrid, Degree>::get_above(string_view key,
+						       get_kv_callback *callback,
+						       void *arg)
 {
 	LOG("get_above start key>=" << std::string(key.data(), key.size()));
 	check_outside_tx();
@@ -167,7 +253,10 @@ status stree::get_above(string_view key, get_kv_callback *callback, void *arg)
 }
 
 /* [key, end), above or equal to key */
-status stree::get_equal_above(string_view key, get_kv_callback *callback, void *arg)
+template <typename Compare, bool Hybrid, std::size_t Degree>
+status basic_stree<Compare, Hybrid, Degree>::get_equal_above(string_view key,
+							     get_kv_callback *callback,
+							     void *arg)
 {
 	LOG("get_equal_above start key>=" << std::string(key.data(), key.size()));
 	check_outside_tx();
@@ -179,7 +268,10 @@ status stree::get_equal_above(string_view key, get_kv_callback *callback, void *
 }
 
 /* [start, key], below or equal to key */
-status stree::get_equal_below(string_view key, get_kv_callback *callback, void *arg)
+template <typename Compare, bool Hybrid, std::size_t Degree>
+status basic_stree<Compare, Hybrid, Degree>::get_equal_below(string_view key,
+							     get_kv_callback *callback,
+							     void *arg)
 {
 	LOG("get_equal_below start key>=" << std::string(key.data(), key.size()));
 	check_outside_tx();
@@ -191,7 +283,10 @@ status stree::get_equal_below(string_view key, get_kv_callback *callback, void *
 }
 
 /* [start, key), less than key, key exclusive */
-status stree::get_below(string_view key, get_kv_callback *callback, void *arg)
+template <typename Compare, bool Hybrid, std::size_t Degree>
+status basic_stree<Compare, Hybrid, Degree>::get_below(string_view key,
+						       get_kv_callback *callback,
+						       void *arg)
 {
 	LOG("get_below key<" << std::string(key.data(), key.size()));
 	check_outside_tx();
@@ -203,8 +298,11 @@ status stree::get_below(string_view key, get_kv_callback *callback, void *arg)
 }
 
 /* get between (key1, key2), key1 exclusive, key2 exclusive */
-status stree::get_between(string_view key1, string_view key2, get_kv_callback *callback,
-			  void *arg)
+template <typename Compare, bool Hybrid, std::size_t Degree>
+status basic_stree<Compare, Hybrid, Degree>::get_between(string_view key1,
+							 string_view key2,
+							 get_kv_callback *callback,
+							 void *arg)
 {
 	LOG("get_between key range=[" << std::string(key1.data(), key1.size()) << ","
 				      << std::string(key2.data(), key2.size()) << ")");
@@ -220,12 +318,13 @@ status stree::get_between(string_view key1, string_view key2, get_kv_callback *c
 	return status::OK;
 }
 
-status stree::exists(string_view key)
+template <typename Compare, bool Hybrid, std::size_t Degree>
+status basic_stree<Compare, Hybrid, Degree>::exists(string_view key)
 {
 	LOG("exists for key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
 
-	internal::stree::btree_type::iterator it = my_btree->find(key);
+	container_iterator it = my_btree->find(key);
 	if (it == my_btree->end()) {
 		LOG("  key not found");
 		return status::NOT_FOUND;
@@ -233,12 +332,14 @@ status stree::exists(string_view key)
 	return status::OK;
 }
 
-status stree::get(string_view key, get_v_callback *callback, void *arg)
+template <typename Compare, bool Hybrid, std::size_t Degree>
+status basic_stree<Compare, Hybrid, Degree>::get(string_view key,
+						 get_v_callback *callback, void *arg)
 {
 	LOG("get using callback for key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
 
-	internal::stree::btree_type::iterator it = my_btree->find(key);
+	container_iterator it = my_btree->find(key);
 	if (it == my_btree->end()) {
 		LOG("  key not found");
 		return status::NOT_FOUND;
@@ -248,7 +349,8 @@ status stree::get(string_view key, get_v_callback *callback, void *arg)
 	return status::OK;
 }
 
-status stree::put(string_view key, string_view value)
+template <typename Compare, bool Hybrid, std::size_t Degree>
+status basic_stree<Compare, Hybrid, Degree>::put(string_view key, string_view value)
 {
 	LOG("put key=" << std::string(key.data(), key.size())
 		       << ", value.size=" << std::to_string(value.size()));
@@ -256,15 +358,16 @@ status stree::put(string_view key, string_view value)
 
 	auto result = my_btree->try_emplace(key, value);
 	if (!result.second) { // key already exists, so update
-		typename internal::stree::btree_type::value_type &entry = *result.first;
-		transaction::manual tx(pmpool);
+		typename container_type::value_type &entry = *result.first;
+		transaction::manual tx(this->pmpool);
 		entry.second = value;
 		transaction::commit();
 	}
 	return status::OK;
 }
 
-status stree::remove(string_view key)
+template <typename Compare, bool Hybrid, std::size_t Degree>
+status basic_stree<Compare, Hybrid, Degree>::remove(string_view key)
 {
 	LOG("remove key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
@@ -273,47 +376,175 @@ status stree::remove(string_view key)
 	return (result == 1) ? status::OK : status::NOT_FOUND;
 }
 
-void stree::Recover()
+template <typename Compare, bool Hybrid, std::size_t Degree>
+status basic_stree<Compare, Hybrid, Degree>::defrag(double start_percent,
+						    double amount_percent)
+{
+	LOG("defrag: start_percent = " << start_percent
+				       << " amount_percent = " << amount_percent);
+	check_outside_tx();
+
+	try {
+		my_btree->defragment(start_percent, amount_percent);
+	} catch (std::range_error &e) {
+		out_err_stream("defrag") << e.what();
+		return status::INVALID_ARGUMENT;
+	} catch (pmem::defrag_error &e) {
+		out_err_stream("defrag") << e.what();
+		return status::DEFRAG_ERROR;
+	}
+
+	return status::OK;
+}
+
+/* thrown out of the tree's bulk_load when the callback stops the load */
+struct bulk_load_stopped {
+};
+
+/*
+ * Leaves are filled up to "bulk_load_fill" percent (75 by default), so that later
+ * puts do not split all of them. The index of the hybrid tree is rebuilt from the
+ * loaded leaves.
+ */
+template <typename Compare, bool Hybrid, std::size_t Degree>
+status basic_stree<Compare, Hybrid, Degree>::bulk_load(bulk_load_callback *callback,
+						       void *arg)
 {
-	if (!OID_IS_NULL(*root_oid)) {
-		my_btree = (internal::stree::btree_type *)pmemobj_direct(*root_oid);
+	LOG("bulk_load");
+	check_outside_tx();
+
+	if (my_btree->size() != 0) {
+		out_err_stream("bulk_load") << "database is not empty";
+		return status::INVALID_ARGUMENT;
+	}
+
+	uint64_t fill;
+	if (!config->get_uint64("bulk_load_fill", &fill))
+		fill = 75;
+	if (fill == 0 || fill > 100) {
+		out_err_stream("bulk_load")
+			<< "bulk_load_fill has to be in range [1, 100]";
+		return status::INVALID_ARGUMENT;
+	}
+	auto leaf_size = std::max<std::size_t>(1, (Degree - 1) * fill / 100);
+
+	auto next = [&](string_view &key, string_view &value) {
+		const char *k, *v;
+		std::size_t kb, vb;
+		int ret = callback(&k, &kb, &v, &vb, arg);
+		if (ret < 0)
+			throw bulk_load_stopped();
+		if (ret > 0)
+			return false;
+
+		key = string_view(k, kb);
+		value = string_view(v, vb);
+		return true;
+	};
+
+	auto s = status::OK;
+	close_index(my_btree);
+	try {
+		my_btree->bulk_load(next, leaf_size);
+	} catch (bulk_load_stopped &) {
+		s = status::STOPPED_BY_CB;
+	} catch (std::invalid_argument &e) {
+		out_err_stream("bulk_load") << e.what();
+		s = status::INVALID_ARGUMENT;
+	} catch (...) {
+		open_index(my_btree, recovery_threads);
+		throw;
+	}
+	open_index(my_btree, recovery_threads);
+
+	return s;
+}
+
+template <typename Compare, bool Hybrid, std::size_t Degree>
+void basic_stree<Compare, Hybrid, Degree>::get_gauges(
+	internal::stats::metrics_type &gauges)
+{
+	gauges.emplace_back("size", my_btree->size());
+}
+
+template <typename Compare, bool Hybrid, std::size_t Degree>
+void basic_stree<Compare, Hybrid, Degree>::Recover(std::size_t n_threads)
+{
+	using internal::stree::root_type;
+
+	if (!OID_IS_NULL(*this->root_oid)) {
+		auto root = (root_type *)pmemobj_direct(*this->root_oid);
+		if (root->degree != Degree)
+			throw internal::invalid_argument(
+				"Tree of degree " + std::to_string(root->degree) +
+				" cannot be opened as a tree of degree " +
+				std::to_string(Degree));
+		if (root->inline_size != STREE_INLINE_SIZE)
+			throw internal::invalid_argument(
+				"Pool was created with STREE_INLINE_SIZE=" +
+				std::to_string(root->inline_size) + ", this build uses " +
+				std::to_string(STREE_INLINE_SIZE));
+
+		my_btree = (container_type *)pmemobj_direct(root->tree);
 		my_btree->key_comp().runtime_initialize(
 			internal::extract_comparator(*config));
 	} else {
-		pmem::obj::transaction::run(pmpool, [&] {
-			pmem::obj::transaction::snapshot(root_oid);
-			*root_oid =
-				pmem::obj::make_persistent<internal::stree::btree_type>()
-					.raw();
-			my_btree =
-				(internal::stree::btree_type *)pmemobj_direct(*root_oid);
+		uint64_t prefix_compression;
+		if (!config->get_uint64("prefix_compression", &prefix_compression))
+			prefix_compression = 0;
+		if (prefix_compression && !Hybrid)
+			throw internal::invalid_argument(
+				"prefix_compression requires hybrid mode");
+		if (prefix_compression &&
+		    !std::is_same<Compare, internal::binary_pmemobj_compare>::value)
+			throw internal::invalid_argument(
+				"prefix_compression requires the default (binary) "
+				"comparator");
+
+		pmem::obj::transaction::run(this->pmpool, [&] {
+			pmem::obj::transaction::snapshot(this->root_oid);
+			auto root = pmem::obj::make_persistent<root_type>();
+			root->degree = Degree;
+			root->inline_size = STREE_INLINE_SIZE;
+			root->tree = pmem::obj::make_persistent<container_type>().raw();
+			*this->root_oid = root.raw();
+			my_btree = (container_type *)pmemobj_direct(root->tree);
 			my_btree->key_comp().initialize(
 				internal::extract_comparator(*config));
+			if (prefix_compression)
+				enable_prefix_compression(my_btree);
 		});
 	}
+
+	open_index(my_btree, n_threads);
 }
 
-internal::iterator_base *stree::new_iterator()
+template <typename Compare, bool Hybrid, std::size_t Degree>
+internal::iterator_base *basic_stree<Compare, Hybrid, Degree>::new_iterator()
 {
-	return new stree_iterator<false>{my_btree};
+	return new stree_iterator<container_type, false>{my_btree};
 }
 
-internal::iterator_base *stree::new_const_iterator()
+template <typename Compare, bool Hybrid, std::size_t Degree>
+internal::iterator_base *basic_stree<Compare, Hybrid, Degree>::new_const_iterator()
 {
-	return new stree_iterator<true>{my_btree};
+	return new stree_iterator<container_type, true>{my_btree};
 }
 
-stree::stree_iterator<true>::stree_iterator(container_type *c)
+template <typename Container>
+stree_iterator<Container, true>::stree_iterator(container_type *c)
     : container(c), it_(nullptr), pop(pmem::obj::pool_by_vptr(c))
 {
 }
 
-stree::stree_iterator<false>::stree_iterator(container_type *c)
-    : stree::stree_iterator<true>(c)
+template <typename Container>
+stree_iterator<Container, false>::stree_iterator(container_type *c)
+    : stree_iterator<Container, true>(c)
 {
 }
 
-status stree::stree_iterator<true>::seek(string_view key)
+template <typename Container>
+status stree_iterator<Container, true>::seek(string_view key)
 {
 	init_seek();
 
@@ -324,7 +555,8 @@ status stree::stree_iterator<true>::seek(string_view key)
 	return status::NOT_FOUND;
 }
 
-status stree::stree_iterator<true>::seek_lower(string_view key)
+template <typename Container>
+status stree_iterator<Container, true>::seek_lower(string_view key)
 {
 	init_seek();
 
@@ -339,7 +571,8 @@ status stree::stree_iterator<true>::seek_lower(string_view key)
 	return status::OK;
 }
 
-status stree::stree_iterator<true>::seek_lower_eq(string_view key)
+template <typename Container>
+status stree_iterator<Container, true>::seek_lower_eq(string_view key)
 {
 	init_seek();
 
@@ -354,7 +587,8 @@ status stree::stree_iterator<true>::seek_lower_eq(string_view key)
 	return status::OK;
 }
 
-status stree::stree_iterator<true>::seek_higher(string_view key)
+template <typename Container>
+status stree_iterator<Container, true>::seek_higher(string_view key)
 {
 	init_seek();
 
@@ -365,7 +599,8 @@ status stree::stree_iterator<true>::seek_higher(string_view key)
 	return status::OK;
 }
 
-status stree::stree_iterator<true>::seek_higher_eq(string_view key)
+template <typename Container>
+status stree_iterator<Container, true>::seek_higher_eq(string_view key)
 {
 	init_seek();
 
@@ -376,7 +611,8 @@ status stree::stree_iterator<true>::seek_higher_eq(string_view key)
 	return status::OK;
 }
 
-status stree::stree_iterator<true>::seek_to_first()
+template <typename Container>
+status stree_iterator<Container, true>::seek_to_first()
 {
 	init_seek();
 
@@ -388,7 +624,8 @@ status stree::stree_iterator<true>::seek_to_first()
 	return status::OK;
 }
 
-status stree::stree_iterator<true>::seek_to_last()
+template <typename Container>
+status stree_iterator<Container, true>::seek_to_last()
 {
 	init_seek();
 
@@ -401,7 +638,8 @@ status stree::stree_iterator<true>::seek_to_last()
 	return status::OK;
 }
 
-status stree::stree_iterator<true>::is_next()
+template <typename Container>
+status stree_iterator<Container, true>::is_next()
 {
 	auto tmp = it_;
 	if (tmp == container->end() || ++tmp == container->end())
@@ -410,7 +648,8 @@ status stree::stree_iterator<true>::is_next()
 	return status::OK;
 }
 
-status stree::stree_iterator<true>::next()
+template <typename Container>
+status stree_iterator<Container, true>::next()
 {
 	init_seek();
 
@@ -420,7 +659,8 @@ status stree::stree_iterator<true>::next()
 	return status::OK;
 }
 
-status stree::stree_iterator<true>::prev()
+template <typename Container>
+status stree_iterator<Container, true>::prev()
 {
 	init_seek();
 
@@ -432,15 +672,17 @@ status stree::stree_iterator<true>::prev()
 	return status::OK;
 }
 
-result<string_view> stree::stree_iterator<true>::key()
+template <typename Container>
+result<string_view> stree_iterator<Container, true>::key()
 {
 	assert(it_ != container->end());
 
-	return {it_->first.cdata()};
+	return {it_.key(key_buffer)};
 }
 
-result<pmem::obj::slice<const char *>> stree::stree_iterator<true>::read_range(size_t pos,
-									       size_t n)
+template <typename Container>
+result<pmem::obj::slice<const char *>>
+stree_iterator<Container, true>::read_range(size_t pos, size_t n)
 {
 	assert(it_ != container->end());
 
@@ -450,25 +692,28 @@ result<pmem::obj::slice<const char *>> stree::stree_iterator<true>::read_range(s
 	return {it_->second.crange(pos, n)};
 }
 
-result<pmem::obj::slice<char *>> stree::stree_iterator<false>::write_range(size_t pos,
-									   size_t n)
+template <typename Container>
+result<pmem::obj::slice<char *>>
+stree_iterator<Container, false>::write_range(size_t pos, size_t n)
 {
-	assert(it_ != container->end());
+	auto &it = this->it_;
+	assert(it != this->container->end());
 
-	if (pos + n > it_->second.size() || pos + n < pos)
-		n = it_->second.size() - pos;
+	if (pos + n > it->second.size() || pos + n < pos)
+		n = it->second.size() - pos;
 
-	log.push_back({{it_->second.cdata() + pos, n}, pos});
+	log.push_back({{it->second.cdata() + pos, n}, pos});
 	auto &val = log.back().first;
 
 	return {{&val[0], &val[0] + n}};
 }
 
-status stree::stree_iterator<false>::commit()
+template <typename Container>
+status stree_iterator<Container, false>::commit()
 {
-	pmem::obj::transaction::run(pop, [&] {
+	pmem::obj::transaction::run(this->pop, [&] {
 		for (auto &p : log) {
-			auto dest = it_->second.range(p.second, p.first.size());
+			auto dest = this->it_->second.range(p.second, p.first.size());
 			std::copy(p.first.begin(), p.first.end(), dest.begin());
 		}
 	});
@@ -477,10 +722,66 @@ status stree::stree_iterator<false>::commit()
 	return status::OK;
 }
 
-void stree::stree_iterator<false>::abort()
+template <typename Container>
+void stree_iterator<Container, false>::abort()
 {
 	log.clear();
 }
 
+namespace internal
+{
+namespace stree
+{
+
+/*
+ * Returns the degree of the tree stored in the pool given by cfg, or (if the pool
+ * has no tree yet) the one requested with the "degree" config item. A pool given by
+ * "path" is opened (into 'pool'), to be handed over to the engine's instantiation.
+ */
+std::size_t pool_degree(config &cfg, bool hybrid, pmemobj_pool &pool)
+{
+	auto stored_degree = [](PMEMoid oid) -> uint64_t {
+		if (OID_IS_NULL(oid))
+			return 0;
+		return static_cast<root_type *>(pmemobj_direct(oid))->degree;
+	};
+
+	uint64_t degree = 0;
+	PMEMoid *oid;
+	const char *path;
+	if (cfg.get_object("oid", (void **)&oid)) {
+		degree = stored_degree(*oid);
+	} else if (cfg.get_string("path", &path)) {
+		pool = pmemobj_pool(cfg, layout(hybrid));
+		degree = stored_degree(pool.engine_data());
+	}
+
+	if (degree == 0 && !cfg.get_uint64("degree", &degree))
+		degree = DEGREE;
+
+	if (std::find(std::begin(DEGREES), std::end(DEGREES), degree) ==
+	    std::end(DEGREES))
+		throw invalid_argument("Unsupported stree degree: " +
+				       std::to_string(degree));
+
+	return degree;
+}
+
+} /* namespace stree */
+} /* namespace internal */
+
+template class basic_stree<internal::pmemobj_compare, false, 16>;
+template class basic_stree<internal::binary_pmemobj_compare, false, 16>;
+template class basic_stree<internal::pmemobj_compare, true, 16>;
+template class basic_stree<internal::binary_pmemobj_compare, true, 16>;
+template class basic_stree<internal::pmemobj_compare, false, 32>;
+template class basic_stree<internal::binary_pmemobj_compare, false, 32>;
+template class basic_stree<internal::pmemobj_compare, true, 32>;
+template class basic_stree<internal::binary_pmemobj_compare, true, 32>;
+template class basic_stree<internal::pmemobj_compare, false, 64>;
+template class basic_stree<internal::binary_pmemobj_compare, false, 64>;
+template class basic_stree<internal::pmemobj_compare, true, 64>;
+template class basic_stree<internal::binary_pmemobj_compare, true, 64>;
+
 } // namespace kv
 } // namespace pmem
@@ -1,17 +1,21 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2017-2020, Intel Corporation */
+/* Copyright 2017-2021, Intel Corporation */
 
 #pragma once
 
-#include <libpmemobj++/container/string.hpp>
 #include <libpmemobj++/make_persistent.hpp>
 #include <libpmemobj++/persistent_ptr.hpp>
 
 #include "../comparator/pmemobj_comparator.h"
 #include "../iterator.h"
 #include "../pmemobj_engine.h"
+#include "stree/compact_string.h"
+#include "stree/hybrid_b_tree.h"
 #include "stree/persistent_b_tree.h"
 
+#include <string>
+#include <type_traits>
+
 using pmem::obj::persistent_ptr;
 using pmem::obj::pool;
 
@@ -27,29 +31,75 @@ namespace stree
 /**
  * Indicates the maximum number of descendants a single node can have.
  * DEGREE - 1 is the maximum number of entries a node can have.
+ *
+ * DEGREE is the default, a tree can be created with any of DEGREES (see
+ * the "degree" config item). The degree is stored in the pool.
  */
 const size_t DEGREE = 32;
+const size_t DEGREES[] = {16, 32, 64};
+
+/*
+ * Keys and values up to STREE_INLINE_SIZE bytes long are stored in leaves, longer
+ * ones are allocated separately (see compact_string). It can be changed at build
+ * time (STREE_INLINE_SIZE in CMake), the size is stored in the pool. The default
+ * makes a string 64 bytes long.
+ */
+#ifndef STREE_INLINE_SIZE
+#define STREE_INLINE_SIZE 55
+#endif
 
-using string_t = pmem::obj::string;
+using string_t = compact_string<STREE_INLINE_SIZE>;
 
 using key_type = string_t;
 using value_type = string_t;
-using btree_type = b_tree<key_type, value_type, internal::pmemobj_compare, DEGREE>;
+template <typename Compare, std::size_t Degree = DEGREE>
+using btree_type = b_tree<key_type, value_type, Compare, Degree>;
+template <typename Compare, std::size_t Degree = DEGREE>
+using hybrid_btree_type = hybrid_b_tree<key_type, value_type, Compare, Degree>;
+
+/* hybrid trees keep only leaves in the pool, see the "hybrid" config item */
+template <typename Compare, bool Hybrid, std::size_t Degree>
+using tree_type = typename std::conditional<Hybrid, hybrid_btree_type<Compare, Degree>,
+					    btree_type<Compare, Degree>>::type;
+
+/**
+ * Root object of stree's pools. The tree's type depends on its degree and on
+ * the inline size of its strings, so they are kept along with the tree.
+ */
+struct root_type {
+	pmem::obj::p<uint64_t> degree;
+	pmem::obj::p<uint64_t> inline_size;
+	PMEMoid tree;
+};
+
+std::size_t pool_degree(config &cfg, bool hybrid, pmemobj_pool &pool);
 
 } /* namespace stree */
 } /* namespace internal */
 
-class stree : public pmemobj_engine_base<internal::stree::btree_type> {
+template <typename Container, bool IsConst>
+class stree_iterator;
+
+/**
+ * Compare is internal::binary_pmemobj_compare if the default (binary) comparator
+ * is used - comparisons are then inlined into the tree - and
+ * internal::pmemobj_compare, which calls the configured comparator, otherwise.
+ * Both have the same layout, so pools do not depend on the instantiation.
+ *
+ * If Hybrid is true, inner nodes of the tree are kept in DRAM and rebuilt from
+ * the list of leaves on open (see hybrid_b_tree); such pools have their own layout.
+ * Degree is the tree's node size, one of internal::stree::DEGREES.
+ */
+template <typename Compare, bool Hybrid, std::size_t Degree>
+class basic_stree : public pmemobj_engine_base<internal::stree::root_type> {
 private:
-	using container_type = internal::stree::btree_type;
+	using container_type = internal::stree::tree_type<Compare, Hybrid, Degree>;
 	using container_iterator = typename container_type::iterator;
 
-	template <bool IsConst>
-	class stree_iterator;
-
 public:
-	stree(std::unique_ptr<internal::config> cfg);
-	~stree();
+	basic_stree(std::unique_ptr<internal::config> cfg,
+		    internal::pmemobj_pool pool = internal::pmemobj_pool());
+	~basic_stree();
 
 	std::string name() final;
 
@@ -74,23 +124,40 @@ public:
 	status put(string_view key, string_view value) final;
 	status remove(string_view key) final;
 
+	status defrag(double start_percent, double amount_percent) final;
+	status bulk_load(bulk_load_callback *callback, void *arg) final;
+
+	void get_gauges(internal::stats::metrics_type &gauges) final;
+
 	internal::iterator_base *new_iterator() final;
 	internal::iterator_base *new_const_iterator() final;
 
 private:
-	stree(const stree &);
-	void operator=(const stree &);
+	basic_stree(const basic_stree &);
+	void operator=(const basic_stree &);
 	status iterate(container_iterator first, container_iterator last,
 		       get_kv_callback *callback, void *arg);
-	void Recover();
+	void Recover(std::size_t n_threads);
 
-	internal::stree::btree_type *my_btree;
+	container_type *my_btree;
 	std::unique_ptr<internal::config> config;
+	std::size_t recovery_threads;
+};
+
+/**
+ * stree_variant<Hybrid, Degree>::type<Compare> is the engine for a tree of the given
+ * kind, to be chosen (with internal::stree::pool_degree, which opens the pool for
+ * the engine) before creating the engine.
+ */
+template <bool Hybrid, std::size_t Degree>
+struct stree_variant {
+	template <typename Compare>
+	using type = basic_stree<Compare, Hybrid, Degree>;
 };
 
-template <>
-class stree::stree_iterator<true> : virtual public internal::iterator_base {
-	using container_type = stree::container_type;
+template <typename Container>
+class stree_iterator<Container, true> : virtual public internal::iterator_base {
+	using container_type = Container;
 
 public:
 	stree_iterator(container_type *container);
@@ -114,13 +181,15 @@ public:
 
 protected:
 	container_type *container;
-	container_type::iterator it_;
+	typename container_type::iterator it_;
 	pmem::obj::pool_base pop;
+	/* keys of leaves with a prefix are assembled here */
+	std::string key_buffer;
 };
 
-template <>
-class stree::stree_iterator<false> : public stree::stree_iterator<true> {
-	using container_type = stree::container_type;
+template <typename Container>
+class stree_iterator<Container, false> : public stree_iterator<Container, true> {
+	using container_type = Container;
 
 public:
 	stree_iterator(container_type *container);
@@ -0,0 +1,269 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef COMPACT_STRING
+#define COMPACT_STRING
+
+#include <libpmemobj++/detail/common.hpp>
+#include <libpmemobj++/make_persistent_array.hpp>
+#include <libpmemobj++/p.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+#include <libpmemobj++/slice.hpp>
+#include <libpmemobj++/transaction.hpp>
+
+#include "../../libpmemkv.hpp"
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/**
+ * Persistent string which keeps up to InlineSize characters in the object itself
+ * and allocates a separate buffer only for longer ones. Used for keys and values
+ * of stree, so entries of small records are stored entirely in their leaf: a put
+ * does not allocate anything but leaves and a lookup does not follow pointers.
+ *
+ * Like pmem::obj::string, it is null-terminated and all modifications have to be
+ * done in a transaction.
+ */
+template <std::size_t InlineSize>
+class compact_string {
+public:
+	using size_type = std::size_t;
+
+	compact_string();
+	compact_string(string_view s);
+	compact_string(const compact_string &other);
+	compact_string(compact_string &&other);
+	~compact_string();
+
+	compact_string &operator=(const compact_string &other);
+	compact_string &operator=(string_view s);
+	compact_string &assign(const char *s, size_type count);
+
+	const char *c_str() const;
+	const char *cdata() const;
+	size_type size() const;
+
+	pmem::obj::slice<const char *> crange(size_type pos, size_type count) const;
+	pmem::obj::slice<char *> range(size_type pos, size_type count);
+
+	template <typename F>
+	void for_each_ptr(F func);
+
+private:
+	bool is_inline() const;
+	char *data();
+	void construct(const char *s, size_type count);
+	void release();
+
+	pmem::obj::p<uint64_t> _size;
+	/* ptr is used iff _size > InlineSize */
+	union {
+		char inline_data[InlineSize + 1];
+		pmem::obj::persistent_ptr<char[]> ptr;
+	};
+}; /* class compact_string */
+
+template <std::size_t InlineSize>
+compact_string<InlineSize>::compact_string() : _size(0)
+{
+	inline_data[0] = '\0';
+}
+
+template <std::size_t InlineSize>
+compact_string<InlineSize>::compact_string(string_view s)
+{
+	construct(s.data(), s.size());
+}
+
+template <std::size_t InlineSize>
+compact_string<InlineSize>::compact_string(const compact_string &other)
+{
+	construct(other.cdata(), other.size());
+}
+
+/**
+ * Takes over the buffer of an out of line string, other is left empty then.
+ * Inline strings are copied and other is not modified.
+ */
+template <std::size_t InlineSize>
+compact_string<InlineSize>::compact_string(compact_string &&other) : _size(other._size)
+{
+	if (is_inline()) {
+		std::memcpy(inline_data, other.inline_data, size() + 1);
+		return;
+	}
+
+	new (&ptr) pmem::obj::persistent_ptr<char[]>(other.ptr);
+	pmem::detail::conditional_add_to_tx(&other);
+	other._size = 0;
+	other.inline_data[0] = '\0';
+}
+
+template <std::size_t InlineSize>
+compact_string<InlineSize>::~compact_string()
+{
+	release();
+}
+
+template <std::size_t InlineSize>
+compact_string<InlineSize> &
+compact_string<InlineSize>::operator=(const compact_string &other)
+{
+	if (this != &other)
+		assign(other.cdata(), other.size());
+
+	return *this;
+}
+
+template <std::size_t InlineSize>
+compact_string<InlineSize> &compact_string<InlineSize>::operator=(string_view s)
+{
+	return assign(s.data(), s.size());
+}
+
+/**
+ * Replaces the content with count characters from s. A buffer is allocated only
+ * if the new content does not fit in place: inline or in the current buffer
+ * (which is then kept, also if the new content is shorter).
+ *
+ * @pre must be called in a transaction
+ */
+template <std::size_t InlineSize>
+compact_string<InlineSize> &compact_string<InlineSize>::assign(const char *s,
+							      size_type count)
+{
+	assert(pmemobj_tx_stage() == TX_STAGE_WORK);
+
+	if (!is_inline() && count > InlineSize && count <= size()) {
+		pmem::obj::transaction::snapshot(ptr.get(), count + 1);
+		std::memmove(ptr.get(), s, count);
+		ptr.get()[count] = '\0';
+		_size = count;
+		return *this;
+	}
+
+	pmem::obj::transaction::snapshot(this);
+	if (is_inline() && count <= InlineSize) {
+		/* s may point into inline_data */
+		std::memmove(inline_data, s, count);
+		inline_data[count] = '\0';
+		_size = count;
+		return *this;
+	}
+
+	/* the old buffer is freed when the transaction commits, s stays valid */
+	release();
+	construct(s, count);
+
+	return *this;
+}
+
+template <std::size_t InlineSize>
+const char *compact_string<InlineSize>::c_str() const
+{
+	return cdata();
+}
+
+template <std::size_t InlineSize>
+const char *compact_string<InlineSize>::cdata() const
+{
+	return is_inline() ? inline_data : ptr.get();
+}
+
+template <std::size_t InlineSize>
+typename compact_string<InlineSize>::size_type compact_string<InlineSize>::size() const
+{
+	return static_cast<size_type>(_size.get_ro());
+}
+
+template <std::size_t InlineSize>
+pmem::obj::slice<const char *> compact_string<InlineSize>::crange(size_type pos,
+								  size_type count) const
+{
+	assert(pos + count <= size());
+
+	return {cdata() + pos, cdata() + pos + count};
+}
+
+/**
+ * Adds the range to a transaction and returns it.
+ *
+ * @pre must be called in a transaction
+ */
+template <std::size_t InlineSize>
+pmem::obj::slice<char *> compact_string<InlineSize>::range(size_type pos,
+							   size_type count)
+{
+	assert(pos + count <= size());
+
+	pmem::obj::transaction::snapshot(data() + pos, count);
+
+	return {data() + pos, data() + pos + count};
+}
+
+/**
+ * Calls func for the buffer of an out of line string (used by defragmentation).
+ */
+template <std::size_t InlineSize>
+template <typename F>
+void compact_string<InlineSize>::for_each_ptr(F func)
+{
+	if (!is_inline())
+		func(ptr);
+}
+
+template <std::size_t InlineSize>
+bool compact_string<InlineSize>::is_inline() const
+{
+	return size() <= InlineSize;
+}
+
+template <std::size_t InlineSize>
+char *compact_string<InlineSize>::data()
+{
+	return is_inline() ? inline_data : ptr.get();
+}
+
+/**
+ * Initializes the string, without adding it to a transaction (it has to be a new
+ * object or already snapshotted).
+ */
+template <std::size_t InlineSize>
+void compact_string<InlineSize>::construct(const char *s, size_type count)
+{
+	_size = count;
+	if (is_inline()) {
+		std::memmove(inline_data, s, count);
+		inline_data[count] = '\0';
+		return;
+	}
+
+	new (&ptr) pmem::obj::persistent_ptr<char[]>(
+		pmem::obj::make_persistent<char[]>(count + 1));
+	std::memcpy(ptr.get(), s, count);
+	ptr.get()[count] = '\0';
+}
+
+template <std::size_t InlineSize>
+void compact_string<InlineSize>::release()
+{
+	if (!is_inline())
+		pmem::obj::delete_persistent<char[]>(ptr, size() + 1);
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* COMPACT_STRING */
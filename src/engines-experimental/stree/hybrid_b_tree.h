@@ -0,0 +1,1017 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef HYBRID_B_TREE
+#define HYBRID_B_TREE
+
+#include "../../parallel.h"
+#include "persistent_b_tree.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/**
+ * Inner node of volatile_index, kept in DRAM. All keys in children[i] are lower
+ * than keys[i], and all keys in children[i + 1] are greater or equal to keys[i].
+ */
+template <typename LeafType, std::size_t capacity>
+struct alignas(64) volatile_inner_node_t {
+	union child_t {
+		volatile_inner_node_t *inner;
+		LeafType *leaf;
+	};
+
+	explicit volatile_inner_node_t(std::size_t level) : level(level), size(0)
+	{
+	}
+
+	/* nodes are allocated cache line aligned also before C++17 */
+	static void *operator new(std::size_t count);
+	static void operator delete(void *ptr) noexcept;
+
+	void insert(std::size_t pos, std::string &&key, child_t child);
+	void remove(std::size_t pos);
+
+	/* 1 if children are leaves */
+	std::size_t level;
+	/* number of keys, there is one child more */
+	std::size_t size;
+	std::string keys[capacity];
+	child_t children[capacity + 1];
+}; /* struct volatile_inner_node_t */
+
+/**
+ * Inner levels of hybrid_b_tree_base. They are not persistent: they are rebuilt from
+ * the list of leaves when the tree is opened, and updated after leaves are split
+ * or removed. Keys in inner nodes are the shortest separators of neighbouring
+ * leaves (see hybrid_b_tree_base::separator), not copies of keys stored in leaves.
+ */
+template <typename LeafType, typename Compare, std::size_t capacity>
+class volatile_index {
+public:
+	using leaf_type = LeafType;
+	using key_compare = Compare;
+	using node_type = volatile_inner_node_t<leaf_type, capacity>;
+	using child_t = typename node_type::child_t;
+
+	/* nodes split when full, so this is enough for 16^15 leaves */
+	static const std::size_t MAX_HEIGHT = 16;
+
+	/**
+	 * Nodes on the way from the root to a leaf and positions of the next
+	 * nodes (or of the leaf) among their children.
+	 */
+	struct path_type {
+		node_type *nodes[MAX_HEIGHT];
+		std::size_t pos[MAX_HEIGHT];
+		std::size_t height = 0;
+	};
+
+	volatile_index(const std::vector<leaf_type *> &leaves,
+		       std::vector<std::string> &separators, std::size_t n_threads);
+	~volatile_index();
+
+	volatile_index(const volatile_index &) = delete;
+	volatile_index &operator=(const volatile_index &) = delete;
+
+	template <typename K>
+	leaf_type *find_leaf(const K &key, const key_compare &comp) const;
+	template <typename K>
+	leaf_type *find_leaf(const K &key, const key_compare &comp,
+			     path_type &path) const;
+	leaf_type *rightmost_leaf() const;
+
+	void insert(const path_type &path, std::string &&separator, leaf_type *leaf);
+	void remove(const path_type &path);
+
+private:
+	node_type *root;
+
+	static void destroy(node_type *node);
+}; /* class volatile_index */
+
+/**
+ * B+ tree with persistent leaves and volatile inner nodes (volatile_index). Only
+ * the doubly-linked list of leaves is stored in the pool, so splitting a leaf
+ * persists only the leaf, its new neighbour and their links. The interface is
+ * the same as b_tree's, but open() must be called after the pool is opened (and
+ * close() before it is closed).
+ *
+ * With prefix compression enabled (which requires keys compared byte by byte),
+ * each leaf split stores the common prefix of keys of both leaves once, in the
+ * leaf, and only the rest of keys in entries (see leaf_node_t::set_prefix).
+ *
+ * All leaves but the first one are non-empty.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+class hybrid_b_tree_base {
+private:
+	const static std::size_t node_capacity = degree - 1;
+
+	using leaf_type = leaf_node_t<Key, T, Compare, node_capacity>;
+	using leaf_pptr = persistent_ptr<leaf_type>;
+	using index_type = volatile_index<leaf_type, Compare, node_capacity>;
+	using path_type = typename index_type::path_type;
+
+public:
+	using value_type = typename leaf_type::value_type;
+	using key_type = typename leaf_type::key_type;
+	using mapped_type = typename leaf_type::mapped_type;
+	using key_compare = Compare;
+	using size_type = std::size_t;
+	using difference_type = std::ptrdiff_t;
+
+	using reference = typename leaf_type::reference;
+	using const_reference = typename leaf_type::const_reference;
+
+	using iterator = b_tree_iterator<leaf_type, false>;
+	using const_iterator = b_tree_iterator<leaf_type, true>;
+
+	hybrid_b_tree_base();
+	~hybrid_b_tree_base();
+
+	hybrid_b_tree_base(const hybrid_b_tree_base &) = delete;
+	hybrid_b_tree_base &operator=(const hybrid_b_tree_base &) = delete;
+
+	void open(std::size_t n_threads);
+	void close();
+
+	void enable_prefix_compression();
+
+	template <typename K, typename M>
+	std::pair<iterator, bool> try_emplace(K &&key, M &&obj);
+
+	template <typename K>
+	iterator find(const K &key);
+	template <typename K>
+	const_iterator find(const K &key) const;
+	template <typename K>
+	iterator lower_bound(const K &key);
+	template <typename K>
+	const_iterator lower_bound(const K &key) const;
+	template <typename K>
+	iterator upper_bound(const K &key);
+	template <typename K>
+	const_iterator upper_bound(const K &key) const;
+
+	template <typename K>
+	size_type erase(const K &key);
+
+	template <typename Source>
+	void bulk_load(Source next, size_type leaf_size);
+
+	pmem::obj::defrag_result defragment(double start_percent = 0,
+					    double amount_percent = 100);
+
+	iterator begin();
+	iterator end();
+	const_iterator begin() const;
+	const_iterator end() const;
+	const_iterator cbegin() const;
+	const_iterator cend() const;
+
+	size_type size() const noexcept;
+
+	key_compare &key_comp();
+	const key_compare &key_comp() const;
+
+private:
+	leaf_pptr head;
+	key_compare compare;
+	pmem::obj::p<size_type> _size;
+	pmem::obj::p<bool> compress_prefixes;
+	/* volatile, set by open() */
+	index_type *index;
+
+	template <typename K, typename M>
+	std::pair<iterator, bool> split_leaf(leaf_type *leaf, path_type &path, K &&key,
+					     M &&obj);
+	std::string separator(string_view left, string_view right) const;
+	void clear();
+
+	pool_base get_pool_base() const;
+}; /* class hybrid_b_tree_base */
+
+// -------------------------------------------------------------------------------------
+// -------------------------------- volatile_inner_node_t ------------------------------
+// -------------------------------------------------------------------------------------
+
+template <typename LeafType, std::size_t capacity>
+void *volatile_inner_node_t<LeafType, capacity>::operator new(std::size_t count)
+{
+	void *ptr;
+	if (posix_memalign(&ptr, alignof(volatile_inner_node_t), count) != 0)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+template <typename LeafType, std::size_t capacity>
+void volatile_inner_node_t<LeafType, capacity>::operator delete(void *ptr) noexcept
+{
+	free(ptr);
+}
+
+/**
+ * Inserts child on position 'pos' (> 0), with 'key' as its lower bound.
+ *
+ * @pre size < capacity
+ */
+template <typename LeafType, std::size_t capacity>
+void volatile_inner_node_t<LeafType, capacity>::insert(std::size_t pos,
+						       std::string &&key, child_t child)
+{
+	assert(size < capacity);
+	assert(pos > 0 && pos <= size + 1);
+
+	std::move_backward(keys + pos - 1, keys + size, keys + size + 1);
+	std::copy_backward(children + pos, children + size + 1, children + size + 2);
+	keys[pos - 1] = std::move(key);
+	children[pos] = child;
+	++size;
+}
+
+/**
+ * Removes child on position 'pos' with one of the keys bounding it, so that its
+ * keys belong to a neighbour.
+ *
+ * @pre size > 0
+ */
+template <typename LeafType, std::size_t capacity>
+void volatile_inner_node_t<LeafType, capacity>::remove(std::size_t pos)
+{
+	assert(size > 0);
+	assert(pos <= size);
+
+	std::size_t key_pos = pos > 0 ? pos - 1 : 0;
+	std::move(keys + key_pos + 1, keys + size, keys + key_pos);
+	std::copy(children + pos + 1, children + size + 1, children + pos);
+	keys[--size].clear();
+}
+
+// -------------------------------------------------------------------------------------
+// ----------------------------------- volatile_index ----------------------------------
+// -------------------------------------------------------------------------------------
+
+/**
+ * Builds inner nodes over 'leaves', bottom-up, one level at a time (each level
+ * in 'n_threads' threads). separators[i] separates leaves[i] and leaves[i + 1];
+ * strings are moved out of 'separators'.
+ *
+ * @pre !leaves.empty()
+ */
+template <typename LeafType, typename Compare, std::size_t capacity>
+volatile_index<LeafType, Compare, capacity>::volatile_index(
+	const std::vector<leaf_type *> &leaves, std::vector<std::string> &separators,
+	std::size_t n_threads)
+    : root(nullptr)
+{
+	assert(!leaves.empty());
+	assert(separators.size() + 1 == leaves.size());
+
+	std::vector<child_t> children(leaves.size());
+	for (std::size_t i = 0; i < leaves.size(); ++i)
+		children[i].leaf = leaves[i];
+
+	std::vector<std::unique_ptr<node_type>> level_nodes;
+	for (std::size_t level = 1;; ++level) {
+		const std::size_t n_children = children.size();
+		const std::size_t n_parents = (n_children + capacity) / (capacity + 1);
+		std::vector<std::unique_ptr<node_type>> parents(n_parents);
+		std::vector<std::string> parent_separators(n_parents - 1);
+
+		/* parent p gets children [first, last) and separators between them,
+		 * the one after them separates it from parent p + 1 */
+		auto build_node = [&](std::size_t p) {
+			std::size_t first = n_children * p / n_parents;
+			std::size_t last = n_children * (p + 1) / n_parents;
+			std::unique_ptr<node_type> node(new node_type(level));
+			node->size = last - first - 1;
+			std::copy(children.begin() + static_cast<std::ptrdiff_t>(first),
+				  children.begin() + static_cast<std::ptrdiff_t>(last),
+				  node->children);
+			for (std::size_t i = first; i + 1 < last; ++i)
+				node->keys[i - first] = std::move(separators[i]);
+			if (p + 1 < n_parents)
+				parent_separators[p] = std::move(separators[last - 1]);
+			parents[p] = std::move(node);
+		};
+
+		std::size_t n_t = std::min(n_threads, n_parents);
+		n_t = std::max<std::size_t>(n_t, 1);
+		run_parallel(n_t, [&](std::size_t t) {
+			std::size_t end = n_parents * (t + 1) / n_t;
+			for (std::size_t p = n_parents * t / n_t; p < end; ++p)
+				build_node(p);
+		});
+
+		/* children are owned by their parents from now on */
+		for (auto &node : level_nodes)
+			node.release();
+
+		children.resize(n_parents);
+		for (std::size_t p = 0; p < n_parents; ++p)
+			children[p].inner = parents[p].get();
+		level_nodes = std::move(parents);
+		separators = std::move(parent_separators);
+
+		if (n_parents == 1)
+			break;
+	}
+
+	root = level_nodes.front().release();
+}
+
+template <typename LeafType, typename Compare, std::size_t capacity>
+volatile_index<LeafType, Compare, capacity>::~volatile_index()
+{
+	destroy(root);
+}
+
+template <typename LeafType, typename Compare, std::size_t capacity>
+void volatile_index<LeafType, Compare, capacity>::destroy(node_type *node)
+{
+	if (node->level > 1) {
+		for (std::size_t i = 0; i <= node->size; ++i)
+			destroy(node->children[i].inner);
+	}
+	delete node;
+}
+
+template <typename LeafType, typename Compare, std::size_t capacity>
+template <typename K>
+typename volatile_index<LeafType, Compare, capacity>::leaf_type *
+volatile_index<LeafType, Compare, capacity>::find_leaf(const K &key,
+						       const key_compare &comp) const
+{
+	path_type path;
+	return find_leaf(key, comp, path);
+}
+
+/**
+ * Returns leaf which may contain the key, saving the path to it.
+ */
+template <typename LeafType, typename Compare, std::size_t capacity>
+template <typename K>
+typename volatile_index<LeafType, Compare, capacity>::leaf_type *
+volatile_index<LeafType, Compare, capacity>::find_leaf(const K &key,
+						       const key_compare &comp,
+						       path_type &path) const
+{
+	node_type *node = root;
+	path.height = 0;
+	while (true) {
+		auto pos = static_cast<std::size_t>(
+			std::upper_bound(node->keys, node->keys + node->size, key,
+					 [&comp](const K &key, const std::string &sep) {
+						 return comp(key, sep);
+					 }) -
+			node->keys);
+		assert(path.height < MAX_HEIGHT);
+		path.nodes[path.height] = node;
+		path.pos[path.height] = pos;
+		++path.height;
+
+		if (node->level == 1)
+			return node->children[pos].leaf;
+		node = node->children[pos].inner;
+	}
+}
+
+template <typename LeafType, typename Compare, std::size_t capacity>
+typename volatile_index<LeafType, Compare, capacity>::leaf_type *
+volatile_index<LeafType, Compare, capacity>::rightmost_leaf() const
+{
+	node_type *node = root;
+	while (node->level > 1)
+		node = node->children[node->size].inner;
+	return node->children[node->size].leaf;
+}
+
+/**
+ * Inserts 'leaf' as the right neighbour of the leaf at the end of 'path', with
+ * 'separator' as its lower bound. Full nodes on the path are split.
+ */
+template <typename LeafType, typename Compare, std::size_t capacity>
+void volatile_index<LeafType, Compare, capacity>::insert(const path_type &path,
+							 std::string &&separator,
+							 leaf_type *leaf)
+{
+	std::string key = std::move(separator);
+	child_t child;
+	child.leaf = leaf;
+
+	for (std::size_t d = path.height; d-- > 0;) {
+		node_type *node = path.nodes[d];
+		std::size_t pos = path.pos[d] + 1;
+		if (node->size < capacity) {
+			node->insert(pos, std::move(key), child);
+			return;
+		}
+
+		/* move upper half to a new node, then insert into one of them */
+		const std::size_t middle = capacity / 2;
+		std::unique_ptr<node_type> right(new node_type(node->level));
+		right->size = capacity - middle - 1;
+		std::move(node->keys + middle + 1, node->keys + capacity, right->keys);
+		std::copy(node->children + middle + 1, node->children + capacity + 1,
+			  right->children);
+		std::string middle_key = std::move(node->keys[middle]);
+		for (std::size_t i = middle; i < capacity; ++i)
+			node->keys[i].clear();
+		node->size = middle;
+
+		if (pos <= middle + 1)
+			node->insert(pos, std::move(key), child);
+		else
+			right->insert(pos - middle - 1, std::move(key), child);
+
+		key = std::move(middle_key);
+		child.inner = right.release();
+	}
+
+	/* root was split */
+	std::unique_ptr<node_type> new_root(new node_type(root->level + 1));
+	new_root->children[0].inner = root;
+	new_root->children[1] = child;
+	new_root->keys[0] = std::move(key);
+	new_root->size = 1;
+	root = new_root.release();
+}
+
+/**
+ * Removes the leaf at the end of 'path', and inner nodes left without children.
+ *
+ * @pre the leaf is not the only one
+ */
+template <typename LeafType, typename Compare, std::size_t capacity>
+void volatile_index<LeafType, Compare, capacity>::remove(const path_type &path)
+{
+	for (std::size_t d = path.height; d-- > 0;) {
+		node_type *node = path.nodes[d];
+		if (node->size > 0) {
+			node->remove(path.pos[d]);
+			break;
+		}
+		/* the only child is removed, so the node is removed from its parent */
+		assert(d > 0);
+		delete node;
+	}
+
+	while (root->level > 1 && root->size == 0) {
+		node_type *child = root->children[0].inner;
+		delete root;
+		root = child;
+	}
+}
+
+// -------------------------------------------------------------------------------------
+// -------------------------------- hybrid_b_tree_base ---------------------------------
+// -------------------------------------------------------------------------------------
+
+template <typename Key, typename T, typename Compare, std::size_t degree>
+hybrid_b_tree_base<Key, T, Compare, degree>::hybrid_b_tree_base() : index(nullptr)
+{
+	assert(pmemobj_tx_stage() == TX_STAGE_WORK);
+	head = make_persistent<leaf_type>();
+	_size = 0;
+	compress_prefixes = false;
+}
+
+template <typename Key, typename T, typename Compare, std::size_t degree>
+hybrid_b_tree_base<Key, T, Compare, degree>::~hybrid_b_tree_base()
+{
+	try {
+		close();
+		pool_base pop = get_pool_base();
+		pmem::obj::transaction::run(pop, [&] {
+			while (head) {
+				leaf_pptr next = head->get_next();
+				delete_persistent<leaf_type>(head);
+				head = next;
+			}
+		});
+	} catch (transaction_error &e) {
+		std::terminate();
+	}
+}
+
+/**
+ * Builds inner nodes, in 'n_threads' threads. Leaves are listed by following
+ * their links, then separators of neighbouring leaves are computed in parallel.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+void hybrid_b_tree_base<Key, T, Compare, degree>::open(std::size_t n_threads)
+{
+	/* 'index' may be left over from a previous run, it's not used */
+	std::vector<leaf_type *> leaves;
+	for (leaf_type *leaf = head.get(); leaf; leaf = leaf->get_next().get())
+		leaves.push_back(leaf);
+
+	const std::size_t n_separators = leaves.size() - 1;
+	std::vector<std::string> separators(n_separators);
+	n_threads = std::max<std::size_t>(1, std::min(n_threads, n_separators));
+	run_parallel(n_threads, [&](std::size_t t) {
+		std::string left, right;
+		for (std::size_t i = n_separators * t / n_threads;
+		     i < n_separators * (t + 1) / n_threads; ++i)
+			separators[i] = separator(
+				leaves[i]->key(leaves[i]->back(), left),
+				leaves[i + 1]->key(leaves[i + 1]->front(), right));
+	});
+
+	index = new index_type(leaves, separators, n_threads);
+
+	/* the pointer is meaningful only until close(), but pmemcheck expects
+	 * every store to the pool to be persisted */
+	get_pool_base().persist(&index, sizeof(index));
+}
+
+template <typename Key, typename T, typename Compare, std::size_t degree>
+void hybrid_b_tree_base<Key, T, Compare, degree>::close()
+{
+	delete index;
+	index = nullptr;
+	get_pool_base().persist(&index, sizeof(index));
+}
+
+/**
+ * Enables prefix compression of leaves, from their next split on. It's stored
+ * in the tree, so it should be enabled right after the tree is created.
+ *
+ * @pre must be called in a transaction scope.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+void hybrid_b_tree_base<Key, T, Compare, degree>::enable_prefix_compression()
+{
+	assert(pmemobj_tx_stage() == TX_STAGE_WORK);
+	compress_prefixes = true;
+}
+
+template <typename Key, typename T, typename Compare, std::size_t degree>
+template <typename K, typename M>
+std::pair<typename hybrid_b_tree_base<Key, T, Compare, degree>::iterator, bool>
+hybrid_b_tree_base<Key, T, Compare, degree>::try_emplace(K &&key, M &&obj)
+{
+	path_type path;
+	leaf_type *leaf = index->find_leaf(key, compare, path);
+
+	auto leaf_it = leaf->find(key, compare);
+	if (leaf_it != leaf->end())
+		return std::pair<iterator, bool>(iterator(leaf, leaf_it), false);
+
+	if (leaf->full())
+		return split_leaf(leaf, path, std::forward<K>(key), std::forward<M>(obj));
+
+	auto pop = get_pool_base();
+	typename leaf_type::iterator res;
+	pmem::obj::transaction::run(pop, [&] {
+		res = leaf->insert(leaf->lower_bound(key, compare), std::forward<K>(key),
+				   std::forward<M>(obj));
+		++_size;
+	});
+	return std::pair<iterator, bool>(iterator(leaf, res), true);
+}
+
+/**
+ * Moves upper half of the full 'leaf' to a new leaf and inserts the new entry
+ * into one of them, in a single transaction. Prefixes of both leaves are
+ * extended there, if prefix compression is enabled. The new leaf is added to
+ * the index afterwards.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+template <typename K, typename M>
+std::pair<typename hybrid_b_tree_base<Key, T, Compare, degree>::iterator, bool>
+hybrid_b_tree_base<Key, T, Compare, degree>::split_leaf(leaf_type *leaf, path_type &path,
+						   K &&key, M &&obj)
+{
+	assert(leaf->full());
+
+	auto pop = get_pool_base();
+	leaf_pptr leaf_ptr(leaf);
+	leaf_pptr node;
+	typename leaf_type::iterator res;
+	std::string left, right;
+	bool less = compare(key, leaf->key(*(leaf->begin() + leaf->size() / 2), left));
+	pmem::obj::transaction::run(pop, [&] {
+		node = make_persistent<leaf_type>();
+		node->move(pop, leaf_ptr, compare);
+
+		leaf_type *target = less ? leaf : node.get();
+		res = target->insert(target->lower_bound(key, compare),
+				     std::forward<K>(key), std::forward<M>(obj));
+		++_size;
+
+		node->set_next(leaf_ptr->get_next());
+		node->set_prev(leaf_ptr);
+		if (leaf_ptr->get_next())
+			leaf_ptr->get_next()->set_prev(node);
+		leaf_ptr->set_next(node);
+
+		if (compress_prefixes) {
+			leaf->compress_prefix();
+			node->compress_prefix();
+		}
+	});
+
+	index->insert(path,
+		      separator(leaf->key(leaf->back(), left),
+				node->key(node->front(), right)),
+		      node.get());
+
+	return std::pair<iterator, bool>(iterator(less ? leaf : node.get(), res), true);
+}
+
+/**
+ * Returns the shortest prefix of 'right' which is greater than 'left', if the
+ * comparator agrees that it lies between them, and 'right' otherwise.
+ *
+ * @pre left < right
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+std::string hybrid_b_tree_base<Key, T, Compare, degree>::separator(string_view left,
+							      string_view right) const
+{
+	const char *l = left.data();
+	const char *r = right.data();
+	std::size_t common = 0;
+	std::size_t n = std::min(left.size(), right.size());
+	while (common < n && l[common] == r[common])
+		++common;
+
+	std::string sep(r, std::min(common + 1, right.size()));
+	if (sep.size() < right.size() && !(compare(left, sep) && !compare(right, sep)))
+		sep.assign(r, right.size());
+
+	return sep;
+}
+
+/**
+ * Removes all entries, in a single transaction. The tree is left with one empty
+ * leaf, as a new one.
+ *
+ * @pre the index is closed
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+void hybrid_b_tree_base<Key, T, Compare, degree>::clear()
+{
+	auto pop = get_pool_base();
+	pmem::obj::transaction::run(pop, [&] {
+		while (head) {
+			leaf_pptr next = head->get_next();
+			delete_persistent<leaf_type>(head);
+			head = next;
+		}
+		head = make_persistent<leaf_type>();
+		_size = 0;
+	});
+}
+
+template <typename Key, typename T, typename Compare, std::size_t degree>
+template <typename K>
+typename hybrid_b_tree_base<Key, T, Compare, degree>::iterator
+hybrid_b_tree_base<Key, T, Compare, degree>::find(const K &key)
+{
+	leaf_type *leaf = index->find_leaf(key, compare);
+	auto leaf_it = leaf->find(key, compare);
+	if (leaf_it == leaf->end())
+		return end();
+
+	return iterator(leaf, leaf_it);
+}
+
+template <typename Key, typename T, typename Compare, std::size_t degree>
+template <typename K>
+typename hybrid_b_tree_base<Key, T, Compare, degree>::const_iterator
+hybrid_b_tree_base<Key, T, Compare, degree>::find(const K &key) const
+{
+	const leaf_type *leaf = index->find_leaf(key, compare);
+	auto leaf_it = leaf->find(key, compare);
+	if (leaf_it == leaf->cend())
+		return cend();
+
+	return const_iterator(leaf, leaf_it);
+}
+
+/**
+ * Returns an iterator pointing to the least element which is larger than or equal
+ * to the given key. Keys lower than a leaf's separator, but greater than all of
+ * its keys, are found in the next leaf.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+template <typename K>
+typename hybrid_b_tree_base<Key, T, Compare, degree>::iterator
+hybrid_b_tree_base<Key, T, Compare, degree>::lower_bound(const K &key)
+{
+	leaf_type *leaf = index->find_leaf(key, compare);
+	auto leaf_it = leaf->lower_bound(key, compare);
+	if (leaf_it == leaf->end() && leaf->get_next())
+		return iterator(leaf->get_next().get());
+
+	return iterator(leaf, leaf_it);
+}
+
+template <typename Key, typename T, typename Compare, std::size_t degree>
+template <typename K>
+typename hybrid_b_tree_base<Key, T, Compare, degree>::const_iterator
+hybrid_b_tree_base<Key, T, Compare, degree>::lower_bound(const K &key) const
+{
+	const leaf_type *leaf = index->find_leaf(key, compare);
+	auto leaf_it = leaf->lower_bound(key, compare);
+	if (leaf_it == leaf->cend() && leaf->get_next())
+		return const_iterator(leaf->get_next().get());
+
+	return const_iterator(leaf, leaf_it);
+}
+
+/**
+ * Returns an iterator pointing to the least element which is larger than the
+ * given key.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+template <typename K>
+typename hybrid_b_tree_base<Key, T, Compare, degree>::iterator
+hybrid_b_tree_base<Key, T, Compare, degree>::upper_bound(const K &key)
+{
+	leaf_type *leaf = index->find_leaf(key, compare);
+	auto leaf_it = leaf->upper_bound(key, compare);
+	if (leaf_it == leaf->end() && leaf->get_next())
+		return iterator(leaf->get_next().get());
+
+	return iterator(leaf, leaf_it);
+}
+
+template <typename Key, typename T, typename Compare, std::size_t degree>
+template <typename K>
+typename hybrid_b_tree_base<Key, T, Compare, degree>::const_iterator
+hybrid_b_tree_base<Key, T, Compare, degree>::upper_bound(const K &key) const
+{
+	const leaf_type *leaf = index->find_leaf(key, compare);
+	auto leaf_it = leaf->upper_bound(key, compare);
+	if (leaf_it == leaf->cend() && leaf->get_next())
+		return const_iterator(leaf->get_next().get());
+
+	return const_iterator(leaf, leaf_it);
+}
+
+/**
+ * Removes the key. A leaf left empty is unlinked and freed in the same
+ * transaction (unless it's the only one), and then removed from the index.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+template <typename K>
+typename hybrid_b_tree_base<Key, T, Compare, degree>::size_type
+hybrid_b_tree_base<Key, T, Compare, degree>::erase(const K &key)
+{
+	path_type path;
+	leaf_type *leaf = index->find_leaf(key, compare, path);
+	if (leaf->find(key, compare) == leaf->end())
+		return size_type(0);
+
+	auto pop = get_pool_base();
+	leaf_pptr prev = leaf->get_prev();
+	leaf_pptr next = leaf->get_next();
+	bool remove_leaf = leaf->size() == 1 && (prev || next);
+	pmem::obj::transaction::run(pop, [&] {
+		leaf->erase(pop, key, compare);
+		--_size;
+		if (!remove_leaf)
+			return;
+
+		if (prev)
+			prev->set_next(next);
+		else
+			head = next;
+		if (next)
+			next->set_prev(prev);
+		delete_persistent<leaf_type>(leaf_pptr(leaf));
+	});
+
+	if (remove_leaf)
+		index->remove(path);
+
+	return size_type(1);
+}
+
+/**
+ * Fills the empty tree with entries returned by next(key, value), until it
+ * returns false. Leaves are filled with up to 'leaf_size' entries one after
+ * another (and their prefixes compressed, if enabled), up to BULK_LOAD_TX_LEAVES
+ * leaves in a single transaction; next() is called inside of it. The index has
+ * to be built by open() afterwards.
+ *
+ * If next() throws or keys are not sorted, all loaded entries are removed and
+ * the exception is rethrown.
+ *
+ * @pre size() == 0 and the index is closed
+ * @pre 0 < leaf_size <= degree - 1
+ *
+ * @throw std::invalid_argument if keys are not strictly increasing.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+template <typename Source>
+void hybrid_b_tree_base<Key, T, Compare, degree>::bulk_load(Source next,
+							   size_type leaf_size)
+{
+	assert(size() == 0 && !head->get_next());
+	assert(index == nullptr);
+	assert(leaf_size > 0 && leaf_size <= node_capacity);
+
+	auto pop = get_pool_base();
+	leaf_pptr leaf = head;
+	std::string buffer;
+	string_view key, value;
+	try {
+		bool more = next(key, value);
+		while (more) {
+			pmem::obj::transaction::run(pop, [&] {
+				size_type n = 0;
+				for (size_type n_leaves = 0;
+				     more && n_leaves < BULK_LOAD_TX_LEAVES; ++n) {
+					if (leaf->size() > 0 &&
+					    !compare(leaf->key(leaf->back(),
+							       buffer),
+						     key))
+						throw std::invalid_argument(
+							"keys are not sorted");
+
+					if (leaf->size() < leaf_size) {
+						leaf->insert(leaf->end(), key, value);
+					} else {
+						leaf_pptr right =
+							make_persistent<leaf_type>();
+						right->insert(right->end(), key, value);
+						right->set_prev(leaf);
+						leaf->set_next(right);
+						if (compress_prefixes)
+							leaf->compress_prefix();
+						leaf = right;
+						++n_leaves;
+					}
+					more = next(key, value);
+				}
+				if (!more && compress_prefixes)
+					leaf->compress_prefix();
+				_size += n;
+			});
+		}
+	} catch (...) {
+		clear();
+		throw;
+	}
+}
+
+/**
+ * Defragments keys and values stored in approximately 'amount_percent' percent
+ * of leaves, starting from 'start_percent' percent of leaves. Leaves stay in
+ * place, so the index is not affected.
+ *
+ * @throw std::range_error if the range is incorrect.
+ * @throw pmem::defrag_error when a failure during defragmentation occurs.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+pmem::obj::defrag_result
+hybrid_b_tree_base<Key, T, Compare, degree>::defragment(double start_percent,
+						   double amount_percent)
+{
+	if (start_percent < 0 || start_percent >= 100 || amount_percent < 0 ||
+	    amount_percent > 100 || start_percent + amount_percent > 100)
+		throw std::range_error("incorrect range");
+
+	size_type n_leaves = 0;
+	for (leaf_type *leaf = head.get(); leaf; leaf = leaf->get_next().get())
+		++n_leaves;
+
+	auto first = static_cast<size_type>(
+		std::floor(static_cast<double>(n_leaves) * start_percent / 100));
+	auto last = static_cast<size_type>(
+		std::ceil(static_cast<double>(n_leaves) *
+			  (start_percent + amount_percent) / 100));
+
+	pmem::obj::defrag my_defrag(get_pool_base());
+
+	leaf_type *leaf = head.get();
+	for (size_type i = 0; leaf && i < last; ++i) {
+		if (i >= first) {
+			for (auto &entry : *leaf) {
+				my_defrag.add(entry.first);
+				my_defrag.add(entry.second);
+			}
+		}
+		leaf = leaf->get_next().get();
+	}
+
+	return my_defrag.run();
+}
+
+template <typename Key, typename T, typename Compare, std::size_t degree>
+typename hybrid_b_tree_base<Key, T, Compare, degree>::iterator
+hybrid_b_tree_base<Key, T, Compare, degree>::begin()
+{
+	return iterator(head.get());
+}
+
+template <typename Key, typename T, typename Compare, std::size_t degree>
+typename hybrid_b_tree_base<Key, T, Compare, degree>::iterator
+hybrid_b_tree_base<Key, T, Compare, degree>::end()
+{
+	leaf_type *leaf = index->rightmost_leaf();
+	return iterator(leaf, leaf->end());
+}
+
+template <typename Key, typename T, typename Compare, std::size_t degree>
+typename hybrid_b_tree_base<Key, T, Compare, degree>::const_iterator
+hybrid_b_tree_base<Key, T, Compare, degree>::begin() const
+{
+	return const_iterator(head.get());
+}
+
+template <typename Key, typename T, typename Compare, std::size_t degree>
+typename hybrid_b_tree_base<Key, T, Compare, degree>::const_iterator
+hybrid_b_tree_base<Key, T, Compare, degree>::end() const
+{
+	const leaf_type *leaf = index->rightmost_leaf();
+	return const_iterator(leaf, leaf->end());
+}
+
+template <typename Key, typename T, typename Compare, std::size_t degree>
+typename hybrid_b_tree_base<Key, T, Compare, degree>::const_iterator
+hybrid_b_tree_base<Key, T, Compare, degree>::cbegin() const
+{
+	return begin();
+}
+
+template <typename Key, typename T, typename Compare, std::size_t degree>
+typename hybrid_b_tree_base<Key, T, Compare, degree>::const_iterator
+hybrid_b_tree_base<Key, T, Compare, degree>::cend() const
+{
+	return end();
+}
+
+template <typename Key, typename T, typename Compare, std::size_t degree>
+typename hybrid_b_tree_base<Key, T, Compare, degree>::size_type
+hybrid_b_tree_base<Key, T, Compare, degree>::size() const noexcept
+{
+	return _size;
+}
+
+template <typename Key, typename T, typename Compare, std::size_t degree>
+typename hybrid_b_tree_base<Key, T, Compare, degree>::key_compare &
+hybrid_b_tree_base<Key, T, Compare, degree>::key_comp()
+{
+	return compare;
+}
+
+template <typename Key, typename T, typename Compare, std::size_t degree>
+const typename hybrid_b_tree_base<Key, T, Compare, degree>::key_compare &
+hybrid_b_tree_base<Key, T, Compare, degree>::key_comp() const
+{
+	return compare;
+}
+
+template <typename Key, typename T, typename Compare, std::size_t degree>
+pool_base hybrid_b_tree_base<Key, T, Compare, degree>::get_pool_base() const
+{
+	PMEMoid oid = pmemobj_oid(this);
+	return pool_base(pmemobj_pool_by_oid(oid));
+}
+
+} /* namespace internal */
+
+template <typename Key, typename Value, typename Compare = std::less<Key>,
+	  std::size_t degree = 64>
+class hybrid_b_tree : public internal::hybrid_b_tree_base<Key, Value, Compare, degree> {
+private:
+	using base_type = internal::hybrid_b_tree_base<Key, Value, Compare, degree>;
+
+public:
+	/* type definitions */
+	using key_type = typename base_type::key_type;
+	using mapped_type = typename base_type::mapped_type;
+	using value_type = typename base_type::value_type;
+	using iterator = typename base_type::iterator;
+	using const_iterator = typename base_type::const_iterator;
+
+	explicit hybrid_b_tree() : base_type()
+	{
+	}
+
+	hybrid_b_tree(const hybrid_b_tree &) = delete;
+	hybrid_b_tree &operator=(const hybrid_b_tree &) = delete;
+};
+
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* HYBRID_B_TREE */
@@ -1,9 +1,10 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2017-2020, Intel Corporation */
+/* Copyright 2017-2021, Intel Corporation */
 
 #ifndef PERSISTENT_B_TREE
 #define PERSISTENT_B_TREE
 
+#include <libpmemobj++/defrag.hpp>
 #include <libpmemobj++/detail/common.hpp>
 #include <libpmemobj++/detail/life.hpp>
 #include <libpmemobj++/make_persistent.hpp>
@@ -11,12 +12,23 @@
 #include <libpmemobj++/pool.hpp>
 #include <libpmemobj++/transaction.hpp>
 
+#include "../../comparator/comparator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <numeric>
+#include <stdexcept>
+#include <string>
 #include <type_traits>
 #include <vector>
 
 #include <cassert>
 
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 namespace pmem
 {
 namespace kv
@@ -26,6 +38,11 @@ namespace internal
 
 using namespace pmem::obj;
 
+/**
+ * Number of leaves filled in a single transaction by bulk_load() of the trees.
+ */
+const std::size_t BULK_LOAD_TX_LEAVES = 32;
+
 /**
  * Base node type for inner and leaf node types
  */
@@ -106,6 +123,28 @@ private:
 	size_type position;
 }; /* class node_iterator */
 
+/**
+ * True if Compare provides a static fingerprint(key) method, returning a 1-byte
+ * hash of a key, equal for all keys which compare equal. Leaves store fingerprints
+ * of their keys then, and point lookups compare only the keys with a matching
+ * fingerprint.
+ */
+template <typename Compare, typename Key, typename = void>
+struct has_fingerprint : std::false_type {
+};
+
+template <typename Compare, typename Key>
+struct has_fingerprint<Compare, Key,
+		       decltype(void(Compare::fingerprint(std::declval<const Key &>())))>
+    : std::true_type {
+};
+
+/**
+ * Leaf of b_tree and hybrid_b_tree. Keys in entries may share a prefix, which is
+ * then stored once per leaf and entries hold only the rest of keys (see
+ * set_prefix). Leaves of b_tree never have a prefix, as its inner nodes point to
+ * keys stored in leaves.
+ */
 template <typename Key, typename T, typename Compare, uint64_t capacity>
 class leaf_node_t : public node_t {
 public:
@@ -137,10 +176,21 @@ public:
 	const_iterator find(const K &key, const key_compare &) const;
 	template <typename K>
 	iterator lower_bound(const K &key, const key_compare &comp);
+	template <typename K>
+	const_iterator lower_bound(const K &key, const key_compare &comp) const;
+	template <typename K>
+	iterator upper_bound(const K &key, const key_compare &comp);
+	template <typename K>
+	const_iterator upper_bound(const K &key, const key_compare &comp) const;
 
 	template <typename K>
 	size_type erase(pool_base &pop, const K &key, const key_compare &);
 
+	string_view key(const_reference entry, std::string &buffer) const;
+	const key_type &get_prefix() const;
+	void set_prefix(string_view new_prefix);
+	void compress_prefix();
+
 	iterator begin();
 	const_iterator begin() const;
 	const_iterator cbegin() const;
@@ -168,7 +218,11 @@ private:
 	};
 	/* array of indexes to support ordering */
 	pmem::obj::array<difference_type, capacity> idxs;
+	/* fingerprints of keys, by position in entries (see has_fingerprint) */
+	pmem::obj::array<uint8_t, capacity> fps;
 	pmem::obj::p<size_type> _size;
+	/* common prefix of keys, not stored in entries */
+	key_type prefix;
 	/* persistent pointers to the neighboring leafs */
 	pmem::obj::persistent_ptr<leaf_node_t> prev;
 	pmem::obj::persistent_ptr<leaf_node_t> next;
@@ -176,6 +230,17 @@ private:
 	/* private helper methods */
 	template <typename... Args>
 	pointer emplace(difference_type pos, Args &&... args);
+	void set_fingerprint(difference_type pos, std::true_type);
+	void set_fingerprint(difference_type pos, std::false_type);
+	template <typename K>
+	size_type find_idx(const K &key, const key_compare &, std::true_type) const;
+	template <typename K>
+	size_type find_idx(const K &key, const key_compare &, std::false_type) const;
+	uint64_t match_fingerprint(uint8_t fp) const;
+	template <typename K>
+	bool has_prefix(const K &key) const;
+	template <typename K>
+	string_view suffix(const K &key) const;
 	size_type insert_idx(const_iterator pos);
 	void remove_idx(size_type idx);
 	void internal_erase(pool_base &pop, iterator it);
@@ -216,6 +281,7 @@ public:
 	void replace(iterator it, const K &key);
 	void delete_with_child(iterator it, bool left);
 	void inherit_child(iterator it, node_pptr &child, bool left);
+	void append(const_reference key, const node_pptr &child);
 	void update_splitted_child(pool_base &pop, const_reference key,
 				   node_pptr &left_child, node_pptr &right_child,
 				   const key_compare &);
@@ -288,6 +354,8 @@ public:
 	reference operator*() const;
 	pointer operator->() const;
 
+	string_view key(std::string &buffer) const;
+
 private:
 	leaf_node_ptr current_node;
 	leaf_iterator leaf_it;
@@ -349,6 +417,12 @@ public:
 	template <typename K>
 	size_type erase(const K &key);
 
+	template <typename Source>
+	void bulk_load(Source next, size_type leaf_size);
+
+	pmem::obj::defrag_result defragment(double start_percent = 0,
+					    double amount_percent = 100);
+
 	iterator begin();
 	iterator end();
 	const_iterator begin() const;
@@ -410,6 +484,10 @@ private:
 	void delete_inner_ext(inner_pptr &node, inner_pair &parent,
 			      std::pair<node_pptr, node_pptr> &neighbors,
 			      bool has_left_sibling);
+	void append_rightmost(std::vector<inner_type *> &spine, const key_type *key,
+			      node_pptr child);
+	void clear();
+	void delete_subtree(node_pptr &node);
 
 	static inner_pptr &cast_inner(node_pptr &node);
 	static inner_type *cast_inner(node_t *node);
@@ -590,6 +668,7 @@ leaf_node_t<Key, T, Compare, capacity>::leaf_node_t() : node_t()
 {
 	assert(pmemobj_tx_stage() == TX_STAGE_WORK);
 	std::iota(idxs.begin(), idxs.end(), 0);
+	std::fill(fps.begin(), fps.end(), 0);
 	_size = 0;
 }
 
@@ -633,6 +712,8 @@ void leaf_node_t<Key, T, Compare, capacity>::move(pool_base &pop,
 	pmem::obj::transaction::run(pop, [&] {
 		/* add range to tx before moving to avoid sequential snapshotting */
 		other->add_to_tx(middle_idx, other->size());
+		/* moved entries hold suffixes of the same keys */
+		prefix = other->prefix;
 		difference_type count = 0;
 		while (temp != last) {
 			emplace(count++, *temp++);
@@ -644,18 +725,80 @@ void leaf_node_t<Key, T, Compare, capacity>::move(pool_base &pop,
 	assert(is_sorted(comp));
 }
 
+/**
+ * Keys which do not start with the prefix are lower or greater than all keys in
+ * the leaf (a prefix is set only if keys are compared byte by byte). Others are
+ * compared without it.
+ */
 template <typename Key, typename T, typename Compare, uint64_t capacity>
 template <typename K>
 typename leaf_node_t<Key, T, Compare, capacity>::iterator
 leaf_node_t<Key, T, Compare, capacity>::lower_bound(const K &key, const key_compare &comp)
 {
-	return std::lower_bound(
-		begin(), end(), key,
-		[&comp](const_reference e, const K &key) { return comp(e.first, key); });
+	if (!has_prefix(key))
+		return make_string_view(key).compare(make_string_view(prefix)) < 0
+			? begin()
+			: end();
+
+	return std::lower_bound(begin(), end(), suffix(key),
+				[&comp](const_reference e, string_view key) {
+					return comp(e.first, key);
+				});
+}
+
+template <typename Key, typename T, typename Compare, uint64_t capacity>
+template <typename K>
+typename leaf_node_t<Key, T, Compare, capacity>::const_iterator
+leaf_node_t<Key, T, Compare, capacity>::lower_bound(const K &key,
+						    const key_compare &comp) const
+{
+	if (!has_prefix(key))
+		return make_string_view(key).compare(make_string_view(prefix)) < 0
+			? cbegin()
+			: cend();
+
+	return std::lower_bound(cbegin(), cend(), suffix(key),
+				[&comp](const_reference e, string_view key) {
+					return comp(e.first, key);
+				});
+}
+
+template <typename Key, typename T, typename Compare, uint64_t capacity>
+template <typename K>
+typename leaf_node_t<Key, T, Compare, capacity>::iterator
+leaf_node_t<Key, T, Compare, capacity>::upper_bound(const K &key, const key_compare &comp)
+{
+	if (!has_prefix(key))
+		return make_string_view(key).compare(make_string_view(prefix)) < 0
+			? begin()
+			: end();
+
+	return std::upper_bound(begin(), end(), suffix(key),
+				[&comp](string_view key, const_reference e) {
+					return comp(key, e.first);
+				});
+}
+
+template <typename Key, typename T, typename Compare, uint64_t capacity>
+template <typename K>
+typename leaf_node_t<Key, T, Compare, capacity>::const_iterator
+leaf_node_t<Key, T, Compare, capacity>::upper_bound(const K &key,
+						    const key_compare &comp) const
+{
+	if (!has_prefix(key))
+		return make_string_view(key).compare(make_string_view(prefix)) < 0
+			? cbegin()
+			: cend();
+
+	return std::upper_bound(cbegin(), cend(), suffix(key),
+				[&comp](string_view key, const_reference e) {
+					return comp(key, e.first);
+				});
 }
 
 /**
- * Inserts element into the leaf in a sorted way specified by idxs_pos.
+ * Inserts element into the leaf in a sorted way specified by idxs_pos. If the key
+ * does not start with the prefix, the prefix is shortened.
  *
  * @pre key must not already exist in the leaf.
  */
@@ -670,8 +813,16 @@ leaf_node_t<Key, T, Compare, capacity>::insert(iterator idxs_pos, K &&key, M &&o
 	assert(std::none_of(
 		idxs.cdata(), idxs.cdata() + size(),
 		[&insert_pos](difference_type idx) { return insert_pos == idx; }));
+	if (!has_prefix(key)) {
+		auto k = make_string_view(key);
+		size_type common = 0;
+		size_type n = std::min(k.size(), prefix.size());
+		while (common < n && k.data()[common] == prefix.c_str()[common])
+			++common;
+		set_prefix(string_view(k.data(), common));
+	}
 	// insert an entry to the end
-	emplace(insert_pos, std::forward<K>(key), std::forward<M>(obj));
+	emplace(insert_pos, suffix(key), std::forward<M>(obj));
 	// update idxs & return iterator
 	return iterator(this, insert_idx(idxs_pos));
 }
@@ -681,12 +832,11 @@ template <typename K>
 typename leaf_node_t<Key, T, Compare, capacity>::iterator
 leaf_node_t<Key, T, Compare, capacity>::find(const K &key, const key_compare &comp)
 {
-	iterator it = lower_bound(key, comp);
-	if (it != end() && (!comp(it->first, key) && !comp(key, it->first))) {
-		return it;
-	} else {
+	if (!has_prefix(key))
 		return end();
-	}
+
+	return iterator(this, find_idx(suffix(key), comp,
+				       has_fingerprint<key_compare, key_type>()));
 }
 
 template <typename Key, typename T, typename Compare, uint64_t capacity>
@@ -694,12 +844,11 @@ template <typename K>
 typename leaf_node_t<Key, T, Compare, capacity>::const_iterator
 leaf_node_t<Key, T, Compare, capacity>::find(const K &key, const key_compare &comp) const
 {
-	const_iterator it = lower_bound(key, comp);
-	if (it != cend() && (!comp(it->first, key) && !comp(key, it->first))) {
-		return it;
-	} else {
+	if (!has_prefix(key))
 		return cend();
-	}
+
+	return const_iterator(this, find_idx(suffix(key), comp,
+					     has_fingerprint<key_compare, key_type>()));
 }
 
 template <typename Key, typename T, typename Compare, uint64_t capacity>
@@ -864,7 +1013,220 @@ leaf_node_t<Key, T, Compare, capacity>::emplace(difference_type pos, Args &&...
 	/* to avoid snapshotting of an uninitialized memory */
 	pmemobj_tx_xadd_range_direct(entries + pos, sizeof(value_type),
 				     POBJ_XADD_NO_SNAPSHOT);
-	return new (entries + pos) value_type(std::forward<Args>(args)...);
+	pointer entry = new (entries + pos) value_type(std::forward<Args>(args)...);
+	set_fingerprint(pos, has_fingerprint<key_compare, key_type>());
+	return entry;
+}
+
+/**
+ * Stores fingerprint of the key constructed in position 'pos' of entries.
+ *
+ * @pre must be called in a transaction scope.
+ */
+template <typename Key, typename T, typename Compare, uint64_t capacity>
+void leaf_node_t<Key, T, Compare, capacity>::set_fingerprint(difference_type pos,
+							     std::true_type)
+{
+	/* fps.cdata() does not add the whole array to the transaction */
+	auto fp = const_cast<uint8_t *>(fps.cdata()) + pos;
+	/* the entry is not in idxs yet, so its old fingerprint is never read */
+	pmemobj_tx_xadd_range_direct(fp, sizeof(*fp), POBJ_XADD_NO_SNAPSHOT);
+	*fp = key_compare::fingerprint(entries[pos].first);
+}
+
+template <typename Key, typename T, typename Compare, uint64_t capacity>
+void leaf_node_t<Key, T, Compare, capacity>::set_fingerprint(difference_type,
+							     std::false_type)
+{
+}
+
+/**
+ * Returns position of the key in idxs, or size() if it's not in the leaf.
+ * Only keys with a matching fingerprint are compared.
+ */
+template <typename Key, typename T, typename Compare, uint64_t capacity>
+template <typename K>
+typename leaf_node_t<Key, T, Compare, capacity>::size_type
+leaf_node_t<Key, T, Compare, capacity>::find_idx(const K &key, const key_compare &comp,
+						 std::true_type) const
+{
+	uint64_t candidates = match_fingerprint(key_compare::fingerprint(key));
+	if (!candidates)
+		return size();
+
+	for (size_type i = 0; i < size(); ++i) {
+		auto pos = idxs[i];
+		if (!(candidates & (uint64_t(1) << pos)))
+			continue;
+		const key_type &k = entries[pos].first;
+		if (!comp(k, key) && !comp(key, k))
+			return i;
+	}
+	return size();
+}
+
+/**
+ * Returns position of the key in idxs, or size() if it's not in the leaf.
+ */
+template <typename Key, typename T, typename Compare, uint64_t capacity>
+template <typename K>
+typename leaf_node_t<Key, T, Compare, capacity>::size_type
+leaf_node_t<Key, T, Compare, capacity>::find_idx(const K &key, const key_compare &comp,
+						 std::false_type) const
+{
+	auto it = std::lower_bound(
+		cbegin(), cend(), key,
+		[&comp](const_reference e, const K &key) { return comp(e.first, key); });
+	if (it != cend() && !comp(key, it->first))
+		return static_cast<size_type>(std::distance(cbegin(), it));
+	return size();
+}
+
+/**
+ * Returns bitmask of positions in entries with the given fingerprint (including
+ * the unused ones). Fingerprints are compared 32 or 16 at a time if AVX2 or SSE2
+ * is available at build time.
+ */
+template <typename Key, typename T, typename Compare, uint64_t capacity>
+uint64_t leaf_node_t<Key, T, Compare, capacity>::match_fingerprint(uint8_t fp) const
+{
+	static_assert(capacity <= 64, "fingerprints mask does not fit in uint64_t");
+
+	const uint8_t *data = fps.cdata();
+	uint64_t mask = 0;
+	size_type pos = 0;
+#ifdef __AVX2__
+	const __m256i needle256 = _mm256_set1_epi8(static_cast<char>(fp));
+	for (; pos + 32 <= capacity; pos += 32) {
+		auto chunk = _mm256_loadu_si256(
+			reinterpret_cast<const __m256i *>(data + pos));
+		auto bits = static_cast<uint32_t>(
+			_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle256)));
+		mask |= uint64_t(bits) << pos;
+	}
+#endif
+#ifdef __SSE2__
+	const __m128i needle128 = _mm_set1_epi8(static_cast<char>(fp));
+	for (; pos + 16 <= capacity; pos += 16) {
+		auto chunk =
+			_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos));
+		auto bits = static_cast<uint32_t>(
+			_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle128)));
+		mask |= uint64_t(bits) << pos;
+	}
+#endif
+	for (; pos < capacity; ++pos)
+		if (data[pos] == fp)
+			mask |= uint64_t(1) << pos;
+	return mask;
+}
+
+/**
+ * Returns true if the key starts with the prefix (always, if there's none).
+ */
+template <typename Key, typename T, typename Compare, uint64_t capacity>
+template <typename K>
+bool leaf_node_t<Key, T, Compare, capacity>::has_prefix(const K &key) const
+{
+	if (prefix.size() == 0)
+		return true;
+
+	auto k = make_string_view(key);
+	return k.size() >= prefix.size() &&
+		std::memcmp(k.data(), prefix.c_str(), prefix.size()) == 0;
+}
+
+/**
+ * Returns part of the key following the prefix.
+ *
+ * @pre has_prefix(key)
+ */
+template <typename Key, typename T, typename Compare, uint64_t capacity>
+template <typename K>
+string_view leaf_node_t<Key, T, Compare, capacity>::suffix(const K &key) const
+{
+	auto k = make_string_view(key);
+	return string_view(k.data() + prefix.size(), k.size() - prefix.size());
+}
+
+/**
+ * Returns the whole key of an entry of this leaf. If the leaf has a prefix, the
+ * key is assembled in 'buffer'.
+ */
+template <typename Key, typename T, typename Compare, uint64_t capacity>
+string_view leaf_node_t<Key, T, Compare, capacity>::key(const_reference entry,
+							std::string &buffer) const
+{
+	if (prefix.size() == 0)
+		return make_string_view(entry.first);
+
+	buffer.assign(prefix.c_str(), prefix.size());
+	buffer.append(entry.first.c_str(), entry.first.size());
+	return string_view(buffer.data(), buffer.size());
+}
+
+template <typename Key, typename T, typename Compare, uint64_t capacity>
+const typename leaf_node_t<Key, T, Compare, capacity>::key_type &
+leaf_node_t<Key, T, Compare, capacity>::get_prefix() const
+{
+	return prefix;
+}
+
+/**
+ * Replaces the prefix with 'new_prefix', rewriting suffixes of keys (and their
+ * fingerprints). A prefix must be set only if keys are compared byte by byte.
+ *
+ * @pre all keys in the leaf start with new_prefix.
+ * @pre must be called in a transaction scope.
+ */
+template <typename Key, typename T, typename Compare, uint64_t capacity>
+void leaf_node_t<Key, T, Compare, capacity>::set_prefix(string_view new_prefix)
+{
+	assert(pmemobj_tx_stage() == TX_STAGE_WORK);
+
+	/* fingerprints of entries in idxs are read after an abort */
+	pmemobj_tx_add_range_direct(fps.cdata(), sizeof(uint8_t) * capacity);
+
+	std::string key;
+	for (size_type i = 0; i < size(); ++i) {
+		auto pos = idxs.cdata()[i];
+		key_type &entry_key = entries[pos].first;
+		key.assign(prefix.c_str(), prefix.size());
+		key.append(entry_key.c_str(), entry_key.size());
+		assert(key.compare(0, new_prefix.size(), new_prefix.data(),
+				   new_prefix.size()) == 0);
+		entry_key.assign(key.data() + new_prefix.size(),
+				 key.size() - new_prefix.size());
+		set_fingerprint(pos, has_fingerprint<key_compare, key_type>());
+	}
+
+	prefix.assign(new_prefix.data(), new_prefix.size());
+}
+
+/**
+ * Extends the prefix to the longest one shared by keys in the leaf, i.e. by
+ * the first and the last one.
+ *
+ * @pre must be called in a transaction scope.
+ */
+template <typename Key, typename T, typename Compare, uint64_t capacity>
+void leaf_node_t<Key, T, Compare, capacity>::compress_prefix()
+{
+	if (size() < 2)
+		return;
+
+	const key_type &first = front().first;
+	const key_type &last = back().first;
+	size_type common = 0;
+	size_type n = std::min(first.size(), last.size());
+	while (common < n && first.c_str()[common] == last.c_str()[common])
+		++common;
+	if (common == 0)
+		return;
+
+	std::string new_prefix(prefix.c_str(), prefix.size());
+	new_prefix.append(first.c_str(), common);
+	set_prefix(string_view(new_prefix.data(), new_prefix.size()));
 }
 
 /**
@@ -1090,6 +1452,23 @@ void inner_node_t<Key, Compare, capacity>::inherit_child(iterator it, node_pptr
 	}
 }
 
+/**
+ * Adds child after the last one, with key as its lower bound (used by bulk_load).
+ *
+ * @pre !full() and key is greater than all keys in the node's subtree.
+ */
+template <typename Key, typename Compare, uint64_t capacity>
+void inner_node_t<Key, Compare, capacity>::append(const_reference key,
+						  const node_pptr &child)
+{
+	assert(pmemobj_tx_stage() == TX_STAGE_WORK);
+	assert(!full());
+
+	entries[size()] = pmem::obj::persistent_ptr<key_type>(&key);
+	children[size() + 1] = child;
+	++_size;
+}
+
 template <typename Key, typename Compare, uint64_t capacity>
 template <typename K>
 const typename inner_node_t<Key, Compare, capacity>::node_pptr &
@@ -1393,6 +1772,16 @@ typename b_tree_iterator<LeafType, is_const>::pointer
 	return &**this;
 }
 
+/**
+ * Returns the key of the current entry. If its leaf has a prefix, the whole key
+ * is assembled in 'buffer' (and is valid until the buffer changes).
+ */
+template <typename LeafType, bool is_const>
+string_view b_tree_iterator<LeafType, is_const>::key(std::string &buffer) const
+{
+	return current_node->key(*leaf_it, buffer);
+}
+
 // -------------------------------------------------------------------------------------
 // ------------------------------------- b_tree_base -----------------------------------
 // -------------------------------------------------------------------------------------
@@ -1490,7 +1879,7 @@ typename b_tree_base<Key, T, Compare, degree>::const_iterator
 b_tree_base<Key, T, Compare, degree>::find(const K &key) const
 {
 	leaf_type *leaf = find_leaf_node(key);
-	typename leaf_type::const_iterator leaf_it = leaf->find(key);
+	typename leaf_type::const_iterator leaf_it = leaf->find(key, compare);
 	if (leaf->cend() == leaf_it)
 		return cend();
 
@@ -1686,6 +2075,79 @@ void b_tree_base<Key, T, Compare, degree>::delete_inner_ext(
 	deallocate(node);
 }
 
+/**
+ * Adds child (whose lowest key is 'key') after the rightmost node of its level,
+ * spine holds the rightmost inner node of each level above. If such a node is
+ * full, its last child is moved to a new right neighbour, together with the new
+ * child, and the neighbour is added to the level above in the same way.
+ *
+ * @pre must be called in a transaction scope.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+void b_tree_base<Key, T, Compare, degree>::append_rightmost(
+	std::vector<inner_type *> &spine, const key_type *key, node_pptr child)
+{
+	assert(pmemobj_tx_stage() == TX_STAGE_WORK);
+
+	for (size_type level = 0; level < spine.size(); ++level) {
+		inner_type *parent = spine[level];
+		if (!parent->full()) {
+			parent->append(*key, child);
+			return;
+		}
+
+		const key_type *parent_key = &parent->back();
+		node_pptr last_child = parent->get_left_child(parent->end());
+		parent->delete_with_child(parent->end() - 1, false);
+
+		node_pptr right;
+		cast_inner(right) =
+			allocate_inner(parent->level(), *key, last_child, child);
+		spine[level] = cast_inner(right.get());
+		key = parent_key;
+		child = right;
+	}
+
+	node_pptr old_root = root;
+	create_new_root(*key, old_root, child);
+	spine.push_back(cast_inner(root.get()));
+}
+
+/**
+ * Removes all entries, in a single transaction. The tree is left with one empty
+ * leaf, as a new one.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+void b_tree_base<Key, T, Compare, degree>::clear()
+{
+	auto pop = get_pool_base();
+	pmem::obj::transaction::run(pop, [&] {
+		delete_subtree(root);
+		cast_leaf(root) = allocate_leaf();
+		_size = 0;
+	});
+}
+
+/**
+ * Deallocates the node and all nodes below it.
+ *
+ * @pre must be called in a transaction scope.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+void b_tree_base<Key, T, Compare, degree>::delete_subtree(node_pptr &node)
+{
+	assert(pmemobj_tx_stage() == TX_STAGE_WORK);
+
+	if (!node->leaf()) {
+		inner_type *inner = cast_inner(node.get());
+		for (size_type i = 0; i <= inner->size(); ++i) {
+			node_pptr child = inner->get_left_child(inner->begin() + i);
+			delete_subtree(child);
+		}
+	}
+	deallocate(node);
+}
+
 /**
  * Erases entry specified by key from the tree.
  */
@@ -1757,6 +2219,124 @@ b_tree_base<Key, T, Compare, degree>::erase(const K &key)
 	return result;
 }
 
+/**
+ * Fills the empty tree with entries returned by next(key, value), until it
+ * returns false. Leaves are filled with up to 'leaf_size' entries one after
+ * another and inner nodes are built bottom-up, along the right edge of the tree,
+ * so nothing is searched or split. Up to BULK_LOAD_TX_LEAVES leaves are filled
+ * in a single transaction, next() is called inside of it.
+ *
+ * If next() throws or keys are not sorted, all loaded entries are removed and
+ * the exception is rethrown.
+ *
+ * @pre size() == 0
+ * @pre 0 < leaf_size <= degree - 1
+ *
+ * @throw std::invalid_argument if keys are not strictly increasing.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+template <typename Source>
+void b_tree_base<Key, T, Compare, degree>::bulk_load(Source next, size_type leaf_size)
+{
+	assert(size() == 0);
+	assert(leaf_size > 0 && leaf_size <= node_capacity);
+
+	/* inner nodes of an emptied tree may be left */
+	if (!root->leaf())
+		clear();
+
+	auto pop = get_pool_base();
+	/* the rightmost inner node of each level, from the lowest one */
+	std::vector<inner_type *> spine;
+	leaf_pptr leaf = cast_leaf(root);
+	std::string buffer;
+	string_view key, value;
+	try {
+		bool more = next(key, value);
+		while (more) {
+			pmem::obj::transaction::run(pop, [&] {
+				size_type n = 0;
+				for (size_type n_leaves = 0;
+				     more && n_leaves < BULK_LOAD_TX_LEAVES; ++n) {
+					if (leaf->size() > 0 &&
+					    !compare(leaf->key(leaf->back(),
+							       buffer),
+						     key))
+						throw std::invalid_argument(
+							"keys are not sorted");
+
+					if (leaf->size() < leaf_size) {
+						leaf->insert(leaf->end(), key, value);
+					} else {
+						leaf_pptr right = allocate_leaf();
+						right->insert(right->end(), key, value);
+						right->set_prev(leaf);
+						leaf->set_next(right);
+						append_rightmost(
+							spine, &right->front().first,
+							cast_node(right));
+						leaf = right;
+						++n_leaves;
+					}
+					more = next(key, value);
+				}
+				_size += n;
+			});
+		}
+	} catch (...) {
+		clear();
+		throw;
+	}
+}
+
+/**
+ * Defragments keys and values stored in approximately 'amount_percent' percent
+ * of leaves, starting from 'start_percent' percent of leaves.
+ *
+ * Only the out-of-line buffers of keys and values are relocated. Nodes stay in
+ * place, because leaves are referenced by their neighbours and inner nodes
+ * point directly to the keys stored inside leaves.
+ *
+ * Not thread-safe, must be called outside of a transaction.
+ *
+ * @throw std::range_error if the range is incorrect.
+ * @throw pmem::defrag_error when a failure during defragmentation occurs.
+ */
+template <typename Key, typename T, typename Compare, std::size_t degree>
+pmem::obj::defrag_result
+b_tree_base<Key, T, Compare, degree>::defragment(double start_percent,
+						 double amount_percent)
+{
+	if (start_percent < 0 || start_percent >= 100 || amount_percent < 0 ||
+	    amount_percent > 100 || start_percent + amount_percent > 100)
+		throw std::range_error("incorrect range");
+
+	size_type n_leaves = 0;
+	for (leaf_type *leaf = leftmost_leaf(); leaf; leaf = leaf->get_next().get())
+		++n_leaves;
+
+	auto first = static_cast<size_type>(
+		std::floor(static_cast<double>(n_leaves) * start_percent / 100));
+	auto last = static_cast<size_type>(
+		std::ceil(static_cast<double>(n_leaves) *
+			  (start_percent + amount_percent) / 100));
+
+	pmem::obj::defrag my_defrag(get_pool_base());
+
+	leaf_type *leaf = leftmost_leaf();
+	for (size_type i = 0; leaf && i < last; ++i) {
+		if (i >= first) {
+			for (auto &entry : *leaf) {
+				my_defrag.add(entry.first);
+				my_defrag.add(entry.second);
+			}
+		}
+		leaf = leaf->get_next().get();
+	}
+
+	return my_defrag.run();
+}
+
 template <typename Key, typename T, typename Compare, std::size_t degree>
 typename b_tree_base<Key, T, Compare, degree>::iterator
 b_tree_base<Key, T, Compare, degree>::begin()
@@ -2223,6 +2803,8 @@ private:
 
 public:
 	using base_type::begin;
+	using base_type::bulk_load;
+	using base_type::defragment;
 	using base_type::end;
 	using base_type::erase;
 	using base_type::find;
@@ -1,34 +1,93 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2017-2019, Intel Corporation */
+/* Copyright 2017-2021, Intel Corporation */
 
 #include "tree3.h"
 #include "../out.h"
+#include "../parallel.h"
 
 #include <algorithm>
 #include <cassert>
 #include <cstring>
+#include <exception>
 #include <iostream>
-#include <list>
+#include <string>
+#include <thread>
 #include <unistd.h>
 
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 namespace pmem
 {
 namespace kv
 {
+namespace internal
+{
+namespace tree3
+{
+
+// changes tree_version for a split of inner nodes (also if an exception is thrown)
+class KVVersionGuard {
+public:
+	KVVersionGuard(std::atomic<std::uint64_t> &v)
+	    : version(v), start(v.load(std::memory_order_relaxed))
+	{
+		assert(start % 2 == 0);
+		version.store(start + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+
+	~KVVersionGuard()
+	{
+		version.store(start + 2, std::memory_order_release);
+	}
+
+private:
+	std::atomic<std::uint64_t> &version;
+	const std::uint64_t start;
+};
+
+/*
+ * The pool's root object holds node sizes of the tree (see root_type) instead of the
+ * list of leaves, so the layout was bumped along with it; pools of the former layout
+ * fail to open instead of being misread.
+ */
+static const char *layout()
+{
+	return "pmemkv_tree3_v2";
+}
 
-tree3::tree3(std::unique_ptr<internal::config> cfg)
-    : pmemobj_engine_base(cfg, "pmemkv_tree3")
+} /* namespace tree3 */
+} /* namespace internal */
+
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+basic_tree3<LeafKeys, InnerKeys>::basic_tree3(std::unique_ptr<internal::config> cfg,
+					      internal::pmemobj_pool pool)
+    : pmemobj_engine_base(cfg, internal::tree3::layout(), std::move(pool)),
+      tree_version(0),
+      leaves_head(nullptr),
+      leaves_tail(nullptr),
+      n_elements(0)
 {
-	Recover();
+	uint64_t recovery_threads;
+	if (!cfg->get_uint64("recovery_threads", &recovery_threads))
+		recovery_threads = std::thread::hardware_concurrency();
+
+	internal::stopwatch recover_time;
+	Recover(std::max<std::size_t>(1, recovery_threads));
+	add_open_phase("recover", recover_time.lap());
 	LOG("Started ok");
 }
 
-tree3::~tree3()
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+basic_tree3<LeafKeys, InnerKeys>::~basic_tree3()
 {
 	LOG("Stopped ok");
 }
 
-std::string tree3::name()
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+std::string basic_tree3<LeafKeys, InnerKeys>::name()
 {
 	return "tree3";
 }
@@ -37,130 +96,249 @@ std::string tree3::name()
 // KEY/VALUE METHODS
 // ===============================================================================================
 
-status tree3::count_all(std::size_t &cnt)
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+status basic_tree3<LeafKeys, InnerKeys>::count_all(std::size_t &cnt)
 {
 	LOG("count_all");
 	check_outside_tx();
-	std::size_t result = 0;
-	auto leaf = (pmem::kv::internal::tree3::KVLeaf *)pmemobj_direct(*root_oid);
-	while (leaf) {
-		for (int slot = LEAF_KEYS; slot--;) {
-			auto kvslot = leaf->slots[slot].get_ro();
-			if (kvslot.empty() || kvslot.hash() == 0)
-				continue;
-			result++;
-		}
-		leaf = leaf->next.get(); // advance to next linked leaf
-	}
-
-	cnt = result;
+	cnt = n_elements.load(std::memory_order_relaxed);
 
 	return status::OK;
 }
 
-status tree3::get_all(get_kv_callback *callback, void *arg)
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+status basic_tree3<LeafKeys, InnerKeys>::count_above(string_view key, std::size_t &cnt)
+{
+	LOG("count_above for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	const std::string lower(key.data(), key.size());
+	internal::tree3::KVRange range;
+	range.lower = &lower;
+
+	return LeafCount(range, cnt);
+}
+
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+status basic_tree3<LeafKeys, InnerKeys>::count_equal_above(string_view key,
+							   std::size_t &cnt)
+{
+	LOG("count_equal_above for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	const std::string lower(key.data(), key.size());
+	internal::tree3::KVRange range;
+	range.lower = &lower;
+	range.lower_inclusive = true;
+
+	return LeafCount(range, cnt);
+}
+
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+status basic_tree3<LeafKeys, InnerKeys>::count_equal_below(string_view key,
+							   std::size_t &cnt)
+{
+	LOG("count_equal_below for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	const std::string upper(key.data(), key.size());
+	internal::tree3::KVRange range;
+	range.upper = &upper;
+	range.upper_inclusive = true;
+
+	return LeafCount(range, cnt);
+}
+
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+status basic_tree3<LeafKeys, InnerKeys>::count_below(string_view key, std::size_t &cnt)
+{
+	LOG("count_below for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	const std::string upper(key.data(), key.size());
+	internal::tree3::KVRange range;
+	range.upper = &upper;
+
+	return LeafCount(range, cnt);
+}
+
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+status basic_tree3<LeafKeys, InnerKeys>::count_between(string_view key1, string_view key2,
+						       std::size_t &cnt)
+{
+	LOG("count_between key range=[" << std::string(key1.data(), key1.size()) << ","
+					<< std::string(key2.data(), key2.size()) << ")");
+	check_outside_tx();
+	const std::string lower(key1.data(), key1.size());
+	const std::string upper(key2.data(), key2.size());
+	internal::tree3::KVRange range;
+	range.lower = &lower;
+	range.upper = &upper;
+
+	return LeafCount(range, cnt);
+}
+
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+status basic_tree3<LeafKeys, InnerKeys>::get_all(get_kv_callback *callback, void *arg)
 {
 	LOG("get_all");
 	check_outside_tx();
-	auto leaf = (pmem::kv::internal::tree3::KVLeaf *)pmemobj_direct(*root_oid);
-	while (leaf) {
-		for (int slot = LEAF_KEYS; slot--;) {
-			auto kvslot = leaf->slots[slot].get_ro();
-			if (kvslot.empty() || kvslot.hash() == 0)
-				continue;
-			auto ret = callback(kvslot.key(), kvslot.get_ks(), kvslot.val(),
-					    kvslot.get_vs(), arg);
-			if (ret != 0)
-				return status::STOPPED_BY_CB;
-		}
-		leaf = leaf->next.get(); // advance to next linked leaf
-	}
 
-	return status::OK;
+	return LeafGet(internal::tree3::KVRange(), callback, arg);
+}
+
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+status basic_tree3<LeafKeys, InnerKeys>::get_above(string_view key,
+						   get_kv_callback *callback, void *arg)
+{
+	LOG("get_above for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	const std::string lower(key.data(), key.size());
+	internal::tree3::KVRange range;
+	range.lower = &lower;
+
+	return LeafGet(range, callback, arg);
+}
+
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+status basic_tree3<LeafKeys, InnerKeys>::get_equal_above(string_view key,
+							 get_kv_callback *callback,
+							 void *arg)
+{
+	LOG("get_equal_above for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	const std::string lower(key.data(), key.size());
+	internal::tree3::KVRange range;
+	range.lower = &lower;
+	range.lower_inclusive = true;
+
+	return LeafGet(range, callback, arg);
+}
+
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+status basic_tree3<LeafKeys, InnerKeys>::get_equal_below(string_view key,
+							 get_kv_callback *callback,
+							 void *arg)
+{
+	LOG("get_equal_below for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	const std::string upper(key.data(), key.size());
+	internal::tree3::KVRange range;
+	range.upper = &upper;
+	range.upper_inclusive = true;
+
+	return LeafGet(range, callback, arg);
+}
+
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+status basic_tree3<LeafKeys, InnerKeys>::get_below(string_view key,
+						   get_kv_callback *callback, void *arg)
+{
+	LOG("get_below for key=" << std::string(key.data(), key.size()));
+	check_outside_tx();
+	const std::string upper(key.data(), key.size());
+	internal::tree3::KVRange range;
+	range.upper = &upper;
+
+	return LeafGet(range, callback, arg);
 }
 
-status tree3::exists(string_view key)
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+status basic_tree3<LeafKeys, InnerKeys>::get_between(string_view key1, string_view key2,
+						     get_kv_callback *callback, void *arg)
+{
+	LOG("get_between key range=[" << std::string(key1.data(), key1.size()) << ","
+				      << std::string(key2.data(), key2.size()) << ")");
+	check_outside_tx();
+	const std::string lower(key1.data(), key1.size());
+	const std::string upper(key2.data(), key2.size());
+	internal::tree3::KVRange range;
+	range.lower = &lower;
+	range.upper = &upper;
+
+	return LeafGet(range, callback, arg);
+}
+
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+status basic_tree3<LeafKeys, InnerKeys>::exists(string_view key)
 {
 	LOG("exists for key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
+	leaf_shared_lock_type lock;
 	// XXX - do not create temporary string
-	auto leafnode = LeafSearch(std::string(key.data(), key.size()));
+	auto leafnode = LeafSearchLocked(std::string(key.data(), key.size()), lock);
 	if (leafnode) {
 		const uint8_t hash = PearsonHash(key.data(), key.size());
-		for (int slot = LEAF_KEYS; slot--;) {
-			if (leafnode->hashes[slot] == hash) {
-				if (leafnode->keys[slot].compare(
-					    std::string(key.data(), key.size())) == 0)
-					return status::OK;
-			}
-		}
+		int slot =
+			LeafFindSlot(leafnode, hash, std::string(key.data(), key.size()));
+		if (slot >= 0)
+			return status::OK;
 	}
 	LOG("   could not find key");
 	return status::NOT_FOUND;
 }
 
-status tree3::get(string_view key, get_v_callback *callback, void *arg)
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+status basic_tree3<LeafKeys, InnerKeys>::get(string_view key, get_v_callback *callback,
+					     void *arg)
 {
 	LOG("get using callback for key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
+	leaf_shared_lock_type lock;
 	// XXX - do not create temporary string
-	auto leafnode = LeafSearch(std::string(key.data(), key.size()));
+	auto leafnode = LeafSearchLocked(std::string(key.data(), key.size()), lock);
 	if (leafnode) {
 		const uint8_t hash = PearsonHash(key.data(), key.size());
-		for (int slot = LEAF_KEYS; slot--;) {
-			if (leafnode->hashes[slot] == hash) {
-				LOG("   found hash match, slot=" << slot);
-				if (leafnode->keys[slot].compare(
-					    std::string(key.data(), key.size())) == 0) {
-					auto kv = leafnode->leaf->slots[slot].get_ro();
-					LOG("   found value, slot="
-					    << slot
-					    << ", size=" << std::to_string(kv.valsize()));
-					callback(kv.val(), kv.valsize(), arg);
-					return status::OK;
-				}
-			}
+		int slot =
+			LeafFindSlot(leafnode, hash, std::string(key.data(), key.size()));
+		if (slot >= 0) {
+			auto kv = leafnode->leaf->slots[slot].get_ro();
+			LOG("   found value, slot=" << slot << ", size="
+						    << std::to_string(kv.valsize()));
+			callback(kv.val(), kv.valsize(), arg);
+			return status::OK;
 		}
 	}
 	LOG("   could not find key");
 	return status::NOT_FOUND;
 }
 
-status tree3::put(string_view key, string_view value)
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+status basic_tree3<LeafKeys, InnerKeys>::put(string_view key, string_view value)
 {
 	LOG("put key=" << std::string(key.data(), key.size())
 		       << ", value.size=" << std::to_string(value.size()));
 	check_outside_tx();
 
 	const auto hash = PearsonHash(key.data(), key.size());
+	leaf_unique_lock_type lock;
 	// XXX - do not create temporary string
-	auto leafnode = LeafSearch(std::string(key.data(), key.size()));
+	auto leafnode = LeafSearchLocked(std::string(key.data(), key.size()), lock);
 	if (!leafnode) {
-		LOG("   adding head leaf");
-		unique_ptr<internal::tree3::KVLeafNode> new_node(
-			new internal::tree3::KVLeafNode());
-		new_node->is_leaf = true;
-		transaction::run(pmpool, [&] {
-			if (!leaves_prealloc.empty()) {
-				new_node->leaf = leaves_prealloc.back();
-				leaves_prealloc.pop_back();
-			} else {
-				auto old_head = persistent_ptr<internal::tree3::KVLeaf>(
-					*root_oid);
-				auto new_leaf =
-					make_persistent<internal::tree3::KVLeaf>();
-				transaction::snapshot(root_oid);
-				*root_oid = new_leaf.raw();
-				new_leaf->next = old_head;
-				new_node->leaf = new_leaf;
-			}
-			LeafFillSpecificSlot(new_node.get(), hash,
-					     std::string(key.data(), key.size()),
-					     std::string(value.data(), value.size()), 0);
-		});
-		tree_top = move(new_node);
-	} else if (LeafFillSlotForKey(leafnode, hash, std::string(key.data(), key.size()),
-				      std::string(value.data(), value.size()))) {
+		std::unique_lock<std::shared_timed_mutex> tree_lock(tree_mtx);
+		if (!tree_top) {
+			LOG("   adding head leaf");
+			unique_ptr<KVLeafNode> new_node(new KVLeafNode());
+			new_node->is_leaf = true;
+			new_node->leaf = LeafAllocate();
+			transaction::run(pmpool, [&] {
+				LeafFillSpecificSlot(
+					new_node.get(), hash,
+					std::string(key.data(), key.size()),
+					std::string(value.data(), value.size()), 0);
+			});
+			n_elements.fetch_add(1, std::memory_order_relaxed);
+			internal::tree3::KVVersionGuard version_guard(tree_version);
+			leaves_head.store(new_node.get(), std::memory_order_release);
+			leaves_tail.store(new_node.get(), std::memory_order_release);
+			tree_top = move(new_node);
+			return status::OK;
+		}
+
+		// other thread added head leaf in the meantime (it's never removed)
+		tree_lock.unlock();
+		leafnode = LeafSearchLocked(std::string(key.data(), key.size()), lock);
+		assert(leafnode);
+	}
+
+	if (LeafFillSlotForKey(leafnode, hash, std::string(key.data(), key.size()),
+			       std::string(value.data(), value.size()))) {
 		// nothing else to do
 	} else {
 		// XXX - do not create temporary string
@@ -170,53 +348,67 @@ status tree3::put(string_view key, string_view value)
 	return status::OK;
 }
 
-status tree3::remove(string_view key)
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+status basic_tree3<LeafKeys, InnerKeys>::remove(string_view key)
 {
 	LOG("remove key=" << std::string(key.data(), key.size()));
 	check_outside_tx();
 
+	leaf_unique_lock_type lock;
 	// XXX - do not create temporary string
-	auto leafnode = LeafSearch(std::string(key.data(), key.size()));
+	auto leafnode = LeafSearchLocked(std::string(key.data(), key.size()), lock);
 	if (!leafnode) {
 		LOG("   head not present");
 		return status::NOT_FOUND;
 	}
 
 	const auto hash = PearsonHash(key.data(), key.size());
-	for (int slot = LEAF_KEYS; slot--;) {
-		if (leafnode->hashes[slot] == hash) {
-			if (leafnode->keys[slot].compare(
-				    std::string(key.data(), key.size())) == 0) {
-				LOG("   freeing slot=" << slot);
-				leafnode->hashes[slot] = 0;
-				leafnode->keys[slot].clear();
-				auto leaf = leafnode->leaf;
-				transaction::run(pmpool, [&] {
-					leaf->slots[slot].get_rw().clear();
-				});
-				return status::OK; // no duplicate keys allowed
-			}
-		}
-	}
-	return status::NOT_FOUND;
+	int slot = LeafFindSlot(leafnode, hash, std::string(key.data(), key.size()));
+	if (slot < 0)
+		return status::NOT_FOUND;
+
+	LOG("   freeing slot=" << slot);
+	leafnode->hashes[slot] = 0;
+	leafnode->keys[slot].clear();
+	auto leaf = leafnode->leaf;
+	transaction::run(pmpool, [&] { leaf->slots[slot].get_rw().clear(); });
+	n_elements.fetch_sub(1, std::memory_order_relaxed);
+	return status::OK;
+}
+
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+internal::iterator_base *basic_tree3<LeafKeys, InnerKeys>::new_iterator()
+{
+	return new tree3_iterator<basic_tree3, false>{this};
+}
+
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+internal::iterator_base *basic_tree3<LeafKeys, InnerKeys>::new_const_iterator()
+{
+	return new tree3_iterator<basic_tree3, true>{this};
 }
 
 // ===============================================================================================
 // PROTECTED LEAF METHODS
 // ===============================================================================================
 
-internal::tree3::KVLeafNode *tree3::LeafSearch(const std::string &key)
+// Traverses inner nodes under shared tree_mtx, so keys of inner nodes are never read
+// while a split moves them. The lock is released before the leaf is returned (a split
+// takes tree_mtx with its leaf locked), so the version of inner nodes the leaf was
+// found in is stored in *version.
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+typename basic_tree3<LeafKeys, InnerKeys>::KVLeafNode *
+basic_tree3<LeafKeys, InnerKeys>::LeafSearch(const std::string &key,
+					     std::uint64_t *version)
 {
-	internal::tree3::KVNode *node = tree_top.get();
-	if (node == nullptr)
-		return nullptr;
+	std::shared_lock<std::shared_timed_mutex> tree_lock(tree_mtx);
+	*version = tree_version.load(std::memory_order_relaxed);
+
+	KVNode *node = tree_top.get();
 	bool matched;
-	while (!node->is_leaf) {
+	while (node != nullptr && !node->is_leaf) {
 		matched = false;
-		auto inner = (internal::tree3::KVInnerNode *)node;
-#ifndef NDEBUG
-		inner->assert_invariants();
-#endif
+		auto inner = (KVInnerNode *)node;
 		const uint8_t keycount = inner->keycount;
 		for (uint8_t idx = 0; idx < keycount; idx++) {
 			node = inner->children[idx].get();
@@ -228,63 +420,223 @@ internal::tree3::KVLeafNode *tree3::LeafSearch(const std::string &key)
 		if (!matched)
 			node = inner->children[keycount].get();
 	}
-	return (internal::tree3::KVLeafNode *)node;
+
+	return (KVLeafNode *)node;
 }
 
-void tree3::LeafFillEmptySlot(internal::tree3::KVLeafNode *leafnode, const uint8_t hash,
-			      const std::string &key, const std::string &value)
+// Finds the leaf for the key and locks it. A split moves keys out of a leaf (under its
+// lock) and changes tree_version before unlocking it, so the leaf is searched again if
+// tree_version has changed before the lock was taken.
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+template <typename Lock>
+typename basic_tree3<LeafKeys, InnerKeys>::KVLeafNode *
+basic_tree3<LeafKeys, InnerKeys>::LeafSearchLocked(const std::string &key, Lock &lock)
 {
-	for (int slot = LEAF_KEYS; slot--;) {
-		if (leafnode->hashes[slot] == 0) {
-			LeafFillSpecificSlot(leafnode, hash, key, value, slot);
-			return;
+	while (true) {
+		std::uint64_t version;
+		auto leafnode = LeafSearch(key, &version);
+		if (leafnode == nullptr)
+			return nullptr;
+
+		Lock leaf_lock(leafnode->mtx);
+		if (tree_version.load(std::memory_order_acquire) == version) {
+			lock = std::move(leaf_lock);
+			return leafnode;
 		}
 	}
 }
 
-bool tree3::LeafFillSlotForKey(internal::tree3::KVLeafNode *leafnode, const uint8_t hash,
-			       const std::string &key, const std::string &value)
+// Calls f(leafnode, slot) for each key in the range, visiting leaves in key order and
+// holding the lock of one leaf at a time, until f returns non-zero. Scan starts at the
+// leaf of the lower bound and ends at the first leaf with a key above the upper bound.
+// Keys of each leaf are passed in ascending order if sorted is true. A concurrent split
+// moves keys to a leaf further in the chain, so keys not above the highest key visited
+// so far are skipped (they were visited in an earlier leaf, or were put in the meantime).
+// f is called with the leaf locked, so (user callbacks called by) f must not write to
+// the tree.
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+template <typename F>
+status basic_tree3<LeafKeys, InnerKeys>::LeafScan(const internal::tree3::KVRange &range,
+						  bool sorted, F &&f)
 {
-	// scan for empty/matching slots
-	int last_empty_slot = -1;
-	int key_match_slot = -1;
-	for (int slot = LEAF_KEYS; slot--;) {
-		auto slot_hash = leafnode->hashes[slot];
-		if (slot_hash == 0) {
-			last_empty_slot = slot;
-		} else if (slot_hash == hash) {
-			if (leafnode->keys[slot].compare(key) == 0) {
-				key_match_slot = slot;
-				break; // no duplicate keys allowed
-			}
+	leaf_shared_lock_type lock;
+	KVLeafNode *leafnode;
+	if (range.lower) {
+		leafnode = LeafSearchLocked(*range.lower, lock);
+	} else {
+		leafnode = leaves_head.load(std::memory_order_acquire);
+		if (leafnode)
+			lock = leaf_shared_lock_type(leafnode->mtx);
+	}
+
+	std::string max_key;
+	bool visited = false;
+	while (leafnode) {
+		int slots[LeafKeys];
+		int n_slots = 0;
+		bool above_upper = false;
+		const std::string *leaf_max_key = nullptr;
+		auto used = ~leafnode->match(0) & KVLeafNode::ALL_SLOTS;
+		for (; used; used &= used - 1) {
+			const int slot = __builtin_ctzll(used);
+			const auto &key = leafnode->keys[slot];
+			if (visited && key.compare(max_key) <= 0)
+				continue;
+			if (!leaf_max_key || leaf_max_key->compare(key) < 0)
+				leaf_max_key = &key;
+			if (!range.below_upper(key))
+				above_upper = true;
+			else if (range.above_lower(key))
+				slots[n_slots++] = slot;
+		}
+		if (sorted)
+			leafnode->sort_slots(slots, n_slots);
+		for (int i = 0; i < n_slots; i++)
+			if (f(leafnode, slots[i]) != 0)
+				return status::STOPPED_BY_CB;
+		if (above_upper)
+			break; // all keys in next leaves are above the upper bound too
+		if (leaf_max_key) {
+			max_key = *leaf_max_key;
+			visited = true;
 		}
+
+		leafnode = leafnode->next; // advance to next leaf in key order
+		lock.unlock();
+		if (leafnode)
+			lock = leaf_shared_lock_type(leafnode->mtx);
+	}
+
+	return status::OK;
+}
+
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+status basic_tree3<LeafKeys, InnerKeys>::LeafCount(const internal::tree3::KVRange &range,
+						   std::size_t &cnt)
+{
+	std::size_t result = 0;
+	LeafScan(range, false, [&](KVLeafNode *, int) {
+		result++;
+		return 0;
+	});
+
+	cnt = result;
+
+	return status::OK;
+}
+
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+status basic_tree3<LeafKeys, InnerKeys>::LeafGet(const internal::tree3::KVRange &range,
+						 get_kv_callback *callback, void *arg)
+{
+	return LeafScan(range, true,
+			[&](KVLeafNode *leafnode, int slot) {
+				auto kvslot = leafnode->leaf->slots[slot].get_ro();
+				return callback(kvslot.key(), kvslot.get_ks(),
+						kvslot.val(), kvslot.get_vs(), arg);
+			});
+}
+
+// Takes a leaf from the preallocated ones, or adds a new one to the persistent list.
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+persistent_ptr<typename basic_tree3<LeafKeys, InnerKeys>::KVLeaf>
+basic_tree3<LeafKeys, InnerKeys>::LeafAllocate()
+{
+	std::lock_guard<std::mutex> lock(leaves_prealloc_mtx);
+	if (!leaves_prealloc.empty()) {
+		auto leaf = leaves_prealloc.back();
+		leaves_prealloc.pop_back();
+		return leaf;
+	}
+
+	// an empty leaf left in the list (e.g. if a split fails) is reused on recovery
+	persistent_ptr<KVLeaf> new_leaf;
+	transaction::run(pmpool, [&] {
+		auto old_head = persistent_ptr<KVLeaf>(root->leaves);
+		new_leaf = make_persistent<KVLeaf>();
+		transaction::snapshot(&root->leaves);
+		root->leaves = new_leaf.raw();
+		new_leaf->next = old_head;
+	});
+	return new_leaf;
+}
+
+// Returns slot holding the key, or -1. Compares only keys in slots with the same hash.
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+int basic_tree3<LeafKeys, InnerKeys>::LeafFindSlot(KVLeafNode *leafnode,
+						   const uint8_t hash,
+						   const std::string &key)
+{
+	for (auto matches = leafnode->match(hash); matches; matches &= matches - 1) {
+		const int slot = __builtin_ctzll(matches);
+		if (leafnode->keys[slot].compare(key) == 0)
+			return slot; // no duplicate keys allowed
+	}
+	return -1;
+}
+
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+void basic_tree3<LeafKeys, InnerKeys>::LeafFillEmptySlot(KVLeafNode *leafnode,
+							 const uint8_t hash,
+							 const std::string &key,
+							 const std::string &value)
+{
+	// highest empty slot
+	auto empty = leafnode->match(0);
+	if (empty) {
+		const int slot = 63 - __builtin_clzll(empty);
+		LeafFillSpecificSlot(leafnode, hash, key, value, slot);
+	}
+}
+
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+bool basic_tree3<LeafKeys, InnerKeys>::LeafFillSlotForKey(KVLeafNode *leafnode,
+							  const uint8_t hash,
+							  const std::string &key,
+							  const std::string &value)
+{
+	// find matching slot, or lowest empty one
+	int slot = LeafFindSlot(leafnode, hash, key);
+	if (slot < 0) {
+		auto empty = leafnode->match(0);
+		if (empty)
+			slot = __builtin_ctzll(empty);
 	}
 
 	// update suitable slot if found
-	int slot = key_match_slot >= 0 ? key_match_slot : last_empty_slot;
 	if (slot >= 0) {
 		LOG("   filling slot=" << slot);
+		const bool new_key = leafnode->hashes[slot] == 0;
 		transaction::run(pmpool, [&] {
 			LeafFillSpecificSlot(leafnode, hash, key, value, slot);
 		});
+		if (new_key)
+			n_elements.fetch_add(1, std::memory_order_relaxed);
 	}
 	return slot >= 0;
 }
 
-void tree3::LeafFillSpecificSlot(internal::tree3::KVLeafNode *leafnode,
-				 const uint8_t hash, const std::string &key,
-				 const std::string &value, const int slot)
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+void basic_tree3<LeafKeys, InnerKeys>::LeafFillSpecificSlot(KVLeafNode *leafnode,
+							    const uint8_t hash,
+							    const std::string &key,
+							    const std::string &value,
+							    const int slot)
 {
 	leafnode->leaf->slots[slot].get_rw().set(hash, key, value);
 	leafnode->hashes[slot] = hash;
 	leafnode->keys[slot] = key;
 }
 
-void tree3::LeafSplitFull(internal::tree3::KVLeafNode *leafnode, const uint8_t hash,
-			  const std::string &key, const std::string &value)
+// Must be called with the leaf locked.
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+void basic_tree3<LeafKeys, InnerKeys>::LeafSplitFull(KVLeafNode *leafnode,
+						     const uint8_t hash,
+						     const std::string &key,
+						     const std::string &value)
 {
-	std::string keys[LEAF_KEYS + 1];
-	keys[LEAF_KEYS] = key;
+	std::string keys[LeafKeys + 1];
+	keys[LeafKeys] = key;
 	for (int slot = LEAF_KEYS; slot--;)
 		keys[slot] = leafnode->keys[slot];
 	std::sort(std::begin(keys), std::end(keys),
@@ -295,25 +647,11 @@ void tree3::LeafSplitFull(internal::tree3::KVLeafNode *leafnode, const uint8_t h
 	LOG("   splitting leaf at key=" << split_key);
 
 	// split leaf into two leaves, moving slots that sort above split key to new leaf
-	unique_ptr<internal::tree3::KVLeafNode> new_leafnode(
-		new internal::tree3::KVLeafNode());
-	new_leafnode->parent = leafnode->parent;
+	unique_ptr<KVLeafNode> new_leafnode(new KVLeafNode());
 	new_leafnode->is_leaf = true;
+	new_leafnode->leaf = LeafAllocate();
 	transaction::run(pmpool, [&] {
-		persistent_ptr<internal::tree3::KVLeaf> new_leaf;
-		if (!leaves_prealloc.empty()) {
-			new_leaf = leaves_prealloc.back();
-			new_leafnode->leaf = new_leaf;
-			leaves_prealloc.pop_back();
-		} else {
-			auto old_head =
-				persistent_ptr<internal::tree3::KVLeaf>(*root_oid);
-			new_leaf = make_persistent<internal::tree3::KVLeaf>();
-			transaction::snapshot(root_oid);
-			*root_oid = new_leaf.raw();
-			new_leaf->next = old_head;
-			new_leafnode->leaf = new_leaf;
-		}
+		auto new_leaf = new_leafnode->leaf;
 		for (int slot = LEAF_KEYS; slot--;) {
 			if (leafnode->keys[slot].compare(split_key) > 0) {
 				new_leaf->slots[slot].swap(leafnode->leaf->slots[slot]);
@@ -327,19 +665,31 @@ void tree3::LeafSplitFull(internal::tree3::KVLeafNode *leafnode, const uint8_t h
 		LeafFillEmptySlot(target, hash, key, value);
 	});
 
+	n_elements.fetch_add(1, std::memory_order_relaxed);
+
+	// new leaf is not locked, it becomes reachable only through this (locked) one
+	new_leafnode->next = leafnode->next;
+	new_leafnode->prev.store(leafnode, std::memory_order_relaxed);
+	leafnode->next = new_leafnode.get();
+	if (!new_leafnode->next)
+		leaves_tail.store(new_leafnode.get(), std::memory_order_release);
+
 	// recursively update volatile parents outside persistent transaction
+	std::lock_guard<std::shared_timed_mutex> tree_lock(tree_mtx);
+	internal::tree3::KVVersionGuard version_guard(tree_version);
+	new_leafnode->parent = leafnode->parent;
 	InnerUpdateAfterSplit(leafnode, move(new_leafnode), &split_key);
 }
 
-void tree3::InnerUpdateAfterSplit(internal::tree3::KVNode *node,
-				  unique_ptr<internal::tree3::KVNode> new_node,
-				  std::string *split_key)
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+void basic_tree3<LeafKeys, InnerKeys>::InnerUpdateAfterSplit(KVNode *node,
+							     unique_ptr<KVNode> new_node,
+							     std::string *split_key)
 {
 	if (!node->parent) {
 		assert(node == tree_top.get());
 		LOG("   creating new top node for split_key=" << *split_key);
-		unique_ptr<internal::tree3::KVInnerNode> top(
-			new internal::tree3::KVInnerNode());
+		unique_ptr<KVInnerNode> top(new KVInnerNode());
 		top->keycount = 1;
 		top->keys[0] = *split_key;
 		node->parent = top.get();
@@ -354,7 +704,7 @@ void tree3::InnerUpdateAfterSplit(internal::tree3::KVNode *node,
 	}
 
 	LOG("   updating parents for split_key=" << *split_key);
-	internal::tree3::KVInnerNode *inner = node->parent;
+	KVInnerNode *inner = node->parent;
 	{ // insert split_key and new_node into inner node in sorted order
 		const uint8_t keycount = inner->keycount;
 		int idx = 0; // position where split_key should be inserted
@@ -377,8 +727,7 @@ void tree3::InnerUpdateAfterSplit(internal::tree3::KVNode *node,
 	}
 
 	// split inner node at the midpoint, update parents as needed
-	unique_ptr<internal::tree3::KVInnerNode> ni(
-		new internal::tree3::KVInnerNode());	    // create new inner node
+	unique_ptr<KVInnerNode> ni(new KVInnerNode());	    // create new inner node
 	ni->parent = inner->parent;			    // set parent reference
 	for (int i = INNER_KEYS_UPPER; i < keycount; i++) { // move all upper keys
 		ni->keys[i - INNER_KEYS_UPPER] = move(inner->keys[i]); // move key string
@@ -407,82 +756,242 @@ void tree3::InnerUpdateAfterSplit(internal::tree3::KVNode *node,
 // PROTECTED LIFECYCLE METHODS
 // ===============================================================================================
 
-void tree3::Recover()
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+void basic_tree3<LeafKeys, InnerKeys>::Recover(std::size_t n_threads)
 {
-	LOG("Recovering");
+	LOG("Recovering with threads=" << n_threads);
+	internal::stopwatch phase_time;
+
+	using internal::tree3::root_type;
+	if (!OID_IS_NULL(*root_oid)) {
+		root = (root_type *)pmemobj_direct(*root_oid);
+		if (root->leaf_keys != LeafKeys || root->inner_keys != InnerKeys)
+			throw internal::invalid_argument(
+				"Tree with nodes of " + std::to_string(root->leaf_keys) +
+				"/" + std::to_string(root->inner_keys) +
+				" keys cannot be opened as a tree with nodes of " +
+				std::to_string(LeafKeys) + "/" +
+				std::to_string(InnerKeys) + " keys");
+	} else {
+		transaction::run(pmpool, [&] {
+			transaction::snapshot(root_oid);
+			auto new_root = make_persistent<root_type>();
+			new_root->leaf_keys = LeafKeys;
+			new_root->inner_keys = InnerKeys;
+			new_root->leaves = OID_NULL;
+			*root_oid = new_root.raw();
+			root = new_root.get();
+		});
+	}
 
 	// traverse persistent leaves to build list of leaves to recover
-	std::list<internal::tree3::KVRecoveredLeaf> leaves;
+	std::vector<persistent_ptr<KVLeaf>> persistent_leaves;
+	auto root_leaf = persistent_ptr<KVLeaf>(root->leaves);
+	while (root_leaf) {
+		persistent_leaves.push_back(root_leaf);
+		root_leaf = root_leaf->next.get(); // advance to next linked leaf
+	}
 
-	auto root_leaf = persistent_ptr<internal::tree3::KVLeaf>(*root_oid);
+	// recover leaves in parallel, each thread takes a contiguous part of the list
+	const std::size_t n_leaves = persistent_leaves.size();
+	n_threads = std::max<std::size_t>(1, std::min(n_threads, n_leaves));
+	std::vector<KVRecoveredNode> recovered(n_leaves);
+	n_elements.store(0, std::memory_order_relaxed);
+	internal::run_parallel(n_threads, [&](std::size_t t) {
+		std::size_t n_keys = 0;
+		for (std::size_t i = n_leaves * t / n_threads;
+		     i < n_leaves * (t + 1) / n_threads; i++) {
+			auto leaf = persistent_leaves[i];
+			unique_ptr<KVLeafNode> leafnode(new KVLeafNode());
+			leafnode->leaf = leaf;
+			leafnode->is_leaf = true;
 
-	while (root_leaf) {
-		unique_ptr<internal::tree3::KVLeafNode> leafnode(
-			new internal::tree3::KVLeafNode());
-		leafnode->leaf = root_leaf;
-		leafnode->is_leaf = true;
-
-		// find highest sorting key in leaf, while recovering all hashes
-		bool empty_leaf = true;
-		std::string max_key;
-		for (int slot = LEAF_KEYS; slot--;) {
-			auto kvslot = root_leaf->slots[slot].get_ro();
-			if (kvslot.empty())
-				continue;
-			leafnode->hashes[slot] = kvslot.hash();
-			if (leafnode->hashes[slot] == 0)
-				continue;
-			const char *key = kvslot.key();
-			if (empty_leaf) {
-				max_key = std::string(kvslot.key(), kvslot.get_ks());
-				empty_leaf = false;
-			} else if (max_key.compare(0, std::string::npos, kvslot.key(),
-						   kvslot.get_ks()) < 0) {
-				max_key = std::string(kvslot.key(), kvslot.get_ks());
+			// find highest sorting key in leaf, while recovering all hashes
+			bool empty_leaf = true;
+			std::string max_key;
+			for (int slot = LEAF_KEYS; slot--;) {
+				auto kvslot = leaf->slots[slot].get_ro();
+				if (kvslot.empty())
+					continue;
+				leafnode->hashes[slot] = kvslot.hash();
+				if (leafnode->hashes[slot] == 0)
+					continue;
+				const char *key = kvslot.key();
+				const auto ks = kvslot.get_ks();
+				if (empty_leaf) {
+					max_key = std::string(key, ks);
+					empty_leaf = false;
+				} else if (max_key.compare(0, std::string::npos, key,
+							   ks) < 0) {
+					max_key = std::string(key, ks);
+				}
+				leafnode->keys[slot] = std::string(key, ks);
+				n_keys++;
 			}
-			leafnode->keys[slot] = std::string(key, kvslot.get_ks());
-		}
 
-		// use highest sorting key to decide how to recover the leaf
-		if (empty_leaf) {
-			leaves_prealloc.push_back(root_leaf);
-		} else {
-			leaves.push_back({move(leafnode), max_key});
+			// empty leaves are left without a node, to be preallocated
+			if (!empty_leaf)
+				recovered[i] = {move(leafnode), move(max_key)};
 		}
+		n_elements.fetch_add(n_keys, std::memory_order_relaxed);
+	});
 
-		root_leaf = root_leaf->next.get(); // advance to next linked leaf
+	std::vector<KVRecoveredNode> leaves;
+	for (std::size_t i = 0; i < n_leaves; i++) {
+		if (recovered[i].node)
+			leaves.push_back(move(recovered[i]));
+		else
+			leaves_prealloc.push_back(persistent_leaves[i]);
 	}
+	recovered.clear();
+	add_open_phase("recover.leaf_scan", phase_time.lap());
 
-	// sort recovered leaves in ascending key order
-	leaves.sort([](const internal::tree3::KVRecoveredLeaf &lhs,
-		       const internal::tree3::KVRecoveredLeaf &rhs) {
+	// sort recovered leaves in ascending key order: sort parts in parallel, then
+	// merge adjacent pairs of sorted parts (in parallel) until one is left
+	auto by_max_key = [](const KVRecoveredNode &lhs, const KVRecoveredNode &rhs) {
 		return (lhs.max_key.compare(rhs.max_key) < 0);
+	};
+	n_threads = std::max<std::size_t>(1, std::min(n_threads, leaves.size()));
+	std::vector<std::size_t> bounds;
+	for (std::size_t t = 0; t <= n_threads; t++)
+		bounds.push_back(leaves.size() * t / n_threads);
+	internal::run_parallel(n_threads, [&](std::size_t t) {
+		std::sort(leaves.begin() + static_cast<std::ptrdiff_t>(bounds[t]),
+			  leaves.begin() + static_cast<std::ptrdiff_t>(bounds[t + 1]),
+			  by_max_key);
 	});
+	while (bounds.size() > 2) {
+		const std::size_t n_parts = bounds.size() - 1;
+		internal::run_parallel(n_parts / 2, [&](std::size_t p) {
+			auto first = leaves.begin();
+			std::inplace_merge(
+				first + static_cast<std::ptrdiff_t>(bounds[2 * p]),
+				first + static_cast<std::ptrdiff_t>(bounds[2 * p + 1]),
+				first + static_cast<std::ptrdiff_t>(bounds[2 * p + 2]),
+				by_max_key);
+		});
+		std::vector<std::size_t> merged;
+		for (std::size_t i = 0; i < bounds.size(); i += 2)
+			merged.push_back(bounds[i]);
+		if (n_parts % 2 != 0)
+			merged.push_back(bounds.back());
+		bounds = move(merged);
+	}
+	add_open_phase("recover.leaf_sort", phase_time.lap());
 
-	// reconstruct top/inner nodes using adjacent pairs of recovered leaves
+	// chain leaves in key order, then build inner nodes bottom-up, one level at a
+	// time: each parent gets (at most INNER_KEYS + 1) adjacent nodes as children
 	tree_top.reset(nullptr);
 
-	if (!leaves.empty()) {
-		tree_top = move(leaves.front().leafnode);
-		auto max_key = leaves.front().max_key;
-		leaves.pop_front();
-
-		auto prevnode = tree_top.get();
-		while (!leaves.empty()) {
-			std::string split_key = std::string(max_key);
-			auto nextnode = leaves.front().leafnode.get();
-			nextnode->parent = prevnode->parent;
-			InnerUpdateAfterSplit(prevnode, move(leaves.front().leafnode),
-					      &split_key);
-			max_key = leaves.front().max_key;
-			leaves.pop_front();
-			prevnode = nextnode;
-		}
+	KVLeafNode *prevnode = nullptr;
+	for (auto it = leaves.rbegin(); it != leaves.rend(); ++it) {
+		auto leafnode = (KVLeafNode *)it->node.get();
+		leafnode->next = prevnode;
+		if (prevnode)
+			prevnode->prev.store(leafnode, std::memory_order_relaxed);
+		else
+			leaves_tail.store(leafnode, std::memory_order_relaxed);
+		prevnode = leafnode;
 	}
+	leaves_head.store(prevnode, std::memory_order_relaxed);
+
+	auto level = move(leaves);
+	while (level.size() > 1) {
+		const std::size_t n_nodes = level.size();
+		const std::size_t n_parents = (n_nodes + INNER_KEYS) / (INNER_KEYS + 1);
+		std::vector<KVRecoveredNode> parents(n_parents);
+		const std::size_t level_threads = std::min(n_threads, n_parents);
+		internal::run_parallel(level_threads, [&](std::size_t t) {
+			for (std::size_t p = n_parents * t / level_threads;
+			     p < n_parents * (t + 1) / level_threads; p++) {
+				const std::size_t first = n_nodes * p / n_parents;
+				const std::size_t last = n_nodes * (p + 1) / n_parents;
+				unique_ptr<KVInnerNode> inner(new KVInnerNode());
+				inner->keycount = (uint8_t)(last - first - 1);
+				for (std::size_t i = first; i < last; i++) {
+					auto &child = level[i];
+					child.node->parent = inner.get();
+					auto &key = i + 1 < last ? inner->keys[i - first]
+								 : parents[p].max_key;
+					key = move(child.max_key);
+					inner->children[i - first] = move(child.node);
+				}
+#ifndef NDEBUG
+				inner->assert_invariants();
+#endif
+				parents[p].node = move(inner);
+			}
+		});
+		level = move(parents);
+	}
+	if (!level.empty())
+		tree_top = move(level.front().node);
+	add_open_phase("recover.inner_nodes", phase_time.lap());
 
 	LOG("Recovered ok");
 }
 
+// bytes allocated on the heap for the string's characters, if any
+static std::uint64_t string_heap_usage(const std::string &s)
+{
+	auto data = s.data();
+	auto object = reinterpret_cast<const char *>(&s);
+	bool inline_buffer = data >= object && data < object + sizeof(s);
+
+	return inline_buffer ? 0 : s.capacity() + 1;
+}
+
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+static std::uint64_t
+node_dram_usage(const internal::tree3::KVNode<LeafKeys, InnerKeys> *node)
+{
+	std::uint64_t size = 0;
+	if (node->is_leaf) {
+		auto leafnode = static_cast<
+			const internal::tree3::KVLeafNode<LeafKeys, InnerKeys> *>(node);
+		size += sizeof(*leafnode);
+		for (auto &key : leafnode->keys)
+			size += string_heap_usage(key);
+	} else {
+		auto inner = static_cast<
+			const internal::tree3::KVInnerNode<LeafKeys, InnerKeys> *>(node);
+		size += sizeof(*inner);
+		for (auto &key : inner->keys)
+			size += string_heap_usage(key);
+		for (auto &child : inner->children)
+			if (child && !child->is_leaf)
+				size += node_dram_usage(child.get());
+	}
+
+	return size;
+}
+
+// volatile inner and leaf nodes, with copies of all keys
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+std::uint64_t basic_tree3<LeafKeys, InnerKeys>::dram_usage()
+{
+	std::uint64_t size;
+	{
+		std::lock_guard<std::mutex> lock(leaves_prealloc_mtx);
+		size = leaves_prealloc.capacity() *
+			sizeof(persistent_ptr<KVLeaf>);
+	}
+
+	// leaves are counted while walking their chain, under their own locks
+	{
+		std::shared_lock<std::shared_timed_mutex> lock(tree_mtx);
+		if (tree_top && !tree_top->is_leaf)
+			size += node_dram_usage(tree_top.get());
+	}
+	for (auto leafnode = leaves_head.load(std::memory_order_acquire); leafnode;) {
+		leaf_shared_lock_type lock(leafnode->mtx);
+		size += node_dram_usage(leafnode);
+		leafnode = leafnode->next;
+	}
+
+	return size;
+}
+
 // ===============================================================================================
 // PEARSON HASH METHODS
 // ===============================================================================================
@@ -507,7 +1016,8 @@ const uint8_t PEARSON_LOOKUP_TABLE[256] = {
 	216, 131, 89,  21,  28,	 133, 37,  153, 149, 80,  170, 68,  6,	 169, 234, 151};
 
 // Modified Pearson hashing algorithm from RFC 3074
-uint8_t tree3::PearsonHash(const char *data, const size_t size)
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+uint8_t basic_tree3<LeafKeys, InnerKeys>::PearsonHash(const char *data, const size_t size)
 {
 	auto hash = (uint8_t)size;
 	for (size_t i = size; i > 0;) {
@@ -572,21 +1082,487 @@ void internal::tree3::KVSlot::set(const uint8_t hash, const std::string &key,
 	memcpy(kvptr, value.data(), vsize); // copy value into buffer
 }
 
+// ===============================================================================================
+// LEAF NODE METHODS
+// ===============================================================================================
+
+// Bitmask of slots whose hash equals the given one (hash 0 matches empty slots). Hashes
+// are compared 32 or 16 at a time if AVX2 or SSE2 is available at build time.
+namespace internal
+{
+namespace tree3
+{
+
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+uint64_t KVLeafNode<LeafKeys, InnerKeys>::match(const uint8_t hash) const
+{
+	uint64_t mask = 0;
+	int slot = 0;
+#ifdef __AVX2__
+	const __m256i needle256 = _mm256_set1_epi8((char)hash);
+	for (; slot + 32 <= (int)LeafKeys; slot += 32) {
+		auto chunk = _mm256_loadu_si256((const __m256i *)(hashes + slot));
+		auto bits = (uint32_t)_mm256_movemask_epi8(
+			_mm256_cmpeq_epi8(chunk, needle256));
+		mask |= (uint64_t)bits << slot;
+	}
+#endif
+#ifdef __SSE2__
+	const __m128i needle128 = _mm_set1_epi8((char)hash);
+	for (; slot + 16 <= (int)LeafKeys; slot += 16) {
+		auto chunk = _mm_loadu_si128((const __m128i *)(hashes + slot));
+		auto bits = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle128));
+		mask |= (uint64_t)bits << slot;
+	}
+#endif
+	for (; slot < (int)LeafKeys; slot++)
+		if (hashes[slot] == hash)
+			mask |= (uint64_t)1 << slot;
+	return mask;
+}
+
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+void KVLeafNode<LeafKeys, InnerKeys>::sort_slots(int *slots, const int n) const
+{
+	std::sort(slots, slots + n,
+		  [&](int lhs, int rhs) { return keys[lhs].compare(keys[rhs]) < 0; });
+}
+
+} /* namespace tree3 */
+} /* namespace internal */
+
+bool internal::tree3::KVRange::above_lower(const std::string &key) const
+{
+	if (!lower)
+		return true;
+	const int cmp = key.compare(*lower);
+	return cmp > 0 || (cmp == 0 && lower_inclusive);
+}
+
+bool internal::tree3::KVRange::below_upper(const std::string &key) const
+{
+	if (!upper)
+		return true;
+	const int cmp = key.compare(*upper);
+	return cmp < 0 || (cmp == 0 && upper_inclusive);
+}
+
+// ===============================================================================================
+// ITERATOR METHODS
+// ===============================================================================================
+
+template <typename Tree, typename Lock>
+tree3_iterator_base<Tree, Lock>::tree3_iterator_base(Tree *engine)
+    : engine(engine), leafnode(nullptr), n_slots(0), current(0), pop(engine->pmpool)
+{
+}
+
+template <typename Tree>
+tree3_iterator<Tree, true>::tree3_iterator(Tree *engine)
+    : tree3_iterator_base<Tree, internal::tree3::leaf_shared_lock_type>(engine)
+{
+}
+
+template <typename Tree>
+tree3_iterator<Tree, false>::tree3_iterator(Tree *engine)
+    : tree3_iterator_base<Tree, internal::tree3::leaf_unique_lock_type>(engine)
+{
+}
+
+template <typename Tree, typename Lock>
+status tree3_iterator_base<Tree, Lock>::seek(string_view key)
+{
+	init_seek();
+
+	const std::string k(key.data(), key.size());
+	auto node = engine->LeafSearchLocked(k, lock);
+	if (node) {
+		LeafEnter(node);
+		current = LeafLowerBound(k);
+		if (current < n_slots && leafnode->keys[slots[current]].compare(k) == 0)
+			return status::OK;
+	}
+
+	init_seek();
+	return status::NOT_FOUND;
+}
+
+template <typename Tree, typename Lock>
+status tree3_iterator_base<Tree, Lock>::seek_lower(string_view key)
+{
+	init_seek();
+
+	const std::string k(key.data(), key.size());
+	auto node = engine->LeafSearchLocked(k, lock);
+	if (!node)
+		return status::NOT_FOUND;
+
+	LeafEnter(node);
+	return SeekLastBefore(LeafLowerBound(k));
+}
+
+template <typename Tree, typename Lock>
+status tree3_iterator_base<Tree, Lock>::seek_lower_eq(string_view key)
+{
+	init_seek();
+
+	const std::string k(key.data(), key.size());
+	auto node = engine->LeafSearchLocked(k, lock);
+	if (!node)
+		return status::NOT_FOUND;
+
+	LeafEnter(node);
+	return SeekLastBefore(LeafUpperBound(k));
+}
+
+template <typename Tree, typename Lock>
+status tree3_iterator_base<Tree, Lock>::seek_higher(string_view key)
+{
+	init_seek();
+
+	const std::string k(key.data(), key.size());
+	auto node = engine->LeafSearchLocked(k, lock);
+	if (!node)
+		return status::NOT_FOUND;
+
+	LeafEnter(node);
+	return SeekFirstFrom(LeafUpperBound(k));
+}
+
+template <typename Tree, typename Lock>
+status tree3_iterator_base<Tree, Lock>::seek_higher_eq(string_view key)
+{
+	init_seek();
+
+	const std::string k(key.data(), key.size());
+	auto node = engine->LeafSearchLocked(k, lock);
+	if (!node)
+		return status::NOT_FOUND;
+
+	LeafEnter(node);
+	return SeekFirstFrom(LeafLowerBound(k));
+}
+
+template <typename Tree, typename Lock>
+status tree3_iterator_base<Tree, Lock>::seek_to_first()
+{
+	init_seek();
+
+	auto node = engine->leaves_head.load(std::memory_order_acquire);
+	if (!node)
+		return status::NOT_FOUND;
+
+	lock = Lock(node->mtx);
+	LeafEnter(node);
+	return SeekFirstFrom(0);
+}
+
+template <typename Tree, typename Lock>
+status tree3_iterator_base<Tree, Lock>::seek_to_last()
+{
+	init_seek();
+
+	// leaves_tail may lag behind a split of the last leaf
+	auto node = engine->leaves_tail.load(std::memory_order_acquire);
+	if (!node)
+		return status::NOT_FOUND;
+
+	lock = Lock(node->mtx);
+	while (node->next) {
+		node = node->next;
+		lock = Lock(node->mtx);
+	}
+	LeafEnter(node);
+	return SeekLastBefore(n_slots);
+}
+
+template <typename Tree, typename Lock>
+status tree3_iterator_base<Tree, Lock>::is_next()
+{
+	if (!leafnode)
+		return status::NOT_FOUND;
+	if (current + 1 < n_slots)
+		return status::OK;
+
+	for (auto node = leafnode->next; node;) {
+		internal::tree3::leaf_shared_lock_type next_lock(node->mtx);
+		if (~node->match(0) & KVLeafNode::ALL_SLOTS)
+			return status::OK;
+		node = node->next;
+	}
+
+	return status::NOT_FOUND;
+}
+
+template <typename Tree, typename Lock>
+status tree3_iterator_base<Tree, Lock>::next()
+{
+	abort();
+
+	if (!leafnode)
+		return status::NOT_FOUND;
+
+	return SeekFirstFrom(current + 1);
+}
+
+template <typename Tree, typename Lock>
+status tree3_iterator_base<Tree, Lock>::prev()
+{
+	abort();
+
+	if (!leafnode)
+		return status::NOT_FOUND;
+
+	return SeekLastBefore(current);
+}
+
+template <typename Tree, typename Lock>
+result<string_view> tree3_iterator_base<Tree, Lock>::key()
+{
+	assert(leafnode);
+
+	const auto &k = leafnode->keys[slots[current]];
+	return {string_view(k.data(), k.size())};
+}
+
+template <typename Tree, typename Lock>
+result<pmem::obj::slice<const char *>>
+tree3_iterator_base<Tree, Lock>::read_range(size_t pos, size_t n)
+{
+	assert(leafnode);
+
+	const auto &kvslot = CurrentSlot();
+	const size_t size = kvslot.valsize();
+	if (pos + n > size || pos + n < pos)
+		n = size - pos;
+
+	return {{kvslot.val() + pos, kvslot.val() + pos + n}};
+}
+
+// Releases the leaf, so that a failed seek (or a parked iterator) blocks no one.
+template <typename Tree, typename Lock>
+void tree3_iterator_base<Tree, Lock>::init_seek()
+{
+	abort();
+
+	if (lock.owns_lock())
+		lock.unlock();
+	leafnode = nullptr;
+	n_slots = 0;
+}
+
+// Makes the (locked) node the current leaf and sorts its used slots by keys.
+template <typename Tree, typename Lock>
+void tree3_iterator_base<Tree, Lock>::LeafEnter(KVLeafNode *node)
+{
+	leafnode = node;
+	n_slots = 0;
+	auto used = ~node->match(0) & KVLeafNode::ALL_SLOTS;
+	for (; used; used &= used - 1)
+		slots[n_slots++] = __builtin_ctzll(used);
+	node->sort_slots(slots, n_slots);
+}
+
+// Index of the first key in the current leaf which is not below the given one.
+template <typename Tree, typename Lock>
+int tree3_iterator_base<Tree, Lock>::LeafLowerBound(const std::string &key)
+{
+	auto it = std::lower_bound(slots, slots + n_slots, key,
+				   [&](int slot, const std::string &k) {
+					   return leafnode->keys[slot].compare(k) < 0;
+				   });
+	return (int)(it - slots);
+}
+
+// Index of the first key in the current leaf which is above the given one.
+template <typename Tree, typename Lock>
+int tree3_iterator_base<Tree, Lock>::LeafUpperBound(const std::string &key)
+{
+	auto it = std::upper_bound(slots, slots + n_slots, key,
+				   [&](const std::string &k, int slot) {
+					   return k.compare(leafnode->keys[slot]) < 0;
+				   });
+	return (int)(it - slots);
+}
+
+// Moves to the idx-th key of the current leaf or, if there are not as many, to the
+// first key of the next non-empty leaf. Next leaf is locked before the current one is
+// unlocked (as leaves are always locked from left to right), so no split can move keys
+// between them in the meantime.
+template <typename Tree, typename Lock>
+status tree3_iterator_base<Tree, Lock>::SeekFirstFrom(const int idx)
+{
+	if (idx < n_slots) {
+		current = idx;
+		return status::OK;
+	}
+
+	for (auto node = leafnode->next; node; node = node->next) {
+		lock = Lock(node->mtx);
+		LeafEnter(node);
+		if (n_slots > 0) {
+			current = 0;
+			return status::OK;
+		}
+	}
+
+	init_seek();
+	return status::NOT_FOUND;
+}
+
+// Moves to the key before the idx-th one in the current leaf or, if idx is 0, to the
+// last key of the previous non-empty leaf. The current leaf is unlocked first, then
+// the leaf before it is found by walking right from the prev hint (which is refreshed).
+template <typename Tree, typename Lock>
+status tree3_iterator_base<Tree, Lock>::SeekLastBefore(const int idx)
+{
+	if (idx > 0) {
+		current = idx - 1;
+		return status::OK;
+	}
+
+	auto node = leafnode;
+	while (auto before = node->prev.load(std::memory_order_acquire)) {
+		lock.unlock();
+		lock = Lock(before->mtx);
+		while (before->next != node) {
+			before = before->next;
+			lock = Lock(before->mtx);
+		}
+		node->prev.store(before, std::memory_order_release);
+
+		LeafEnter(before);
+		if (n_slots > 0) {
+			current = n_slots - 1;
+			return status::OK;
+		}
+		node = before;
+	}
+
+	init_seek();
+	return status::NOT_FOUND;
+}
+
+template <typename Tree, typename Lock>
+const internal::tree3::KVSlot &tree3_iterator_base<Tree, Lock>::CurrentSlot()
+{
+	return leafnode->leaf->slots[slots[current]].get_ro();
+}
+
+template <typename Tree>
+result<pmem::obj::slice<char *>> tree3_iterator<Tree, false>::write_range(size_t pos,
+									  size_t n)
+{
+	assert(this->leafnode);
+
+	const auto &kvslot = this->CurrentSlot();
+	const size_t size = kvslot.valsize();
+	if (pos + n > size || pos + n < pos)
+		n = size - pos;
+
+	log.push_back({{kvslot.val() + pos, n}, pos});
+	auto &val = log.back().first;
+
+	return {{&val[0], &val[n]}};
+}
+
+// Leaf stays locked since write_range(), so the value cannot have moved in the meantime.
+template <typename Tree>
+status tree3_iterator<Tree, false>::commit()
+{
+	pmem::obj::transaction::run(this->pop, [&] {
+		for (auto &p : log) {
+			auto dest =
+				const_cast<char *>(this->CurrentSlot().val()) + p.second;
+			pmem::obj::transaction::snapshot(dest, p.first.size());
+			std::copy(p.first.begin(), p.first.end(), dest);
+		}
+	});
+	log.clear();
+
+	return status::OK;
+}
+
+template <typename Tree>
+void tree3_iterator<Tree, false>::abort()
+{
+	log.clear();
+}
+
 // ===============================================================================================
 // Node invariants
 // ===============================================================================================
 
-void internal::tree3::KVInnerNode::assert_invariants()
+namespace internal
+{
+namespace tree3
+{
+
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+void KVInnerNode<LeafKeys, InnerKeys>::assert_invariants()
 {
-	assert(keycount <= INNER_KEYS);
+	assert(keycount <= (int)InnerKeys);
 	for (auto i = 0; i < keycount; ++i) {
 		assert(keys[i].size() > 0);
 		assert(children[i] != nullptr);
 	}
 	assert(children[keycount] != nullptr);
-	for (auto i = keycount + 1; i < INNER_KEYS + 1; ++i)
+	for (auto i = keycount + 1; i < (int)InnerKeys + 1; ++i)
 		assert(children[i] == nullptr);
 }
 
+/*
+ * Returns node sizes (keys of leaves and of inner nodes) of the tree stored in the
+ * pool given by cfg, or (if the pool has no tree yet) the ones requested with the
+ * "leaf_keys" and "inner_keys" config items. A pool given by "path" is opened (into
+ * 'pool'), to be handed over to the engine's instantiation.
+ */
+std::pair<std::size_t, std::size_t> pool_node_sizes(config &cfg, pmemobj_pool &pool)
+{
+	uint64_t leaf_keys = 0, inner_keys = 0;
+	auto stored_sizes = [&](PMEMoid oid) {
+		if (OID_IS_NULL(oid))
+			return;
+		auto root = static_cast<root_type *>(pmemobj_direct(oid));
+		leaf_keys = root->leaf_keys;
+		inner_keys = root->inner_keys;
+	};
+
+	PMEMoid *oid;
+	const char *path;
+	if (cfg.get_object("oid", (void **)&oid)) {
+		stored_sizes(*oid);
+	} else if (cfg.get_string("path", &path)) {
+		pool = pmemobj_pool(cfg, layout());
+		stored_sizes(pool.engine_data());
+	}
+
+	if (leaf_keys == 0 && !cfg.get_uint64("leaf_keys", &leaf_keys))
+		leaf_keys = DEFAULT_LEAF_KEYS;
+	if (inner_keys == 0 && !cfg.get_uint64("inner_keys", &inner_keys))
+		inner_keys = DEFAULT_INNER_KEYS;
+
+	if (std::find(std::begin(LEAF_KEYS_SIZES), std::end(LEAF_KEYS_SIZES),
+		      leaf_keys) == std::end(LEAF_KEYS_SIZES))
+		throw invalid_argument("Unsupported tree3 leaf_keys: " +
+				       std::to_string(leaf_keys));
+	if (std::find(std::begin(INNER_KEYS_SIZES), std::end(INNER_KEYS_SIZES),
+		      inner_keys) == std::end(INNER_KEYS_SIZES))
+		throw invalid_argument("Unsupported tree3 inner_keys: " +
+				       std::to_string(inner_keys));
+
+	return {leaf_keys, inner_keys};
+}
+
+} /* namespace tree3 */
+} /* namespace internal */
+
+template class basic_tree3<16, 4>;
+template class basic_tree3<16, 16>;
+template class basic_tree3<48, 4>;
+template class basic_tree3<48, 16>;
+template class basic_tree3<64, 4>;
+template class basic_tree3<64, 16>;
+
 } // namespace kv
 } // namespace pmem
@@ -1,8 +1,9 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2017-2020, Intel Corporation */
+/* Copyright 2017-2021, Intel Corporation */
 
 #pragma once
 
+#include "../iterator.h"
 #include "../pmemobj_engine.h"
 
 #include <libpmemobj++/make_persistent.hpp>
@@ -10,7 +11,11 @@
 #include <libpmemobj++/p.hpp>
 #include <libpmemobj++/persistent_ptr.hpp>
 #include <libpmemobj++/transaction.hpp>
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <utility>
 #include <vector>
 
 using pmem::obj::delete_persistent;
@@ -32,11 +37,14 @@ namespace internal
 namespace tree3
 {
 
-#define INNER_KEYS 4				// maximum keys for inner nodes
-#define INNER_KEYS_MIDPOINT (INNER_KEYS / 2)	// halfway point within the node
-#define INNER_KEYS_UPPER ((INNER_KEYS / 2) + 1) // index where upper half of keys begins
-#define LEAF_KEYS 48				// maximum keys in tree nodes
-#define LEAF_KEYS_MIDPOINT (LEAF_KEYS / 2)	// halfway point within the node
+/*
+ * Maximum numbers of keys in leaves and in inner nodes a tree can be created with (see
+ * the "leaf_keys" and "inner_keys" config items). The sizes are stored in the pool.
+ */
+const std::size_t DEFAULT_LEAF_KEYS = 48;
+const std::size_t LEAF_KEYS_SIZES[] = {16, 48, 64};
+const std::size_t DEFAULT_INNER_KEYS = 4;
+const std::size_t INNER_KEYS_SIZES[] = {4, 16};
 
 class KVSlot {
 public:
@@ -141,53 +149,126 @@ private:
 	persistent_ptr<char[]> kv; // buffer for key & value
 };
 
+template <std::size_t LeafKeys>
 struct KVLeaf {
-	p<KVSlot> slots[LEAF_KEYS];  // array of slot containers
+	p<KVSlot> slots[LeafKeys];   // array of slot containers
 	persistent_ptr<KVLeaf> next; // next leaf in unsorted list
 };
 
+template <std::size_t LeafKeys, std::size_t InnerKeys>
 struct KVInnerNode;
 
-struct KVNode {		      // volatile nodes of the tree
-	bool is_leaf = false; // indicate inner or leaf node
-	KVInnerNode *parent;  // parent of this node (null if top)
+// volatile nodes of the tree
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+struct KVNode {
+	bool is_leaf = false;			  // indicate inner or leaf node
+	KVInnerNode<LeafKeys, InnerKeys> *parent; // parent of this node (null if top)
 	virtual ~KVNode() = default;
 };
 
-struct KVInnerNode final : KVNode {		     // volatile inner nodes of the tree
-	uint8_t keycount;			     // count of keys in this node
-	std::string keys[INNER_KEYS + 1];	     // child keys plus one overflow slot
-	unique_ptr<KVNode> children[INNER_KEYS + 2]; // child nodes plus one overflow slot
+// volatile inner nodes of the tree
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+struct KVInnerNode final : KVNode<LeafKeys, InnerKeys> {
+	uint8_t keycount;		 // count of keys in this node
+	std::string keys[InnerKeys + 1]; // child keys plus one overflow slot
+	unique_ptr<KVNode<LeafKeys, InnerKeys>>
+		children[InnerKeys + 2]; // child nodes plus one overflow slot
 	void assert_invariants();
 };
 
-struct KVLeafNode final : KVNode {   // volatile leaf nodes of the tree
-	uint8_t hashes[LEAF_KEYS];   // Pearson hashes of keys
-	std::string keys[LEAF_KEYS]; // keys stored in this leaf
-	persistent_ptr<KVLeaf> leaf; // pointer to persistent leaf
+// volatile leaf nodes of the tree
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+struct KVLeafNode final : KVNode<LeafKeys, InnerKeys> {
+	uint8_t hashes[LeafKeys];		 // Pearson hashes of keys
+	std::string keys[LeafKeys];		 // keys stored in this leaf
+	persistent_ptr<KVLeaf<LeafKeys>> leaf;	 // pointer to persistent leaf
+	KVLeafNode *next = nullptr;		 // next leaf in key order (null if last)
+	std::atomic<KVLeafNode *> prev{nullptr}; // a leaf before this one (or null)
+	std::shared_timed_mutex mtx; // latch for all of the above and the leaf's slots
+	static constexpr uint64_t ALL_SLOTS = (LeafKeys == 64)
+		? ~uint64_t(0)
+		: (uint64_t(1) << LeafKeys) - 1; // mask of all slots
+
+	uint64_t match(uint8_t hash) const; // mask of slots with the given hash
+	void sort_slots(int *slots, int n) const; // sort slots by their keys
+};
+
+using leaf_mutex_type = std::shared_timed_mutex;
+using leaf_unique_lock_type = std::unique_lock<leaf_mutex_type>;
+using leaf_shared_lock_type = std::shared_lock<leaf_mutex_type>;
+
+struct KVRange {			     // bounds of keys visited by a scan
+	const std::string *lower = nullptr;  // lower bound (null if unbounded)
+	const std::string *upper = nullptr;  // upper bound (null if unbounded)
+	bool lower_inclusive = false;	     // lower bound itself is in range
+	bool upper_inclusive = false;	     // upper bound itself is in range
+
+	bool above_lower(const std::string &key) const; // key is not below range
+	bool below_upper(const std::string &key) const; // key is not above range
 };
 
-struct KVRecoveredLeaf {		 // temporary wrapper used for recovery
-	unique_ptr<KVLeafNode> leafnode; // leaf node being recovered
-	std::string max_key;		 // highest sorting key present
+// temporary wrapper used for recovery
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+struct KVRecoveredNode {
+	unique_ptr<KVNode<LeafKeys, InnerKeys>> node; // leaf or inner node recovered
+	std::string max_key;			      // highest sorting key present
 };
 
+/**
+ * Root object of tree3's pools. Leaves of a tree can be read only with the node
+ * sizes the tree was created with, so they are kept along with the list of leaves.
+ */
+struct root_type {
+	p<uint64_t> leaf_keys;
+	p<uint64_t> inner_keys;
+	PMEMoid leaves; // head of the persistent list of leaves
+};
+
+std::pair<std::size_t, std::size_t> pool_node_sizes(config &cfg, pmemobj_pool &pool);
+
 } /* namespace tree3 */
 } /* namespace internal */
 
-class tree3
-    : public pmemobj_engine_base<internal::tree3::KVLeaf> { // hybrid B+ tree engine
+template <typename Tree, typename Lock>
+class tree3_iterator_base;
+
+template <typename Tree, bool IsConst>
+class tree3_iterator;
+
+/**
+ * Hybrid B+ tree engine. Leaves hold up to LeafKeys keys and are persistent, inner
+ * nodes hold up to InnerKeys keys and are volatile (rebuilt from leaves on open).
+ * The node sizes are ones of internal::tree3::LEAF_KEYS_SIZES and INNER_KEYS_SIZES,
+ * to be chosen (with internal::tree3::pool_node_sizes, which opens the pool for the
+ * engine) before creating the engine.
+ */
+template <std::size_t LeafKeys, std::size_t InnerKeys>
+class basic_tree3 : public pmemobj_engine_base<internal::tree3::root_type> {
 public:
-	tree3(std::unique_ptr<internal::config> cfg);
-	tree3(const tree3 &) = delete;
-	tree3 &operator=(const tree3 &) = delete;
-	~tree3();
+	basic_tree3(std::unique_ptr<internal::config> cfg,
+		    internal::pmemobj_pool pool = internal::pmemobj_pool());
+	basic_tree3(const basic_tree3 &) = delete;
+	basic_tree3 &operator=(const basic_tree3 &) = delete;
+	~basic_tree3();
 
 	std::string name() final;
 
 	status count_all(std::size_t &cnt) final;
+	status count_above(string_view key, std::size_t &cnt) final;
+	status count_equal_above(string_view key, std::size_t &cnt) final;
+	status count_equal_below(string_view key, std::size_t &cnt) final;
+	status count_below(string_view key, std::size_t &cnt) final;
+	status count_between(string_view key1, string_view key2, std::size_t &cnt) final;
 
 	status get_all(get_kv_callback *callback, void *arg) final;
+	status get_above(string_view key, get_kv_callback *callback, void *arg) final;
+	status get_equal_above(string_view key, get_kv_callback *callback,
+			       void *arg) final;
+	status get_equal_below(string_view key, get_kv_callback *callback,
+			       void *arg) final;
+	status get_below(string_view key, get_kv_callback *callback, void *arg) final;
+	status get_between(string_view key1, string_view key2, get_kv_callback *callback,
+			   void *arg) final;
 
 	status exists(string_view key) final;
 
@@ -197,27 +278,142 @@ public:
 
 	status remove(string_view key) final;
 
+	internal::iterator_base *new_iterator() final;
+	internal::iterator_base *new_const_iterator() final;
+
+	static_assert(LeafKeys <= 64, "slots of a leaf must fit in a 64-bit mask");
+	static_assert(LeafKeys >= 2 && InnerKeys >= 2, "nodes must be able to split");
+
+	/* maximum keys for inner nodes, halfway point, index where upper half begins */
+	static constexpr int INNER_KEYS = InnerKeys;
+	static constexpr int INNER_KEYS_MIDPOINT = INNER_KEYS / 2;
+	static constexpr int INNER_KEYS_UPPER = INNER_KEYS / 2 + 1;
+	/* maximum keys in leaves and halfway point within a leaf */
+	static constexpr int LEAF_KEYS = LeafKeys;
+	static constexpr int LEAF_KEYS_MIDPOINT = LEAF_KEYS / 2;
+
+	using KVLeaf = internal::tree3::KVLeaf<LeafKeys>;
+	using KVNode = internal::tree3::KVNode<LeafKeys, InnerKeys>;
+	using KVInnerNode = internal::tree3::KVInnerNode<LeafKeys, InnerKeys>;
+	using KVLeafNode = internal::tree3::KVLeafNode<LeafKeys, InnerKeys>;
+	using KVRecoveredNode = internal::tree3::KVRecoveredNode<LeafKeys, InnerKeys>;
+
 protected:
-	internal::tree3::KVLeafNode *LeafSearch(const std::string &key);
-	void LeafFillEmptySlot(internal::tree3::KVLeafNode *leafnode, uint8_t hash,
-			       const std::string &key, const std::string &value);
-	bool LeafFillSlotForKey(internal::tree3::KVLeafNode *leafnode, uint8_t hash,
+	using leaf_unique_lock_type = internal::tree3::leaf_unique_lock_type;
+	using leaf_shared_lock_type = internal::tree3::leaf_shared_lock_type;
+
+	KVLeafNode *LeafSearch(const std::string &key, std::uint64_t *version);
+	template <typename Lock>
+	KVLeafNode *LeafSearchLocked(const std::string &key, Lock &lock);
+	template <typename F>
+	status LeafScan(const internal::tree3::KVRange &range, bool sorted, F &&f);
+	status LeafCount(const internal::tree3::KVRange &range, std::size_t &cnt);
+	status LeafGet(const internal::tree3::KVRange &range, get_kv_callback *callback,
+		       void *arg);
+	persistent_ptr<KVLeaf> LeafAllocate();
+	int LeafFindSlot(KVLeafNode *leafnode, uint8_t hash, const std::string &key);
+	void LeafFillEmptySlot(KVLeafNode *leafnode, uint8_t hash, const std::string &key,
+			       const std::string &value);
+	bool LeafFillSlotForKey(KVLeafNode *leafnode, uint8_t hash,
 				const std::string &key, const std::string &value);
-	void LeafFillSpecificSlot(internal::tree3::KVLeafNode *leafnode, uint8_t hash,
+	void LeafFillSpecificSlot(KVLeafNode *leafnode, uint8_t hash,
 				  const std::string &key, const std::string &value,
 				  int slot);
-	void LeafSplitFull(internal::tree3::KVLeafNode *leafnode, uint8_t hash,
-			   const std::string &key, const std::string &value);
-	void InnerUpdateAfterSplit(internal::tree3::KVNode *node,
-				   unique_ptr<internal::tree3::KVNode> newnode,
+	void LeafSplitFull(KVLeafNode *leafnode, uint8_t hash, const std::string &key,
+			   const std::string &value);
+	void InnerUpdateAfterSplit(KVNode *node, unique_ptr<KVNode> newnode,
 				   std::string *split_key);
 	uint8_t PearsonHash(const char *data, size_t size);
-	void Recover();
+	void Recover(std::size_t n_threads);
+	std::uint64_t dram_usage() final;
+
+private:
+	template <typename Tree, typename Lock>
+	friend class tree3_iterator_base;
+
+	internal::tree3::root_type *root; // node sizes and head of the list of leaves
+
+	std::mutex leaves_prealloc_mtx; // guards leaves_prealloc and list of leaves
+	vector<persistent_ptr<KVLeaf>> leaves_prealloc; // persisted but unused leaves
+
+	/*
+	 * Inner nodes (and tree_top) are changed under exclusive tree_mtx and read
+	 * under shared one. tree_version changes with every split, so a reader can
+	 * tell if the leaf it found is still the right one once it has locked it.
+	 */
+	std::shared_timed_mutex tree_mtx;
+	std::atomic<std::uint64_t> tree_version;
+	unique_ptr<KVNode> tree_top;		 // pointer to uppermost inner node
+	std::atomic<KVLeafNode *> leaves_head;	 // leaf with lowest keys
+	std::atomic<KVLeafNode *> leaves_tail;	 // some leaf (walk right)
+	std::atomic<std::size_t> n_elements;	 // count of keys
+};
+
+// Iterates over keys in order. The leaf of the current key stays locked (with Lock)
+// until the iterator moves to another leaf or is released, and its used slots are
+// sorted by keys whenever the iterator enters it.
+template <typename Tree, typename Lock>
+class tree3_iterator_base : virtual public internal::iterator_base {
+public:
+	tree3_iterator_base(Tree *engine);
+
+	status seek(string_view key) final;
+	status seek_lower(string_view key) final;
+	status seek_lower_eq(string_view key) final;
+	status seek_higher(string_view key) final;
+	status seek_higher_eq(string_view key) final;
+
+	status seek_to_first() final;
+	status seek_to_last() final;
+
+	status is_next() final;
+	status next() final;
+	status prev() final;
+
+	result<string_view> key() final;
+
+	result<pmem::obj::slice<const char *>> read_range(size_t pos, size_t n) final;
+
+protected:
+	using KVLeafNode = typename Tree::KVLeafNode;
+
+	Tree *engine;
+	KVLeafNode *leafnode;	    // leaf of current key (or null)
+	Lock lock;		    // lock of leafnode
+	int slots[Tree::LEAF_KEYS]; // used slots of leafnode, by key
+	int n_slots;		    // count of used slots
+	int current;		    // index of current key in slots
+	pmem::obj::pool_base pop;
+
+	void init_seek() override;
+	void LeafEnter(KVLeafNode *node);
+	int LeafLowerBound(const std::string &key);
+	int LeafUpperBound(const std::string &key);
+	status SeekFirstFrom(int idx);
+	status SeekLastBefore(int idx);
+	const internal::tree3::KVSlot &CurrentSlot();
+};
+
+template <typename Tree>
+class tree3_iterator<Tree, true> final
+    : public tree3_iterator_base<Tree, internal::tree3::leaf_shared_lock_type> {
+public:
+	tree3_iterator(Tree *engine);
+};
+
+template <typename Tree>
+class tree3_iterator<Tree, false> final
+    : public tree3_iterator_base<Tree, internal::tree3::leaf_unique_lock_type> {
+public:
+	tree3_iterator(Tree *engine);
+
+	result<pmem::obj::slice<char *>> write_range(size_t pos, size_t n) final;
+
+	status commit() final;
+	void abort() final;
 
 private:
-	vector<persistent_ptr<internal::tree3::KVLeaf>>
-		leaves_prealloc;		      // persisted but unused leaves
-	unique_ptr<internal::tree3::KVNode> tree_top; // pointer to uppermost inner node
+	std::vector<std::pair<std::string, size_t>> log;
 };
 
 } /* namespace kv */
@@ -41,6 +41,8 @@ public:
 
 	status remove(string_view key) final;
 
+	void get_gauges(internal::stats::metrics_type &gauges) final;
+
 	internal::iterator_base *new_iterator() final;
 	internal::iterator_base *new_const_iterator() final;
 
@@ -89,6 +91,13 @@ status basic_vcmap<AllocatorT>::count_all(std::size_t &cnt)
 	return status::OK;
 }
 
+template <template <typename T> class AllocatorT>
+void basic_vcmap<AllocatorT>::get_gauges(internal::stats::metrics_type &gauges)
+{
+	gauges.emplace_back("size", pmem_kv_container.size());
+	gauges.emplace_back("bucket_count", pmem_kv_container.bucket_count());
+}
+
 template <template <typename T> class AllocatorT>
 status basic_vcmap<AllocatorT>::get_all(get_kv_callback *callback, void *arg)
 {
@@ -176,6 +185,8 @@ public:
 
 	result<pmem::obj::slice<const char *>> read_range(size_t pos, size_t n) final;
 
+	void release() final;
+
 protected:
 	container_type *container;
 	typename container_type::accessor acc_;
@@ -256,6 +267,14 @@ basic_vcmap<AllocatorT>::basic_vcmap_const_iterator::read_range(size_t pos, size
 	return {{acc_->second.c_str() + pos, acc_->second.c_str() + pos + n}};
 }
 
+template <template <typename T> class AllocatorT>
+void basic_vcmap<AllocatorT>::basic_vcmap_const_iterator::release()
+{
+	this->init_seek();
+
+	acc_.release();
+}
+
 template <template <typename T> class AllocatorT>
 result<pmem::obj::slice<char *>>
 basic_vcmap<AllocatorT>::basic_vcmap_iterator::write_range(size_t pos, size_t n)
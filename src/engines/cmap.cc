@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2017-2020, Intel Corporation */
+/* Copyright 2017-2021, Intel Corporation */
 
 #include "cmap.h"
 #include "../out.h"
@@ -18,7 +18,9 @@ cmap::cmap(std::unique_ptr<internal::config> cfg) : pmemobj_engine_base(cfg, "pm
 		"Wrong size of cmap value and key. This probably means that std::string has size > 32");
 
 	LOG("Started ok");
+	internal::stopwatch recover_time;
 	Recover();
+	add_open_phase("recover", recover_time.lap());
 }
 
 cmap::~cmap()
@@ -116,6 +118,12 @@ status cmap::defrag(double start_percent, double amount_percent)
 	return status::OK;
 }
 
+void cmap::get_gauges(internal::stats::metrics_type &gauges)
+{
+	gauges.emplace_back("size", container->size());
+	gauges.emplace_back("bucket_count", container->bucket_count());
+}
+
 void cmap::Recover()
 {
 	if (!OID_IS_NULL(*root_oid)) {
@@ -181,6 +189,13 @@ result<pmem::obj::slice<const char *>> cmap::cmap_iterator<true>::read_range(siz
 	return {{acc_->second.c_str() + pos, acc_->second.c_str() + pos + n}};
 }
 
+void cmap::cmap_iterator<true>::release()
+{
+	init_seek();
+
+	acc_.release();
+}
+
 result<pmem::obj::slice<char *>> cmap::cmap_iterator<false>::write_range(size_t pos,
 									 size_t n)
 {
@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2017-2020, Intel Corporation */
+/* Copyright 2017-2021, Intel Corporation */
 
 #pragma once
 
@@ -89,6 +89,8 @@ public:
 
 	status defrag(double start_percent, double amount_percent) final;
 
+	void get_gauges(internal::stats::metrics_type &gauges) final;
+
 	internal::iterator_base *new_iterator() final;
 	internal::iterator_base *new_const_iterator() final;
 
@@ -110,6 +112,8 @@ public:
 
 	result<pmem::obj::slice<const char *>> read_range(size_t pos, size_t n) final;
 
+	void release() final;
+
 protected:
 	container_type *container;
 	container_type::accessor acc_;
@@ -70,11 +70,88 @@ void iterator_base::abort()
 	/* by default NOT_SUPPORTED */
 }
 
+void iterator_base::release()
+{
+	init_seek();
+}
+
+void iterator_base::reacquire()
+{
+}
+
 void iterator_base::init_seek()
 {
 	abort();
 }
 
+iterator_cache::~iterator_cache()
+{
+	drain();
+}
+
+/**
+ * Takes a parked iterator out of the cache.
+ *
+ * @return previously released iterator or nullptr if the cache is empty
+ */
+iterator_base *iterator_cache::acquire()
+{
+	for (auto &slot : slots) {
+		if (slot.load(std::memory_order_relaxed) == nullptr)
+			continue;
+
+		auto it = slot.exchange(nullptr, std::memory_order_acquire);
+		if (it) {
+			it->reacquire();
+			return it;
+		}
+	}
+
+	return nullptr;
+}
+
+/**
+ * Parks the iterator in the cache.
+ *
+ * @return false if the cache is full, in which case the caller still owns
+ * the iterator
+ */
+bool iterator_cache::release(iterator_base *it)
+{
+	if (drained.load(std::memory_order_acquire))
+		return false;
+
+	it->release();
+
+	for (auto &slot : slots) {
+		iterator_base *expected = nullptr;
+		if (slot.load(std::memory_order_relaxed) == nullptr &&
+		    slot.compare_exchange_strong(expected, it,
+						 std::memory_order_release))
+			return true;
+	}
+
+	return false;
+}
+
+/**
+ * Destroys all parked iterators, it has to be called before the engine they
+ * belong to releases its state. Iterators deleted by the user afterwards are
+ * destroyed instead of being parked.
+ */
+void iterator_cache::drain()
+{
+	drained.store(true, std::memory_order_release);
+
+	for (auto &slot : slots) {
+		auto it = slot.exchange(nullptr, std::memory_order_acquire);
+		if (it) {
+			it->owner.reset();
+			delete it;
+		}
+	}
+}
+
 } /* namespace internal */
 } /* namespace kv */
 } /* namespace pmem */
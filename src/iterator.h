@@ -6,6 +6,10 @@
 
 #include "libpmemkv.hpp"
 
+#include <array>
+#include <atomic>
+#include <memory>
+
 #include <libpmemobj++/pool.hpp>
 #include <libpmemobj++/slice.hpp>
 #include <libpmemobj++/transaction.hpp>
@@ -16,6 +20,9 @@ namespace kv
 {
 namespace internal
 {
+
+class iterator_cache;
+
 class iterator_base {
 public:
 	virtual ~iterator_base() = default;
@@ -42,10 +49,55 @@ public:
 	virtual status commit();
 	virtual void abort();
 
+	/*
+	 * Called before the iterator is parked in the engine's iterator_cache.
+	 * It must discard uncommitted changes and drop every lock or accessor
+	 * it holds, so that the parked iterator does not block other threads.
+	 */
+	virtual void release();
+
+	/*
+	 * Called when a parked iterator is handed out again; re-acquires
+	 * whatever release() dropped.
+	 */
+	virtual void reacquire();
+
+	/*
+	 * Cache the iterator is returned to on delete (nullptr if none). It is
+	 * shared, so that an iterator deleted after its engine does not access
+	 * a freed cache.
+	 */
+	std::shared_ptr<iterator_cache> owner;
+
 protected:
 	virtual void init_seek();
 };
 
+/*
+ * Small lock-free cache of released iterators, owned by an engine instance.
+ * It lets the C API reuse iterators instead of allocating a new one (and
+ * resolving its pool) on every pmemkv_iterator_new() call.
+ */
+class iterator_cache {
+public:
+	iterator_cache() = default;
+	~iterator_cache();
+
+	iterator_cache(const iterator_cache &) = delete;
+	iterator_cache &operator=(const iterator_cache &) = delete;
+
+	iterator_base *acquire();
+	bool release(iterator_base *it);
+	void drain();
+
+private:
+	static constexpr size_t CACHE_SIZE = 8;
+
+	std::array<std::atomic<iterator_base *>, CACHE_SIZE> slots = {};
+	/* set by drain(), released iterators are not parked anymore */
+	std::atomic<bool> drained{false};
+};
+
 } /* namespace internal */
 } /* namespace kv */
 } /* namespace pmem */
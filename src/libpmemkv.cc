@@ -13,7 +13,9 @@
 #include "libpmemkv.h"
 #include "libpmemkv.hpp"
 #include "libpmemobj++/pexceptions.hpp"
+#include "op_scope.h"
 #include "out.h"
+#include "pmem_emulation.h"
 #include "transaction.h"
 
 #include <iostream>
@@ -75,6 +77,13 @@ iterator_from_internal(pmem::kv::internal::iterator_base *it)
 	return reinterpret_cast<pmemkv_iterator *>(it);
 }
 
+/* Hands the iterator back to its engine for reuse, or destroys it. */
+static inline void iterator_release(pmem::kv::internal::iterator_base *it)
+{
+	if (!it->owner || !it->owner->release(it))
+		delete it;
+}
+
 template <typename Function>
 static inline int catch_and_return_status(const char *func_name, Function &&f)
 {
@@ -104,6 +113,90 @@ static inline int catch_and_return_status(const char *func_name, Function &&f)
 	return status;
 }
 
+using api_op = pmem::kv::internal::api_op;
+
+/* Starts measuring an operation, if runtime statistics or trace of the db are on. */
+static inline pmem::kv::internal::op_scope measure(pmemkv_db *db, api_op op,
+						   const char *k = nullptr, size_t kb = 0)
+{
+	auto engine = db_to_internal(db);
+	return pmem::kv::internal::op_scope(engine->stats(), engine->tracer(), op, k,
+					    kb);
+}
+
+/*
+ * Returns true if user's callbacks have to be wrapped, to count bytes passed
+ * to them or (with PMem latency emulation) to delay reads of them.
+ */
+static inline bool wrap_callbacks(const pmem::kv::internal::op_scope &scope)
+{
+#ifdef PMEM_LATENCY_EMULATION
+	if (pmem::kv::internal::emulation::reads_enabled())
+		return true;
+#endif
+	return scope.active();
+}
+
+/* Wraps user's callback to count bytes passed to it. */
+struct StatsGetKvCallbackContext {
+	pmemkv_get_kv_callback *callback;
+	void *arg;
+	size_t bytes;
+};
+
+static int stats_get_kv_callback(const char *k, size_t kb, const char *v, size_t vb,
+				 void *arg)
+{
+	const auto c = ((StatsGetKvCallbackContext *)arg);
+
+	c->bytes += kb + vb;
+#ifdef PMEM_LATENCY_EMULATION
+	pmem::kv::internal::emulation::read(k, kb);
+	pmem::kv::internal::emulation::read(v, vb);
+#endif
+
+	return c->callback(k, kb, v, vb, c->arg);
+}
+
+struct StatsGetVCallbackContext {
+	pmemkv_get_v_callback *callback;
+	void *arg;
+	size_t bytes;
+};
+
+static void stats_get_v_callback(const char *v, size_t vb, void *arg)
+{
+	const auto c = ((StatsGetVCallbackContext *)arg);
+
+	c->bytes += vb;
+#ifdef PMEM_LATENCY_EMULATION
+	pmem::kv::internal::emulation::read(v, vb);
+#endif
+
+	c->callback(v, vb, c->arg);
+}
+
+/*
+ * Runs range query 'f' (called with the callback and its argument) and
+ * records it as a single iterate operation.
+ */
+template <typename Function>
+static inline int measure_iterate(const char *func_name, pmemkv_db *db,
+				  pmemkv_get_kv_callback *c, void *arg, const char *k,
+				  size_t kb, Function &&f)
+{
+	auto scope = measure(db, api_op::iterate, k, kb);
+
+	if (!wrap_callbacks(scope))
+		return catch_and_return_status(func_name, [&] { return f(c, arg); });
+
+	StatsGetKvCallbackContext ctx = {c, arg, 0};
+	auto ret = catch_and_return_status(
+		func_name, [&] { return f(&stats_get_kv_callback, &ctx); });
+
+	return scope.finish(ret, ctx.bytes);
+}
+
 extern "C" {
 
 pmemkv_config *pmemkv_config_new(void)
@@ -323,7 +416,10 @@ int pmemkv_tx_begin(pmemkv_db *db, pmemkv_tx **tx)
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
 	return catch_and_return_status(__func__, [&] {
-		*tx = tx_from_internal(db_to_internal(db)->begin_tx());
+		auto internal_tx = db_to_internal(db)->begin_tx();
+		internal_tx->statistics = db_to_internal(db)->stats();
+		internal_tx->tracer = db_to_internal(db)->tracer();
+		*tx = tx_from_internal(internal_tx);
 		return PMEMKV_STATUS_OK;
 	});
 }
@@ -333,10 +429,21 @@ int pmemkv_tx_put(pmemkv_tx *tx, const char *k, size_t kb, const char *v, size_t
 	if (!tx)
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
-	return catch_and_return_status(__func__, [&] {
-		return tx_to_internal(tx)->put(pmem::kv::string_view(k, kb),
-					       pmem::kv::string_view(v, vb));
+	auto internal_tx = tx_to_internal(tx);
+	/* traced as a put; in statistics it's accounted for by tx_commit */
+	pmem::kv::internal::op_scope scope(nullptr, internal_tx->tracer, api_op::put, k,
+					   kb);
+
+	auto ret = catch_and_return_status(__func__, [&] {
+		auto s = internal_tx->put(pmem::kv::string_view(k, kb),
+					  pmem::kv::string_view(v, vb));
+		if (s == pmem::kv::status::OK)
+			internal_tx->bytes_written += kb + vb;
+
+		return s;
 	});
+
+	return scope.finish(ret, 0, kb + vb);
 }
 
 int pmemkv_tx_remove(pmemkv_tx *tx, const char *k, size_t kb)
@@ -344,9 +451,16 @@ int pmemkv_tx_remove(pmemkv_tx *tx, const char *k, size_t kb)
 	if (!tx)
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
-	return catch_and_return_status(__func__, [&] {
-		return tx_to_internal(tx)->remove(pmem::kv::string_view(k, kb));
+	auto internal_tx = tx_to_internal(tx);
+	/* traced as a remove; in statistics it's accounted for by tx_commit */
+	pmem::kv::internal::op_scope scope(nullptr, internal_tx->tracer,
+					   api_op::remove, k, kb);
+
+	auto ret = catch_and_return_status(__func__, [&] {
+		return internal_tx->remove(pmem::kv::string_view(k, kb));
 	});
+
+	return scope.finish(ret);
 }
 
 int pmemkv_tx_commit(pmemkv_tx *tx)
@@ -355,8 +469,16 @@ int pmemkv_tx_commit(pmemkv_tx *tx)
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
 	auto internal_tx = tx_to_internal(tx);
+	pmem::kv::internal::op_scope scope(internal_tx->statistics, internal_tx->tracer,
+					   api_op::tx_commit);
+
+	auto ret = catch_and_return_status(__func__,
+					   [&] { return internal_tx->commit(); });
+
+	scope.finish(ret, 0, internal_tx->bytes_written);
+	internal_tx->bytes_written = 0;
 
-	return catch_and_return_status(__func__, [&] { return internal_tx->commit(); });
+	return ret;
 }
 
 void pmemkv_tx_abort(pmemkv_tx *tx)
@@ -368,6 +490,7 @@ void pmemkv_tx_abort(pmemkv_tx *tx)
 
 	try {
 		internal_tx->abort();
+		internal_tx->bytes_written = 0;
 	} catch (const std::exception &exc) {
 		ERR() << exc.what();
 	} catch (...) {
@@ -396,8 +519,32 @@ int pmemkv_open(const char *engine_c_str, pmemkv_config *config, pmemkv_db **db)
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
 	return catch_and_return_status(__func__, [&] {
+		/* engine-independent items, cfg is handed over to the engine below */
+		uint64_t enable_stats = 0, trace_size = 0, trace_signal = 0;
+		pmem::kv::internal::trace_options trace;
+		trace.dump_path = "pmemkv_trace";
+		const char *path;
+		if (cfg) {
+			cfg->get_uint64("stats", &enable_stats);
+			cfg->get_uint64("trace_buffer_size", &trace_size);
+			cfg->get_uint64("trace_signal", &trace_signal);
+			cfg->get_uint64("trace_key_salt", &trace.key_salt);
+			if (cfg->get_string("trace_path", &path))
+				trace.dump_path = path;
+			if (cfg->get_string("capture_path", &path))
+				trace.capture_path = path;
+		}
+		trace.ring_size = static_cast<size_t>(trace_size);
+		trace.dump_signal = static_cast<int>(trace_signal);
+
+		pmem::kv::internal::stopwatch open_time;
 		auto engine = pmem::kv::engine_base::create_engine(engine_c_str,
 								   std::move(cfg));
+		engine->add_open_phase("total", open_time.lap());
+		if (enable_stats)
+			engine->enable_stats();
+		if (trace.ring_size || !trace.capture_path.empty())
+			engine->enable_trace(trace);
 
 		*db = db_from_internal(engine.release());
 
@@ -407,8 +554,14 @@ int pmemkv_open(const char *engine_c_str, pmemkv_config *config, pmemkv_db **db)
 
 void pmemkv_close(pmemkv_db *db)
 {
+	if (!db)
+		return;
+
 	try {
-		delete db_to_internal(db);
+		auto engine = db_to_internal(db);
+		/* parked iterators have to be destroyed while the engine is intact */
+		engine->drain_iterators();
+		delete engine;
 	} catch (const std::exception &exc) {
 		ERR() << exc.what();
 	} catch (...) {
@@ -421,8 +574,11 @@ int pmemkv_count_all(pmemkv_db *db, size_t *cnt)
 	if (!db)
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
-	return catch_and_return_status(
+	auto scope = measure(db, api_op::count);
+	auto ret = catch_and_return_status(
 		__func__, [&] { return db_to_internal(db)->count_all(*cnt); });
+
+	return scope.finish(ret);
 }
 
 int pmemkv_count_above(pmemkv_db *db, const char *k, size_t kb, size_t *cnt)
@@ -430,10 +586,13 @@ int pmemkv_count_above(pmemkv_db *db, const char *k, size_t kb, size_t *cnt)
 	if (!db)
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
-	return catch_and_return_status(__func__, [&] {
+	auto scope = measure(db, api_op::count, k, kb);
+	auto ret = catch_and_return_status(__func__, [&] {
 		return db_to_internal(db)->count_above(pmem::kv::string_view(k, kb),
 						       *cnt);
 	});
+
+	return scope.finish(ret);
 }
 
 int pmemkv_count_equal_above(pmemkv_db *db, const char *k, size_t kb, size_t *cnt)
@@ -441,10 +600,13 @@ int pmemkv_count_equal_above(pmemkv_db *db, const char *k, size_t kb, size_t *cn
 	if (!db)
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
-	return catch_and_return_status(__func__, [&] {
+	auto scope = measure(db, api_op::count, k, kb);
+	auto ret = catch_and_return_status(__func__, [&] {
 		return db_to_internal(db)->count_equal_above(pmem::kv::string_view(k, kb),
 							     *cnt);
 	});
+
+	return scope.finish(ret);
 }
 
 int pmemkv_count_equal_below(pmemkv_db *db, const char *k, size_t kb, size_t *cnt)
@@ -452,10 +614,13 @@ int pmemkv_count_equal_below(pmemkv_db *db, const char *k, size_t kb, size_t *cn
 	if (!db)
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
-	return catch_and_return_status(__func__, [&] {
+	auto scope = measure(db, api_op::count, k, kb);
+	auto ret = catch_and_return_status(__func__, [&] {
 		return db_to_internal(db)->count_equal_below(pmem::kv::string_view(k, kb),
 							     *cnt);
 	});
+
+	return scope.finish(ret);
 }
 
 int pmemkv_count_below(pmemkv_db *db, const char *k, size_t kb, size_t *cnt)
@@ -463,10 +628,13 @@ int pmemkv_count_below(pmemkv_db *db, const char *k, size_t kb, size_t *cnt)
 	if (!db)
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
-	return catch_and_return_status(__func__, [&] {
+	auto scope = measure(db, api_op::count, k, kb);
+	auto ret = catch_and_return_status(__func__, [&] {
 		return db_to_internal(db)->count_below(pmem::kv::string_view(k, kb),
 						       *cnt);
 	});
+
+	return scope.finish(ret);
 }
 
 int pmemkv_count_between(pmemkv_db *db, const char *k1, size_t kb1, const char *k2,
@@ -475,11 +643,14 @@ int pmemkv_count_between(pmemkv_db *db, const char *k1, size_t kb1, const char *
 	if (!db)
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
-	return catch_and_return_status(__func__, [&] {
+	auto scope = measure(db, api_op::count, k1, kb1);
+	auto ret = catch_and_return_status(__func__, [&] {
 		return db_to_internal(db)->count_between(pmem::kv::string_view(k1, kb1),
 							 pmem::kv::string_view(k2, kb2),
 							 *cnt);
 	});
+
+	return scope.finish(ret);
 }
 
 int pmemkv_get_all(pmemkv_db *db, pmemkv_get_kv_callback *c, void *arg)
@@ -487,8 +658,10 @@ int pmemkv_get_all(pmemkv_db *db, pmemkv_get_kv_callback *c, void *arg)
 	if (!db)
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
-	return catch_and_return_status(
-		__func__, [&] { return db_to_internal(db)->get_all(c, arg); });
+	return measure_iterate(__func__, db, c, arg, nullptr, 0,
+			       [&](pmemkv_get_kv_callback *cb, void *cb_arg) {
+				       return db_to_internal(db)->get_all(cb, cb_arg);
+			       });
 }
 
 int pmemkv_get_above(pmemkv_db *db, const char *k, size_t kb, pmemkv_get_kv_callback *c,
@@ -497,10 +670,11 @@ int pmemkv_get_above(pmemkv_db *db, const char *k, size_t kb, pmemkv_get_kv_call
 	if (!db)
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
-	return catch_and_return_status(__func__, [&] {
-		return db_to_internal(db)->get_above(pmem::kv::string_view(k, kb), c,
-						     arg);
-	});
+	return measure_iterate(__func__, db, c, arg, k, kb,
+			       [&](pmemkv_get_kv_callback *cb, void *cb_arg) {
+				       return db_to_internal(db)->get_above(
+					       pmem::kv::string_view(k, kb), cb, cb_arg);
+			       });
 }
 
 int pmemkv_get_equal_above(pmemkv_db *db, const char *k, size_t kb,
@@ -509,10 +683,11 @@ int pmemkv_get_equal_above(pmemkv_db *db, const char *k, size_t kb,
 	if (!db)
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
-	return catch_and_return_status(__func__, [&] {
-		return db_to_internal(db)->get_equal_above(pmem::kv::string_view(k, kb),
-							   c, arg);
-	});
+	return measure_iterate(__func__, db, c, arg, k, kb,
+			       [&](pmemkv_get_kv_callback *cb, void *cb_arg) {
+				       return db_to_internal(db)->get_equal_above(
+					       pmem::kv::string_view(k, kb), cb, cb_arg);
+			       });
 }
 
 int pmemkv_get_equal_below(pmemkv_db *db, const char *k, size_t kb,
@@ -521,10 +696,11 @@ int pmemkv_get_equal_below(pmemkv_db *db, const char *k, size_t kb,
 	if (!db)
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
-	return catch_and_return_status(__func__, [&] {
-		return db_to_internal(db)->get_equal_below(pmem::kv::string_view(k, kb),
-							   c, arg);
-	});
+	return measure_iterate(__func__, db, c, arg, k, kb,
+			       [&](pmemkv_get_kv_callback *cb, void *cb_arg) {
+				       return db_to_internal(db)->get_equal_below(
+					       pmem::kv::string_view(k, kb), cb, cb_arg);
+			       });
 }
 
 int pmemkv_get_below(pmemkv_db *db, const char *k, size_t kb, pmemkv_get_kv_callback *c,
@@ -533,10 +709,11 @@ int pmemkv_get_below(pmemkv_db *db, const char *k, size_t kb, pmemkv_get_kv_call
 	if (!db)
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
-	return catch_and_return_status(__func__, [&] {
-		return db_to_internal(db)->get_below(pmem::kv::string_view(k, kb), c,
-						     arg);
-	});
+	return measure_iterate(__func__, db, c, arg, k, kb,
+			       [&](pmemkv_get_kv_callback *cb, void *cb_arg) {
+				       return db_to_internal(db)->get_below(
+					       pmem::kv::string_view(k, kb), cb, cb_arg);
+			       });
 }
 
 int pmemkv_get_between(pmemkv_db *db, const char *k1, size_t kb1, const char *k2,
@@ -545,11 +722,13 @@ int pmemkv_get_between(pmemkv_db *db, const char *k1, size_t kb1, const char *k2
 	if (!db)
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
-	return catch_and_return_status(__func__, [&] {
-		return db_to_internal(db)->get_between(pmem::kv::string_view(k1, kb1),
-						       pmem::kv::string_view(k2, kb2), c,
-						       arg);
-	});
+	return measure_iterate(__func__, db, c, arg, k1, kb1,
+			       [&](pmemkv_get_kv_callback *cb, void *cb_arg) {
+				       return db_to_internal(db)->get_between(
+					       pmem::kv::string_view(k1, kb1),
+					       pmem::kv::string_view(k2, kb2), cb,
+					       cb_arg);
+			       });
 }
 
 int pmemkv_exists(pmemkv_db *db, const char *k, size_t kb)
@@ -557,9 +736,12 @@ int pmemkv_exists(pmemkv_db *db, const char *k, size_t kb)
 	if (!db)
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
-	return catch_and_return_status(__func__, [&] {
+	auto scope = measure(db, api_op::exists, k, kb);
+	auto ret = catch_and_return_status(__func__, [&] {
 		return db_to_internal(db)->exists(pmem::kv::string_view(k, kb));
 	});
+
+	return scope.finish(ret);
 }
 
 int pmemkv_get(pmemkv_db *db, const char *k, size_t kb, pmemkv_get_v_callback *c,
@@ -568,9 +750,21 @@ int pmemkv_get(pmemkv_db *db, const char *k, size_t kb, pmemkv_get_v_callback *c
 	if (!db)
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
-	return catch_and_return_status(__func__, [&] {
-		return db_to_internal(db)->get(pmem::kv::string_view(k, kb), c, arg);
+	auto scope = measure(db, api_op::get, k, kb);
+
+	if (!wrap_callbacks(scope))
+		return catch_and_return_status(__func__, [&] {
+			return db_to_internal(db)->get(pmem::kv::string_view(k, kb), c,
+						       arg);
+		});
+
+	StatsGetVCallbackContext ctx = {c, arg, 0};
+	auto ret = catch_and_return_status(__func__, [&] {
+		return db_to_internal(db)->get(pmem::kv::string_view(k, kb),
+					       &stats_get_v_callback, &ctx);
 	});
+
+	return scope.finish(ret, ctx.bytes);
 }
 
 struct GetCopyCallbackContext {
@@ -580,6 +774,8 @@ struct GetCopyCallbackContext {
 	char *buffer;
 
 	size_t *value_size;
+
+	size_t copied;
 };
 
 static void get_copy_callback(const char *v, size_t vb, void *arg)
@@ -593,32 +789,53 @@ static void get_copy_callback(const char *v, size_t vb, void *arg)
 		c->result = PMEMKV_STATUS_OK;
 		if (c->buffer != nullptr)
 			memcpy(c->buffer, v, vb);
+		c->copied = vb;
+#ifdef PMEM_LATENCY_EMULATION
+		pmem::kv::internal::emulation::read(v, vb);
+#endif
 	} else {
 		c->result = PMEMKV_STATUS_OUT_OF_MEMORY;
 	}
 }
 
+/* Copies the value to 'buffer', if it fits - bytes past the value are not touched. */
+static int get_copy(const char *func_name, pmemkv_db *db, const char *k, size_t kb,
+		    char *buffer, size_t buffer_size, size_t *value_size)
+{
+	GetCopyCallbackContext ctx = {PMEMKV_STATUS_NOT_FOUND, buffer_size, buffer,
+				      value_size, 0};
+
+	auto scope = measure(db, api_op::get, k, kb);
+	auto ret = catch_and_return_status(func_name, [&] {
+		return db_to_internal(db)->get(pmem::kv::string_view(k, kb),
+					       &get_copy_callback, &ctx);
+	});
+
+	if (ret != PMEMKV_STATUS_OK)
+		return scope.finish(ret);
+
+	return scope.finish(ctx.result, ctx.copied);
+}
+
 int pmemkv_get_copy(pmemkv_db *db, const char *k, size_t kb, char *buffer,
 		    size_t buffer_size, size_t *value_size)
 {
 	if (!db)
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
-	GetCopyCallbackContext ctx = {PMEMKV_STATUS_NOT_FOUND, buffer_size, buffer,
-				      value_size};
-
 	if (buffer != nullptr)
 		memset(buffer, 0, buffer_size);
 
-	auto ret = catch_and_return_status(__func__, [&] {
-		return db_to_internal(db)->get(pmem::kv::string_view(k, kb),
-					       &get_copy_callback, &ctx);
-	});
+	return get_copy(__func__, db, k, kb, buffer, buffer_size, value_size);
+}
 
-	if (ret != PMEMKV_STATUS_OK)
-		return ret;
+int pmemkv_get_into(pmemkv_db *db, const char *k, size_t kb, char *buffer,
+		    size_t buffer_size, size_t *value_size)
+{
+	if (!db)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
-	return ctx.result;
+	return get_copy(__func__, db, k, kb, buffer, buffer_size, value_size);
 }
 
 int pmemkv_put(pmemkv_db *db, const char *k, size_t kb, const char *v, size_t vb)
@@ -626,10 +843,13 @@ int pmemkv_put(pmemkv_db *db, const char *k, size_t kb, const char *v, size_t vb
 	if (!db)
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
-	return catch_and_return_status(__func__, [&] {
+	auto scope = measure(db, api_op::put, k, kb);
+	auto ret = catch_and_return_status(__func__, [&] {
 		return db_to_internal(db)->put(pmem::kv::string_view(k, kb),
 					       pmem::kv::string_view(v, vb));
 	});
+
+	return scope.finish(ret, 0, kb + vb);
 }
 
 int pmemkv_remove(pmemkv_db *db, const char *k, size_t kb)
@@ -637,9 +857,12 @@ int pmemkv_remove(pmemkv_db *db, const char *k, size_t kb)
 	if (!db)
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
-	return catch_and_return_status(__func__, [&] {
+	auto scope = measure(db, api_op::remove, k, kb);
+	auto ret = catch_and_return_status(__func__, [&] {
 		return db_to_internal(db)->remove(pmem::kv::string_view(k, kb));
 	});
+
+	return scope.finish(ret);
 }
 
 int pmemkv_defrag(pmemkv_db *db, double start_percent, double amount_percent)
@@ -647,9 +870,113 @@ int pmemkv_defrag(pmemkv_db *db, double start_percent, double amount_percent)
 	if (!db)
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
-	return catch_and_return_status(__func__, [&] {
+	auto scope = measure(db, api_op::defrag);
+	auto ret = catch_and_return_status(__func__, [&] {
 		return db_to_internal(db)->defrag(start_percent, amount_percent);
 	});
+
+	return scope.finish(ret);
+}
+
+int pmemkv_bulk_load(pmemkv_db *db, pmemkv_bulk_load_callback *c, void *arg)
+{
+	if (!db || !c)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	/* passes the pairs through, counting their bytes for statistics */
+	struct counting_arg {
+		pmemkv_bulk_load_callback *c;
+		void *arg;
+		std::uint64_t bytes;
+	} counting = {c, arg, 0};
+	auto counting_cb = [](const char **k, size_t *kb, const char **v, size_t *vb,
+			      void *a) {
+		auto ca = static_cast<counting_arg *>(a);
+		int ret = ca->c(k, kb, v, vb, ca->arg);
+		if (ret == 0)
+			ca->bytes += *kb + *vb;
+
+		return ret;
+	};
+
+	auto scope = measure(db, api_op::bulk_load);
+	auto ret = catch_and_return_status(__func__, [&] {
+		return db_to_internal(db)->bulk_load(counting_cb, &counting);
+	});
+
+	return scope.finish(ret, 0, counting.bytes);
+}
+
+int pmemkv_stats_get(pmemkv_db *db, pmemkv_stats_callback *c, void *arg)
+{
+	if (!db || !c)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		auto engine = db_to_internal(db);
+		if (!engine->stats())
+			throw pmem::kv::internal::not_supported(
+				"Statistics are not enabled for this database");
+
+		pmem::kv::internal::stats::metrics_type metrics, gauges;
+		engine->stats()->collect(metrics);
+		engine->get_gauges(gauges);
+		for (auto &g : gauges)
+			metrics.emplace_back("engine." + g.first, g.second);
+		for (auto &p : engine->open_phases())
+			metrics.emplace_back("open." + p.first + "_ns", p.second);
+
+		for (auto &m : metrics) {
+			if (c(m.first.c_str(), m.first.size(), m.second, arg) != 0)
+				return PMEMKV_STATUS_STOPPED_BY_CB;
+		}
+
+		return PMEMKV_STATUS_OK;
+	});
+}
+
+int pmemkv_stats_reset(pmemkv_db *db)
+{
+	if (!db)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		auto engine = db_to_internal(db);
+		if (!engine->stats())
+			throw pmem::kv::internal::not_supported(
+				"Statistics are not enabled for this database");
+
+		engine->stats()->reset();
+
+		return PMEMKV_STATUS_OK;
+	});
+}
+
+int pmemkv_trace_dump(pmemkv_db *db, const char *path)
+{
+	if (!db || !path)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		auto engine = db_to_internal(db);
+		if (!engine->tracer())
+			throw pmem::kv::internal::not_supported(
+				"Trace is not enabled for this database");
+
+		engine->tracer()->dump(path);
+
+		return PMEMKV_STATUS_OK;
+	});
+}
+
+int pmemkv_memory_usage_get(pmemkv_db *db, pmemkv_memory_usage *usage)
+{
+	if (!db || !usage)
+		return PMEMKV_STATUS_INVALID_ARGUMENT;
+
+	return catch_and_return_status(__func__, [&] {
+		return db_to_internal(db)->memory_usage(*usage);
+	});
 }
 
 int pmemkv_iterator_new(pmemkv_db *db, pmemkv_iterator **it)
@@ -658,7 +985,8 @@ int pmemkv_iterator_new(pmemkv_db *db, pmemkv_iterator **it)
 		return PMEMKV_STATUS_INVALID_ARGUMENT;
 
 	return catch_and_return_status(__func__, [&] {
-		*it = iterator_from_internal(db_to_internal(db)->new_const_iterator());
+		*it = iterator_from_internal(
+			db_to_internal(db)->acquire_const_iterator());
 		return PMEMKV_STATUS_OK;
 	});
 }
@@ -674,7 +1002,7 @@ int pmemkv_write_iterator_new(pmemkv_db *db, pmemkv_write_iterator **it)
 		auto unique_it = std::unique_ptr<pmemkv_write_iterator>(
 			new pmemkv_write_iterator());
 		unique_it->iter =
-			iterator_from_internal(db_to_internal(db)->new_iterator());
+			iterator_from_internal(db_to_internal(db)->acquire_iterator());
 		*it = unique_it.release();
 		return PMEMKV_STATUS_OK;
 	});
@@ -686,7 +1014,7 @@ void pmemkv_iterator_delete(pmemkv_iterator *it)
 		return;
 
 	try {
-		delete iterator_to_base(it);
+		iterator_release(iterator_to_base(it));
 	} catch (const std::exception &exc) {
 		ERR() << exc.what();
 	} catch (...) {
@@ -700,7 +1028,7 @@ void pmemkv_write_iterator_delete(pmemkv_write_iterator *it)
 		return;
 
 	try {
-		delete iterator_to_base(it->iter);
+		iterator_release(iterator_to_base(it->iter));
 		delete it;
 	} catch (const std::exception &exc) {
 		ERR() << exc.what();
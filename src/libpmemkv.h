@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2017-2020, Intel Corporation */
+/* Copyright 2017-2021, Intel Corporation */
 
 #ifndef LIBPMEMKV_H
 #define LIBPMEMKV_H
@@ -44,6 +44,20 @@ typedef void pmemkv_get_v_callback(const char *value, size_t valuebytes, void *a
 typedef int pmemkv_compare_function(const char *key1, size_t keybytes1, const char *key2,
 				    size_t keybytes2, void *arg);
 
+typedef int pmemkv_stats_callback(const char *name, size_t namebytes, uint64_t value,
+				  void *arg);
+
+typedef int pmemkv_bulk_load_callback(const char **key, size_t *keybytes,
+				      const char **value, size_t *valuebytes, void *arg);
+
+typedef struct {
+	uint64_t dram_bytes;
+	uint64_t pmem_data_bytes;
+	uint64_t pmem_metadata_bytes;
+	uint64_t pmem_free_bytes;
+	uint64_t pmem_fragmented_bytes;
+} pmemkv_memory_usage;
+
 pmemkv_comparator *pmemkv_comparator_new(pmemkv_compare_function *fn, const char *name,
 					 void *arg);
 void pmemkv_comparator_delete(pmemkv_comparator *comparator);
@@ -101,12 +115,21 @@ int pmemkv_get(pmemkv_db *db, const char *k, size_t kb, pmemkv_get_v_callback *c
 	       void *arg);
 int pmemkv_get_copy(pmemkv_db *db, const char *k, size_t kb, char *buffer,
 		    size_t buffer_size, size_t *value_size);
+int pmemkv_get_into(pmemkv_db *db, const char *k, size_t kb, char *buffer,
+		    size_t buffer_size, size_t *value_size);
 int pmemkv_put(pmemkv_db *db, const char *k, size_t kb, const char *v, size_t vb);
 
 int pmemkv_remove(pmemkv_db *db, const char *k, size_t kb);
 
 int pmemkv_defrag(pmemkv_db *db, double start_percent, double amount_percent);
 
+int pmemkv_bulk_load(pmemkv_db *db, pmemkv_bulk_load_callback *c, void *arg);
+
+int pmemkv_stats_get(pmemkv_db *db, pmemkv_stats_callback *c, void *arg);
+int pmemkv_stats_reset(pmemkv_db *db);
+int pmemkv_trace_dump(pmemkv_db *db, const char *path);
+int pmemkv_memory_usage_get(pmemkv_db *db, pmemkv_memory_usage *usage);
+
 const char *pmemkv_errormsg(void);
 
 /* This API is EXPERIMENTAL and might change. */
@@ -60,6 +60,22 @@ typedef int get_kv_function(string_view key, string_view value);
  * @param[in] value returned by callback item's data
  */
 typedef void get_v_function(string_view value);
+/**
+ * The C++ idiomatic function type to use for callback reading runtime statistics.
+ *
+ * @param[in] name name of the metric
+ * @param[in] value current value of the metric
+ */
+typedef int stats_function(string_view name, std::uint64_t value);
+/**
+ * The C++ idiomatic function type to use for callback producing input of bulk load.
+ * It returns 0 after setting the next pair, a positive value at the end of input and
+ * a negative value to stop the load.
+ *
+ * @param[out] key key of the next pair, valid until the next call
+ * @param[out] value value of the next pair, valid until the next call
+ */
+typedef int bulk_load_function(string_view &key, string_view &value);
 
 /**
  * Key-value pair callback, C-style.
@@ -69,6 +85,18 @@ using get_kv_callback = pmemkv_get_kv_callback;
  * Value-only callback, C-style.
  */
 using get_v_callback = pmemkv_get_v_callback;
+/**
+ * Runtime statistics callback, C-style.
+ */
+using stats_callback = pmemkv_stats_callback;
+/**
+ * Bulk load input callback, C-style.
+ */
+using bulk_load_callback = pmemkv_bulk_load_callback;
+/**
+ * Memory used by a database, see db::memory_usage().
+ */
+using memory_usage_info = pmemkv_memory_usage;
 
 /*! \enum status
 	\brief Status returned by most of pmemkv functions.
@@ -590,6 +618,17 @@ public:
 	status remove(string_view key) noexcept;
 	status defrag(double start_percent = 0, double amount_percent = 100);
 
+	status bulk_load(bulk_load_callback *callback, void *arg) noexcept;
+	status bulk_load(std::function<bulk_load_function> f) noexcept;
+	template <typename ForwardIt>
+	status bulk_load(ForwardIt first, ForwardIt last) noexcept;
+
+	status stats(stats_callback *callback, void *arg) noexcept;
+	status stats(std::function<stats_function> f) noexcept;
+	status stats_reset() noexcept;
+	status trace_dump(const std::string &path) noexcept;
+	status memory_usage(memory_usage_info &usage) noexcept;
+
 	result<tx> tx_begin() noexcept;
 
 	result<read_iterator> new_read_iterator();
@@ -1732,6 +1771,27 @@ static inline void call_get_copy(const char *v, size_t vb, void *arg)
 	auto c = reinterpret_cast<std::string *>(arg);
 	c->assign(v, vb);
 }
+
+static inline int call_bulk_load_function(const char **key, size_t *keybytes,
+					  const char **value, size_t *valuebytes,
+					  void *arg)
+{
+	string_view k, v;
+	int ret = (*reinterpret_cast<std::function<bulk_load_function> *>(arg))(k, v);
+	*key = k.data();
+	*keybytes = k.size();
+	*value = v.data();
+	*valuebytes = v.size();
+
+	return ret;
+}
+
+static inline int call_stats_function(const char *name, size_t namebytes,
+				      std::uint64_t value, void *arg)
+{
+	return (*reinterpret_cast<std::function<stats_function> *>(arg))(
+		string_view(name, namebytes), value);
+}
 }
 
 /**
@@ -2233,6 +2293,156 @@ inline status db::defrag(double start_percent, double amount_percent)
 		pmemkv_defrag(this->db_.get(), start_percent, amount_percent));
 }
 
+/**
+ * Fills the empty database with pairs returned by (C-like) callback function, in
+ * ascending order of keys. It is much faster than calling put() for every pair: the
+ * engine builds its structure directly from the sorted input. The callback sets
+ * the next pair and returns 0, returns a positive value at the end of input or a
+ * negative value to stop the load. Key and value have to stay valid until the next
+ * call of the callback.
+ *
+ * If the database is not empty or keys are not in ascending order,
+ * pmem::kv::status::INVALID_ARGUMENT is returned. If the callback stops the load,
+ * pmem::kv::status::STOPPED_BY_CB is returned. In both cases the database is left
+ * empty. Engines without the support for bulk load return
+ * pmem::kv::status::NOT_SUPPORTED.
+ *
+ * The load is not atomic: pairs are committed in batches, so after a crash during
+ * the load the database holds a prefix of the input and has to be cleared before
+ * the load is repeated.
+ *
+ * @param[in] callback function producing the pairs
+ * @param[in] arg additional arguments to be passed to callback
+ *
+ * @return pmem::kv::status
+ */
+inline status db::bulk_load(bulk_load_callback *callback, void *arg) noexcept
+{
+	return static_cast<status>(pmemkv_bulk_load(this->db_.get(), callback, arg));
+}
+
+/**
+ * Fills the empty database with pairs returned by function, in ascending order of
+ * keys. See db::bulk_load(bulk_load_callback *callback, void *arg) for details.
+ *
+ * @param[in] f function setting the next pair and returning 0, or returning a
+ *	positive value at the end of input or a negative value to stop the load
+ *
+ * @return pmem::kv::status
+ */
+inline status db::bulk_load(std::function<bulk_load_function> f) noexcept
+{
+	return static_cast<status>(
+		pmemkv_bulk_load(this->db_.get(), call_bulk_load_function, &f));
+}
+
+/**
+ * Fills the empty database with pairs from the range [first, last), sorted in
+ * ascending order of keys. See db::bulk_load(bulk_load_callback *callback, void
+ * *arg) for details.
+ *
+ * @param[in] first beginning of the range
+ * @param[in] last end of the range, elements have 'first' and 'second' members
+ *	convertible to string_view (e.g. std::map<std::string, std::string>)
+ *
+ * @return pmem::kv::status
+ */
+template <typename ForwardIt>
+inline status db::bulk_load(ForwardIt first, ForwardIt last) noexcept
+{
+	return bulk_load([&](string_view &key, string_view &value) {
+		if (first == last)
+			return 1;
+
+		key = first->first;
+		value = first->second;
+		++first;
+
+		return 0;
+	});
+}
+
+/**
+ * Executes (C-like) callback function for every runtime statistic of the
+ * database: per-operation counters and latency histograms, bytes read and
+ * written and engine specific gauges. Statistics have to be enabled with
+ * the "stats" config item, otherwise pmem::kv::status::NOT_SUPPORTED is
+ * returned. If the callback returns non-zero value, iteration stops and
+ * pmem::kv::status::STOPPED_BY_CB is returned.
+ *
+ * @param[in] callback function to be called for every metric
+ * @param[in] arg additional arguments to be passed to callback
+ *
+ * @return pmem::kv::status
+ */
+inline status db::stats(stats_callback *callback, void *arg) noexcept
+{
+	return static_cast<status>(pmemkv_stats_get(this->db_.get(), callback, arg));
+}
+
+/**
+ * Executes function for every runtime statistic of the database.
+ * See db::stats(stats_callback *callback, void *arg) for details.
+ *
+ * @param[in] f function called for every metric, with its name and value
+ *
+ * @return pmem::kv::status
+ */
+inline status db::stats(std::function<stats_function> f) noexcept
+{
+	return static_cast<status>(
+		pmemkv_stats_get(this->db_.get(), call_stats_function, &f));
+}
+
+/**
+ * Zeroes all runtime statistics of the database (gauges are not affected).
+ *
+ * @return pmem::kv::status
+ */
+inline status db::stats_reset() noexcept
+{
+	return static_cast<status>(pmemkv_stats_reset(this->db_.get()));
+}
+
+/**
+ * Writes trace of recent API calls (one ring buffer of records per thread) to
+ * the file at *path*. Trace has to be enabled with the "trace_buffer_size" config
+ * item, otherwise pmem::kv::status::NOT_SUPPORTED is returned. The dump can be
+ * decoded with utils/pmemkv_trace.py.
+ *
+ * @param[in] path file the trace is written to
+ *
+ * @return pmem::kv::status
+ */
+inline status db::trace_dump(const std::string &path) noexcept
+{
+	return static_cast<status>(pmemkv_trace_dump(this->db_.get(), path.c_str()));
+}
+
+/**
+ * Reports how much memory the database uses:
+ * - dram_bytes - volatile structures kept in DRAM (e.g. tree3's inner nodes),
+ * - pmem_data_bytes - keys and values stored in the pool,
+ * - pmem_metadata_bytes - the rest of memory allocated in the pool (engine's
+ *   structures, allocator's overhead),
+ * - pmem_free_bytes - pool space not allocated, apart from fragmented space
+ *   (0 if pool size cannot be determined),
+ * - pmem_fragmented_bytes - free blocks usable only for objects of their size;
+ *   0 unless the pool was opened by "path" with "heap_stats" config item set,
+ *   counted only for runs used since then (the rest is reported as free).
+ *
+ * It walks through all elements and allocations, so it takes time proportional
+ * to the database size. Supported by pmemobj-based engines.
+ *
+ * @param[out] usage memory usage of the database
+ *
+ * @return pmem::kv::status
+ */
+inline status db::memory_usage(memory_usage_info &usage) noexcept
+{
+	return static_cast<status>(pmemkv_memory_usage_get(this->db_.get(), &usage));
+}
+
 /**
  * Returns new write iterator in pmem::kv::result.
  *
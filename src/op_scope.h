@@ -0,0 +1,129 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_OP_SCOPE_H
+#define LIBPMEMKV_OP_SCOPE_H
+
+#include <chrono>
+#include <cstdint>
+
+#include "stats.h"
+#include "trace.h"
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/*
+ * Measures a single API call, for runtime statistics ('s') and trace ('t').
+ * It does nothing (apart from passing the status through) when both are
+ * disabled, i.e. null. Bytes are accounted for only if the call did not fail.
+ */
+class op_scope {
+public:
+	op_scope(stats *s, trace *t, api_op op, const char *key = nullptr,
+		 size_t key_size = 0) noexcept
+	    : s(s), t(t), op(op), key(key), key_size(key_size)
+	{
+		if (!s && !t)
+			return;
+
+#ifdef PERSIST_STATS
+		if (s) {
+			outer = current_op_counters;
+			current_op_counters = &s->counters(op);
+		}
+#endif
+		start = clock_type::now();
+	}
+
+	/* the outer call's counters are restored however this scope is left */
+	~op_scope()
+	{
+#ifdef PERSIST_STATS
+		if (s)
+			current_op_counters = outer;
+#endif
+	}
+
+	/* a moved-from scope does not restore the counters */
+	op_scope(op_scope &&other) noexcept
+	    : s(other.s),
+	      t(other.t),
+	      op(other.op),
+	      key(other.key),
+	      key_size(other.key_size),
+	      start(other.start)
+#ifdef PERSIST_STATS
+	      ,
+	      outer(other.outer)
+#endif
+	{
+		other.s = nullptr;
+		other.t = nullptr;
+	}
+
+	op_scope(const op_scope &) = delete;
+	op_scope &operator=(const op_scope &) = delete;
+
+	bool active() const noexcept
+	{
+		return s || t;
+	}
+
+	int finish(int status, std::uint64_t bytes_read = 0,
+		   std::uint64_t bytes_written = 0) noexcept
+	{
+		if (!s && !t)
+			return status;
+
+		auto ns = static_cast<std::uint64_t>(
+			std::chrono::duration_cast<std::chrono::nanoseconds>(
+				clock_type::now() - start)
+				.count());
+
+		if (s) {
+			s->record(op, ns, status);
+			if (!stats::is_error(status)) {
+				s->add_bytes_read(bytes_read);
+				s->add_bytes_written(bytes_written);
+			}
+		}
+
+		if (t) {
+			/*
+			 * everything transferred apart from the key itself (only
+			 * written bytes include the key, the value may be empty)
+			 */
+			auto transferred = bytes_read + bytes_written;
+			auto value_size = transferred >= key_size && bytes_written
+				? transferred - key_size
+				: transferred;
+			t->record(op, start, ns, key, key_size, value_size, status);
+		}
+
+		return status;
+	}
+
+private:
+	using clock_type = std::chrono::steady_clock;
+
+	stats *s;
+	trace *t;
+	api_op op;
+	const char *key;
+	size_t key_size;
+	clock_type::time_point start;
+#ifdef PERSIST_STATS
+	stats_shard::op_counters *outer = nullptr;
+#endif
+};
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_OP_SCOPE_H */
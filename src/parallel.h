@@ -0,0 +1,55 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_PARALLEL_H
+#define LIBPMEMKV_PARALLEL_H
+
+#include <cstddef>
+#include <exception>
+#include <thread>
+#include <vector>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/*
+ * Calls f(0), ..., f(n - 1), each in its own thread (f(0) in the calling one), and
+ * rethrows the first exception thrown by any of them. Used to rebuild volatile
+ * indexes on open.
+ */
+template <typename F>
+void run_parallel(std::size_t n, F &&f)
+{
+	std::vector<std::exception_ptr> errors(n);
+	std::vector<std::thread> threads;
+	for (std::size_t i = 1; i < n; i++)
+		threads.emplace_back([&, i] {
+			try {
+				f(i);
+			} catch (...) {
+				errors[i] = std::current_exception();
+			}
+		});
+	try {
+		if (n > 0)
+			f(0);
+	} catch (...) {
+		errors[0] = std::current_exception();
+	}
+	for (auto &thread : threads)
+		thread.join();
+
+	for (auto &error : errors)
+		if (error)
+			std::rethrow_exception(error);
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_PARALLEL_H */
@@ -0,0 +1,259 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+/*
+ * persist_hooks.cc -- intercepts flushes and fences issued by pmemkv (built
+ *		only with PERSIST_STATS or PMEM_LATENCY_EMULATION), to count them
+ *		and/or to delay them as PMem would (see pmem_emulation.h).
+ *
+ * Functions below shadow the libpmemobj ones for every caller inside libpmemkv
+ * (including libpmemobj-cpp containers, which are compiled into it). They are
+ * not exported (see libpmemkv.map), so applications are not affected. Each call
+ * is attributed to the API call measured in this thread (see op_scope) and
+ * then forwarded to libpmemobj.
+ *
+ * Flushes done by libpmemobj internally (e.g. on transaction commit) cannot be
+ * seen this way. Instead, ranges snapshotted in transactions are counted
+ * (tx_ranges, tx_bytes) - each of them is flushed when the transaction commits.
+ */
+
+#include "pmem_emulation.h"
+#include "stats.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <dlfcn.h>
+
+#include <libpmemobj/base.h>
+#include <libpmemobj/tx_base.h>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+#ifdef PERSIST_STATS
+thread_local stats_shard::op_counters *current_op_counters = nullptr;
+
+static constexpr std::uintptr_t CACHELINE_SIZE = 64;
+
+static void count_flush(const void *addr, size_t len)
+{
+	auto c = current_op_counters;
+	if (!c || len == 0)
+		return;
+
+	auto begin = reinterpret_cast<std::uintptr_t>(addr);
+	auto lines = (begin + len - 1) / CACHELINE_SIZE - begin / CACHELINE_SIZE + 1;
+
+	c->flushes.fetch_add(1, std::memory_order_relaxed);
+	c->flushed_lines.fetch_add(lines, std::memory_order_relaxed);
+	c->flushed_bytes.fetch_add(len, std::memory_order_relaxed);
+}
+
+static void count_fence()
+{
+	auto c = current_op_counters;
+	if (c)
+		c->fences.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void count_tx_range(size_t size)
+{
+	auto c = current_op_counters;
+	if (!c)
+		return;
+
+	c->tx_ranges.fetch_add(1, std::memory_order_relaxed);
+	c->tx_bytes.fetch_add(size, std::memory_order_relaxed);
+}
+#endif
+
+static void on_flush(const void *addr, size_t len)
+{
+#ifdef PERSIST_STATS
+	count_flush(addr, len);
+#endif
+#ifdef PMEM_LATENCY_EMULATION
+	emulation::flush(addr, len);
+#endif
+}
+
+static void on_fence()
+{
+#ifdef PERSIST_STATS
+	count_fence();
+#endif
+#ifdef PMEM_LATENCY_EMULATION
+	emulation::fence();
+#endif
+}
+
+static void on_tx_range(size_t size)
+{
+#ifdef PERSIST_STATS
+	count_tx_range(size);
+#endif
+#ifdef PMEM_LATENCY_EMULATION
+	emulation::tx_range(size);
+#endif
+}
+
+/* Handles pmemobj_memcpy/memmove/memset call made with given flags. */
+static void on_mem_op(const void *dest, size_t len, unsigned flags)
+{
+	if (flags & PMEMOBJ_F_MEM_NOFLUSH)
+		return;
+
+	on_flush(dest, len);
+	if (!(flags & PMEMOBJ_F_MEM_NODRAIN))
+		on_fence();
+}
+
+/* Returns the libpmemobj function shadowed by the one named 'name'. */
+template <typename Function>
+static Function *real_function(const char *name)
+{
+	auto f = reinterpret_cast<Function *>(dlsym(RTLD_NEXT, name));
+	if (f == nullptr)
+		abort();
+
+	return f;
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+using namespace pmem::kv::internal;
+
+extern "C" {
+
+void pmemobj_persist(PMEMobjpool *pop, const void *addr, size_t len)
+{
+	static auto real = real_function<decltype(pmemobj_persist)>("pmemobj_persist");
+
+	on_flush(addr, len);
+	on_fence();
+	real(pop, addr, len);
+}
+
+int pmemobj_xpersist(PMEMobjpool *pop, const void *addr, size_t len, unsigned flags)
+{
+	static auto real =
+		real_function<decltype(pmemobj_xpersist)>("pmemobj_xpersist");
+
+	on_flush(addr, len);
+	on_fence();
+	return real(pop, addr, len, flags);
+}
+
+void pmemobj_flush(PMEMobjpool *pop, const void *addr, size_t len)
+{
+	static auto real = real_function<decltype(pmemobj_flush)>("pmemobj_flush");
+
+	on_flush(addr, len);
+	real(pop, addr, len);
+}
+
+int pmemobj_xflush(PMEMobjpool *pop, const void *addr, size_t len, unsigned flags)
+{
+	static auto real = real_function<decltype(pmemobj_xflush)>("pmemobj_xflush");
+
+	on_flush(addr, len);
+	return real(pop, addr, len, flags);
+}
+
+void pmemobj_drain(PMEMobjpool *pop)
+{
+	static auto real = real_function<decltype(pmemobj_drain)>("pmemobj_drain");
+
+	on_fence();
+	real(pop);
+}
+
+void *pmemobj_memcpy_persist(PMEMobjpool *pop, void *dest, const void *src, size_t len)
+{
+	static auto real = real_function<decltype(pmemobj_memcpy_persist)>(
+		"pmemobj_memcpy_persist");
+
+	on_flush(dest, len);
+	on_fence();
+	return real(pop, dest, src, len);
+}
+
+void *pmemobj_memset_persist(PMEMobjpool *pop, void *dest, int c, size_t len)
+{
+	static auto real = real_function<decltype(pmemobj_memset_persist)>(
+		"pmemobj_memset_persist");
+
+	on_flush(dest, len);
+	on_fence();
+	return real(pop, dest, c, len);
+}
+
+void *pmemobj_memcpy(PMEMobjpool *pop, void *dest, const void *src, size_t len,
+		     unsigned flags)
+{
+	static auto real = real_function<decltype(pmemobj_memcpy)>("pmemobj_memcpy");
+
+	on_mem_op(dest, len, flags);
+	return real(pop, dest, src, len, flags);
+}
+
+void *pmemobj_memmove(PMEMobjpool *pop, void *dest, const void *src, size_t len,
+		      unsigned flags)
+{
+	static auto real = real_function<decltype(pmemobj_memmove)>("pmemobj_memmove");
+
+	on_mem_op(dest, len, flags);
+	return real(pop, dest, src, len, flags);
+}
+
+void *pmemobj_memset(PMEMobjpool *pop, void *dest, int c, size_t len, unsigned flags)
+{
+	static auto real = real_function<decltype(pmemobj_memset)>("pmemobj_memset");
+
+	on_mem_op(dest, len, flags);
+	return real(pop, dest, c, len, flags);
+}
+
+int pmemobj_tx_add_range(PMEMoid oid, uint64_t off, size_t size)
+{
+	static auto real =
+		real_function<decltype(pmemobj_tx_add_range)>("pmemobj_tx_add_range");
+
+	on_tx_range(size);
+	return real(oid, off, size);
+}
+
+int pmemobj_tx_add_range_direct(const void *ptr, size_t size)
+{
+	static auto real = real_function<decltype(pmemobj_tx_add_range_direct)>(
+		"pmemobj_tx_add_range_direct");
+
+	on_tx_range(size);
+	return real(ptr, size);
+}
+
+int pmemobj_tx_xadd_range(PMEMoid oid, uint64_t off, size_t size, uint64_t flags)
+{
+	static auto real =
+		real_function<decltype(pmemobj_tx_xadd_range)>("pmemobj_tx_xadd_range");
+
+	on_tx_range(size);
+	return real(oid, off, size, flags);
+}
+
+int pmemobj_tx_xadd_range_direct(const void *ptr, size_t size, uint64_t flags)
+{
+	static auto real = real_function<decltype(pmemobj_tx_xadd_range_direct)>(
+		"pmemobj_tx_xadd_range_direct");
+
+	on_tx_range(size);
+	return real(ptr, size, flags);
+}
+
+} /* extern "C" */
@@ -0,0 +1,182 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+/*
+ * pmem_emulation.cc -- delays flushes, fences and reads of pool memory, so
+ *		that engines run on DRAM behave (and rank) more like on PMem.
+ *
+ * Flushes only add to the number of cache lines pending in this thread; they
+ * are paid for on the next fence, which (as on real hardware) waits until all
+ * of them reach the persistence domain. Delays are busy waits - sleeping is
+ * far too coarse for sub-microsecond latencies.
+ *
+ * Defaults roughly follow the difference between Optane DC PMem and DRAM.
+ */
+
+#include "pmem_emulation.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+namespace emulation
+{
+
+static constexpr std::uintptr_t CACHELINE_SIZE = 64;
+static constexpr size_t MAX_RANGES = 64;
+
+static std::uint64_t env_or(const char *name, std::uint64_t default_value)
+{
+	auto value = std::getenv(name);
+	if (value == nullptr)
+		return default_value;
+
+	return std::strtoull(value, nullptr, 10);
+}
+
+struct latencies {
+	latencies()
+	    : flush_ns(env_or("PMEMKV_EMULATION_FLUSH_NS", 60)),
+	      fence_ns(env_or("PMEMKV_EMULATION_FENCE_NS", 90)),
+	      read_ns(env_or("PMEMKV_EMULATION_READ_NS", 200))
+	{
+	}
+
+	std::uint64_t flush_ns;
+	std::uint64_t fence_ns;
+	std::uint64_t read_ns;
+};
+
+static const latencies &get_latencies()
+{
+	static latencies l;
+	return l;
+}
+
+/* Ranges registered as PMem, an empty slot has begin == 0. */
+struct range {
+	std::atomic<std::uintptr_t> begin;
+	std::atomic<std::uintptr_t> end;
+};
+
+static std::array<range, MAX_RANGES> ranges;
+static std::mutex ranges_mtx;
+
+static thread_local std::uint64_t pending_lines = 0;
+
+static std::uint64_t lines(const void *addr, size_t len)
+{
+	auto begin = reinterpret_cast<std::uintptr_t>(addr);
+	return (begin + len - 1) / CACHELINE_SIZE - begin / CACHELINE_SIZE + 1;
+}
+
+static void delay(std::uint64_t ns)
+{
+	if (ns == 0)
+		return;
+
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::nanoseconds(ns);
+	while (std::chrono::steady_clock::now() < deadline)
+		;
+}
+
+static bool is_pmem(const void *addr)
+{
+	auto a = reinterpret_cast<std::uintptr_t>(addr);
+	for (auto &r : ranges) {
+		auto begin = r.begin.load(std::memory_order_acquire);
+		if (begin != 0 && a >= begin && a < r.end.load(std::memory_order_relaxed))
+			return true;
+	}
+
+	return false;
+}
+
+void flush(const void *addr, size_t len)
+{
+	if (len != 0)
+		pending_lines += lines(addr, len);
+}
+
+void fence()
+{
+	if (pending_lines == 0)
+		return;
+
+	auto &l = get_latencies();
+	delay(l.fence_ns + pending_lines * l.flush_ns);
+	pending_lines = 0;
+}
+
+/*
+ * A range added to a transaction is copied to the undo log (and persisted)
+ * right away and flushed once more on commit, which is not seen here - both
+ * are charged now.
+ */
+void tx_range(size_t len)
+{
+	if (len == 0)
+		return;
+
+	auto &l = get_latencies();
+	auto n = (len + CACHELINE_SIZE - 1) / CACHELINE_SIZE;
+	delay(2 * (l.fence_ns + n * l.flush_ns));
+}
+
+void read(const void *addr, size_t len)
+{
+	if (len == 0 || !is_pmem(addr))
+		return;
+
+	delay(lines(addr, len) * get_latencies().read_ns);
+}
+
+bool reads_enabled()
+{
+	return get_latencies().read_ns != 0;
+}
+
+void register_range(const void *addr, size_t len)
+{
+	if (addr == nullptr || len == 0)
+		return;
+
+	std::lock_guard<std::mutex> lock(ranges_mtx);
+	for (auto &r : ranges) {
+		if (r.begin.load(std::memory_order_relaxed) != 0)
+			continue;
+
+		r.end.store(reinterpret_cast<std::uintptr_t>(addr) + len,
+			    std::memory_order_relaxed);
+		r.begin.store(reinterpret_cast<std::uintptr_t>(addr),
+			      std::memory_order_release);
+		return;
+	}
+	/* no free slot - reads from this pool are not delayed */
+}
+
+void unregister_range(const void *addr)
+{
+	std::lock_guard<std::mutex> lock(ranges_mtx);
+	for (auto &r : ranges) {
+		if (r.begin.load(std::memory_order_relaxed) ==
+		    reinterpret_cast<std::uintptr_t>(addr)) {
+			r.begin.store(0, std::memory_order_release);
+			return;
+		}
+	}
+}
+
+} /* namespace emulation */
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
@@ -0,0 +1,49 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_PMEM_EMULATION_H
+#define LIBPMEMKV_PMEM_EMULATION_H
+
+#include <cstddef>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/*
+ * PMem latency emulation (built only with PMEM_LATENCY_EMULATION), for
+ * benchmarking on machines with DRAM only (e.g. pools on tmpfs). Delays are
+ * taken (once) from environment variables:
+ *
+ * PMEMKV_EMULATION_FLUSH_NS - per flushed cache line, charged on the next fence
+ * PMEMKV_EMULATION_FENCE_NS - per fence with pending flushes
+ * PMEMKV_EMULATION_READ_NS - per cache line of a pool read through the API
+ *
+ * Loads done by engines themselves cannot be intercepted, so read latency is
+ * only charged for keys and values passed from a pool to user's callbacks.
+ */
+namespace emulation
+{
+
+void flush(const void *addr, size_t len);
+void fence();
+void tx_range(size_t len);
+void read(const void *addr, size_t len);
+
+/* True if read latency is emulated (so keys and values have to be checked). */
+bool reads_enabled();
+
+/* Marks [addr, addr + len) as PMem, for read latency. */
+void register_range(const void *addr, size_t len);
+void unregister_range(const void *addr);
+
+} /* namespace emulation */
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_PMEM_EMULATION_H */
@@ -4,12 +4,22 @@
 #ifndef LIBPMEMKV_PMEMOBJ_ENGINE_H
 #define LIBPMEMKV_PMEMOBJ_ENGINE_H
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <stdexcept>
+#include <sys/stat.h>
 #include <unistd.h>
+#include <utility>
 
 #include "engine.h"
 #include "libpmemkv.h"
+#include "pmem_emulation.h"
 #include <libpmemobj++/pool.hpp>
+#include <libpmemobj/base.h>
+#include <libpmemobj/ctl.h>
+#include <libpmemobj/iterator_base.h>
+#include <libpmemobj/pool_base.h>
 
 namespace pmem
 {
@@ -24,15 +34,124 @@ static inline void check_outside_tx()
 
 namespace kv
 {
+namespace internal
+{
+
+/*
+ * Pool given by "path" of a config (created if "force_create" is set), opened before
+ * its engine is created - so that the engine's instantiation can be chosen by what the
+ * pool holds (e.g. node sizes) - and handed over to the engine, so that it's opened
+ * only once. The pool is closed if it's not handed over.
+ */
+class pmemobj_pool {
+public:
+	pmemobj_pool() = default;
+
+	pmemobj_pool(config &cfg, const std::string &layout)
+	{
+		const char *path;
+		if (!cfg.get_string("path", &path))
+			throw invalid_argument(
+				"Config does not contain item with key: \"path\"");
+
+		uint64_t force_create;
+		if (!cfg.get_uint64("force_create", &force_create))
+			force_create = 0;
+
+		stopwatch pool_time;
+		if (force_create) {
+			if (!cfg.get_uint64("size", &size))
+				throw invalid_argument(
+					"Config does not contain item with key: \"size\"");
+
+			try {
+				pop = pmem::obj::pool_base::create(path, layout, size,
+								   S_IRWXU);
+			} catch (pmem::pool_invalid_argument &e) {
+				throw invalid_argument(e.what());
+			}
+			created = true;
+		} else {
+			try {
+				pop = pmem::obj::pool_base::open(path, layout);
+			} catch (pmem::pool_invalid_argument &e) {
+				throw invalid_argument(e.what());
+			}
+
+			struct stat st;
+			if (stat(path, &st) == 0 && S_ISREG(st.st_mode))
+				size = static_cast<uint64_t>(st.st_size);
+		}
+		/* opening includes replaying logs of interrupted transactions */
+		open_ns = pool_time.lap();
+	}
+
+	pmemobj_pool(pmemobj_pool &&other) noexcept
+	    : pop(other.pop), created(other.created), size(other.size),
+	      open_ns(other.open_ns)
+	{
+		other.pop = pmem::obj::pool_base();
+	}
+
+	pmemobj_pool &operator=(pmemobj_pool &&other) noexcept
+	{
+		std::swap(pop, other.pop);
+		std::swap(created, other.created);
+		std::swap(size, other.size);
+		std::swap(open_ns, other.open_ns);
+
+		return *this;
+	}
+
+	pmemobj_pool(const pmemobj_pool &) = delete;
+	pmemobj_pool &operator=(const pmemobj_pool &) = delete;
+
+	~pmemobj_pool()
+	{
+		if (pop.handle())
+			pmemobj_close(pop.handle());
+	}
+
+	bool is_open()
+	{
+		return pop.handle() != nullptr;
+	}
+
+	/*
+	 * Returns the engine's data (EngineData of pmemobj_engine_base, pointed to by
+	 * the pool's root), or OID_NULL if the pool has none yet.
+	 */
+	PMEMoid engine_data()
+	{
+		auto root_size = pmemobj_root_size(pop.handle());
+		if (root_size < sizeof(PMEMoid))
+			return OID_NULL;
+
+		return *static_cast<PMEMoid *>(
+			pmemobj_direct(pmemobj_root(pop.handle(), root_size)));
+	}
+
+	pmem::obj::pool_base pop;
+	bool created = false;
+	/* 0 if unknown, e.g. on devdax */
+	std::uint64_t size = 0;
+	std::uint64_t open_ns = 0;
+};
+
+} /* namespace internal */
 
 template <typename EngineData>
 class pmemobj_engine_base : public engine_base {
 public:
+	/*
+	 * If the engine is given by "path", the pool may be opened beforehand and
+	 * passed as 'pool' (see internal::pmemobj_pool).
+	 */
 	pmemobj_engine_base(std::unique_ptr<internal::config> &cfg,
-			    const std::string &layout)
+			    const std::string &layout,
+			    internal::pmemobj_pool pool = internal::pmemobj_pool())
 	{
 		const char *path = nullptr;
-		std::size_t size;
 		PMEMoid *oid;
 
 		auto is_path = cfg->get_string("path", &path);
@@ -45,37 +164,29 @@ public:
 			throw internal::invalid_argument(
 				"Config does not contain item with key: \"path\" or \"oid\"");
 		} else if (is_path) {
-			uint64_t force_create;
-			cfg_by_path = true;
+			if (!pool.is_open())
+				pool = internal::pmemobj_pool(*cfg, layout);
 
-			if (!cfg->get_uint64("force_create", &force_create)) {
-				force_create = 0;
-			}
+			add_open_phase(pool.created ? "pool_create" : "pool_open",
+				       pool.open_ns);
+			pool_size = pool.size;
 
-			pmem::obj::pool<Root> pop;
-			if (force_create) {
-				if (!cfg->get_uint64("size", &size)) {
-					throw internal::invalid_argument(
-						"Config does not contain item with key: \"size\"");
-				}
-
-				try {
-					pop = pmem::obj::pool<Root>::create(
-						path, layout, size, S_IRWXU);
-				} catch (pmem::pool_invalid_argument &e) {
-					throw internal::invalid_argument(e.what());
-				}
-			} else {
-				try {
-					pop = pmem::obj::pool<Root>::open(path, layout);
-				} catch (pmem::pool_invalid_argument &e) {
-					throw internal::invalid_argument(e.what());
-				}
-			}
+			pmem::obj::pool<Root> pop(pool.pop);
+			pool.pop = pmem::obj::pool_base();
+			cfg_by_path = true;
 
 			root_oid = pop.root()->ptr.raw_ptr();
 			pmpool = pop;
 
+			/* they slow down every allocation, so they are opt-in */
+			uint64_t heap_stats;
+			if (cfg->get_uint64("heap_stats", &heap_stats) && heap_stats)
+				enable_heap_stats();
+#ifdef PMEM_LATENCY_EMULATION
+			/* the pool is mapped as a whole, starting at its handle */
+			internal::emulation::register_range(pmpool.handle(), pool_size);
+#endif
+
 		} else if (is_oid) {
 			pmpool = pmem::obj::pool_base(pmemobj_pool_by_ptr(oid));
 			root_oid = oid;
@@ -84,11 +195,124 @@ public:
 
 	~pmemobj_engine_base()
 	{
-		if (cfg_by_path)
+		if (cfg_by_path) {
+#ifdef PMEM_LATENCY_EMULATION
+			internal::emulation::unregister_range(pmpool.handle());
+#endif
 			pmpool.close();
+		}
+	}
+
+	/*
+	 * Allocated PMem is summed over all objects in the pool (so, if the pool
+	 * is shared, i.e. the engine was opened with "oid", other objects are
+	 * counted as metadata), data is summed over all elements.
+	 */
+	status memory_usage(pmemkv_memory_usage &usage) override
+	{
+		check_outside_tx();
+
+		auto handle = pmpool.handle();
+		std::uint64_t allocated = pmemobj_root_size(handle);
+		for (auto oid = pmemobj_first(handle); !OID_IS_NULL(oid);
+		     oid = pmemobj_next(oid))
+			allocated += pmemobj_alloc_usable_size(oid);
+
+		std::uint64_t data = 0;
+		auto s = get_all(
+			[](const char *, size_t kb, const char *, size_t vb, void *arg) {
+				*static_cast<std::uint64_t *>(arg) += kb + vb;
+				return 0;
+			},
+			&data);
+		if (s != status::OK)
+			return s;
+
+		usage.dram_bytes = dram_usage();
+		usage.pmem_data_bytes = data;
+		usage.pmem_metadata_bytes = allocated > data ? allocated - data : 0;
+		/* free blocks of runs are usable only for objects of their size */
+		usage.pmem_fragmented_bytes = run_usage().first;
+		auto unallocated = pool_size > allocated ? pool_size - allocated : 0;
+		usage.pmem_free_bytes = unallocated > usage.pmem_fragmented_bytes
+			? unallocated - usage.pmem_fragmented_bytes
+			: 0;
+
+		return status::OK;
 	}
 
 protected:
+	/*
+	 * Enables heap statistics of libpmemobj, needed to tell the fragmentation
+	 * (see run_usage). Only for pools opened by "path".
+	 */
+	void enable_heap_stats()
+	{
+		if (!cfg_by_path)
+			return;
+
+		enum pobj_stats_enabled stats = POBJ_STATS_ENABLED_TRANSIENT;
+		pmemobj_ctl_set(pmpool.handle(), "stats.enabled", &stats);
+	}
+
+	/*
+	 * Returns free space in runs (chunks divided into blocks of a single size,
+	 * which hold small objects) and the total size of runs. The free space in
+	 * runs cannot be used for objects of other sizes, it's what defrag gains.
+	 * Based on heap statistics of libpmemobj, which count only runs used since
+	 * they were enabled (see enable_heap_stats); both values are 0 if they are
+	 * not enabled.
+	 */
+	std::pair<std::uint64_t, std::uint64_t> run_usage()
+	{
+		std::uint64_t active = 0, allocated = 0;
+		auto handle = pmpool.handle();
+		if (pmemobj_ctl_get(handle, "stats.heap.run_active", &active) != 0 ||
+		    pmemobj_ctl_get(handle, "stats.heap.run_allocated", &allocated) != 0)
+			return {0, 0};
+
+		return {active > allocated ? active - allocated : 0, active};
+	}
+
+	/* Returns the part of runs which is free, in percent (see run_usage). */
+	double fragmentation_percent()
+	{
+		auto runs = run_usage();
+		if (runs.second == 0)
+			return 0;
+
+		return 100.0 * static_cast<double>(runs.first) /
+			static_cast<double>(runs.second);
+	}
+
+	/* Returns size of engine's volatile structures (e.g. index) in DRAM. */
+	virtual std::uint64_t dram_usage()
+	{
+		return 0;
+	}
+
+	/*
+	 * Translates the defrag() arguments into a [first, last) range of
+	 * element indexes, for engines which defragment element by element.
+	 * Throws std::range_error on arguments which concurrent_hash_map's
+	 * defragment() would also reject.
+	 */
+	static std::pair<std::size_t, std::size_t>
+	defrag_range(std::size_t size, double start_percent, double amount_percent)
+	{
+		if (start_percent < 0 || start_percent >= 100 || amount_percent < 0 ||
+		    amount_percent > 100 || start_percent + amount_percent > 100)
+			throw std::range_error("incorrect range");
+
+		auto first = static_cast<std::size_t>(
+			std::floor(static_cast<double>(size) * start_percent / 100));
+		auto last = static_cast<std::size_t>(std::ceil(
+			static_cast<double>(size) * (start_percent + amount_percent) /
+			100));
+
+		return {first, (std::min)(last, size)};
+	}
+
 	struct Root {
 		pmem::obj::persistent_ptr<EngineData>
 			ptr; /* used when path is specified */
@@ -98,6 +322,9 @@ protected:
 	PMEMoid *root_oid;
 
 	bool cfg_by_path = false;
+
+	/* 0 if unknown, e.g. for pools opened by "oid" or on devdax */
+	std::uint64_t pool_size = 0;
 };
 
 } /* namespace kv */
@@ -0,0 +1,187 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "stats.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+const char *api_op_name(api_op op)
+{
+	switch (op) {
+		case api_op::get:
+			return "get";
+		case api_op::put:
+			return "put";
+		case api_op::remove:
+			return "remove";
+		case api_op::exists:
+			return "exists";
+		case api_op::count:
+			return "count";
+		case api_op::iterate:
+			return "iterate";
+		case api_op::tx_commit:
+			return "tx_commit";
+		case api_op::defrag:
+			return "defrag";
+		case api_op::bulk_load:
+			return "bulk_load";
+		default:
+			return "unknown";
+	}
+}
+
+std::uint64_t latency_histogram::upper_bound(unsigned idx)
+{
+	if (idx < SUB_BUCKETS)
+		return idx;
+
+	if (idx == BUCKETS - 1)
+		return UINT64_MAX;
+
+	unsigned shift = idx / SUB_BUCKETS - 1;
+	std::uint64_t sub = idx % SUB_BUCKETS;
+
+	return ((SUB_BUCKETS + sub + 1) << shift) - 1;
+}
+
+size_t next_thread_index() noexcept
+{
+	static std::atomic<size_t> counter(0);
+
+	return counter.fetch_add(1, std::memory_order_relaxed);
+}
+
+/* Shards are value-initialized, which zeroes all the counters. */
+stats::stats() : shards(new stats_shard[SHARDS]())
+{
+}
+
+void stats::reset() noexcept
+{
+	for (size_t s = 0; s < SHARDS; s++) {
+		for (auto &c : shards[s].ops) {
+			c.count.store(0, std::memory_order_relaxed);
+			c.errors.store(0, std::memory_order_relaxed);
+			c.sum_ns.store(0, std::memory_order_relaxed);
+			c.max_ns.store(0, std::memory_order_relaxed);
+			c.flushes.store(0, std::memory_order_relaxed);
+			c.flushed_lines.store(0, std::memory_order_relaxed);
+			c.flushed_bytes.store(0, std::memory_order_relaxed);
+			c.fences.store(0, std::memory_order_relaxed);
+			c.tx_ranges.store(0, std::memory_order_relaxed);
+			c.tx_bytes.store(0, std::memory_order_relaxed);
+			for (auto &b : c.histogram)
+				b.store(0, std::memory_order_relaxed);
+		}
+		shards[s].bytes_read.store(0, std::memory_order_relaxed);
+		shards[s].bytes_written.store(0, std::memory_order_relaxed);
+	}
+}
+
+/* Returns upper bound of the bucket holding the value of the given quantile. */
+static std::uint64_t percentile(const std::vector<std::uint64_t> &histogram,
+				std::uint64_t count, std::uint64_t max, double quantile)
+{
+	auto rank = static_cast<std::uint64_t>(
+		std::ceil(quantile * static_cast<double>(count)));
+	if (rank == 0)
+		rank = 1;
+
+	std::uint64_t seen = 0;
+	for (unsigned i = 0; i < histogram.size(); i++) {
+		seen += histogram[i];
+		if (seen >= rank)
+			return std::min(latency_histogram::upper_bound(i), max);
+	}
+
+	return max;
+}
+
+void stats::collect(metrics_type &out) const
+{
+	for (size_t op = 0; op < static_cast<size_t>(api_op::max); op++) {
+		std::uint64_t count = 0, errors = 0, sum = 0, max = 0;
+#ifdef PERSIST_STATS
+		std::uint64_t flushes = 0, lines = 0, flushed = 0, fences = 0,
+			      tx_ranges = 0, tx_bytes = 0;
+#endif
+		std::vector<std::uint64_t> histogram(latency_histogram::BUCKETS, 0);
+
+		for (size_t s = 0; s < SHARDS; s++) {
+			auto &c = shards[s].ops[op];
+			count += c.count.load(std::memory_order_relaxed);
+			errors += c.errors.load(std::memory_order_relaxed);
+			sum += c.sum_ns.load(std::memory_order_relaxed);
+			max = std::max(max, c.max_ns.load(std::memory_order_relaxed));
+#ifdef PERSIST_STATS
+			flushes += c.flushes.load(std::memory_order_relaxed);
+			lines += c.flushed_lines.load(std::memory_order_relaxed);
+			flushed += c.flushed_bytes.load(std::memory_order_relaxed);
+			fences += c.fences.load(std::memory_order_relaxed);
+			tx_ranges += c.tx_ranges.load(std::memory_order_relaxed);
+			tx_bytes += c.tx_bytes.load(std::memory_order_relaxed);
+#endif
+			for (unsigned b = 0; b < latency_histogram::BUCKETS; b++)
+				histogram[b] +=
+					c.histogram[b].load(std::memory_order_relaxed);
+		}
+
+		std::string prefix = api_op_name(static_cast<api_op>(op));
+
+		out.emplace_back(prefix + ".count", count);
+		out.emplace_back(prefix + ".errors", errors);
+
+		if (count == 0)
+			continue;
+
+#ifdef PERSIST_STATS
+		out.emplace_back(prefix + ".persist.flushes", flushes);
+		out.emplace_back(prefix + ".persist.flushed_lines", lines);
+		out.emplace_back(prefix + ".persist.flushed_bytes", flushed);
+		out.emplace_back(prefix + ".persist.fences", fences);
+		out.emplace_back(prefix + ".persist.tx_ranges", tx_ranges);
+		out.emplace_back(prefix + ".persist.tx_bytes", tx_bytes);
+#endif
+
+		prefix += ".latency_ns";
+		out.emplace_back(prefix + ".mean", sum / count);
+		out.emplace_back(prefix + ".max", max);
+		out.emplace_back(prefix + ".p50", percentile(histogram, count, max, 0.5));
+		out.emplace_back(prefix + ".p90", percentile(histogram, count, max, 0.9));
+		out.emplace_back(prefix + ".p99",
+				 percentile(histogram, count, max, 0.99));
+		out.emplace_back(prefix + ".p999",
+				 percentile(histogram, count, max, 0.999));
+
+		/* raw histogram, each bucket named after its upper bound */
+		for (unsigned b = 0; b < latency_histogram::BUCKETS; b++) {
+			if (histogram[b] == 0)
+				continue;
+			auto upper = latency_histogram::upper_bound(b);
+			out.emplace_back(prefix + ".bucket." + std::to_string(upper),
+					 histogram[b]);
+		}
+	}
+
+	std::uint64_t bytes_read = 0, bytes_written = 0;
+	for (size_t s = 0; s < SHARDS; s++) {
+		bytes_read += shards[s].bytes_read.load(std::memory_order_relaxed);
+		bytes_written += shards[s].bytes_written.load(std::memory_order_relaxed);
+	}
+
+	out.emplace_back("bytes_read", bytes_read);
+	out.emplace_back("bytes_written", bytes_written);
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
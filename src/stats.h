@@ -0,0 +1,219 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_STATS_H
+#define LIBPMEMKV_STATS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "libpmemkv.h"
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/* Operations measured at the API boundary. */
+enum class api_op : std::uint8_t {
+	get,
+	put,
+	remove,
+	exists,
+	count,
+	iterate,
+	tx_commit,
+	defrag,
+	bulk_load,
+	max
+};
+
+const char *api_op_name(api_op op);
+
+size_t next_thread_index() noexcept;
+
+/* Returns small, sequential number of the calling thread (used to pick its shard). */
+inline size_t thread_index() noexcept
+{
+	static thread_local size_t idx = next_thread_index();
+	return idx;
+}
+
+/*
+ * Log-linear latency histogram (in the spirit of HdrHistogram). Values below
+ * SUB_BUCKETS get a bucket each; above that every power of two is split into
+ * SUB_BUCKETS linear sub-buckets, so a recorded value is off by at most
+ * 1/SUB_BUCKETS of itself. Values above 2^(MAX_EXPONENT+1) land in the last bucket.
+ */
+struct latency_histogram {
+	static constexpr unsigned SUB_BUCKET_BITS = 3;
+	static constexpr unsigned SUB_BUCKETS = 1U << SUB_BUCKET_BITS;
+	static constexpr unsigned MAX_EXPONENT = 39;
+	static constexpr unsigned BUCKETS =
+		(MAX_EXPONENT - SUB_BUCKET_BITS + 2) * SUB_BUCKETS;
+
+	static unsigned bucket(std::uint64_t value)
+	{
+		if (value < SUB_BUCKETS)
+			return static_cast<unsigned>(value);
+
+		unsigned exp = 63U - static_cast<unsigned>(__builtin_clzll(value));
+		if (exp > MAX_EXPONENT)
+			return BUCKETS - 1;
+
+		unsigned sub = static_cast<unsigned>(value >> (exp - SUB_BUCKET_BITS)) &
+			(SUB_BUCKETS - 1);
+
+		return (exp - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub;
+	}
+
+	/* Largest value which falls into bucket 'idx'. */
+	static std::uint64_t upper_bound(unsigned idx);
+};
+
+/*
+ * Counters of a single shard. Threads are spread over the shards, so that
+ * concurrent operations do not bounce the same cache lines between cores.
+ */
+struct stats_shard {
+	struct op_counters {
+		std::atomic<std::uint64_t> count;
+		std::atomic<std::uint64_t> errors;
+		std::atomic<std::uint64_t> sum_ns;
+		std::atomic<std::uint64_t> max_ns;
+		std::array<std::atomic<std::uint64_t>, latency_histogram::BUCKETS>
+			histogram;
+
+		/* persistence cost, counted only if built with PERSIST_STATS */
+		std::atomic<std::uint64_t> flushes;
+		std::atomic<std::uint64_t> flushed_lines;
+		std::atomic<std::uint64_t> flushed_bytes;
+		std::atomic<std::uint64_t> fences;
+		std::atomic<std::uint64_t> tx_ranges;
+		std::atomic<std::uint64_t> tx_bytes;
+	};
+
+	std::array<op_counters, static_cast<size_t>(api_op::max)> ops;
+	std::atomic<std::uint64_t> bytes_read;
+	std::atomic<std::uint64_t> bytes_written;
+
+	/* keeps neighbouring shards out of each other's cache lines */
+	char padding[64];
+};
+
+/*
+ * Per-database runtime statistics: operation counts, latency histograms and
+ * bytes transferred. Recording only touches the calling thread's shard with
+ * relaxed atomics; shards are summed up when statistics are read.
+ */
+class stats {
+public:
+	using metrics_type = std::vector<std::pair<std::string, std::uint64_t>>;
+
+	static constexpr size_t SHARDS = 16;
+
+	stats();
+
+	/* NOT_FOUND and STOPPED_BY_CB are regular outcomes, not failures. */
+	static bool is_error(int status) noexcept
+	{
+		return status != PMEMKV_STATUS_OK && status != PMEMKV_STATUS_NOT_FOUND &&
+			status != PMEMKV_STATUS_STOPPED_BY_CB;
+	}
+
+	void record(api_op op, std::uint64_t duration_ns, int status) noexcept
+	{
+		auto &c = counters(op);
+
+		c.count.fetch_add(1, std::memory_order_relaxed);
+		if (is_error(status))
+			c.errors.fetch_add(1, std::memory_order_relaxed);
+
+		c.sum_ns.fetch_add(duration_ns, std::memory_order_relaxed);
+		c.histogram[latency_histogram::bucket(duration_ns)].fetch_add(
+			1, std::memory_order_relaxed);
+
+		auto max = c.max_ns.load(std::memory_order_relaxed);
+		while (duration_ns > max &&
+		       !c.max_ns.compare_exchange_weak(max, duration_ns,
+						       std::memory_order_relaxed))
+			;
+	}
+
+	void add_bytes_read(std::uint64_t bytes) noexcept
+	{
+		if (bytes)
+			local_shard().bytes_read.fetch_add(bytes,
+							   std::memory_order_relaxed);
+	}
+
+	void add_bytes_written(std::uint64_t bytes) noexcept
+	{
+		if (bytes)
+			local_shard().bytes_written.fetch_add(bytes,
+							      std::memory_order_relaxed);
+	}
+
+	stats_shard::op_counters &counters(api_op op) noexcept
+	{
+		return local_shard().ops[static_cast<size_t>(op)];
+	}
+
+	/* Appends all metrics, as (name, value) pairs, to 'out'. */
+	void collect(metrics_type &out) const;
+
+	void reset() noexcept;
+
+private:
+	stats_shard &local_shard() noexcept
+	{
+		return shards[thread_index() % SHARDS];
+	}
+
+	std::unique_ptr<stats_shard[]> shards;
+};
+
+#ifdef PERSIST_STATS
+/*
+ * Counters of the API call being measured in this thread (null if none), to
+ * which flushes and fences are attributed - see persist_hooks.cc.
+ */
+extern thread_local stats_shard::op_counters *current_op_counters;
+#endif
+
+/* Measures wall time of consecutive phases, e.g. of opening a database. */
+class stopwatch {
+public:
+	stopwatch() noexcept : start(std::chrono::steady_clock::now())
+	{
+	}
+
+	/* Returns ns elapsed since construction or the previous lap(). */
+	std::uint64_t lap() noexcept
+	{
+		auto now = std::chrono::steady_clock::now();
+		auto elapsed = now - start;
+		start = now;
+
+		return static_cast<std::uint64_t>(
+			std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed)
+				.count());
+	}
+
+private:
+	std::chrono::steady_clock::time_point start;
+};
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_STATS_H */
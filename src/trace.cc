@@ -0,0 +1,328 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "trace.h"
+#include "out.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <vector>
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/* how often the dumper thread checks if the dump signal was received */
+static constexpr std::chrono::milliseconds SIGNAL_POLL_INTERVAL(100);
+
+/* number of dump signals received so far, shared by all traced databases */
+static std::atomic<unsigned> signal_dumps_requested(0);
+
+extern "C" void trace_signal_handler(int)
+{
+	signal_dumps_requested.fetch_add(1, std::memory_order_relaxed);
+}
+
+/*
+ * The handler is installed once per signal, by the first traced database using
+ * it, and the previous one is restored only when the last of them is closed
+ * (in whatever order they are closed).
+ */
+struct signal_handler_ref {
+	unsigned users;
+	struct sigaction old_action;
+};
+
+static std::mutex signal_handlers_mtx;
+static std::map<int, signal_handler_ref> signal_handlers;
+
+static void acquire_signal_handler(int signal)
+{
+	std::lock_guard<std::mutex> lock(signal_handlers_mtx);
+
+	auto it = signal_handlers.find(signal);
+	if (it != signal_handlers.end()) {
+		it->second.users++;
+		return;
+	}
+
+	signal_handler_ref ref;
+	ref.users = 1;
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = trace_signal_handler;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(signal, &sa, &ref.old_action) != 0)
+		throw std::runtime_error("cannot set handler of signal " +
+					 std::to_string(signal) + ": " + strerror(errno));
+
+	signal_handlers.emplace(signal, ref);
+}
+
+static void release_signal_handler(int signal) noexcept
+{
+	std::lock_guard<std::mutex> lock(signal_handlers_mtx);
+
+	auto it = signal_handlers.find(signal);
+	if (it == signal_handlers.end() || --it->second.users > 0)
+		return;
+
+	sigaction(signal, &it->second.old_action, nullptr);
+	signal_handlers.erase(it);
+}
+
+static size_t round_up_pow2(size_t n)
+{
+	size_t size = 1;
+	while (size < n)
+		size <<= 1;
+
+	return size;
+}
+
+static trace_header make_header(std::uint64_t records)
+{
+	trace_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+	header.version = TRACE_VERSION;
+	header.record_size = sizeof(trace_record);
+	header.records = records;
+
+	return header;
+}
+
+capture_file::capture_file(const std::string &path)
+    : file(path, std::ios::binary | std::ios::trunc)
+{
+	if (!file)
+		throw std::runtime_error("cannot open " + path + ": " + strerror(errno));
+
+	/* record count is filled in on close */
+	auto header = make_header(0);
+	file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+	if (!file)
+		throw std::runtime_error("cannot write " + path);
+
+	for (auto &b : buffers)
+		b.records.reserve(BUFFER_SIZE);
+}
+
+capture_file::~capture_file()
+{
+	for (auto &b : buffers)
+		write(b.records);
+
+	auto header = make_header(written);
+	file.seekp(0);
+	file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+}
+
+void capture_file::append(const trace_record &record) noexcept
+{
+	auto &b = buffers[thread_index() % BUFFERS];
+
+	std::lock_guard<std::mutex> lock(b.mtx);
+	if (b.records.size() == BUFFER_SIZE) {
+		write(b.records);
+		b.records.clear();
+	}
+
+	/* capacity is reserved, so it does not allocate (nor throw) */
+	b.records.push_back(record);
+}
+
+void capture_file::write(const std::vector<trace_record> &records) noexcept
+{
+	std::lock_guard<std::mutex> lock(file_mtx);
+	if (failed || records.empty())
+		return;
+
+	file.write(reinterpret_cast<const char *>(records.data()),
+		   static_cast<std::streamsize>(records.size() * sizeof(trace_record)));
+	if (file)
+		written += records.size();
+	else
+		failed = true;
+}
+
+trace::trace(const trace_options &options)
+    : ring_size(options.ring_size ? round_up_pow2(options.ring_size) : 0),
+      key_salt(options.key_salt),
+      rings(),
+      dump_path(options.dump_path),
+      dump_signal(options.dump_signal)
+{
+	epoch_offset = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::system_clock::now().time_since_epoch() -
+		std::chrono::steady_clock::now().time_since_epoch());
+
+	if (!options.capture_path.empty())
+		capture.reset(new capture_file(options.capture_path));
+
+	if (dump_signal == 0)
+		return;
+
+	acquire_signal_handler(dump_signal);
+	try {
+		dumper = std::thread(&trace::run_dumper, this);
+	} catch (...) {
+		release_signal_handler(dump_signal);
+		throw;
+	}
+}
+
+trace::~trace()
+{
+	if (dumper.joinable()) {
+		release_signal_handler(dump_signal);
+
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			stopped = true;
+		}
+		cv.notify_one();
+
+		dumper.join();
+	}
+
+	for (auto &r : rings)
+		delete r.load(std::memory_order_relaxed);
+}
+
+trace::ring *trace::local_ring() noexcept
+{
+	auto &slot = rings[thread_index() % RINGS];
+
+	auto r = slot.load(std::memory_order_acquire);
+	if (r)
+		return r;
+
+	/* first record written by this thread, allocate its ring */
+	ring *created;
+	try {
+		created = new ring(ring_size);
+	} catch (...) {
+		return nullptr;
+	}
+
+	if (slot.compare_exchange_strong(r, created, std::memory_order_acq_rel))
+		return created;
+
+	/* another thread sharing the slot was faster */
+	delete created;
+	return r;
+}
+
+std::uint64_t trace::hash(const char *key, size_t key_size) const noexcept
+{
+	std::uint64_t h = 14695981039346656037ULL;
+	for (size_t i = 0; key_salt && i < sizeof(key_salt); i++) {
+		h ^= (key_salt >> (8 * i)) & 0xff;
+		h *= 1099511628211ULL;
+	}
+	for (size_t i = 0; i < key_size; i++) {
+		h ^= static_cast<unsigned char>(key[i]);
+		h *= 1099511628211ULL;
+	}
+
+	return h;
+}
+
+void trace::record(api_op op, std::chrono::steady_clock::time_point start,
+		   std::uint64_t duration_ns, const char *key, size_t key_size,
+		   std::uint64_t value_size, int status) noexcept
+{
+	trace_record rec;
+	rec.timestamp_ns = static_cast<std::uint64_t>(
+		std::chrono::duration_cast<std::chrono::nanoseconds>(
+			start.time_since_epoch() + epoch_offset)
+			.count());
+	rec.duration_ns = duration_ns;
+	rec.key_hash = key ? hash(key, key_size) : 0;
+	rec.key_size = static_cast<std::uint32_t>(key_size);
+	rec.value_size = static_cast<std::uint32_t>(value_size);
+	rec.thread = static_cast<std::uint32_t>(thread_index());
+	rec.op = static_cast<std::uint8_t>(op);
+	rec.status = static_cast<std::int8_t>(status);
+	rec.reserved = 0;
+
+	if (capture)
+		capture->append(rec);
+
+	if (ring_size == 0)
+		return;
+
+	auto r = local_ring();
+	if (!r)
+		return;
+
+	auto pos = r->head.fetch_add(1, std::memory_order_relaxed);
+	r->records[pos & (ring_size - 1)] = rec;
+}
+
+void trace::dump(const std::string &path) const
+{
+	std::vector<trace_record> records;
+	for (auto &slot : rings) {
+		auto r = slot.load(std::memory_order_acquire);
+		if (!r)
+			continue;
+
+		auto head = r->head.load(std::memory_order_acquire);
+		auto n = (std::min)(head, static_cast<std::uint64_t>(ring_size));
+		for (auto pos = head - n; pos < head; pos++)
+			records.push_back(r->records[pos & (ring_size - 1)]);
+	}
+
+	auto header = make_header(records.size());
+
+	std::ofstream out(path, std::ios::binary | std::ios::trunc);
+	if (!out)
+		throw std::runtime_error("cannot open " + path + ": " + strerror(errno));
+
+	out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+	out.write(reinterpret_cast<const char *>(records.data()),
+		  static_cast<std::streamsize>(records.size() * sizeof(trace_record)));
+	out.close();
+	if (!out)
+		throw std::runtime_error("cannot write " + path);
+}
+
+void trace::run_dumper()
+{
+	unsigned handled = signal_dumps_requested.load(std::memory_order_relaxed);
+
+	std::unique_lock<std::mutex> lock(mtx);
+	while (!cv.wait_for(lock, SIGNAL_POLL_INTERVAL, [&] { return stopped; })) {
+		auto requested = signal_dumps_requested.load(std::memory_order_relaxed);
+		if (requested == handled)
+			continue;
+		handled = requested;
+
+		lock.unlock();
+
+		auto path = dump_path + "." + std::to_string(dumps_done++);
+		try {
+			dump(path);
+		} catch (std::exception &e) {
+			ERR() << "trace dump failed: " << e.what();
+		}
+
+		lock.lock();
+	}
+}
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
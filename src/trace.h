@@ -0,0 +1,173 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_TRACE_H
+#define LIBPMEMKV_TRACE_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "stats.h"
+
+namespace pmem
+{
+namespace kv
+{
+namespace internal
+{
+
+/*
+ * A single traced API call, as stored in memory and in dump files (in native
+ * byte order). Keep in sync with utils/pmemkv_trace.py.
+ */
+struct trace_record {
+	std::uint64_t timestamp_ns; /* start of the call, since the epoch */
+	std::uint64_t duration_ns;
+	std::uint64_t key_hash; /* FNV-1a, of key_salt (if set) and the key */
+	std::uint32_t key_size;
+	std::uint32_t value_size;
+	std::uint32_t thread;
+	std::uint8_t op; /* api_op */
+	std::int8_t status;
+	std::uint16_t reserved;
+};
+
+static_assert(sizeof(trace_record) == 40, "trace_record layout changed");
+
+/*
+ * Dump (and capture) file header, followed by trace records (oldest first per
+ * thread).
+ */
+struct trace_header {
+	char magic[8]; /* TRACE_MAGIC */
+	std::uint32_t version;
+	std::uint32_t record_size;
+	std::uint64_t records;
+};
+
+static constexpr char TRACE_MAGIC[8] = {'P', 'M', 'K', 'V', 'T', 'R', 'C', '\0'};
+static constexpr std::uint32_t TRACE_VERSION = 1;
+
+struct trace_options {
+	size_t ring_size = 0;
+	std::string dump_path;
+	int dump_signal = 0;
+	std::string capture_path;
+	std::uint64_t key_salt = 0;
+};
+
+/*
+ * Appends trace records to a capture file, which has the same format as dumps.
+ * Records are buffered per thread (threads are spread over BUFFERS buffers)
+ * and written out by the thread which fills its buffer, so records of each
+ * thread are stored in order of calls. The header is completed when the
+ * capture is closed. After a write error nothing more is captured.
+ */
+class capture_file {
+public:
+	static constexpr size_t BUFFERS = 64;
+	static constexpr size_t BUFFER_SIZE = 4096;
+
+	explicit capture_file(const std::string &path);
+	~capture_file();
+
+	capture_file(const capture_file &) = delete;
+	capture_file &operator=(const capture_file &) = delete;
+
+	void append(const trace_record &record) noexcept;
+
+private:
+	struct buffer {
+		std::mutex mtx;
+		std::vector<trace_record> records;
+	};
+
+	void write(const std::vector<trace_record> &records) noexcept;
+
+	std::array<buffer, BUFFERS> buffers;
+
+	std::mutex file_mtx;
+	std::ofstream file;
+	std::uint64_t written = 0;
+	bool failed = false;
+};
+
+/*
+ * Binary trace of API calls. Each thread writes to its own ring buffer (threads
+ * are spread over RINGS rings; if there are more of them, rings get shared),
+ * overwriting the oldest records. Recording takes no locks and does no I/O.
+ *
+ * Rings are dumped on demand (dump()) or, if 'dump_signal' is not 0, every time
+ * that signal is received - a background thread then writes the dump to
+ * '<dump_path>.<n>'. Records written while a dump is taken may be torn.
+ *
+ * If 'capture_path' is set, every record is also appended to a capture file
+ * (for replaying the workload), then 'ring_size' may be 0. Keys are never
+ * stored, only their hashes; a secret 'key_salt' makes them harder to revert
+ * by hashing guessed keys.
+ */
+class trace {
+public:
+	static constexpr size_t RINGS = 64;
+
+	explicit trace(const trace_options &options);
+	~trace();
+
+	trace(const trace &) = delete;
+	trace &operator=(const trace &) = delete;
+
+	void record(api_op op, std::chrono::steady_clock::time_point start,
+		    std::uint64_t duration_ns, const char *key, size_t key_size,
+		    std::uint64_t value_size, int status) noexcept;
+
+	/* Writes all rings to file at 'path', throws on failure. */
+	void dump(const std::string &path) const;
+
+private:
+	struct ring {
+		explicit ring(size_t size) : records(new trace_record[size]())
+		{
+		}
+
+		std::unique_ptr<trace_record[]> records;
+		std::atomic<std::uint64_t> head{0};
+	};
+
+	ring *local_ring() noexcept;
+	void run_dumper();
+
+	std::uint64_t hash(const char *key, size_t key_size) const noexcept;
+
+	size_t ring_size;
+	std::uint64_t key_salt;
+	std::array<std::atomic<ring *>, RINGS> rings;
+
+	/* difference between system and steady clock, to timestamp records */
+	std::chrono::nanoseconds epoch_offset;
+
+	std::string dump_path;
+	int dump_signal;
+	unsigned dumps_done = 0;
+
+	std::unique_ptr<capture_file> capture;
+
+	std::mutex mtx;
+	std::condition_variable cv;
+	bool stopped = false;
+	std::thread dumper;
+};
+
+} /* namespace internal */
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_TRACE_H */
@@ -1,10 +1,12 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2020, Intel Corporation */
+/* Copyright 2020-2021, Intel Corporation */
 
 #ifndef LIBPMEMKV_TRANSACTION_H
 #define LIBPMEMKV_TRANSACTION_H
 
 #include "libpmemkv.hpp"
+#include "stats.h"
+#include "trace.h"
 
 #include <cassert>
 
@@ -35,6 +37,13 @@ public:
 	{
 		return status::NOT_SUPPORTED;
 	}
+
+	/* Runtime statistics of the engine (set by pmemkv_tx_begin), may be null */
+	stats *statistics = nullptr;
+	/* Trace of the engine (set by pmemkv_tx_begin), may be null */
+	trace *tracer = nullptr;
+	/* Bytes put since the transaction began, accounted for on commit */
+	std::uint64_t bytes_written = 0;
 };
 
 class dram_log {
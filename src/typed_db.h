@@ -0,0 +1,170 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#ifndef LIBPMEMKV_TYPED_DB_H
+#define LIBPMEMKV_TYPED_DB_H
+
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+
+#include <libpmemobj++/pexceptions.hpp>
+
+#include "engine.h"
+#include "exceptions.h"
+#include "out.h"
+
+namespace pmem
+{
+namespace kv
+{
+
+/*
+ * typed_db -- database handle for an engine chosen at compile time, e.g.
+ *	typed_db<cmap>. It is meant for applications built along with pmemkv's
+ *	sources (e.g. linked with the static library, see BUILD_STATIC), as it
+ *	needs the engines' internal headers.
+ *
+ * Calls go straight to the engine's methods - not through the C API,
+ * std::function and engine_base's vtable - and callbacks are any callables,
+ * passed to the engine through a template trampoline. Runtime statistics and
+ * tracing are not available, as they are set up by pmemkv_open.
+ *
+ * Errors are reported as in pmem::kv::db: by status, with a message
+ * available from errormsg().
+ */
+template <typename Engine>
+class typed_db {
+public:
+	typed_db() = default;
+
+	typed_db(const typed_db &) = delete;
+	typed_db &operator=(const typed_db &) = delete;
+
+	status open(config &&cfg) noexcept
+	{
+		return catch_status(__func__, [&] {
+			std::unique_ptr<internal::config> c(
+				reinterpret_cast<internal::config *>(cfg.release()));
+			/* config allocates its internals only when an item is put */
+			if (!c)
+				c.reset(new internal::config);
+
+			engine.reset(new Engine(std::move(c)));
+			return status::OK;
+		});
+	}
+
+	void close() noexcept
+	{
+		engine.reset();
+	}
+
+	status count_all(std::size_t &cnt) noexcept
+	{
+		return catch_status(__func__,
+				    [&] { return engine->Engine::count_all(cnt); });
+	}
+
+	status exists(string_view key) noexcept
+	{
+		return catch_status(__func__,
+				    [&] { return engine->Engine::exists(key); });
+	}
+
+	/* Calls f(string_view value) if the key is found. */
+	template <typename F>
+	status get(string_view key, F &&f) noexcept
+	{
+		using func_type = typename std::remove_reference<F>::type;
+
+		return catch_status(__func__, [&] {
+			return engine->Engine::get(key, &call_v<func_type>, &f);
+		});
+	}
+
+	status get(string_view key, std::string *value) noexcept
+	{
+		return get(key, [value](string_view v) {
+			value->assign(v.data(), v.size());
+		});
+	}
+
+	/*
+	 * Calls f(string_view key, string_view value) for each entry, until it
+	 * returns non-zero.
+	 */
+	template <typename F>
+	status get_all(F &&f) noexcept
+	{
+		using func_type = typename std::remove_reference<F>::type;
+
+		return catch_status(__func__, [&] {
+			return engine->Engine::get_all(&call_kv<func_type>, &f);
+		});
+	}
+
+	status put(string_view key, string_view value) noexcept
+	{
+		return catch_status(__func__,
+				    [&] { return engine->Engine::put(key, value); });
+	}
+
+	status remove(string_view key) noexcept
+	{
+		return catch_status(__func__,
+				    [&] { return engine->Engine::remove(key); });
+	}
+
+	std::string errormsg()
+	{
+		return std::string(out_get_errormsg());
+	}
+
+private:
+	template <typename F>
+	static void call_v(const char *v, size_t vb, void *arg)
+	{
+		(*static_cast<F *>(arg))(string_view(v, vb));
+	}
+
+	template <typename F>
+	static int call_kv(const char *k, size_t kb, const char *v, size_t vb, void *arg)
+	{
+		return (*static_cast<F *>(arg))(string_view(k, kb), string_view(v, vb));
+	}
+
+	/* Same as catch_and_return_status in libpmemkv.cc. */
+	template <typename Function>
+	static status catch_status(const char *func_name, Function &&f) noexcept
+	{
+		int s = PMEMKV_STATUS_UNKNOWN_ERROR;
+		try {
+			s = static_cast<int>(f());
+		} catch (internal::error &e) {
+			out_err_stream(func_name) << e.what();
+			s = e.status_code;
+		} catch (std::bad_alloc &e) {
+			out_err_stream(func_name) << e.what();
+			s = PMEMKV_STATUS_OUT_OF_MEMORY;
+		} catch (pmem::transaction_scope_error &e) {
+			out_err_stream(func_name) << e.what();
+			s = PMEMKV_STATUS_TRANSACTION_SCOPE_ERROR;
+		} catch (std::exception &e) {
+			out_err_stream(func_name) << e.what();
+		} catch (...) {
+			out_err_stream(func_name) << "Unspecified error";
+		}
+		set_last_status(s);
+
+		return static_cast<status>(s);
+	}
+
+	std::unique_ptr<Engine> engine;
+};
+
+} /* namespace kv */
+} /* namespace pmem */
+
+#endif /* LIBPMEMKV_TYPED_DB_H */
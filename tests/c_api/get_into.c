@@ -0,0 +1,85 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include <libpmemkv.h>
+
+#include "unittest.h"
+
+#include <string.h>
+
+/**
+ * Tests pmemkv_get_into - only the value is written to the buffer.
+ */
+
+#define BUFFER_SIZE 64
+#define FILL 0x5A
+
+static void assert_filled(const char *buffer, size_t from, size_t to)
+{
+	for (size_t i = from; i < to; i++)
+		UT_ASSERTeq(buffer[i], FILL);
+}
+
+static void test_get_into(const char *engine, pmemkv_config *cfg)
+{
+	pmemkv_db *db;
+	int s = pmemkv_open(engine, cfg, &db);
+	UT_ASSERTeq(s, PMEMKV_STATUS_OK);
+
+	const char *key = "key1";
+	const char *value = "value1";
+	s = pmemkv_put(db, key, strlen(key), value, strlen(value));
+	UT_ASSERTeq(s, PMEMKV_STATUS_OK);
+
+	char buffer[BUFFER_SIZE];
+	size_t value_size = 0;
+
+	/* value fits - bytes past it are not touched */
+	memset(buffer, FILL, BUFFER_SIZE);
+	s = pmemkv_get_into(db, key, strlen(key), buffer, BUFFER_SIZE, &value_size);
+	UT_ASSERTeq(s, PMEMKV_STATUS_OK);
+	UT_ASSERTeq(value_size, strlen(value));
+	UT_ASSERTeq(memcmp(buffer, value, strlen(value)), 0);
+	assert_filled(buffer, strlen(value), BUFFER_SIZE);
+
+	/* exact fit */
+	memset(buffer, FILL, BUFFER_SIZE);
+	s = pmemkv_get_into(db, key, strlen(key), buffer, strlen(value), &value_size);
+	UT_ASSERTeq(s, PMEMKV_STATUS_OK);
+	UT_ASSERTeq(memcmp(buffer, value, strlen(value)), 0);
+	assert_filled(buffer, strlen(value), BUFFER_SIZE);
+
+	/* buffer too small - size is reported, buffer is intact */
+	memset(buffer, FILL, BUFFER_SIZE);
+	value_size = 0;
+	s = pmemkv_get_into(db, key, strlen(key), buffer, strlen(value) - 1, &value_size);
+	UT_ASSERTeq(s, PMEMKV_STATUS_OUT_OF_MEMORY);
+	UT_ASSERTeq(value_size, strlen(value));
+	assert_filled(buffer, 0, BUFFER_SIZE);
+
+	/* missing key */
+	value_size = 0;
+	s = pmemkv_get_into(db, "key2", 4, buffer, BUFFER_SIZE, &value_size);
+	UT_ASSERTeq(s, PMEMKV_STATUS_NOT_FOUND);
+	UT_ASSERTeq(value_size, 0);
+	assert_filled(buffer, 0, BUFFER_SIZE);
+
+	/* value_size is optional */
+	s = pmemkv_get_into(db, key, strlen(key), buffer, BUFFER_SIZE, NULL);
+	UT_ASSERTeq(s, PMEMKV_STATUS_OK);
+	UT_ASSERTeq(memcmp(buffer, value, strlen(value)), 0);
+
+	pmemkv_close(db);
+}
+
+int main(int argc, char *argv[])
+{
+	START();
+
+	if (argc < 3)
+		UT_FATAL("usage %s: engine config", argv[0]);
+
+	test_get_into(argv[1], C_CONFIG_FROM_JSON(argv[2]));
+
+	return 0;
+}
@@ -0,0 +1,137 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+#include <atomic>
+#include <new>
+
+/**
+ * Checks that C API calls do not allocate memory (with operator new) on their
+ * success path, with and without statistics enabled. On blackhole, which does
+ * no work of its own and finds nothing, only the API layer is measured. On
+ * engines which store data, lookups find the value put before, so copying of
+ * values (and counting of copied bytes) is measured as well - writes are not,
+ * as engines may allocate in their own write paths (e.g. in transactions).
+ */
+
+static std::atomic<std::uint64_t> allocations(0);
+
+void *operator new(std::size_t size)
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+
+	void *ptr = malloc(size ? size : 1);
+	if (ptr == nullptr)
+		throw std::bad_alloc();
+
+	return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept
+{
+	free(ptr);
+}
+
+static const size_t N_CALLS = 1000;
+
+static void get_v_cb(const char *, size_t, void *)
+{
+}
+
+static int get_kv_cb(const char *, size_t, const char *, size_t, void *)
+{
+	return 0;
+}
+
+static void check(const char *name, int s, int expected, std::uint64_t before)
+{
+	if (s != expected)
+		UT_FATAL("%s returned status %d instead of %d", name, s, expected);
+
+	auto n = allocations.load() - before;
+	if (n != 0)
+		UT_FATAL("%s made %llu allocation(s) in %zu calls", name,
+			 static_cast<unsigned long long>(n), N_CALLS);
+}
+
+/* every call must return 'expected' status */
+#define CHECK_CALL(call, expected)                                                       \
+	do {                                                                             \
+		int s = call;                                                            \
+		auto before = allocations.load();                                        \
+		for (size_t i = 0; i < N_CALLS && s == (expected); i++)                  \
+			s = call;                                                        \
+		check(#call, s, expected, before);                                       \
+	} while (0)
+
+static int put_remove(pmemkv_db *db, const char *k, size_t kb, const char *v, size_t vb)
+{
+	int s = pmemkv_put(db, k, kb, v, vb);
+	if (s != PMEMKV_STATUS_OK)
+		return s;
+
+	return pmemkv_remove(db, k, kb);
+}
+
+static void test(const char *engine, pmemkv_config *cfg, bool stats)
+{
+	if (stats)
+		UT_ASSERTeq(pmemkv_config_put_uint64(cfg, "stats", 1), PMEMKV_STATUS_OK);
+
+	pmemkv_db *db;
+	int s = pmemkv_open(engine, cfg, &db);
+	UT_ASSERTeq(s, PMEMKV_STATUS_OK);
+
+	const char *k = "key";
+	const char *v = "value";
+	char buffer[64];
+	size_t cnt;
+
+	/* blackhole stores nothing, so it finds nothing */
+	const bool blackhole = strcmp(engine, "blackhole") == 0;
+	const int found = blackhole ? PMEMKV_STATUS_NOT_FOUND : PMEMKV_STATUS_OK;
+
+	/* the first call of each function is not counted (thread locals etc.) */
+	if (blackhole)
+		CHECK_CALL(pmemkv_put(db, k, 3, v, 5), PMEMKV_STATUS_OK);
+	else
+		UT_ASSERTeq(pmemkv_put(db, k, 3, v, 5), PMEMKV_STATUS_OK);
+	CHECK_CALL(pmemkv_get(db, k, 3, &get_v_cb, nullptr), found);
+	CHECK_CALL(pmemkv_get_copy(db, k, 3, buffer, sizeof(buffer), &cnt), found);
+	CHECK_CALL(pmemkv_get_into(db, k, 3, buffer, sizeof(buffer), &cnt), found);
+	CHECK_CALL(pmemkv_exists(db, k, 3), found);
+	CHECK_CALL(pmemkv_count_all(db, &cnt), PMEMKV_STATUS_OK);
+	CHECK_CALL(pmemkv_get_all(db, &get_kv_cb, nullptr), found);
+
+	if (blackhole) {
+		CHECK_CALL(put_remove(db, k, 3, v, 5), PMEMKV_STATUS_OK);
+	} else {
+		UT_ASSERTeq(cnt, 1);
+		UT_ASSERTeq(pmemkv_get_copy(db, k, 3, buffer, sizeof(buffer), &cnt),
+			    PMEMKV_STATUS_OK);
+		UT_ASSERTeq(cnt, 5);
+		UT_ASSERT(memcmp(buffer, v, 5) == 0);
+
+		UT_ASSERTeq(pmemkv_remove(db, k, 3), PMEMKV_STATUS_OK);
+		UT_ASSERTeq(pmemkv_exists(db, k, 3), PMEMKV_STATUS_NOT_FOUND);
+	}
+
+	pmemkv_close(db);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 3)
+		UT_FATAL("usage: %s engine json_config", argv[0]);
+
+	return run_test([&] {
+		test(argv[1], C_CONFIG_FROM_JSON(argv[2]), false);
+		test(argv[1], C_CONFIG_FROM_JSON(argv[2]), true);
+	});
+}
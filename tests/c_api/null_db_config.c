@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2020, Intel Corporation */
+/* Copyright 2020-2021, Intel Corporation */
 
 #include <libpmemkv.h>
 
@@ -67,6 +67,9 @@ void null_db_all_funcs_test()
 	s = pmemkv_get_copy(NULL, key1, strlen(key1), val, 10, &cnt);
 	UT_ASSERT(s == PMEMKV_STATUS_INVALID_ARGUMENT);
 
+	s = pmemkv_get_into(NULL, key1, strlen(key1), val, 10, &cnt);
+	UT_ASSERT(s == PMEMKV_STATUS_INVALID_ARGUMENT);
+
 	s = pmemkv_put(NULL, key1, strlen(key1), value1, strlen(value1));
 	UT_ASSERT(s == PMEMKV_STATUS_INVALID_ARGUMENT);
 
@@ -76,6 +79,9 @@ void null_db_all_funcs_test()
 	s = pmemkv_defrag(NULL, 0, 100);
 	UT_ASSERT(s == PMEMKV_STATUS_INVALID_ARGUMENT);
 
+	s = pmemkv_bulk_load(NULL, NULL, NULL);
+	UT_ASSERT(s == PMEMKV_STATUS_INVALID_ARGUMENT);
+
 	pmemkv_tx *tx;
 	s = pmemkv_tx_begin(NULL, &tx);
 	UT_ASSERT(s == PMEMKV_STATUS_INVALID_ARGUMENT);
@@ -347,3 +347,29 @@ function(add_engine_test)
 			-DRAW_PARAMS=${raw_params})
 	endforeach()
 endfunction()
+
+# adds performance regression test of an engine (see perf/perf.cc), labeled 'perf'
+function(add_perf_test)
+	set(oneValueArgs ENGINE SCRIPT)
+	cmake_parse_arguments(TEST "" "${oneValueArgs}" "" ${ARGN})
+
+	# without a baseline the test could only fail
+	if(NOT EXISTS ${CMAKE_CURRENT_SOURCE_DIR}/perf/baselines/${TEST_ENGINE}.json
+			AND NOT TESTS_PERF_RECORD)
+		message(STATUS "No perf baseline of ${TEST_ENGINE}, its perf test is skipped")
+		return()
+	endif()
+
+	add_engine_test(ENGINE ${TEST_ENGINE}
+			BINARY perf
+			TRACERS none
+			SCRIPT ${TEST_SCRIPT})
+
+	get_filename_component(script_name ${TEST_SCRIPT} NAME_WE)
+	set(test_name ${TEST_ENGINE}__perf__${script_name}_0_none)
+	if(TEST ${test_name})
+		set_tests_properties(${test_name} PROPERTIES
+				LABELS perf
+				RUN_SERIAL TRUE)
+	endif()
+endfunction()
@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2020, Intel Corporation */
+/* Copyright 2020-2021, Intel Corporation */
 
 /**
  * Test basic methods available in iterators (sorted and unsorted engines).
@@ -129,6 +129,55 @@ static void write_abort_test(pmem::kv::db &kv)
 	verify_keys<false>(it);
 }
 
+/*
+ * Iterators released by the user are cached by the engine and handed out
+ * again; check that a reused iterator does not carry any state (locks,
+ * uncommitted changes) from its previous life.
+ */
+template <bool IsConst>
+static void reuse_test(pmem::kv::db &kv)
+{
+	insert_keys(kv);
+
+	for (size_t round = 0; round < 20; round++) {
+		auto it = new_iterator<IsConst>(kv);
+
+		auto &p = keys[round % keys.size()];
+		ASSERT_STATUS(it.seek(p.first), pmem::kv::status::OK);
+		verify_key<IsConst>(it, p.first);
+	}
+
+	/* no parked iterator may block the writers */
+	auto &p = keys.front();
+	ASSERT_STATUS(kv.remove(p.first), pmem::kv::status::OK);
+	ASSERT_STATUS(kv.put(p.first, p.second), pmem::kv::status::OK);
+
+	auto it = new_iterator<IsConst>(kv);
+	verify_keys<IsConst>(it);
+}
+
+/* only for non const (write) iterators */
+static void reuse_abort_test(pmem::kv::db &kv)
+{
+	insert_keys(kv);
+
+	for (size_t round = 0; round < 20; round++) {
+		auto it = new_iterator<false>(kv);
+
+		auto &p = keys[round % keys.size()];
+		ASSERT_STATUS(it.seek(p.first), pmem::kv::status::OK);
+		auto res = it.write_range();
+		UT_ASSERT(res.is_ok());
+		for (auto &c : res.get_value())
+			c = 'x';
+
+		/* iterator is released without commit */
+	}
+
+	auto it = new_iterator<false>(kv);
+	verify_keys<false>(it);
+}
+
 static void test(int argc, char *argv[])
 {
 	if (argc < 3)
@@ -140,6 +189,9 @@ static void test(int argc, char *argv[])
 				 seek_test<false>,
 				 write_test,
 				 write_abort_test,
+				 reuse_test<true>,
+				 reuse_test<false>,
+				 reuse_abort_test,
 			 });
 }
 
@@ -0,0 +1,138 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+/**
+ * Tests keys and values of sizes around 'inline_size' - the biggest size an
+ * engine stores in place (e.g. STREE_INLINE_SIZE of stree), above which it
+ * allocates a separate buffer - and overwrites moving values across it.
+ */
+
+using namespace pmem::kv;
+
+/* string of 'size' characters, different for every 'seed' */
+static std::string make_string(size_t size, size_t seed)
+{
+	std::string s(size, '\0');
+	for (size_t i = 0; i < size; i++)
+		s[i] = static_cast<char>('a' + (seed + i) % 26);
+
+	return s;
+}
+
+static void verify(pmem::kv::db &kv, const std::string &key, const std::string &expected)
+{
+	std::string value;
+	ASSERT_STATUS(kv.get(key, &value), status::OK);
+	UT_ASSERTeq(value.size(), expected.size());
+	UT_ASSERT(value == expected);
+}
+
+static void BoundarySizesTest(const size_t inline_size, pmem::kv::db &kv)
+{
+	/**
+	 * TEST: keys and values just below, at and just above the inline size.
+	 */
+	const std::vector<size_t> key_sizes = {1, inline_size - 1, inline_size,
+					       inline_size + 1};
+	const std::vector<size_t> value_sizes = {0, inline_size - 1, inline_size,
+						 inline_size + 1};
+
+	std::vector<std::pair<std::string, std::string>> entries;
+	size_t seed = 0;
+	for (auto ks : key_sizes) {
+		for (auto vs : value_sizes) {
+			entries.emplace_back(make_string(ks, seed),
+					     make_string(vs, seed + 1));
+			ASSERT_STATUS(kv.put(entries.back().first, entries.back().second),
+				      status::OK);
+			seed++;
+		}
+	}
+
+	std::size_t cnt = std::numeric_limits<std::size_t>::max();
+	ASSERT_STATUS(kv.count_all(cnt), status::OK);
+	UT_ASSERTeq(cnt, entries.size());
+	for (auto &e : entries)
+		verify(kv, e.first, e.second);
+
+	/* keys of each size are removed on their own */
+	for (size_t i = 0; i < entries.size(); i += 2)
+		ASSERT_STATUS(kv.remove(entries[i].first), status::OK);
+	for (size_t i = 0; i < entries.size(); i++) {
+		if (i % 2 == 0)
+			ASSERT_STATUS(kv.exists(entries[i].first), status::NOT_FOUND);
+		else
+			verify(kv, entries[i].first, entries[i].second);
+	}
+}
+
+static void OverwriteTest(const size_t inline_size, pmem::kv::db &kv)
+{
+	/**
+	 * TEST: a value is overwritten with sizes which move it out of place and
+	 * back, and which shrink and grow its separate buffer.
+	 */
+	const std::vector<size_t> value_sizes = {
+		inline_size,	     /* in place */
+		inline_size + 1,     /* in place -> buffer */
+		inline_size,	     /* buffer -> in place */
+		0,		     /* in place, empty */
+		4 * inline_size,     /* in place -> buffer */
+		2 * inline_size,     /* fits in the current buffer */
+		inline_size + 1,     /* fits in the current buffer again */
+		3 * inline_size,     /* longer than the content, new buffer */
+		inline_size - 1,     /* buffer -> in place */
+		4 * inline_size + 1, /* in place -> buffer */
+	};
+
+	/* key stored in place and key in a separate buffer */
+	for (auto ks : {inline_size, inline_size + 1}) {
+		auto key = make_string(ks, 0);
+		/* neighbours, to check that overwrites do not affect them */
+		auto lower = make_string(ks, 25);
+		auto higher = make_string(ks, 1);
+		ASSERT_STATUS(kv.put(lower, "lower"), status::OK);
+		ASSERT_STATUS(kv.put(higher, "higher"), status::OK);
+
+		size_t seed = 0;
+		for (auto vs : value_sizes) {
+			auto value = make_string(vs, seed++);
+			ASSERT_STATUS(kv.put(key, value), status::OK);
+			verify(kv, key, value);
+		}
+
+		std::size_t cnt = std::numeric_limits<std::size_t>::max();
+		ASSERT_STATUS(kv.count_all(cnt), status::OK);
+		UT_ASSERTeq(cnt, 3);
+		verify(kv, lower, "lower");
+		verify(kv, higher, "higher");
+
+		ASSERT_STATUS(kv.remove(key), status::OK);
+		ASSERT_STATUS(kv.remove(lower), status::OK);
+		ASSERT_STATUS(kv.remove(higher), status::OK);
+	}
+}
+
+static void test(int argc, char *argv[])
+{
+	using namespace std::placeholders;
+
+	if (argc < 4)
+		UT_FATAL("usage: %s engine json_config inline_size", argv[0]);
+
+	auto inline_size = std::stoull(argv[3]);
+	UT_ASSERT(inline_size >= 2);
+
+	run_engine_tests(argv[1], argv[2],
+			 {
+				 std::bind(BoundarySizesTest, inline_size, _1),
+				 std::bind(OverwriteTest, inline_size, _1),
+			 });
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
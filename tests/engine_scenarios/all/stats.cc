@@ -0,0 +1,126 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+#include <map>
+
+/**
+ * Tests runtime statistics (enabled with "stats" config item).
+ */
+
+using namespace pmem::kv;
+
+static std::map<std::string, std::uint64_t> get_stats(pmem::kv::db &kv)
+{
+	std::map<std::string, std::uint64_t> stats;
+	auto s = kv.stats([&](string_view name, std::uint64_t value) {
+		stats[std::string(name.data(), name.size())] = value;
+		return 0;
+	});
+	ASSERT_STATUS(s, status::OK);
+
+	return stats;
+}
+
+static void CountersTest(pmem::kv::db &kv)
+{
+	ASSERT_STATUS(kv.stats_reset(), status::OK);
+
+	const size_t n = 100;
+	for (size_t i = 0; i < n; i++) {
+		ASSERT_STATUS(kv.put(entry_from_number(i), entry_from_number(i, "", "v")),
+			      status::OK);
+	}
+
+	std::string value;
+	for (size_t i = 0; i < n; i++) {
+		ASSERT_STATUS(kv.get(entry_from_number(i), &value), status::OK);
+	}
+	ASSERT_STATUS(kv.get(entry_from_number(n), &value), status::NOT_FOUND);
+
+	ASSERT_STATUS(kv.exists(entry_from_number(0)), status::OK);
+	ASSERT_STATUS(kv.remove(entry_from_number(0)), status::OK);
+
+	auto stats = get_stats(kv);
+
+	UT_ASSERTeq(stats["put.count"], n);
+	UT_ASSERTeq(stats["put.errors"], 0);
+	/* NOT_FOUND is not an error */
+	UT_ASSERTeq(stats["get.count"], n + 1);
+	UT_ASSERTeq(stats["get.errors"], 0);
+	UT_ASSERTeq(stats["exists.count"], 1);
+	UT_ASSERTeq(stats["remove.count"], 1);
+	UT_ASSERTeq(stats["tx_commit.count"], 0);
+
+	std::uint64_t written = 0, read = 0;
+	for (size_t i = 0; i < n; i++) {
+		written += entry_from_number(i).size() +
+			entry_from_number(i, "", "v").size();
+		read += entry_from_number(i, "", "v").size();
+	}
+	UT_ASSERTeq(stats["bytes_written"], written);
+	UT_ASSERTeq(stats["bytes_read"], read);
+
+	/* histogram buckets sum up to the number of calls */
+	std::uint64_t in_buckets = 0;
+	for (auto &s : stats) {
+		if (s.first.find("put.latency_ns.bucket.") == 0)
+			in_buckets += s.second;
+	}
+	UT_ASSERTeq(in_buckets, n);
+
+	UT_ASSERT(stats["put.latency_ns.p50"] <= stats["put.latency_ns.p99"]);
+	UT_ASSERT(stats["put.latency_ns.p99"] <= stats["put.latency_ns.max"]);
+	UT_ASSERT(stats["put.latency_ns.mean"] <= stats["put.latency_ns.max"]);
+}
+
+static void ResetTest(pmem::kv::db &kv)
+{
+	ASSERT_STATUS(kv.put(entry_from_string("key"), entry_from_string("value")),
+		      status::OK);
+	ASSERT_STATUS(kv.stats_reset(), status::OK);
+
+	auto stats = get_stats(kv);
+	UT_ASSERTeq(stats["put.count"], 0);
+	UT_ASSERTeq(stats["bytes_written"], 0);
+	UT_ASSERT(stats.find("put.latency_ns.max") == stats.end());
+	/* open time is not reset */
+	UT_ASSERT(stats.find("open.total_ns") != stats.end());
+	UT_ASSERT(stats["open.total_ns"] > 0);
+}
+
+static void StopByCallbackTest(pmem::kv::db &kv)
+{
+	size_t calls = 0;
+	auto s = kv.stats([&](string_view, std::uint64_t) {
+		calls++;
+		return 1;
+	});
+	ASSERT_STATUS(s, status::STOPPED_BY_CB);
+	UT_ASSERTeq(calls, 1);
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 3)
+		UT_FATAL("usage: %s engine json_config", argv[0]);
+
+	auto cfg = CONFIG_FROM_JSON(argv[2]);
+	ASSERT_STATUS(cfg.put_uint64("stats", 1), status::OK);
+
+	auto kv = INITIALIZE_KV(argv[1], std::move(cfg));
+
+	CountersTest(kv);
+	CLEAR_KV(kv);
+	ResetTest(kv);
+	CLEAR_KV(kv);
+	StopByCallbackTest(kv);
+
+	kv.close();
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
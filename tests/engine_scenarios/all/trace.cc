@@ -0,0 +1,181 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <fstream>
+#include <thread>
+#include <vector>
+
+/**
+ * Tests trace of API calls (enabled with "trace_buffer_size" config item),
+ * its capture to a file ("capture_path") and dumps on signal ("trace_signal").
+ */
+
+using namespace pmem::kv;
+
+static const size_t RING_SIZE = 16;
+
+/* keep in sync with src/trace.h */
+struct trace_header {
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t record_size;
+	std::uint64_t records;
+};
+
+struct trace_record {
+	std::uint64_t timestamp_ns;
+	std::uint64_t duration_ns;
+	std::uint64_t key_hash;
+	std::uint32_t key_size;
+	std::uint32_t value_size;
+	std::uint32_t thread;
+	std::uint8_t op;
+	std::int8_t status;
+	std::uint16_t reserved;
+};
+
+static const size_t N_PUTS = 100;
+
+static const int DUMP_SIGNAL = SIGUSR1;
+
+static std::vector<trace_record> read_trace(const std::string &path)
+{
+	std::ifstream in(path, std::ios::binary);
+	UT_ASSERT(in.good());
+
+	trace_header header;
+	in.read(reinterpret_cast<char *>(&header), sizeof(header));
+	UT_ASSERT(in.good());
+	UT_ASSERT(memcmp(header.magic, "PMKVTRC", 8) == 0);
+	UT_ASSERTeq(header.version, 1);
+	UT_ASSERTeq(header.record_size, sizeof(trace_record));
+
+	std::vector<trace_record> records(header.records);
+	in.read(reinterpret_cast<char *>(records.data()),
+		static_cast<std::streamsize>(records.size() * sizeof(trace_record)));
+	UT_ASSERT(in.good());
+
+	return records;
+}
+
+static void DumpTest(pmem::kv::db &kv, const std::string &dump_path)
+{
+	const size_t n = N_PUTS;
+	for (size_t i = 0; i < n; i++) {
+		ASSERT_STATUS(kv.put(entry_from_number(i), entry_from_string("value")),
+			      status::OK);
+	}
+	std::string value;
+	ASSERT_STATUS(kv.get(entry_from_number(n), &value), status::NOT_FOUND);
+
+	ASSERT_STATUS(kv.trace_dump(dump_path), status::OK);
+
+	auto records = read_trace(dump_path);
+	/* single thread, so a single (full) ring */
+	UT_ASSERTeq(records.size(), RING_SIZE);
+
+	/* the oldest records were overwritten, the last one is the get */
+	for (size_t i = 1; i < records.size(); i++)
+		UT_ASSERT(records[i - 1].timestamp_ns <= records[i].timestamp_ns);
+
+	auto &get = records.back();
+	UT_ASSERTeq(get.status, static_cast<std::int8_t>(status::NOT_FOUND));
+	UT_ASSERTeq(get.key_size, entry_from_number(n).size());
+	UT_ASSERTeq(get.value_size, 0);
+
+	auto &put = records[records.size() - 2];
+	UT_ASSERTeq(put.status, static_cast<std::int8_t>(status::OK));
+	UT_ASSERTeq(put.key_size, entry_from_number(n - 1).size());
+	UT_ASSERTeq(put.value_size, entry_from_string("value").size());
+	UT_ASSERT(put.op != get.op);
+}
+
+/* Checks the capture of all calls made so far, after the database is closed. */
+static void CaptureTest(const std::string &capture_path, size_t n)
+{
+	auto records = read_trace(capture_path);
+
+	/* n puts and a get, all in order of calls */
+	UT_ASSERTeq(records.size(), n + 1);
+	for (size_t i = 0; i < n; i++) {
+		UT_ASSERTeq(records[i].status, static_cast<std::int8_t>(status::OK));
+		UT_ASSERTeq(records[i].op, records[0].op);
+		UT_ASSERTeq(records[i].key_size, entry_from_number(i).size());
+		if (i > 0)
+			UT_ASSERT(records[i - 1].timestamp_ns <= records[i].timestamp_ns);
+	}
+	UT_ASSERTeq(records[n].status, static_cast<std::int8_t>(status::NOT_FOUND));
+}
+
+static bool signal_handled_by_default()
+{
+	struct sigaction sa;
+	UT_ASSERTeq(sigaction(DUMP_SIGNAL, nullptr, &sa), 0);
+
+	return sa.sa_handler == SIG_DFL;
+}
+
+/*
+ * Opens another database tracing the same signal and closes it, while the tested
+ * one is still open - the signal must still be handled (and not kill the process).
+ */
+static void SignalTest(const std::string &trace_path)
+{
+	config cfg;
+	ASSERT_STATUS(cfg.put_uint64("trace_buffer_size", RING_SIZE), status::OK);
+	ASSERT_STATUS(cfg.put_uint64("trace_signal", DUMP_SIGNAL), status::OK);
+	ASSERT_STATUS(cfg.put_string("trace_path", trace_path + ".other"), status::OK);
+
+	pmem::kv::db other;
+	ASSERT_STATUS(other.open("blackhole", std::move(cfg)), status::OK);
+	other.close();
+
+	UT_ASSERT(!signal_handled_by_default());
+	UT_ASSERTeq(raise(DUMP_SIGNAL), 0);
+
+	/* the database still open dumps its trace in the background */
+	auto dump_path = trace_path + ".0";
+	for (int i = 0; i < 100 && !std::ifstream(dump_path).good(); i++)
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	UT_ASSERT(std::ifstream(dump_path).good());
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 3)
+		UT_FATAL("usage: %s engine json_config", argv[0]);
+
+	auto cfg = CONFIG_FROM_JSON(argv[2]);
+	std::string path;
+	ASSERT_STATUS(cfg.get_string("path", path), status::OK);
+
+	ASSERT_STATUS(cfg.put_uint64("trace_buffer_size", RING_SIZE), status::OK);
+	ASSERT_STATUS(cfg.put_string("capture_path", path + ".capture"), status::OK);
+	ASSERT_STATUS(cfg.put_uint64("trace_signal", DUMP_SIGNAL), status::OK);
+	ASSERT_STATUS(cfg.put_string("trace_path", path + ".signal"), status::OK);
+
+	UT_ASSERT(signal_handled_by_default());
+
+	auto kv = INITIALIZE_KV(argv[1], std::move(cfg));
+
+	DumpTest(kv, path + ".trace");
+	SignalTest(path + ".signal");
+
+	kv.close();
+
+	/* the last database tracing the signal restored its handler */
+	UT_ASSERT(signal_handled_by_default());
+
+	CaptureTest(path + ".capture", N_PUTS);
+	UT_ASSERTeq(read_trace(path + ".signal.0").size(), RING_SIZE);
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
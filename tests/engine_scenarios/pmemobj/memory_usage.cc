@@ -0,0 +1,71 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+/**
+ * Tests memory usage reported by pmemobj based engines.
+ */
+
+using namespace pmem::kv;
+
+static memory_usage_info get_usage(pmem::kv::db &kv)
+{
+	memory_usage_info usage;
+	ASSERT_STATUS(kv.memory_usage(usage), status::OK);
+
+	return usage;
+}
+
+static void MemoryUsageTest(pmem::kv::db &kv)
+{
+	auto empty = get_usage(kv);
+	UT_ASSERTeq(empty.pmem_data_bytes, 0);
+	/* pool is a regular file, so its size is known */
+	UT_ASSERT(empty.pmem_free_bytes > 0);
+
+	const size_t n = 1000;
+	std::uint64_t data = 0;
+	for (size_t i = 0; i < n; i++) {
+		auto key = entry_from_number(i);
+		auto value = entry_from_number(i, "", std::string(100, 'v'));
+		ASSERT_STATUS(kv.put(key, value), status::OK);
+		data += key.size() + value.size();
+	}
+
+	auto usage = get_usage(kv);
+	UT_ASSERTeq(usage.pmem_data_bytes, data);
+	/* every engine needs some space for its structures */
+	UT_ASSERT(usage.pmem_metadata_bytes > 0);
+	UT_ASSERT(usage.pmem_free_bytes + data <= empty.pmem_free_bytes);
+
+	for (size_t i = 0; i < n; i++)
+		ASSERT_STATUS(kv.remove(entry_from_number(i)), status::OK);
+
+	/* fragmented space is not counted as free */
+	auto removed = get_usage(kv);
+	UT_ASSERTeq(removed.pmem_data_bytes, 0);
+	UT_ASSERT(removed.pmem_free_bytes + removed.pmem_fragmented_bytes <=
+		  empty.pmem_free_bytes + empty.pmem_fragmented_bytes);
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 3)
+		UT_FATAL("usage: %s engine json_config", argv[0]);
+
+	auto cfg = CONFIG_FROM_JSON(argv[2]);
+	/* needed for pmem_fragmented_bytes */
+	ASSERT_STATUS(cfg.put_uint64("heap_stats", 1), status::OK);
+
+	auto kv = INITIALIZE_KV(argv[1], std::move(cfg));
+
+	MemoryUsageTest(kv);
+
+	kv.close();
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
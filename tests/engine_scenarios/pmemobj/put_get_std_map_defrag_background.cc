@@ -0,0 +1,67 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "../put_get_std_map.hpp"
+
+#include <chrono>
+#include <thread>
+
+/*
+ * Runs put/get workload while defrag is scheduled in the background
+ * (defrag_interval_ms config item), checks that the idle database gets
+ * defragmented and that no data is lost.
+ */
+static std::uint64_t defrag_steps(pmem::kv::db &kv)
+{
+	std::uint64_t steps = 0;
+	auto s = kv.stats([&](pmem::kv::string_view name, std::uint64_t value) {
+		if (std::string(name.data(), name.size()) == "engine.defrag.steps")
+			steps = value;
+		return 0;
+	});
+	ASSERT_STATUS(s, pmem::kv::status::OK);
+
+	return steps;
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 6)
+		UT_FATAL("usage: %s engine json_config n_inserts key_length value_length",
+			 argv[0]);
+
+	auto n_inserts = std::stoull(argv[3]);
+	auto key_length = std::stoull(argv[4]);
+	auto value_length = std::stoull(argv[5]);
+
+	auto cfg = CONFIG_FROM_JSON(argv[2]);
+	ASSERT_STATUS(cfg.put_uint64("defrag_interval_ms", 1), pmem::kv::status::OK);
+	ASSERT_STATUS(cfg.put_uint64("defrag_step_percent", 25), pmem::kv::status::OK);
+	ASSERT_STATUS(cfg.put_uint64("stats", 1), pmem::kv::status::OK);
+
+	auto kv = INITIALIZE_KV(argv[1], std::move(cfg));
+
+	auto proto = PutToMapTest(n_inserts, key_length, value_length, kv);
+
+	/* remove every other element to leave holes behind */
+	for (auto it = proto.begin(); it != proto.end();) {
+		ASSERT_STATUS(kv.remove(it->first), pmem::kv::status::OK);
+		it = proto.erase(it);
+		if (it != proto.end())
+			++it;
+	}
+
+	/* the database is idle now, so the scheduler has to do a full pass */
+	for (int i = 0; i < 1000 && defrag_steps(kv) < 4; i++)
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	UT_ASSERT(defrag_steps(kv) >= 4);
+
+	VerifyKv(proto, kv);
+
+	kv.close();
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
@@ -0,0 +1,160 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "iterate.hpp"
+
+#include <iomanip>
+#include <sstream>
+
+/**
+ * Tests bulk_load method of sorted engines: loading sorted pairs into an empty
+ * database and error handling (non-empty database, unsorted input, callback
+ * stopping the load).
+ */
+
+static std::string sorted_key(size_t i)
+{
+	std::ostringstream os;
+	os << std::setw(10) << std::setfill('0') << i;
+	/* some keys do not fit in place of the entry */
+	if (i % 7 == 0)
+		os << std::string(100, 'k');
+
+	return os.str();
+}
+
+static kv_list gen_sorted(size_t items)
+{
+	kv_list list;
+	for (size_t i = 0; i < items; i++)
+		list.emplace_back(sorted_key(i * 2),
+				  std::string(i % 200, 'v') + std::to_string(i));
+
+	return list;
+}
+
+using kv_range = std::pair<kv_list::iterator, kv_list::iterator>;
+
+static int produce(const char **key, size_t *keybytes, const char **value,
+		   size_t *valuebytes, void *arg)
+{
+	auto it = reinterpret_cast<kv_range *>(arg);
+	if (it->first == it->second)
+		return 1;
+
+	*key = it->first->first.data();
+	*keybytes = it->first->first.size();
+	*value = it->first->second.data();
+	*valuebytes = it->first->second.size();
+	++it->first;
+
+	return 0;
+}
+
+static void BulkLoadTest(pmem::kv::db &kv, size_t items)
+{
+	/**
+	 * TEST: sorted pairs are loaded into empty database and then modified.
+	 */
+	auto expected = gen_sorted(items);
+	ASSERT_STATUS(kv.bulk_load(expected.begin(), expected.end()), status::OK);
+	verify_get_all(kv, items, expected);
+
+	std::string value;
+	for (size_t i = 0; i < items; i += items / 10 + 1) {
+		ASSERT_STATUS(kv.get(expected[i].first, &value), status::OK);
+		UT_ASSERT(value == expected[i].second);
+	}
+
+	/* keys between the loaded ones and after them */
+	for (size_t i = 1; i < items * 2 + 10; i += 5) {
+		ASSERT_STATUS(kv.put(sorted_key(i), "put"), status::OK);
+		expected.emplace_back(sorted_key(i), "put");
+	}
+	expected = kv_sort(expected);
+	verify_get_all(kv, expected.size(), expected);
+
+	/* loading to non-empty database is not allowed */
+	auto more = gen_sorted(10);
+	ASSERT_STATUS(kv.bulk_load(more.begin(), more.end()), status::INVALID_ARGUMENT);
+	verify_get_all(kv, expected.size(), expected);
+
+	CLEAR_KV(kv);
+	verify_get_all(kv, 0, kv_list());
+
+	/* database emptied with remove can be loaded again, with C-like API */
+	expected = gen_sorted(items / 2);
+	auto range = std::make_pair(expected.begin(), expected.end());
+	ASSERT_STATUS(kv.bulk_load(produce, &range), status::OK);
+	verify_get_all(kv, expected.size(), expected);
+
+	CLEAR_KV(kv);
+}
+
+static void BulkLoadErrorsTest(pmem::kv::db &kv, size_t items)
+{
+	/**
+	 * TEST: failed loads leave the database empty.
+	 */
+	auto list = gen_sorted(items);
+
+	/* empty input */
+	ASSERT_STATUS(kv.bulk_load(list.begin(), list.begin()), status::OK);
+	verify_get_all(kv, 0, kv_list());
+
+	/* unsorted input */
+	auto unsorted = list;
+	std::swap(unsorted[items / 2], unsorted[items / 2 + 1]);
+	ASSERT_STATUS(kv.bulk_load(unsorted.begin(), unsorted.end()),
+		      status::INVALID_ARGUMENT);
+	verify_get_all(kv, 0, kv_list());
+
+	/* duplicated key */
+	auto duplicated = list;
+	duplicated[items - 1].first = duplicated[items - 2].first;
+	ASSERT_STATUS(kv.bulk_load(duplicated.begin(), duplicated.end()),
+		      status::INVALID_ARGUMENT);
+	verify_get_all(kv, 0, kv_list());
+
+	/* callback stops the load */
+	size_t i = 0;
+	auto s = kv.bulk_load([&](string_view &key, string_view &value) {
+		if (i == items * 3 / 4)
+			return -1;
+
+		key = list[i].first;
+		value = list[i].second;
+		++i;
+
+		return 0;
+	});
+	ASSERT_STATUS(s, status::STOPPED_BY_CB);
+	verify_get_all(kv, 0, kv_list());
+
+	/* and the database is still usable */
+	ASSERT_STATUS(kv.bulk_load(list.begin(), list.end()), status::OK);
+	verify_get_all(kv, items, list);
+
+	CLEAR_KV(kv);
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 4)
+		UT_FATAL("usage: %s engine json_config items", argv[0]);
+
+	size_t items = std::stoull(argv[3]);
+	UT_ASSERT(items >= 2);
+
+	auto kv = INITIALIZE_KV(argv[1], CONFIG_FROM_JSON(argv[2]));
+
+	BulkLoadTest(kv, items);
+	BulkLoadErrorsTest(kv, items);
+
+	kv.close();
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
@@ -9,3 +9,7 @@ set(LAYOUT "pmemkv")
 if (NOT ${ENGINE} STREQUAL "cmap") 
     string(CONCAT LAYOUT "pmemkv_" ${ENGINE})
 endif()
+# layouts of stree and tree3 have a version, bumped with changes of their pools
+if (${ENGINE} STREQUAL "stree" OR ${ENGINE} STREQUAL "tree3")
+    string(CONCAT LAYOUT ${LAYOUT} "_v2")
+endif()
@@ -0,0 +1,18 @@
+# SPDX-License-Identifier: BSD-3-Clause
+# Copyright 2021, Intel Corporation
+
+include(${PARENT_SRC_DIR}/helpers.cmake)
+include(${PARENT_SRC_DIR}/engines/pmemobj_based/helpers.cmake)
+
+setup()
+
+# the smallest and the biggest node size, in both modes
+pmempool_execute(create -l ${LAYOUT} -s ${DB_SIZE} obj ${DIR}/testfile)
+make_config({"path":"${DIR}/testfile","degree":16})
+execute(${TEST_EXECUTABLE} ${ENGINE} ${CONFIG} ${PARAMS})
+
+pmempool_execute(create -l pmemkv_stree_hybrid -s ${DB_SIZE} obj ${DIR}/testfile_hybrid)
+make_config({"path":"${DIR}/testfile_hybrid","hybrid":1,"degree":64})
+execute(${TEST_EXECUTABLE} ${ENGINE} ${CONFIG} ${PARAMS})
+
+finish()
@@ -0,0 +1,17 @@
+# SPDX-License-Identifier: BSD-3-Clause
+# Copyright 2021, Intel Corporation
+
+include(${PARENT_SRC_DIR}/helpers.cmake)
+include(${PARENT_SRC_DIR}/engines/pmemobj_based/helpers.cmake)
+
+setup()
+
+# hybrid stree uses its own layout (its root object differs)
+set(LAYOUT "pmemkv_stree_hybrid")
+
+pmempool_execute(create -l ${LAYOUT} -s ${DB_SIZE} obj ${DIR}/testfile)
+
+make_config({"path":"${DIR}/testfile","hybrid":1,"recovery_threads":4})
+execute(${TEST_EXECUTABLE} ${ENGINE} ${CONFIG} ${PARAMS})
+
+finish()
@@ -0,0 +1,291 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2021, Intel Corporation */
+
+#include "unittest.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <new>
+#include <sstream>
+
+#include <rapidjson/document.h>
+#include <rapidjson/istreamwrapper.h>
+
+/**
+ * Performance regression test - runs short, deterministic workloads and
+ * compares them with a baseline stored in PERF_BASELINES_DIR/<engine>.json:
+ *
+ * {
+ *	"tolerance": {"relative_ops_per_sec": 0.5, "allocs_per_op": 0.1},
+ *	"workloads": {"put": {"relative_ops_per_sec": 0.25, "allocs_per_op": 0}, ...}
+ * }
+ *
+ * Throughput is compared relative to the blackhole engine measured in the same
+ * process (i.e. to the cost of the API itself), so that baselines do not
+ * depend on the machine as much as raw ops/sec would. The test fails if it is
+ * lower than the baseline by more than the tolerance (a fraction), or if there
+ * are more operator new calls per operation than in the baseline (plus the
+ * tolerance). For blackhole only allocations are compared, its throughput
+ * relative to itself is always 1. A missing baseline is an error, so that an
+ * engine cannot go unchecked unnoticed (tests of engines with no baseline are
+ * registered only with TESTS_PERF_RECORD).
+ *
+ * Measured values are printed in the same format. With
+ * PMEMKV_PERF_UPDATE_BASELINE=1 they are written to the baseline file instead.
+ */
+
+using namespace pmem::kv;
+
+static const size_t N_KEYS = 10000;
+static const size_t VALUE_SIZE = 64;
+static const size_t RUNS = 5;
+
+static const double DEFAULT_OPS_TOLERANCE = 0.5;
+static const double DEFAULT_ALLOCS_TOLERANCE = 0.1;
+
+static std::atomic<std::uint64_t> allocations(0);
+
+void *operator new(std::size_t size)
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+
+	void *ptr = malloc(size ? size : 1);
+	if (ptr == nullptr)
+		throw std::bad_alloc();
+
+	return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept
+{
+	free(ptr);
+}
+
+struct measurement {
+	double ops_per_sec;
+	double allocs_per_op;
+};
+
+using measurements = std::map<std::string, measurement>;
+
+static void get_cb(const char *, size_t, void *)
+{
+}
+
+static status do_put(db &kv, const std::string &k, const std::string &v)
+{
+	return kv.put(k, v);
+}
+
+static status do_get(db &kv, const std::string &k, const std::string &)
+{
+	return kv.get(k, &get_cb, nullptr);
+}
+
+static status do_exists(db &kv, const std::string &k, const std::string &)
+{
+	return kv.exists(k);
+}
+
+static status do_remove(db &kv, const std::string &k, const std::string &)
+{
+	return kv.remove(k);
+}
+
+struct workload {
+	const char *name;
+	status (*op)(db &kv, const std::string &k, const std::string &v);
+};
+
+/* In order - each workload runs on what was left by the previous one. */
+static const std::vector<workload> workloads = {
+	{"put", do_put},
+	{"get", do_get},
+	{"exists", do_exists},
+	{"overwrite", do_put},
+	{"remove", do_remove},
+	{"get_miss", do_get},
+};
+
+/* Runs all workloads RUNS times, keeping the best throughput of each. */
+static measurements measure(db &kv, const std::vector<std::string> &keys)
+{
+	const std::string value(VALUE_SIZE, 'x');
+	measurements res;
+
+	for (size_t run = 0; run < RUNS; run++) {
+		for (auto &w : workloads) {
+			auto allocs_before = allocations.load();
+			auto start = std::chrono::steady_clock::now();
+
+			for (auto &k : keys) {
+				auto s = w.op(kv, k, value);
+				if (s != status::OK && s != status::NOT_FOUND)
+					UT_FATAL("%s failed with status %d", w.name,
+						 static_cast<int>(s));
+			}
+
+			auto end = std::chrono::steady_clock::now();
+			auto allocs = allocations.load() - allocs_before;
+
+			std::chrono::duration<double> sec = end - start;
+			measurement r = {static_cast<double>(keys.size()) / sec.count(),
+				    static_cast<double>(allocs) /
+					    static_cast<double>(keys.size())};
+
+			auto it = res.find(w.name);
+			if (it == res.end()) {
+				res[w.name] = r;
+				continue;
+			}
+
+			auto &best = it->second;
+			best.ops_per_sec = (std::max)(best.ops_per_sec, r.ops_per_sec);
+			best.allocs_per_op =
+				(std::min)(best.allocs_per_op, r.allocs_per_op);
+		}
+	}
+
+	return res;
+}
+
+static std::string to_json(const std::string &name, const measurements &engine,
+			   const measurements &baseline)
+{
+	std::ostringstream out;
+	out << "{\n\t\"tolerance\": {\"relative_ops_per_sec\": " << DEFAULT_OPS_TOLERANCE
+	    << ", \"allocs_per_op\": " << DEFAULT_ALLOCS_TOLERANCE << "},\n";
+	out << "\t\"workloads\": {\n";
+
+	size_t i = 0;
+	for (auto &w : workloads) {
+		auto &r = engine.at(w.name);
+		out << "\t\t\"" << w.name << "\": {";
+		if (name != "blackhole")
+			out << "\"relative_ops_per_sec\": "
+			    << r.ops_per_sec / baseline.at(w.name).ops_per_sec << ", ";
+		out << "\"allocs_per_op\": " << r.allocs_per_op << "}"
+		    << (++i < workloads.size() ? "," : "") << "\n";
+	}
+	out << "\t}\n}\n";
+
+	return out.str();
+}
+
+/* Returns number of regressions found. */
+static int compare(const std::string &path, const measurements &engine,
+		   const measurements &baseline)
+{
+	std::ifstream in(path);
+	if (!in.good())
+		UT_FATAL("no baseline in %s, record it with "
+			 "PMEMKV_PERF_UPDATE_BASELINE=1",
+			 path.c_str());
+
+	rapidjson::IStreamWrapper isw(in);
+	rapidjson::Document doc;
+	if (doc.ParseStream(isw).HasParseError() || !doc.IsObject())
+		UT_FATAL("cannot parse %s", path.c_str());
+
+	double ops_tolerance = DEFAULT_OPS_TOLERANCE;
+	double allocs_tolerance = DEFAULT_ALLOCS_TOLERANCE;
+	if (doc.HasMember("tolerance")) {
+		auto &t = doc["tolerance"];
+		if (t.HasMember("relative_ops_per_sec"))
+			ops_tolerance = t["relative_ops_per_sec"].GetDouble();
+		if (t.HasMember("allocs_per_op"))
+			allocs_tolerance = t["allocs_per_op"].GetDouble();
+	}
+
+	if (!doc.HasMember("workloads"))
+		UT_FATAL("no workloads in %s", path.c_str());
+
+	int regressions = 0;
+	auto &expected = doc["workloads"];
+	for (auto &w : workloads) {
+		if (!expected.HasMember(w.name))
+			continue;
+
+		auto &e = expected[w.name];
+		auto &r = engine.at(w.name);
+		auto relative = r.ops_per_sec / baseline.at(w.name).ops_per_sec;
+
+		if (e.HasMember("relative_ops_per_sec")) {
+			auto min = e["relative_ops_per_sec"].GetDouble() *
+				(1 - ops_tolerance);
+			if (relative < min) {
+				std::cerr << w.name
+					  << ": throughput relative to blackhole "
+					  << relative << " is below " << min << std::endl;
+				regressions++;
+			}
+		}
+
+		if (e.HasMember("allocs_per_op")) {
+			auto max = e["allocs_per_op"].GetDouble() + allocs_tolerance;
+			if (r.allocs_per_op > max) {
+				std::cerr << w.name << ": " << r.allocs_per_op
+					  << " allocations per operation, at most "
+					  << max << " expected" << std::endl;
+				regressions++;
+			}
+		}
+	}
+
+	return regressions;
+}
+
+static void test(int argc, char *argv[])
+{
+	if (argc < 3)
+		UT_FATAL("usage: %s engine json_config", argv[0]);
+
+	std::string engine = argv[1];
+
+	std::vector<std::string> keys;
+	for (size_t i = 0; i < N_KEYS; i++) {
+		auto n = std::to_string(i);
+		keys.emplace_back("key" + std::string(8 - n.size(), '0') + n);
+	}
+
+	measurements baseline;
+	{
+		auto kv = INITIALIZE_KV("blackhole", CONFIG_FROM_JSON("{}"));
+		baseline = measure(kv, keys);
+		kv.close();
+	}
+
+	auto kv = INITIALIZE_KV(engine, CONFIG_FROM_JSON(argv[2]));
+	auto res = measure(kv, keys);
+	kv.close();
+
+	auto json = to_json(engine, res, baseline);
+	std::cout << json;
+
+	auto path = std::string(PERF_BASELINES_DIR) + "/" + engine + ".json";
+	auto update = std::getenv("PMEMKV_PERF_UPDATE_BASELINE");
+	if (update && std::string(update) == "1") {
+		std::ofstream out(path);
+		out << json;
+		UT_ASSERT(out.good());
+		return;
+	}
+
+	auto regressions = compare(path, res, baseline);
+	if (regressions)
+		UT_FATAL("%d performance regression(s) in %s", regressions,
+			 engine.c_str());
+}
+
+int main(int argc, char *argv[])
+{
+	return run_test([&] { test(argc, argv); });
+}
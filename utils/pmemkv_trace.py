@@ -0,0 +1,140 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: BSD-3-Clause
+# Copyright 2021, Intel Corporation
+
+#
+# pmemkv_trace.py -- decodes and summarizes trace dumps written by
+#	pmemkv_trace_dump() or on the trace signal, and captures (see "trace_*"
+#	and "capture_path" config items in libpmemkv(7)).
+#
+# Usage: pmemkv_trace.py [--top N] [--csv] dump_file
+#
+# Without --csv prints, per operation, number of calls, errors and latency
+# percentiles, followed by the N slowest calls.
+#
+
+import argparse
+import struct
+import sys
+
+# keep in sync with src/trace.h
+MAGIC = b"PMKVTRC\0"
+HEADER = struct.Struct("=8sIIQ")
+RECORD = struct.Struct("=QQQIIIBbH")
+
+# order of internal::api_op in src/stats.h
+OPS = ["get", "put", "remove", "exists", "count", "iterate", "tx_commit", "defrag",
+       "bulk_load"]
+
+# PMEMKV_STATUS_* from src/libpmemkv.h
+STATUSES = ["OK", "UNKNOWN_ERROR", "NOT_FOUND", "NOT_SUPPORTED",
+	    "INVALID_ARGUMENT", "CONFIG_PARSING_ERROR", "CONFIG_TYPE_ERROR",
+	    "STOPPED_BY_CB", "OUT_OF_MEMORY", "WRONG_ENGINE_NAME",
+	    "TRANSACTION_SCOPE_ERROR", "DEFRAG_ERROR", "COMPARATOR_MISMATCH"]
+NOT_ERRORS = {0, 2, 7}
+
+
+class Record:
+	def __init__(self, fields):
+		(self.timestamp, self.duration, self.key_hash, self.key_size,
+		 self.value_size, self.thread, op, self.status, _) = fields
+		self.op = OPS[op] if op < len(OPS) else "op_%d" % op
+
+	def status_name(self):
+		if 0 <= self.status < len(STATUSES):
+			return STATUSES[self.status]
+		return str(self.status)
+
+
+def read_dump(path):
+	with open(path, "rb") as f:
+		data = f.read()
+
+	if len(data) < HEADER.size:
+		sys.exit("%s: file too short" % path)
+
+	magic, version, record_size, count = HEADER.unpack_from(data)
+	if magic != MAGIC:
+		sys.exit("%s: not a pmemkv trace dump" % path)
+	if version != 1 or record_size != RECORD.size:
+		sys.exit("%s: unsupported version %d (record size %d)" %
+			 (path, version, record_size))
+
+	# capture of a database which was not closed has no record count
+	available = (len(data) - HEADER.size) // RECORD.size
+	count = min(count, available) if count else available
+
+	records = [Record(RECORD.unpack_from(data, HEADER.size + i * RECORD.size))
+		   for i in range(count)]
+	records.sort(key=lambda r: r.timestamp)
+
+	return records
+
+
+def percentile(sorted_values, q):
+	idx = min(len(sorted_values) - 1, int(q * len(sorted_values)))
+	return sorted_values[idx]
+
+
+def print_csv(records):
+	print("timestamp_ns,thread,op,key_hash,key_size,value_size,duration_ns,status")
+	for r in records:
+		print("%d,%d,%s,%016x,%d,%d,%d,%s" %
+		      (r.timestamp, r.thread, r.op, r.key_hash, r.key_size,
+		       r.value_size, r.duration, r.status_name()))
+
+
+def print_summary(records, top):
+	if not records:
+		print("no records")
+		return
+
+	span = (records[-1].timestamp - records[0].timestamp) / 1e9
+	print("%d records from %d threads, %.3f s" %
+	      (len(records), len({r.thread for r in records}), span))
+	print()
+
+	print("%-10s %10s %8s %10s %10s %10s %10s %12s" %
+	      ("op", "count", "errors", "p50_ns", "p99_ns", "p999_ns", "max_ns",
+	       "bytes"))
+	for op in OPS:
+		calls = [r for r in records if r.op == op]
+		if not calls:
+			continue
+		durations = sorted(r.duration for r in calls)
+		errors = sum(1 for r in calls if r.status not in NOT_ERRORS)
+		size = sum(r.key_size + r.value_size for r in calls)
+		print("%-10s %10d %8d %10d %10d %10d %10d %12d" %
+		      (op, len(calls), errors, percentile(durations, 0.5),
+		       percentile(durations, 0.99), percentile(durations, 0.999),
+		       durations[-1], size))
+
+	print()
+	print("slowest %d calls:" % top)
+	print("%-20s %6s %-10s %-16s %8s %10s %12s %s" %
+	      ("timestamp_ns", "thread", "op", "key_hash", "key_size",
+	       "value_size", "duration_ns", "status"))
+	for r in sorted(records, key=lambda r: r.duration, reverse=True)[:top]:
+		print("%-20d %6d %-10s %016x %8d %10d %12d %s" %
+		      (r.timestamp, r.thread, r.op, r.key_hash, r.key_size,
+		       r.value_size, r.duration, r.status_name()))
+
+
+def main():
+	parser = argparse.ArgumentParser(description="Decode pmemkv trace dump.")
+	parser.add_argument("dump", help="trace dump file")
+	parser.add_argument("--top", type=int, default=10,
+			    help="number of slowest calls to show (default: 10)")
+	parser.add_argument("--csv", action="store_true",
+			    help="print all records as CSV instead of a summary")
+	args = parser.parse_args()
+
+	records = read_dump(args.dump)
+	if args.csv:
+		print_csv(records)
+	else:
+		print_summary(records, args.top)
+
+
+if __name__ == "__main__":
+	main()